@@ -0,0 +1,45 @@
+;; Time full collections of a large live heap, for comparing the
+;; parallel marker across thread counts (CHIBI_GC_MARK_THREADS).
+
+(import (scheme base) (scheme write) (scheme process-context)
+        (chibi ast) (chibi time))
+
+(define (make-tree depth)
+  (if (zero? depth)
+      (make-vector 2 depth)
+      (vector (make-tree (- depth 1)) (make-tree (- depth 1)) depth)))
+
+(define (make-lists n len)
+  (let lp ((i 0) (res '()))
+    (if (= i n)
+        res
+        (lp (+ i 1) (cons (make-list len i) res)))))
+
+(define (usecs tv)
+  (+ (* 1000000 (timeval-seconds tv)) (timeval-microseconds tv)))
+
+(define depth
+  (let ((args (command-line)))
+    (if (pair? (cdr args)) (string->number (cadr args)) 20)))
+
+;; a wide tree and many long lists, so there is plenty to steal
+(define live (cons (make-tree depth) (make-lists 64 20000)))
+
+(define rounds 5)
+
+(gc)
+(let lp ((i 0) (best #f) (total 0))
+  (if (< i rounds)
+      (let* ((start (usecs (car (get-time-of-day))))
+             (_ (gc))
+             (t (- (usecs (car (get-time-of-day))) start)))
+        (lp (+ i 1) (if (and best (< best t)) best t) (+ total t)))
+      (begin
+        (display "threads: ")
+        (display (or (get-environment-variable "CHIBI_GC_MARK_THREADS")
+                     "default"))
+        (display " best-gc-ms: ")
+        (display (/ (round (/ best 100)) 10.))
+        (display " avg-gc-ms: ")
+        (display (/ (round (/ total rounds 100)) 10.))
+        (newline))))
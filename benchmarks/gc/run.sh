@@ -0,0 +1,19 @@
+#!/bin/sh
+
+# Report full collection times of a large heap for each number of
+# parallel mark threads.  Requires a build with SEXP_USE_PARALLEL_MARK=1.
+# Note the times include the (single-threaded) sweep.
+
+BENCHDIR=$(dirname $0)
+if [ "${BENCHDIR%%/*}" = "." ]; then
+    BENCHDIR="$(pwd)${BENCHDIR#.}"
+fi
+CHIBIHOME="${BENCHDIR%%/benchmarks/gc}"
+CHIBI="${CHIBI:-${CHIBIHOME}/chibi-scheme} -I$CHIBIHOME"
+DEPTH="${DEPTH:-20}"
+
+for n in ${THREADS:-1 2 4 8 16 32}; do
+    CHIBI_GC_MARK_THREADS=$n \
+        LD_LIBRARY_PATH="$CHIBIHOME" DYLD_LIBRARY_PATH="$CHIBIHOME" \
+        $CHIBI -I"$CHIBIHOME/lib" "$BENCHDIR/mark.scm" "$DEPTH"
+done
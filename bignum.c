@@ -1295,7 +1295,7 @@ static int sexp_number_type (sexp a) {
   return sexp_pointerp(a) ?
     (sexp_pointer_tag(a)<(sizeof(sexp_number_types)/sizeof(sexp_number_types[0]))
      ? sexp_number_types[sexp_pointer_tag(a)] : 0)
-#if SEXP_USE_IMMEDIATE_FLONUMS
+#if SEXP_USE_IMMEDIATE_FLONUMS || SEXP_USE_TAGGED_FLONUMS
     : sexp_flonump(a) ? 2
 #endif
     : sexp_fixnump(a);
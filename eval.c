@@ -4,16 +4,24 @@
 
 #include "chibi/eval.h"
 
-#if SEXP_USE_DEBUG_VM || SEXP_USE_PROFILE_VM || SEXP_USE_STATIC_LIBS
+#if SEXP_USE_DEBUG_VM || SEXP_USE_PROFILE_VM || SEXP_USE_STATIC_LIBS || SEXP_USE_MODULE_CACHE
 #include "opt/opcode_names.h"
 #endif
 
+#if SEXP_USE_MODULE_CACHE
+#include "chibi/gc_heap.h"
+#endif
+
 /************************************************************************/
 
 static int scheme_initialized_p = 0;
 
 static sexp analyze (sexp ctx, sexp x, int depth, int defok);
 
+#if SEXP_USE_MODULE_CACHE
+static void sexp_module_cache_record_macro (sexp ctx, sexp name, sexp mac);
+#endif
+
 #if SEXP_USE_MODULES
 sexp sexp_load_module_file_op (sexp ctx, sexp self, sexp_sint_t n, sexp file, sexp env);
 sexp sexp_find_module_file_op (sexp ctx, sexp self, sexp_sint_t n, sexp file);
@@ -81,21 +89,143 @@ sexp sexp_maybe_wrap_error (sexp ctx, sexp obj) {
 
 /********************** environment utilities ***************************/
 
-static sexp sexp_env_cell_loc1 (sexp env, sexp key, int localp, sexp *varenv) {
+#if SEXP_USE_INDEXED_ENVS
+
+/* An env index is a pair of hash tables for the bindings and the */
+/* renames of a frame.  Each table is a vector #(head generation */
+/* cells ...) mapping names to the first cell for that name in the */
+/* list starting at head.  Defines push new cells in front of the */
+/* head, which a lookup scans before using the table, and anything */
+/* else which changes the cells of a list bumps the generation to */
+/* invalidate all indexes. */
+
+#define sexp_env_index_generation(ctx) sexp_global(ctx, SEXP_G_ENV_INDEX_GENERATION)
+
+static void sexp_env_invalidate_indexes (sexp ctx) {
+  sexp_env_index_generation(ctx)
+    = sexp_make_fixnum(sexp_unbox_fixnum(sexp_env_index_generation(ctx)) + 1);
+}
+
+/* hash on the name rather than the address, which changes when */
+/* images are loaded */
+static sexp_uint_t sexp_env_key_hash (sexp key) {
+  sexp_uint_t i, res = 0;
+  while (sexp_synclop(key))
+    key = sexp_synclo_expr(key);
+  if (sexp_lsymbolp(key)) {
+    for (i=0; i<sexp_lsymbol_length(key); i++)
+      res = res * 31 + (unsigned char)sexp_lsymbol_data(key)[i];
+  } else if (sexp_isymbolp(key)) {
+    res = (sexp_uint_t)key >> 3;
+  }
+  return res;
+}
+
+static sexp sexp_env_make_index (sexp ctx, sexp env, int renamesp, sexp ls) {
+  sexp_uint_t i, n, size = SEXP_ENV_INDEX_THRESHOLD;
+  sexp x, *cells;
+  sexp_gc_var2(res, tmp);
+  for (n=0, x=ls; sexp_pairp(x); x=sexp_env_next_cell(x))
+    n++;
+  while (size < 2*n)
+    size *= 2;
+  sexp_gc_preserve2(ctx, res, tmp);
+  res = sexp_make_vector(ctx, sexp_make_fixnum(size+2), SEXP_FALSE);
+  if (!sexp_exceptionp(res)
+      && !(sexp_env_index(env) && sexp_pairp(sexp_env_index(env)))) {
+    tmp = sexp_cons(ctx, SEXP_FALSE, SEXP_FALSE);
+    if (sexp_exceptionp(tmp)) res = tmp;
+    else sexp_env_index(env) = tmp;
+  }
+  if (sexp_exceptionp(res)) {
+    res = NULL;
+  } else {
+    sexp_vector_set(res, SEXP_ZERO, ls);
+    sexp_vector_set(res, SEXP_ONE, sexp_env_index_generation(ctx));
+    cells = sexp_vector_data(res) + 2;
+    for ( ; sexp_pairp(ls); ls=sexp_env_next_cell(ls)) {
+      for (i=sexp_env_key_hash(sexp_car(ls)) & (size-1);
+           sexp_pairp(cells[i]) && sexp_car(cells[i]) != sexp_car(ls);
+           i=(i+1) & (size-1))
+        ;
+      if (!sexp_pairp(cells[i]))
+        cells[i] = ls;
+    }
+    if (renamesp)
+      sexp_cdr(sexp_env_index(env)) = res;
+    else
+      sexp_car(sexp_env_index(env)) = res;
+  }
+  sexp_gc_release2(ctx);
+  return res;
+}
+
+/* the first cell for key in the bindings or renames of env */
+static sexp sexp_env_list_cell (sexp ctx, sexp env, int renamesp, sexp key) {
+  sexp_uint_t i, n, size;
+  sexp ls, head, *cells, index = sexp_env_index(env);
+#if SEXP_USE_RENAME_BINDINGS
+  head = renamesp ? sexp_env_renames(env) : sexp_env_bindings(env);
+#else
+  head = sexp_env_bindings(env);
+#endif
+  index = (index && sexp_pairp(index)) ? (renamesp ? sexp_cdr(index) : sexp_car(index))
+    : SEXP_FALSE;
+  if (!(sexp_vectorp(index) && sexp_vector_ref(index, SEXP_ONE)
+        == sexp_env_index_generation(ctx)))
+    index = NULL;
+  for (n=0, ls=head; sexp_pairp(ls); ls=sexp_env_next_cell(ls), n++) {
+    if (index && ls == sexp_vector_ref(index, SEXP_ZERO))
+      goto lookup;
+    if (sexp_car(ls) == key)
+      return ls;
+    if (n == SEXP_ENV_INDEX_THRESHOLD
+        && (index = sexp_env_make_index(ctx, env, renamesp, head)))
+      goto lookup;
+  }
+  return NULL;
+ lookup:
+  size = sexp_vector_length(index) - 2;
+  cells = sexp_vector_data(index) + 2;
+  for (i=sexp_env_key_hash(key) & (size-1); sexp_pairp(cells[i]);
+       i=(i+1) & (size-1))
+    if (sexp_car(cells[i]) == key)
+      return cells[i];
+  return NULL;
+}
+
+#else
+
+#define sexp_env_invalidate_indexes(ctx)
+
+static sexp sexp_env_list_cell (sexp ctx, sexp env, int renamesp, sexp key) {
   sexp ls;
+#if SEXP_USE_RENAME_BINDINGS
+  ls = renamesp ? sexp_env_renames(env) : sexp_env_bindings(env);
+#else
+  ls = sexp_env_bindings(env);
+#endif
+  for ( ; sexp_pairp(ls); ls=sexp_env_next_cell(ls))
+    if (sexp_car(ls) == key)
+      return ls;
+  return NULL;
+}
+
+#endif
+
+static sexp sexp_env_cell_loc1 (sexp ctx, sexp env, sexp key, int localp, sexp *varenv) {
+  sexp cell;
   do {
 #if SEXP_USE_RENAME_BINDINGS
-    for (ls=sexp_env_renames(env); sexp_pairp(ls); ls=sexp_env_next_cell(ls))
-      if (sexp_car(ls) == key) {
-        if (varenv) *varenv = env;
-        return sexp_cdr(ls);
-      }
+    if ((cell = sexp_env_list_cell(ctx, env, 1, key))) {
+      if (varenv) *varenv = env;
+      return sexp_cdr(cell);
+    }
 #endif
-    for (ls=sexp_env_bindings(env); sexp_pairp(ls); ls=sexp_env_next_cell(ls))
-      if (sexp_car(ls) == key) {
-        if (varenv) *varenv = env;
-        return ls;
-      }
+    if ((cell = sexp_env_list_cell(ctx, env, 0, key))) {
+      if (varenv) *varenv = env;
+      return cell;
+    }
     if (localp) break;
     env = sexp_env_parent(env);
   } while (env && sexp_envp(env));
@@ -109,12 +239,12 @@ static sexp sexp_env_cell_loc (sexp ctx, sexp env, sexp key, int localp, sexp *v
       env = sexp_car(ls);
       break;
     }
-  cell = sexp_env_cell_loc1(env, key, localp, varenv);
+  cell = sexp_env_cell_loc1(ctx, env, key, localp, varenv);
   while (!cell && key && sexp_synclop(key)) {
     if (!sexp_pairp(ls) && sexp_not(sexp_memq(ctx, sexp_synclo_expr(key), sexp_synclo_free_vars(key))))
       env = sexp_synclo_env(key);
     key = sexp_synclo_expr(key);
-    cell = sexp_env_cell_loc1(env, key, localp, varenv);
+    cell = sexp_env_cell_loc1(ctx, env, key, localp, varenv);
   }
   return cell;
 }
@@ -130,6 +260,7 @@ static sexp sexp_env_undefine (sexp ctx, sexp env, sexp key) {
     if (sexp_car(ls2) == key) {
       if (ls1) sexp_env_next_cell(ls1) = sexp_env_next_cell(ls2);
       else sexp_env_bindings(env) = sexp_env_next_cell(ls2);
+      sexp_env_invalidate_indexes(ctx);
       return SEXP_TRUE;
     }
   return SEXP_FALSE;
@@ -143,17 +274,15 @@ sexp sexp_env_cell_define (sexp ctx, sexp env, sexp key,
   if (varenv) *varenv = env;
 #if SEXP_USE_RENAME_BINDINGS
   /* remove any existing renamed definition */
-  for (ls=sexp_env_renames(env); sexp_pairp(ls); ls=sexp_env_next_cell(ls))
-    if (sexp_car(ls) == key) {
-      sexp_car(ls) = SEXP_FALSE;
-      break;
-    }
+  if ((ls = sexp_env_list_cell(ctx, env, 1, key))) {
+    sexp_car(ls) = SEXP_FALSE;
+    sexp_env_invalidate_indexes(ctx);
+  }
 #endif
-  for (ls=sexp_env_bindings(env); sexp_pairp(ls); ls=sexp_env_next_cell(ls))
-    if (sexp_car(ls) == key) {
-      sexp_cdr(ls) = value;
-      return ls;
-    }
+  if ((ls = sexp_env_list_cell(ctx, env, 0, key))) {
+    sexp_cdr(ls) = value;
+    return ls;
+  }
   sexp_gc_preserve2(ctx, cell, ls);
   sexp_env_push(ctx, env, cell, key, value);
   sexp_gc_release2(ctx);
@@ -225,6 +354,9 @@ sexp sexp_extend_env (sexp ctx, sexp env, sexp vars, sexp value) {
   sexp_env_bindings(e) = SEXP_NULL;
 #if SEXP_USE_STABLE_ABI || SEXP_USE_RENAME_BINDINGS
   sexp_env_renames(e) = SEXP_NULL;
+#endif
+#if SEXP_USE_STABLE_ABI || SEXP_USE_INDEXED_ENVS
+  sexp_env_index(e) = SEXP_FALSE;
 #endif
   for ( ; sexp_pairp(vars); vars = sexp_cdr(vars))
     sexp_env_push(ctx, e, tmp, sexp_car(vars), value);
@@ -305,6 +437,8 @@ void sexp_shrink_bcode (sexp ctx, sexp_uint_t i) {
         = sexp_bytecode_literals(sexp_context_bc(ctx));
       sexp_bytecode_source(tmp)
         = sexp_bytecode_source(sexp_context_bc(ctx));
+      sexp_bytecode_lambda(tmp)
+        = sexp_bytecode_lambda(sexp_context_bc(ctx));
       memcpy(sexp_bytecode_data(tmp),
              sexp_bytecode_data(sexp_context_bc(ctx)),
              i);
@@ -328,6 +462,8 @@ void sexp_expand_bcode (sexp ctx, sexp_sint_t size) {
         = sexp_bytecode_literals(sexp_context_bc(ctx));
       sexp_bytecode_source(tmp)
         = sexp_bytecode_source(sexp_context_bc(ctx));
+      sexp_bytecode_lambda(tmp)
+        = sexp_bytecode_lambda(sexp_context_bc(ctx));
       memcpy(sexp_bytecode_data(tmp),
              sexp_bytecode_data(sexp_context_bc(ctx)),
              sexp_bytecode_length(sexp_context_bc(ctx)));
@@ -497,6 +633,13 @@ static void sexp_init_eval_context_bytecodes (sexp ctx) {
     = sexp_make_procedure(ctx, SEXP_ZERO, SEXP_ZERO, tmp, vec);
   sexp_bytecode_name(sexp_procedure_code(sexp_global(ctx, SEXP_G_FINAL_RESUMER)))
     = sexp_intern(ctx, "final-resumer", -1);
+#if SEXP_USE_SEGMENTED_CONTINUATIONS
+  ctx2 = sexp_make_child_context(ctx, NULL);
+  sexp_emit(ctx2, SEXP_OP_UNDERFLOW);
+  sexp_global(ctx, SEXP_G_UNDERFLOW_BYTECODE) = sexp_complete_bytecode(ctx2);
+  sexp_bytecode_name(sexp_global(ctx, SEXP_G_UNDERFLOW_BYTECODE))
+    = sexp_intern(ctx, "continuation-underflow", -1);
+#endif
   sexp_gc_release3(ctx);
 }
 #endif
@@ -509,6 +652,12 @@ void sexp_init_eval_context_globals (sexp ctx) {
   sexp_init_eval_context_bytecodes(ctx);
 #endif
   sexp_global(ctx, SEXP_G_MODULE_PATH) = SEXP_NULL;
+#if SEXP_USE_INDEXED_ENVS
+  sexp_global(ctx, SEXP_G_ENV_INDEX_GENERATION) = SEXP_ZERO;
+#endif
+#if SEXP_USE_MODULE_CACHE
+  sexp_global(ctx, SEXP_G_MODULE_CACHE_LOG) = SEXP_FALSE;
+#endif
   user_path = getenv(SEXP_MODULE_PATH_VAR);
   if (!user_path) user_path = sexp_default_user_module_path;
   sexp_add_path(ctx, user_path);
@@ -522,10 +671,10 @@ void sexp_init_eval_context_globals (sexp ctx) {
     = sexp_user_exception(ctx, SEXP_FALSE, "I/O would block once", SEXP_NULL);
   sexp_global(ctx, SEXP_G_THREAD_TERMINATE_ERROR)
     = sexp_user_exception(ctx, SEXP_FALSE, "thread terminated", SEXP_NULL);
-  sexp_global(ctx, SEXP_G_THREADS_FRONT) = SEXP_NULL;
-  sexp_global(ctx, SEXP_G_THREADS_BACK) = SEXP_NULL;
+  sexp_global(ctx, SEXP_G_THREADS_RUNNABLE) = SEXP_FALSE;
   sexp_global(ctx, SEXP_G_THREADS_SIGNALS) = SEXP_ZERO;
   sexp_global(ctx, SEXP_G_THREADS_SIGNAL_RUNNER) = SEXP_FALSE;
+  sexp_global(ctx, SEXP_G_THREADS_BLOCKED) = SEXP_FALSE;
   sexp_global(ctx, SEXP_G_ATOMIC_P) = SEXP_FALSE;
 #endif
 }
@@ -552,6 +701,7 @@ sexp sexp_make_eval_context (sexp ctx, sexp stack, sexp env, sexp_uint_t size, s
     sexp_bytecode_length(sexp_context_bc(res)) = SEXP_INIT_BCODE_SIZE;
     sexp_bytecode_literals(sexp_context_bc(res)) = SEXP_NULL;
     sexp_bytecode_source(sexp_context_bc(res)) = SEXP_NULL;
+    sexp_bytecode_lambda(sexp_context_bc(res)) = SEXP_FALSE;
     if ((! stack) || (stack == SEXP_FALSE)) {
       stack = sexp_alloc_tagged(res, SEXP_STACK_SIZE, SEXP_STACK);
       if (sexp_exceptionp(stack)) {
@@ -833,6 +983,8 @@ static sexp analyze_set (sexp ctx, sexp x, int depth) {
                  || (varenv && sexp_immutablep(varenv))) {
         res = sexp_compile_error(ctx, "immutable binding", sexp_cadr(x));
       } else {
+        if (! sexp_lambdap(sexp_ref_loc(ref)))
+          sexp_env_cell_assigned_p(sexp_ref_cell(ref)) = 1;
         res = sexp_make_set(ctx, ref, value);
         sexp_set_source(res) = sexp_pair_source(x);
       }
@@ -1032,6 +1184,10 @@ static sexp analyze_bind_syntax (sexp ls, sexp eval_ctx, sexp bind_ctx, int loca
       sexp_env_push(eval_ctx, sexp_context_env(bind_ctx), tmp, name, mac);
     else
       sexp_env_define(eval_ctx, sexp_context_env(bind_ctx), name, mac);
+#if SEXP_USE_MODULE_CACHE
+    if (!localp)
+      sexp_module_cache_record_macro(eval_ctx, name, mac);
+#endif
 #if !SEXP_USE_STRICT_TOPLEVEL_BINDINGS
     if (localp)
       sexp_env_cell_syntactic_p(sexp_env_cell(eval_ctx, sexp_context_env(bind_ctx), name, 0)) = 1;
@@ -1064,6 +1220,9 @@ static sexp analyze_let_syntax_aux (sexp ctx, sexp x, int recp, int depth) {
     sexp_env_bindings(env) = SEXP_NULL;
 #if SEXP_USE_STABLE_ABI || SEXP_USE_RENAME_BINDINGS
     sexp_env_renames(env) = SEXP_NULL;
+#endif
+#if SEXP_USE_STABLE_ABI || SEXP_USE_INDEXED_ENVS
+    sexp_env_index(env) = SEXP_FALSE;
 #endif
     ctx2 = sexp_make_child_context(ctx, sexp_context_lambda(ctx));
     sexp_context_env(ctx2) = env;
@@ -1262,6 +1421,78 @@ static sexp diff_free_vars (sexp ctx, sexp lambda, sexp fv, sexp params) {
   return res;
 }
 
+#if SEXP_USE_UNBOXED_LOCALS
+/* escape analysis: a set! variable only needs to be boxed if it's */
+/* captured by a closure, or if a continuation captured by a call */
+/* from its frame could re-enter the frame with a stale copy of it */
+
+static int captured_var_p (sexp name, sexp lambda, sexp x) {
+  sexp ls;
+  if (sexp_lambdap(x)) {
+    for (ls=sexp_lambda_fv(x); sexp_pairp(ls); ls=sexp_cdr(ls))
+      if (sexp_ref_name(sexp_car(ls)) == name
+          && sexp_ref_loc(sexp_car(ls)) == lambda)
+        return 1;
+  } else if (sexp_pairp(x)) {
+    for ( ; sexp_pairp(x); x=sexp_cdr(x))
+      if (captured_var_p(name, lambda, sexp_car(x)))
+        return 1;
+  } else if (sexp_cndp(x)) {
+    return captured_var_p(name, lambda, sexp_cnd_test(x))
+      || captured_var_p(name, lambda, sexp_cnd_pass(x))
+      || captured_var_p(name, lambda, sexp_cnd_fail(x));
+  } else if (sexp_seqp(x)) {
+    return captured_var_p(name, lambda, sexp_seq_ls(x));
+  } else if (sexp_setp(x)) {
+    return captured_var_p(name, lambda, sexp_set_value(x));
+  } else if (sexp_synclop(x)) {
+    return captured_var_p(name, lambda, sexp_synclo_expr(x));
+  }
+  return 0;
+}
+
+static int reentrant_call_p (sexp x, int tailp) {
+  sexp op;
+  if (sexp_pairp(x)) {
+    op = sexp_car(x);
+    if (!tailp && !(sexp_opcodep(op)
+                    && sexp_opcode_code(op) != SEXP_OP_CALLCC
+                    && sexp_opcode_code(op) != SEXP_OP_APPLY1))
+      return 1;
+    for ( ; sexp_pairp(x); x=sexp_cdr(x))
+      if (reentrant_call_p(sexp_car(x), 0))
+        return 1;
+  } else if (sexp_cndp(x)) {
+    return reentrant_call_p(sexp_cnd_test(x), 0)
+      || reentrant_call_p(sexp_cnd_pass(x), tailp)
+      || reentrant_call_p(sexp_cnd_fail(x), tailp);
+  } else if (sexp_seqp(x)) {
+    for (x=sexp_seq_ls(x); sexp_pairp(x); x=sexp_cdr(x))
+      if (reentrant_call_p(sexp_car(x), tailp && sexp_nullp(sexp_cdr(x))))
+        return 1;
+  } else if (sexp_setp(x)) {
+    return reentrant_call_p(sexp_set_value(x), 0);
+  } else if (sexp_synclop(x)) {
+    return reentrant_call_p(sexp_synclo_expr(x), tailp);
+  }
+  return 0;
+}
+
+static sexp boxed_vars (sexp ctx, sexp lambda) {
+  sexp ls;
+  sexp_gc_var1(res);
+  if (reentrant_call_p(sexp_lambda_body(lambda), 1))
+    return sexp_lambda_sv(lambda);
+  sexp_gc_preserve1(ctx, res);
+  res = SEXP_NULL;
+  for (ls=sexp_lambda_sv(lambda); sexp_pairp(ls); ls=sexp_cdr(ls))
+    if (captured_var_p(sexp_car(ls), lambda, sexp_lambda_body(lambda)))
+      sexp_push(ctx, res, sexp_car(ls));
+  sexp_gc_release1(ctx);
+  return res;
+}
+#endif
+
 sexp sexp_free_vars (sexp ctx, sexp x, sexp fv) {
   sexp_gc_var2(fv1, fv2);
   sexp_gc_preserve2(ctx, fv1, fv2);
@@ -1272,6 +1503,11 @@ sexp sexp_free_vars (sexp ctx, sexp x, sexp fv) {
     fv2 = sexp_append2(ctx, sexp_lambda_locals(x), fv2);
     fv2 = diff_free_vars(ctx, x, fv1, fv2);
     sexp_lambda_fv(x) = fv2;
+#if SEXP_USE_UNBOXED_LOCALS
+    /* from here on sv only holds the vars which need boxing */
+    if (sexp_pairp(sexp_lambda_sv(x)))
+      sexp_lambda_sv(x) = boxed_vars(ctx, x);
+#endif
     fv1 = union_free_vars(ctx, fv2, fv);
   } else if (sexp_pairp(x)) {
     for ( ; sexp_pairp(x); x=sexp_cdr(x))
@@ -2055,6 +2291,7 @@ void sexp_string_utf8_set (sexp ctx, sexp str, sexp index, sexp ch) {
       memcpy(q, sexp_string_data(str), i);
       memcpy(q+i+new_len, p+old_len, len-i-new_len+1);
       sexp_string_bytes(str) = b;
+      sexp_write_barrier(ctx, str, b);
       p = q + i;
     }
     sexp_string_size(str) += new_len - old_len;
@@ -2304,6 +2541,9 @@ sexp sexp_make_env_op (sexp ctx, sexp self, sexp_sint_t n) {
   sexp_env_bindings(e) = SEXP_NULL;
 #if SEXP_USE_STABLE_ABI || SEXP_USE_RENAME_BINDINGS
   sexp_env_renames(e) = SEXP_NULL;
+#endif
+#if SEXP_USE_STABLE_ABI || SEXP_USE_INDEXED_ENVS
+  sexp_env_index(e) = SEXP_FALSE;
 #endif
   return e;
 }
@@ -2573,6 +2813,7 @@ sexp sexp_load_standard_env (sexp ctx, sexp e, sexp version) {
       tmp = sexp_cons(ctx, sym, tmp);
       sexp_env_next_cell(tmp) = sexp_env_next_cell(sexp_env_bindings(e));
       sexp_env_next_cell(sexp_env_bindings(e)) = tmp;
+      sexp_env_invalidate_indexes(ctx);
     }
   }
 #endif
@@ -2678,6 +2919,614 @@ sexp sexp_env_import_op (sexp ctx, sexp self, sexp_sint_t n, sexp to, sexp from,
   return SEXP_VOID;
 }
 
+/************************** module cache ******************************/
+
+#if SEXP_USE_MODULE_CACHE
+
+/* While a library is loaded from source, each top-level form compiled */
+/* into its env is packed before it's run, along with any macros it   */
+/* defines.  Cells, symbols and other objects which must stay shared  */
+/* are referenced by descriptors, resolved against the env and the    */
+/* modules it imports when replaying, at which point the env is in    */
+/* the same state it was when packing:                                */
+/*                                                                    */
+/*   sym                  an interned symbol                          */
+/*   (cell key [module])  a global cell, of the env or a module       */
+/*   (env [module])       the env itself or a module's env            */
+/*   (core-env)           the env init-7.scm was loaded into          */
+/*   (value tag cell)     the current value of a cell, of type tag    */
+
+#define SEXP_MODULE_CACHE_MAGIC "\a\achibi-c"
+
+/* the log of a module being recorded is #(env modules entries state parent) */
+#define sexp_module_cache_log(ctx) sexp_global(ctx, SEXP_G_MODULE_CACHE_LOG)
+#define sexp_log_env(log)     sexp_vector_ref(log, SEXP_ZERO)
+#define sexp_log_modules(log) sexp_vector_ref(log, SEXP_ONE)
+#define sexp_log_entries(log) sexp_vector_ref(log, SEXP_TWO)
+#define sexp_log_state(log)   sexp_vector_ref(log, SEXP_THREE)
+#define sexp_log_parent(log)  sexp_vector_ref(log, SEXP_FOUR)
+
+#define SEXP_LOG_IDLE      SEXP_FALSE
+#define SEXP_LOG_COMPILING SEXP_TRUE
+
+struct sexp_module_cache_state {
+  sexp env, modules, *externs;
+  sexp_sint_t count;
+};
+
+/* the parent of the meta env, which macros from (chibi) close over */
+static sexp sexp_module_cache_core_env (sexp ctx) {
+  sexp meta = sexp_global(ctx, SEXP_G_META_ENV);
+  return sexp_envp(meta) ? sexp_env_parent(meta) : NULL;
+}
+
+static sexp sexp_module_cache_module_env (sexp ctx, sexp modules, sexp name) {
+  for ( ; sexp_pairp(modules); modules=sexp_cdr(modules))
+    if (sexp_pairp(sexp_car(modules)) && sexp_envp(sexp_cdar(modules))
+        && sexp_truep(sexp_equalp(ctx, sexp_caar(modules), name)))
+      return sexp_cdar(modules);
+  return NULL;
+}
+
+/* Env cells link to the next binding through the source slot, which */
+/* for a datum is only ever #f or a (file . line) pair. */
+static int sexp_module_cache_datump (sexp x) {
+  sexp src = sexp_pair_source(x);
+  return sexp_not(src)
+    || (sexp_pairp(src) && sexp_fixnump(sexp_cdr(src))
+        && (sexp_stringp(sexp_car(src)) || sexp_not(sexp_car(src))));
+}
+
+static sexp sexp_module_cache_find_value (sexp env, sexp x) {
+  sexp cell;
+  for (cell=sexp_env_bindings(env); sexp_pairp(cell); cell=sexp_env_next_cell(cell))
+    if (sexp_cdr(cell) == x)
+      return cell;
+  return NULL;
+}
+
+static sexp sexp_module_cache_cell_desc (sexp ctx, struct sexp_module_cache_state *state, sexp cell) {
+  sexp ls, key = sexp_car(cell), res = NULL;
+  int localp;
+  if (!sexp_symbolp(key)) return NULL;
+  if (sexp_env_cell_loc1(ctx, state->env, key, 1, NULL) == cell)
+    return sexp_list2(ctx, sexp_intern(ctx, "cell", -1), key);
+  /* prefer the module defining the cell over those importing it */
+  for (localp=1; localp>=0 && !res; localp--)
+    for (ls=state->modules; sexp_pairp(ls) && !res; ls=sexp_cdr(ls))
+      if (sexp_envp(sexp_cdar(ls)) && sexp_cdar(ls) != state->env
+          && sexp_env_cell_loc1(ctx, sexp_cdar(ls), key, localp, NULL) == cell)
+        res = sexp_caar(ls);
+  return res ? sexp_list3(ctx, sexp_intern(ctx, "cell", -1), key, res) : NULL;
+}
+
+/* Names a primitive or known procedure by the cell holding it, */
+/* looked up by name or else by value if scanp is true. */
+static sexp sexp_module_cache_value_desc (sexp ctx, struct sexp_module_cache_state *state, sexp x, sexp name, int scanp) {
+  sexp ls, cell = NULL;
+  sexp_gc_var1(res);
+  sexp_gc_preserve1(ctx, res);
+  res = NULL;
+  if (sexp_stringp(name))
+    name = sexp_string_to_symbol(ctx, name);
+  if (sexp_symbolp(name)
+      && (cell = sexp_env_cell_loc1(ctx, state->env, name, 0, NULL))
+      && sexp_cdr(cell) != x)
+    cell = NULL;
+  if (!cell && scanp) {
+    cell = sexp_module_cache_find_value(state->env, x);
+    for (ls=state->modules; !cell && sexp_pairp(ls); ls=sexp_cdr(ls))
+      if (sexp_envp(sexp_cdar(ls)))
+        cell = sexp_module_cache_find_value(sexp_cdar(ls), x);
+  }
+  if (cell && (res = sexp_module_cache_cell_desc(ctx, state, cell)))
+    res = sexp_list3(ctx, sexp_intern(ctx, "value", -1),
+                     sexp_make_fixnum(sexp_pointer_tag(x)), res);
+  sexp_gc_release1(ctx);
+  return res;
+}
+
+static sexp_sint_t sexp_module_cache_extern (sexp ctx, void *data, sexp x) {
+  struct sexp_module_cache_state *state = (struct sexp_module_cache_state*)data;
+  sexp_sint_t res = -2;
+  sexp ls;
+  sexp_gc_var1(desc);
+  sexp_gc_preserve1(ctx, desc);
+  desc = NULL;
+  switch (sexp_pointer_tag(x)) {
+  case SEXP_PAIR:
+    if (sexp_module_cache_datump(x)) res = -1;
+    else desc = sexp_module_cache_cell_desc(ctx, state, x);
+    break;
+  case SEXP_SYMBOL:
+    if (sexp_intern(ctx, sexp_lsymbol_data(x), sexp_lsymbol_length(x)) == x)
+      desc = x;
+    break;
+  case SEXP_ENV:
+    if (x == state->env) {
+      desc = sexp_list1(ctx, sexp_intern(ctx, "env", -1));
+    } else if (x == sexp_module_cache_core_env(ctx)) {
+      desc = sexp_list1(ctx, sexp_intern(ctx, "core-env", -1));
+    } else {
+      for (ls=state->modules; sexp_pairp(ls); ls=sexp_cdr(ls))
+        if (sexp_cdar(ls) == x) {
+          desc = sexp_list2(ctx, sexp_intern(ctx, "env", -1), sexp_caar(ls));
+          break;
+        }
+    }
+    break;
+  case SEXP_OPCODE:
+    desc = sexp_module_cache_value_desc(ctx, state, x, sexp_opcode_name(x), 1);
+    break;
+  case SEXP_CORE:
+    desc = sexp_module_cache_value_desc(ctx, state, x, sexp_core_name(x), 1);
+    break;
+  case SEXP_TYPE:
+    desc = sexp_module_cache_value_desc(ctx, state, x, sexp_type_name(x), 1);
+    break;
+  case SEXP_PROCEDURE:
+    /* known procedures keep their identity, anything else is copied */
+    desc = sexp_module_cache_value_desc(ctx, state, x, sexp_bytecode_name(sexp_procedure_code(x)), 0);
+    if (!desc) res = -1;
+    break;
+  default:
+    res = -1;
+    break;
+  }
+  if (desc && !sexp_exceptionp(desc)) {
+    desc = sexp_cons(ctx, desc, *state->externs);
+    if (sexp_pairp(desc)) {
+      *state->externs = desc;
+      res = state->count++;
+    }
+  }
+  sexp_gc_release1(ctx);
+  return res;
+}
+
+/* Packs x into an entry (descriptors . bytes), or #f if x refers to */
+/* anything which can't be named. */
+static sexp sexp_module_cache_pack (sexp ctx, sexp log, sexp x) {
+  struct sexp_module_cache_state state;
+  sexp_gc_var2(externs, res);
+  sexp_gc_preserve2(ctx, externs, res);
+  externs = SEXP_NULL;
+  state.env = sexp_log_env(log);
+  state.modules = sexp_log_modules(log);
+  state.externs = &externs;
+  state.count = 0;
+  res = sexp_pack_objects(ctx, x, sexp_module_cache_extern, &state);
+  if (sexp_bytesp(res)) {
+    externs = sexp_reverse(ctx, externs);
+    externs = sexp_write_to_string(ctx, externs);
+    res = sexp_stringp(externs) ? sexp_cons(ctx, externs, res) : SEXP_FALSE;
+  }
+  sexp_gc_release2(ctx);
+  return sexp_pairp(res) ? res : SEXP_FALSE;
+}
+
+static void sexp_module_cache_record (sexp ctx, sexp log, sexp x) {
+  sexp_gc_var1(entry);
+  if (sexp_not(sexp_log_entries(log))) return;
+  sexp_gc_preserve1(ctx, entry);
+  /* imports into the env while loading can't be replayed */
+  if (sexp_env_parent(sexp_log_env(log)) == sexp_log_parent(log))
+    entry = sexp_module_cache_pack(ctx, log, x);
+  else
+    entry = SEXP_FALSE;
+  if (sexp_pairp(entry))
+    sexp_push(ctx, sexp_log_entries(log), entry);
+  else
+    sexp_log_entries(log) = SEXP_FALSE;
+  sexp_gc_release1(ctx);
+}
+
+static void sexp_module_cache_record_macro (sexp ctx, sexp name, sexp mac) {
+  sexp cell, log = sexp_module_cache_log(ctx);
+  sexp_gc_var1(tmp);
+  if (sexp_vectorp(log) && sexp_log_state(log) == SEXP_LOG_COMPILING
+      && (cell = sexp_env_cell_loc1(ctx, sexp_log_env(log), name, 1, NULL))
+      && sexp_cdr(cell) == mac) {
+    sexp_gc_preserve1(ctx, tmp);
+    tmp = sexp_cons(ctx, name, mac);
+    sexp_module_cache_record(ctx, log, tmp);
+    sexp_gc_release1(ctx);
+  }
+}
+
+sexp sexp_module_cache_begin_op (sexp ctx, sexp self, sexp_sint_t n, sexp env, sexp modules) {
+  sexp res = sexp_module_cache_log(ctx);
+  sexp_gc_var1(log);
+  sexp_assert_type(ctx, sexp_envp, SEXP_ENV, env);
+  sexp_gc_preserve1(ctx, log);
+  log = sexp_make_vector(ctx, SEXP_FIVE, SEXP_NULL);
+  if (sexp_exceptionp(log)) {
+    res = log;
+  } else {
+    sexp_log_env(log) = env;
+    sexp_log_modules(log) = modules;
+    sexp_log_state(log) = SEXP_LOG_IDLE;
+    sexp_log_parent(log) = sexp_env_parent(env);
+    sexp_module_cache_log(ctx) = log;
+  }
+  sexp_gc_release1(ctx);
+  return res;
+}
+
+sexp sexp_module_cache_end_op (sexp ctx, sexp self, sexp_sint_t n, sexp prev) {
+  sexp log = sexp_module_cache_log(ctx), res = SEXP_FALSE;
+  if (sexp_vectorp(log) && sexp_truep(sexp_listp(ctx, sexp_log_entries(log))))
+    res = sexp_reverse(ctx, sexp_log_entries(log));
+  sexp_module_cache_log(ctx) = sexp_vectorp(prev) ? prev : SEXP_FALSE;
+  return res;
+}
+
+sexp sexp_module_cache_compile_op (sexp ctx, sexp self, sexp_sint_t n, sexp obj) {
+  sexp_gc_var2(log, res);
+  sexp_gc_preserve2(ctx, log, res);
+  log = sexp_module_cache_log(ctx);
+  if (!sexp_vectorp(log)) {
+    res = sexp_user_exception(ctx, self, "no module is being recorded", obj);
+  } else {
+    sexp_log_state(log) = SEXP_LOG_COMPILING;
+    res = sexp_compile_op(ctx, self, 2, obj, sexp_log_env(log));
+    sexp_log_state(log) = SEXP_LOG_IDLE;
+    if (sexp_procedurep(res))
+      sexp_module_cache_record(ctx, log, res);
+  }
+  sexp_gc_release2(ctx);
+  return res;
+}
+
+static sexp sexp_module_cache_resolve_cell (sexp ctx, sexp env, sexp modules, sexp desc) {
+  if (!(sexp_pairp(desc) && sexp_pairp(sexp_cdr(desc)) && sexp_symbolp(sexp_cadr(desc))))
+    return NULL;
+  if (sexp_pairp(sexp_cddr(desc))) {
+    env = sexp_module_cache_module_env(ctx, modules, sexp_caddr(desc));
+    return env ? sexp_env_cell_loc1(ctx, env, sexp_cadr(desc), 0, NULL) : NULL;
+  }
+  return sexp_env_cell_loc1(ctx, env, sexp_cadr(desc), 1, NULL);
+}
+
+/* Resolves the descriptors of an entry to a vector of objects, */
+/* defining any cells of the env yet to be created only once all */
+/* else is found, or returns #f. */
+static sexp sexp_module_cache_resolve (sexp ctx, sexp env, sexp modules, sexp descs) {
+  sexp ls, desc, x, tag, res = SEXP_FALSE;
+  sexp_sint_t i, missing = 0;
+  sexp_gc_var1(vec);
+  if (!sexp_truep(sexp_listp(ctx, descs))) return SEXP_FALSE;
+  sexp_gc_preserve1(ctx, vec);
+  vec = sexp_make_vector(ctx, sexp_length(ctx, descs), SEXP_FALSE);
+  if (sexp_exceptionp(vec)) goto done;
+  for (i=0, ls=descs; sexp_pairp(ls); ls=sexp_cdr(ls), i++) {
+    desc = sexp_car(ls);
+    x = NULL;
+    if (sexp_symbolp(desc)) {
+      x = desc;
+    } else if (sexp_pairp(desc) && sexp_car(desc) == sexp_intern(ctx, "cell", -1)) {
+      x = sexp_module_cache_resolve_cell(ctx, env, modules, desc);
+      if (!x && sexp_nullp(sexp_cddr(desc))) {
+        missing++;
+        continue;
+      }
+    } else if (sexp_pairp(desc) && sexp_car(desc) == sexp_intern(ctx, "env", -1)) {
+      x = sexp_pairp(sexp_cdr(desc))
+        ? sexp_module_cache_module_env(ctx, modules, sexp_cadr(desc)) : env;
+    } else if (sexp_pairp(desc) && sexp_car(desc) == sexp_intern(ctx, "core-env", -1)) {
+      x = sexp_module_cache_core_env(ctx);
+    } else if (sexp_pairp(desc) && sexp_car(desc) == sexp_intern(ctx, "value", -1)
+               && sexp_pairp(sexp_cdr(desc)) && sexp_pairp(sexp_cddr(desc))) {
+      tag = sexp_cadr(desc);
+      x = sexp_module_cache_resolve_cell(ctx, env, modules, sexp_caddr(desc));
+      x = x ? sexp_cdr(x) : NULL;
+      if (x && !(sexp_pointerp(x) && sexp_fixnump(tag)
+                 && sexp_pointer_tag(x) == sexp_unbox_fixnum(tag)))
+        x = NULL;
+    }
+    if (!x) goto done;
+    sexp_vector_set(vec, sexp_make_fixnum(i), x);
+  }
+  for (i=0, ls=descs; missing > 0 && sexp_pairp(ls); ls=sexp_cdr(ls), i++)
+    if (sexp_not(sexp_vector_ref(vec, sexp_make_fixnum(i)))) {
+      x = sexp_env_cell_define(ctx, env, sexp_cadar(ls), SEXP_UNDEF, NULL);
+      if (!sexp_pairp(x)) goto done;
+      sexp_vector_set(vec, sexp_make_fixnum(i), x);
+      missing--;
+    }
+  res = vec;
+ done:
+  sexp_gc_release1(ctx);
+  return res;
+}
+
+/* Returns the thunk to run for a recorded form, #t after defining a */
+/* recorded macro, or #f if the entry can't be replayed in env. */
+sexp sexp_module_cache_entry_op (sexp ctx, sexp self, sexp_sint_t n, sexp entry, sexp env, sexp modules) {
+  sexp_gc_var2(res, externs);
+  sexp_assert_type(ctx, sexp_pairp, SEXP_PAIR, entry);
+  sexp_assert_type(ctx, sexp_envp, SEXP_ENV, env);
+  if (!(sexp_stringp(sexp_car(entry)) && sexp_bytesp(sexp_cdr(entry))))
+    return SEXP_FALSE;
+  sexp_gc_preserve2(ctx, res, externs);
+  externs = sexp_read_from_string(ctx, sexp_string_data(sexp_car(entry)),
+                                  sexp_string_size(sexp_car(entry)));
+  externs = sexp_module_cache_resolve(ctx, env, modules, externs);
+  res = sexp_vectorp(externs)
+    ? sexp_unpack_objects(ctx, sexp_cdr(entry), externs) : SEXP_FALSE;
+  if (sexp_pairp(res) && sexp_symbolp(sexp_car(res))
+      && (sexp_macrop(sexp_cdr(res)) || sexp_corep(sexp_cdr(res)))) {
+    res = sexp_env_define(ctx, env, sexp_car(res), sexp_cdr(res));
+    if (!sexp_exceptionp(res)) res = SEXP_TRUE;
+  } else if (!sexp_procedurep(res)) {
+    res = SEXP_FALSE;
+  }
+  sexp_gc_release2(ctx);
+  return res;
+}
+
+static sexp_uint_t sexp_module_cache_hash (sexp_uint_t hash, const char *s) {
+  for ( ; *s; s++)
+    hash = (hash ^ (unsigned char)*s) * 1099511628211u;
+  return hash;
+}
+
+/* The build a cache was written by, as the version, ABI and a hash */
+/* of the VM instruction set and primitive table, which is all the   */
+/* packed bytecode and descriptors depend on. */
+static void sexp_module_cache_build (char *buf) {
+  int i;
+  char tmp[64];
+  struct sexp_opcode_struct *op;
+  sexp_uint_t hash = 14695981039346656037u;
+  sprintf(tmp, "%d %d %d", SEXP_OP_NUM_OPCODES, (int)sizeof(struct sexp_struct),
+          (int)sizeof(sexp));
+  hash = sexp_module_cache_hash(hash, tmp);
+  for (i=0; i<SEXP_OP_NUM_OPCODES; i++)
+    hash = sexp_module_cache_hash(hash, sexp_opcode_names[i]);
+  for (op=sexp_primitive_opcodes; op->op_class; op++) {
+    hash = sexp_module_cache_hash(hash, (const char*)op->name);
+    sprintf(tmp, " %d %d %d %d %d", op->op_class, op->code, op->num_args,
+            op->flags, op->inverse);
+    hash = sexp_module_cache_hash(hash, tmp);
+  }
+  sprintf(buf, "%s %s %016llx", sexp_version, SEXP_ABI_IDENTIFIER,
+          (unsigned long long)hash);
+}
+
+/* The cache file for a key (name features source ...) is named by a */
+/* hash of the module name and its definition file, so a rebuild or */
+/* edit replaces rather than adds to the cache.  There's no default */
+/* directory: builds and installs run chibi too, and mustn't write */
+/* into the builder's home. */
+static char* sexp_module_cache_path (sexp ctx, sexp key, int createp) {
+  const char *dir = getenv(SEXP_MODULE_CACHE_VAR);
+  char *res, *p;
+  sexp_uint_t hash = 14695981039346656037u;
+  sexp_gc_var1(name);
+  if (!dir || !*dir) return NULL;
+  sexp_gc_preserve1(ctx, name);
+  name = sexp_write_to_string(ctx, sexp_car(key));
+  if (sexp_stringp(name))
+    hash = sexp_module_cache_hash(hash, sexp_string_data(name));
+  hash = sexp_module_cache_hash(hash, sexp_string_data(sexp_caddr(key)));
+  sexp_gc_release1(ctx);
+  res = (char*) malloc(strlen(dir) + 48);
+  if (!res) return NULL;
+  strcpy(res, dir);
+  if (createp) {
+    for (p=res+1; *p; p++)
+      if (*p == '/') {
+        *p = '\0';
+        mkdir(res, 0777);
+        *p = '/';
+      }
+    mkdir(res, 0777);
+  }
+  sprintf(res + strlen(res), "/%016llx.cache", (unsigned long long)hash);
+  return res;
+}
+
+/* The header records everything the cache depends on: the build, the */
+/* features and the size and modification time of each source file. */
+static sexp sexp_module_cache_header (sexp ctx, sexp key) {
+  struct stat st;
+  sexp ls;
+  char build[128];
+  sexp_gc_var2(res, tmp);
+  sexp_gc_preserve2(ctx, res, tmp);
+  res = SEXP_NULL;
+  for (ls=sexp_cddr(key); sexp_pairp(ls); ls=sexp_cdr(ls)) {
+    if (!sexp_stringp(sexp_car(ls)) || stat(sexp_string_data(sexp_car(ls)), &st)) {
+      res = SEXP_FALSE;
+      break;
+    }
+    tmp = sexp_list3(ctx, sexp_car(ls), sexp_make_integer(ctx, st.st_mtime),
+                     sexp_make_integer(ctx, st.st_size));
+    res = sexp_cons(ctx, tmp, res);
+  }
+  if (sexp_pairp(res)) {
+    res = sexp_cons(ctx, sexp_cadr(key), sexp_reverse(ctx, res));
+    sexp_module_cache_build(build);
+    tmp = sexp_c_string(ctx, build, -1);
+    res = sexp_cons(ctx, tmp, res);
+    res = sexp_write_to_string(ctx, res);
+  }
+  sexp_gc_release2(ctx);
+  return sexp_stringp(res) ? res : SEXP_FALSE;
+}
+
+/* The chunks following the header are covered by a checksum, so a */
+/* truncated or corrupted file is recompiled rather than unpacked. */
+static sexp_uint_t sexp_module_cache_checksum (sexp_uint_t sum, const void *data, sexp_uint_t len) {
+  const unsigned char *p = (const unsigned char*)data, *end = p + len;
+  for ( ; p < end; p++)
+    sum = (sum ^ *p) * 1099511628211u;
+  return sum;
+}
+
+static int sexp_module_cache_write (FILE *out, const void *data, sexp_uint_t len, sexp_uint_t *sum) {
+  if (sum) {
+    *sum = sexp_module_cache_checksum(*sum, &len, sizeof(len));
+    if (len > 0 && data) *sum = sexp_module_cache_checksum(*sum, data, len);
+  }
+  return fwrite(&len, sizeof(len), 1, out) == 1
+    && (len == 0 || !data || fwrite(data, len, 1, out) == 1);
+}
+
+static int sexp_module_cache_read_uint (const unsigned char **p, const unsigned char *end, sexp_uint_t *n) {
+  if ((sexp_uint_t)(end - *p) < sizeof(*n)) return 0;
+  memcpy(n, *p, sizeof(*n));
+  *p += sizeof(*n);
+  return 1;
+}
+
+static const unsigned char* sexp_module_cache_read (const unsigned char **p, const unsigned char *end, sexp_uint_t *len) {
+  const unsigned char *res;
+  if (!sexp_module_cache_read_uint(p, end, len)
+      || (sexp_uint_t)(end - *p) < *len)
+    return NULL;
+  res = *p;
+  *p += *len;
+  return res;
+}
+
+/* Parses the chunks following a matching header, returning #t if */
+/* the file is truncated. */
+static sexp sexp_module_cache_parse (sexp ctx, const unsigned char *p, const unsigned char *end) {
+  const unsigned char *str, *bytes;
+  sexp_uint_t str_len, bytes_len, count, entries;
+  int ok = 1;
+  sexp_gc_var3(res, chunk, tmp);
+  if (!sexp_module_cache_read_uint(&p, end, &count))
+    return SEXP_TRUE;
+  sexp_gc_preserve3(ctx, res, chunk, tmp);
+  for (res=SEXP_NULL; ok && count > 0; count--) {
+    ok = sexp_module_cache_read_uint(&p, end, &entries);
+    for (chunk=SEXP_NULL; ok && entries > 0; entries--) {
+      ok = (str = sexp_module_cache_read(&p, end, &str_len))
+        && (bytes = sexp_module_cache_read(&p, end, &bytes_len));
+      if (ok) {
+        tmp = sexp_make_bytes(ctx, sexp_make_fixnum(bytes_len), SEXP_ZERO);
+        if ((ok = sexp_bytesp(tmp))) {
+          memcpy(sexp_bytes_data(tmp), bytes, bytes_len);
+          tmp = sexp_cons(ctx, SEXP_FALSE, tmp);
+          sexp_car(tmp) = sexp_c_string(ctx, (const char*)str, str_len);
+          chunk = sexp_cons(ctx, tmp, chunk);
+        }
+      }
+    }
+    chunk = sexp_reverse(ctx, chunk);
+    res = sexp_cons(ctx, chunk, res);
+  }
+  res = ok ? sexp_reverse(ctx, res) : SEXP_TRUE;
+  sexp_gc_release3(ctx);
+  return res;
+}
+
+/* Returns the list of chunks, one per file or body of the module, */
+/* each a list of entries, or #t if there's no valid cache and the */
+/* module should be recorded, or #f if caching is turned off. */
+sexp sexp_open_module_cache_op (sexp ctx, sexp self, sexp_sint_t n, sexp key) {
+  char *path;
+  FILE *in;
+  long size;
+  sexp_uint_t len, sum;
+  unsigned char *buf = NULL;
+  const unsigned char *p, *data;
+  sexp_gc_var2(header, res);
+  if (!(sexp_pairp(sexp_cdr(key)) && sexp_pairp(sexp_cddr(key))
+        && sexp_stringp(sexp_caddr(key))))
+    return SEXP_FALSE;
+  if (!(path = sexp_module_cache_path(ctx, key, 0)))
+    return SEXP_FALSE;
+  sexp_gc_preserve2(ctx, header, res);
+  header = sexp_module_cache_header(ctx, key);
+  res = sexp_stringp(header) ? SEXP_TRUE : SEXP_FALSE;
+  if (sexp_stringp(header) && (in = fopen(path, "rb"))) {
+    if (fseek(in, 0, SEEK_END) == 0 && (size = ftell(in)) > 8
+        && fseek(in, 0, SEEK_SET) == 0 && (buf = (unsigned char*) malloc(size))
+        && fread(buf, size, 1, in) == 1
+        && memcmp(buf, SEXP_MODULE_CACHE_MAGIC, 8) == 0) {
+      p = buf + 8;
+      data = sexp_module_cache_read(&p, buf + size, &len);
+      if (data && len == sexp_string_size(header)
+          && memcmp(data, sexp_string_data(header), len) == 0
+          && sexp_module_cache_read_uint(&p, buf + size, &sum)
+          && sum == sexp_module_cache_checksum(14695981039346656037u, p, buf + size - p))
+        res = sexp_module_cache_parse(ctx, p, buf + size);
+    }
+    fclose(in);
+    free(buf);
+  }
+  free(path);
+  sexp_gc_release2(ctx);
+  return res;
+}
+
+/* Saves the recorded chunks for key, or removes the cache if chunks */
+/* is #f. */
+sexp sexp_save_module_cache_op (sexp ctx, sexp self, sexp_sint_t n, sexp key, sexp chunks) {
+  char *path, *tmp_path;
+  FILE *out;
+  long pos;
+  sexp_uint_t sum = 14695981039346656037u;
+  sexp ls, ls2, res = SEXP_FALSE;
+  sexp_gc_var1(header);
+  if (!(sexp_pairp(sexp_cdr(key)) && sexp_pairp(sexp_cddr(key))
+        && sexp_stringp(sexp_caddr(key))))
+    return SEXP_FALSE;
+  if (!(path = sexp_module_cache_path(ctx, key, sexp_truep(chunks))))
+    return SEXP_FALSE;
+  if (!sexp_truep(sexp_listp(ctx, chunks))) {
+    remove(path);
+    free(path);
+    return SEXP_FALSE;
+  }
+  sexp_gc_preserve1(ctx, header);
+  header = sexp_module_cache_header(ctx, key);
+  /* write to a temporary file renamed into place, so readers only */
+  /* ever see a complete cache, unique per context since several */
+  /* may run in one process */
+  if (sexp_stringp(header) && (tmp_path = (char*) malloc(strlen(path) + 48))) {
+    sprintf(tmp_path, "%s.%ld.%lx", path, (long)getpid(), (unsigned long)(sexp_uint_t)ctx);
+    if ((out = fopen(tmp_path, "wb"))) {
+      res = sexp_make_boolean(
+        fwrite(SEXP_MODULE_CACHE_MAGIC, 8, 1, out) == 1
+        && sexp_module_cache_write(out, sexp_string_data(header), sexp_string_size(header), NULL)
+        && (pos = ftell(out)) >= 0
+        && fwrite(&sum, sizeof(sum), 1, out) == 1   /* filled in below */
+        && sexp_module_cache_write(out, NULL, sexp_unbox_fixnum(sexp_length(ctx, chunks)), &sum));
+      for (ls=chunks; sexp_truep(res) && sexp_pairp(ls); ls=sexp_cdr(ls)) {
+        if (!(sexp_truep(sexp_listp(ctx, sexp_car(ls)))
+              && sexp_module_cache_write(out, NULL, sexp_unbox_fixnum(sexp_length(ctx, sexp_car(ls))), &sum)))
+          res = SEXP_FALSE;
+        for (ls2=sexp_car(ls); sexp_truep(res) && sexp_pairp(ls2); ls2=sexp_cdr(ls2))
+          if (!(sexp_pairp(sexp_car(ls2)) && sexp_stringp(sexp_caar(ls2))
+                && sexp_bytesp(sexp_cdar(ls2))
+                && sexp_module_cache_write(out, sexp_string_data(sexp_caar(ls2)),
+                                           sexp_string_size(sexp_caar(ls2)), &sum)
+                && sexp_module_cache_write(out, sexp_bytes_data(sexp_cdar(ls2)),
+                                           sexp_bytes_length(sexp_cdar(ls2)), &sum)))
+            res = SEXP_FALSE;
+      }
+      if (sexp_truep(res)
+          && !(fseek(out, pos, SEEK_SET) == 0 && fwrite(&sum, sizeof(sum), 1, out) == 1))
+        res = SEXP_FALSE;
+      if (fclose(out) || sexp_not(res) || rename(tmp_path, path)) {
+        remove(tmp_path);
+        res = SEXP_FALSE;
+      }
+    }
+    free(tmp_path);
+  }
+  free(path);
+  sexp_gc_release1(ctx);
+  return res;
+}
+
+#endif
+
 /************************** eval interface ****************************/
 
 sexp sexp_generate_op (sexp ctx, sexp self, sexp_sint_t n, sexp ast, sexp env) {
@@ -12,6 +12,14 @@
 
 #if SEXP_USE_MMAP_GC
 #include <sys/mman.h>
+#include <unistd.h>
+#elif SEXP_USE_SHRINK_HEAP && defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#if SEXP_USE_PARALLEL_MARK
+#include <pthread.h>
+#include <sched.h>
 #endif
 
 #define SEXP_BANNER(x) ("**************** GC "x"\n")
@@ -32,11 +40,33 @@ static sexp* stack_base;
 #define sexp_debug_printf(fmt, ...)
 #endif
 
+#if SEXP_USE_TIME_GC
+static sexp_uint_t sexp_gc_usecs_since (struct rusage *start) {
+  struct rusage end;
+  getrusage(RUSAGE_SELF, &end);
+  return (end.ru_utime.tv_sec - start->ru_utime.tv_sec) * 1000000 +
+    end.ru_utime.tv_usec - start->ru_utime.tv_usec;
+}
+#endif
+
 static sexp_heap sexp_heap_last (sexp_heap h) {
   while (h->next) h = h->next;
   return h;
 }
 
+#if SEXP_USE_GENERATIONAL_GC
+#define sexp_gc_in_range_p(h, x) \
+  (((char*)(x) >= (h)->mark_lo) && ((char*)(x) < (h)->mark_hi))
+#define sexp_in_nursery_p(n, x) \
+  (((char*)(x) >= (n)->data) && ((char*)(x) < (n)->data + (n)->size))
+/* during a minor collection only objects in the nursery are marked, */
+/* everything else is considered live */
+#define sexp_gc_deadp(h, x) (sexp_gc_in_range_p(h, x) && !sexp_markedp(x))
+#else
+#define sexp_gc_in_range_p(h, x) 1
+#define sexp_gc_deadp(h, x) (!sexp_markedp(x))
+#endif
+
 #if !SEXP_USE_FIXED_CHUNK_SIZE_HEAPS && !SEXP_USE_MALLOC
 static size_t sexp_heap_total_size (sexp_heap h) {
   size_t total_size = 0;
@@ -84,6 +114,12 @@ void sexp_debug_alloc_sizes(sexp ctx) {
 #endif
 
 void sexp_free_heap (sexp_heap heap) {
+#if SEXP_USE_INCREMENTAL_GC
+  free(heap->gray);
+#endif
+#if SEXP_USE_ALLOC_BUFFERS
+  free(heap->alloc_buffers);
+#endif
 #if SEXP_USE_MMAP_GC
   munmap(heap, sexp_heap_pad_size(heap->size));
 #else
@@ -258,7 +294,8 @@ static void sexp_mark_one (sexp ctx, sexp* types, sexp x) {
   sexp t, *p, *q;
   struct sexp_gc_var_t *saves;
  loop:
-  if (!x || !sexp_pointerp(x) || !sexp_valid_object_p(ctx, x) || sexp_markedp(x))
+  if (!x || !sexp_pointerp(x) || !sexp_valid_object_p(ctx, x) || sexp_markedp(x)
+      || !sexp_gc_in_range_p(sexp_context_heap(ctx), x))
     return;
   sexp_markedp(x) = 1;
   if (sexp_contextp(x)) {
@@ -364,51 +401,110 @@ void sexp_conservative_mark (sexp ctx) {
 #endif
 
 #if SEXP_USE_WEAK_REFERENCES
-int sexp_reset_weak_references(sexp ctx) {
-  int i, len, broke, all_reset_p;
-  sexp_heap h;
+/* Mark the extra (ephemeron value) fields of live weak objects which */
+/* still have a live key.  These aren't traced as normal slots, so */
+/* without this a value only reachable from its ephemeron would be */
+/* freed while the ephemeron still points to it. */
+static int sexp_mark_weak_values (sexp ctx, sexp_heap h, sexp_heap stop) {
+  int i, len, marked = 0;
   sexp p, t, end, *v;
   sexp_free_list q, r;
-  if (sexp_not(sexp_global(ctx, SEXP_G_WEAK_OBJECTS_PRESENT)))
-    return 0;
-  broke = 0;
-  /* just scan the whole heap */
-  for (h = sexp_context_heap(ctx) ; h; h=h->next) {
+  for ( ; h != stop; h=h->next) {
     p = sexp_heap_first_block(h);
     q = h->free_list;
     end = sexp_heap_end(h);
     while (p < end) {
-      /* find the preceding and succeeding free list pointers */
       for (r=q->next; r && ((char*)r<(char*)p); q=r, r=r->next)
         ;
-      if ((char*)r == (char*)p) { /* this is a free block, skip it */
+      if ((char*)r == (char*)p) {
         p = (sexp) (((char*)p) + r->size);
         continue;
       }
-      if (sexp_valid_object_p(ctx, p) && sexp_markedp(p)) {
+      if (sexp_valid_object_p(ctx, p)
+          && !sexp_gc_deadp(sexp_context_heap(ctx), p)) {
         t = sexp_object_type(ctx, p);
-        if (sexp_type_weak_base(t) > 0) {
-          all_reset_p = 1;
+        if (sexp_type_weak_base(t) > 0 && sexp_type_weak_len_extra(t) > 0) {
           v = (sexp*) ((char*)p + sexp_type_weak_base(t));
           len = sexp_type_num_weak_slots_of_object(t, p);
-          for (i=0; i<len; i++) {
-            if (v[i] && sexp_pointerp(v[i]) && ! sexp_markedp(v[i])) {
-              v[i] = SEXP_FALSE;
-              sexp_brokenp(p) = 1;
-            } else {
-              all_reset_p = 0;
-            }
-          }
-          if (all_reset_p) {      /* ephemerons */
-            broke++;
+          for (i=0; i<len; i++)
+            if (!(v[i] && sexp_pointerp(v[i])
+                  && sexp_gc_deadp(sexp_context_heap(ctx), v[i])))
+              break;
+          if (i < len) {        /* at least one key is live */
             len += sexp_type_weak_len_extra(t);
-            for ( ; i<len; i++) v[i] = SEXP_FALSE;
+            for (i=sexp_type_num_weak_slots_of_object(t, p); i<len; i++)
+              if (v[i] && sexp_pointerp(v[i])
+                  && sexp_gc_deadp(sexp_context_heap(ctx), v[i])) {
+                sexp_mark(ctx, v[i]);
+                marked++;
+              }
           }
         }
       }
       p = (sexp) (((char*)p)+sexp_heap_align(sexp_allocated_bytes(ctx, p)));
     }
   }
+  return marked;
+}
+
+static int sexp_reset_weak_object (sexp ctx, sexp p) {
+  int i, len, all_reset_p = 1;
+  sexp t = sexp_object_type(ctx, p), *v;
+  v = (sexp*) ((char*)p + sexp_type_weak_base(t));
+  len = sexp_type_num_weak_slots_of_object(t, p);
+  for (i=0; i<len; i++) {
+    if (v[i] && sexp_pointerp(v[i])
+        && sexp_gc_deadp(sexp_context_heap(ctx), v[i])) {
+      v[i] = SEXP_FALSE;
+      sexp_brokenp(p) = 1;
+    } else {
+      all_reset_p = 0;
+    }
+  }
+  if (all_reset_p) {      /* ephemerons */
+    len += sexp_type_weak_len_extra(t);
+    for ( ; i<len; i++) v[i] = SEXP_FALSE;
+    return 1;
+  }
+  return 0;
+}
+
+/* reset weak references in live objects in the chunks from h to stop */
+static int sexp_reset_weak_heaps (sexp ctx, sexp_heap h, sexp_heap stop) {
+  int broke = 0;
+  sexp p, end;
+  sexp_free_list q, r;
+  for ( ; h != stop; h=h->next) {
+    p = sexp_heap_first_block(h);
+    q = h->free_list;
+    end = sexp_heap_end(h);
+    while (p < end) {
+      /* find the preceding and succeeding free list pointers */
+      for (r=q->next; r && ((char*)r<(char*)p); q=r, r=r->next)
+        ;
+      if ((char*)r == (char*)p) { /* this is a free block, skip it */
+        p = (sexp) (((char*)p) + r->size);
+        continue;
+      }
+      if (sexp_valid_object_p(ctx, p)
+          && !sexp_gc_deadp(sexp_context_heap(ctx), p)
+          && sexp_type_weak_base(sexp_object_type(ctx, p)) > 0)
+        broke += sexp_reset_weak_object(ctx, p);
+      p = (sexp) (((char*)p)+sexp_heap_align(sexp_allocated_bytes(ctx, p)));
+    }
+  }
+  return broke;
+}
+
+int sexp_reset_weak_references(sexp ctx) {
+  int broke;
+  if (sexp_not(sexp_global(ctx, SEXP_G_WEAK_OBJECTS_PRESENT)))
+    return 0;
+  /* repeat until no more values were newly marked */
+  while (sexp_mark_weak_values(ctx, sexp_context_heap(ctx), NULL))
+    ;
+  /* just scan the whole heap */
+  broke = sexp_reset_weak_heaps(ctx, sexp_context_heap(ctx), NULL);
   sexp_debug_printf("%p (broke %d weak references)", ctx, broke);
   return broke;
 }
@@ -417,19 +513,18 @@ int sexp_reset_weak_references(sexp ctx) {
 #endif
 
 #if SEXP_USE_FINALIZERS
-sexp sexp_finalize (sexp ctx) {
+/* finalize unmarked objects in the heap chunks from h up to stop */
+static sexp sexp_finalize_heaps (sexp ctx, sexp_heap h, sexp_heap stop) {
   size_t size;
   sexp p, t, end;
   sexp_free_list q, r;
   sexp_proc2 finalizer;
   sexp_sint_t finalize_count = 0;
-  sexp_heap h = sexp_context_heap(ctx);
 #if SEXP_USE_DL
   sexp_sint_t free_dls = 0, pass = 0;
  loop:
 #endif
-  /* scan over the whole heap */
-  for ( ; h; h=h->next) {
+  for ( ; h != stop; h=h->next) {
     p = sexp_heap_first_block(h);
     q = h->free_list;
     end = sexp_heap_end(h);
@@ -466,80 +561,243 @@ sexp sexp_finalize (sexp ctx) {
 #endif
   return sexp_make_fixnum(finalize_count);
 }
+
+sexp sexp_finalize (sexp ctx) {
+  /* scan over the whole heap */
+  return sexp_finalize_heaps(ctx, sexp_context_heap(ctx), NULL);
+}
+#else
+#define sexp_finalize_heaps(ctx, h, stop) SEXP_ZERO
 #endif
 
-sexp sexp_sweep (sexp ctx, size_t *sum_freed_ptr) {
-  size_t freed, max_freed=0, sum_freed=0, size;
-  sexp_heap h = sexp_context_heap(ctx);
+#if SEXP_USE_SEGREGATED_FREE_LISTS
+static int sexp_free_list_class (size_t size) {
+  size_t n = size / SEXP_MINIMUM_OBJECT_SIZE;
+  int c;
+  if (n <= SEXP_FREE_LIST_EXACT_CLASSES)
+    return n > 0 ? n - 1 : 0;
+  n = (n - 1) / SEXP_FREE_LIST_EXACT_CLASSES;
+  for (c=SEXP_FREE_LIST_EXACT_CLASSES; n > 1 && c < SEXP_FREE_LIST_CLASSES-1; n >>= 1)
+    c++;
+  return c;
+}
+
+static void sexp_free_list_push_class (sexp_heap h, sexp_free_list ls) {
+  int c = sexp_free_list_class(ls->size);
+  ls->class_next = h->free_classes[c];
+  h->free_classes[c] = ls;
+  h->free_class_bits |= (1uL << c);
+}
+
+/* rebuild the back links and size classes from the address-ordered */
+/* free list, which is all the sweep maintains */
+void sexp_index_free_list (sexp_heap h) {
+  sexp_free_list q, r, *tails[SEXP_FREE_LIST_CLASSES];
+  int c;
+  for (c=0; c<SEXP_FREE_LIST_CLASSES; c++)
+    tails[c] = &h->free_classes[c];
+  h->free_list->prev = h->free_list->class_next = NULL;
+  /* keep each class in address order for locality */
+  for (q=h->free_list; (r=q->next); q=r) {
+    r->prev = q;
+    c = sexp_free_list_class(r->size);
+    *tails[c] = r;
+    tails[c] = &r->class_next;
+  }
+  h->free_class_bits = 0;
+  for (c=0; c<SEXP_FREE_LIST_CLASSES; c++) {
+    *tails[c] = NULL;
+    if (h->free_classes[c])
+      h->free_class_bits |= (1uL << c);
+  }
+}
+#endif
+
+static void sexp_sweep_heap (sexp ctx, sexp_heap h, size_t *max_freed_ptr,
+                             size_t *sum_freed_ptr) {
+  size_t freed, max_freed=*max_freed_ptr, sum_freed=*sum_freed_ptr, size;
   sexp p, end;
   sexp_free_list q, r, s;
-  /* scan over the whole heap */
-  for ( ; h; h=h->next) {
-    p = sexp_heap_first_block(h);
-    q = h->free_list;
-    end = sexp_heap_end(h);
-    while (p < end) {
-      /* find the preceding and succeeding free list pointers */
-      for (r=q->next; r && ((char*)r<(char*)p); q=r, r=r->next)
-        ;
-      if ((char*)r == (char*)p) { /* this is a free block, skip it */
-        p = (sexp) (((char*)p) + r->size);
-        continue;
-      }
-      size = sexp_heap_align(sexp_allocated_bytes(ctx, p));
+  p = sexp_heap_first_block(h);
+  q = h->free_list;
+  end = sexp_heap_end(h);
+  while (p < end) {
+    /* find the preceding and succeeding free list pointers */
+    for (r=q->next; r && ((char*)r<(char*)p); q=r, r=r->next)
+      ;
+    if ((char*)r == (char*)p) { /* this is a free block, skip it */
+      p = (sexp) (((char*)p) + r->size);
+      continue;
+    }
+    size = sexp_heap_align(sexp_allocated_bytes(ctx, p));
 #if SEXP_USE_DEBUG_GC > 1
-      if (!sexp_valid_object_p(ctx, p))
-        fprintf(stderr, SEXP_BANNER("%p sweep: invalid object at %p"), ctx, p);
-      if ((char*)q + q->size > (char*)p)
-        fprintf(stderr, SEXP_BANNER("%p sweep: bad size at %p < %p + %lu"),
-                ctx, p, q, q->size);
-      if (r && ((char*)p)+size > (char*)r)
-        fprintf(stderr, SEXP_BANNER("%p sweep: bad size at %p + %lu > %p"),
-                ctx, p, size, r);
+    if (!sexp_valid_object_p(ctx, p))
+      fprintf(stderr, SEXP_BANNER("%p sweep: invalid object at %p"), ctx, p);
+    if ((char*)q + q->size > (char*)p)
+      fprintf(stderr, SEXP_BANNER("%p sweep: bad size at %p < %p + %lu"),
+              ctx, p, q, q->size);
+    if (r && ((char*)p)+size > (char*)r)
+      fprintf(stderr, SEXP_BANNER("%p sweep: bad size at %p + %lu > %p"),
+              ctx, p, size, r);
 #endif
-      if (!sexp_markedp(p)) {
-        /* free p */
-        sum_freed += size;
-        if (((((char*)q) + q->size) == (char*)p) && (q != h->free_list)) {
-          /* merge q with p */
-          if (r && r->size && ((((char*)p)+size) == (char*)r)) {
-            /* ... and with r */
-            q->next = r->next;
-            freed = q->size + size + r->size;
-            p = (sexp) (((char*)p) + size + r->size);
-          } else {
-            freed = q->size + size;
-            p = (sexp) (((char*)p)+size);
-          }
-          q->size = freed;
+    if (!sexp_markedp(p)) {
+      /* free p */
+      sum_freed += size;
+      if (((((char*)q) + q->size) == (char*)p) && (q != h->free_list)) {
+        /* merge q with p */
+        if (r && r->size && ((((char*)p)+size) == (char*)r)) {
+          /* ... and with r */
+          q->next = r->next;
+          freed = q->size + size + r->size;
+          p = (sexp) (((char*)p) + size + r->size);
         } else {
-          s = (sexp_free_list)p;
-          if (r && r->size && ((((char*)p)+size) == (char*)r)) {
-            /* merge p with r */
-            s->size = size + r->size;
-            s->next = r->next;
-            q->next = s;
-            freed = size + r->size;
-          } else {
-            s->size = size;
-            s->next = r;
-            q->next = s;
-            freed = size;
-          }
-          p = (sexp) (((char*)p)+freed);
+          freed = q->size + size;
+          p = (sexp) (((char*)p)+size);
         }
-        if (freed > max_freed)
-          max_freed = freed;
+        q->size = freed;
       } else {
-        sexp_markedp(p) = 0;
-        p = (sexp) (((char*)p)+size);
+        s = (sexp_free_list)p;
+        if (r && r->size && ((((char*)p)+size) == (char*)r)) {
+          /* merge p with r */
+          s->size = size + r->size;
+          s->next = r->next;
+          q->next = s;
+          freed = size + r->size;
+        } else {
+          s->size = size;
+          s->next = r;
+          q->next = s;
+          freed = size;
+        }
+        p = (sexp) (((char*)p)+freed);
       }
+      if (freed > max_freed)
+        max_freed = freed;
+    } else {
+      sexp_markedp(p) = 0;
+      p = (sexp) (((char*)p)+size);
     }
   }
+  sexp_index_free_list(h);
+  *max_freed_ptr = max_freed;
+  *sum_freed_ptr = sum_freed;
+}
+
+sexp sexp_sweep (sexp ctx, size_t *sum_freed_ptr) {
+  size_t max_freed=0, sum_freed=0;
+  sexp_heap h = sexp_context_heap(ctx);
+  /* scan over the whole heap */
+  for ( ; h; h=h->next)
+    sexp_sweep_heap(ctx, h, &max_freed, &sum_freed);
   if (sum_freed_ptr) *sum_freed_ptr = sum_freed;
   return sexp_make_fixnum(max_freed);
 }
 
+#define sexp_heap_emptyp(h) (h->free_list->next && h->free_list->next->size \
+  == h->size - sexp_heap_align(sexp_free_chunk_size))
+
+#if SEXP_USE_SHRINK_HEAP
+
+#if SEXP_USE_MMAP_GC
+#define sexp_trim_malloc()
+#elif defined(__GLIBC__)
+/* free() may keep large blocks in the arena */
+#define sexp_trim_malloc() malloc_trim(0)
+#else
+#define sexp_trim_malloc()
+#endif
+
+#if SEXP_USE_MMAP_GC
+/* release the pages of an empty chunk, leaving its free block header */
+static void sexp_release_heap_pages (sexp_heap h) {
+  sexp_uint_t page = sysconf(_SC_PAGESIZE);
+  char *lo = (char*)h->free_list->next + sexp_free_chunk_size;
+  char *hi = h->data + h->size;
+  lo = (char*)(((sexp_uint_t)lo + page - 1) & ~(page - 1));
+  hi = (char*)((sexp_uint_t)hi & ~(page - 1));
+  if (lo < hi)
+    madvise(lo, hi - lo, MADV_DONTNEED);
+}
+#endif
+
+/* Give back chunks which have stayed empty for the last */
+/* SEXP_SHRINK_HEAP_DELAY collections.  Only called once every chunk */
+/* has been swept. */
+static void sexp_shrink_heap (sexp ctx) {
+  sexp_heap h0 = sexp_context_heap(ctx), h, *hp;
+  sexp_free_list q;
+  size_t total_size = 0, free_size = 0, live_size;
+  int candidates = 0;
+  for (h=h0; h; h=h->next) {
+    total_size += h->size;
+    if (h != h0 && sexp_heap_emptyp(h)
+#if SEXP_USE_GENERATIONAL_GC
+        && h != h0->nursery
+#endif
+        ) {
+      if (++h->empty_count >= SEXP_SHRINK_HEAP_DELAY)
+        candidates = 1;
+    } else {
+      h->empty_count = 0;
+    }
+  }
+  if (!candidates) return;
+  for (h=h0; h; h=h->next)
+    for (q=h->free_list; q; q=q->next)
+      free_size += q->size;
+  live_size = total_size - free_size;
+  for (hp=&h0->next; (h=*hp); ) {
+    if (h->empty_count >= SEXP_SHRINK_HEAP_DELAY
+        && total_size - h->size >= SEXP_SHRINK_HEAP_LOW_WATER
+        && live_size < (total_size - h->size) * SEXP_SHRINK_HEAP_RATIO) {
+      sexp_debug_printf("%p (releasing chunk: %p size: %lu)", ctx, h, h->size);
+      *hp = h->next;
+      total_size -= h->size;
+      sexp_free_heap(h);
+      sexp_trim_malloc();
+      continue;
+    }
+#if SEXP_USE_MMAP_GC
+    if (h->empty_count == SEXP_SHRINK_HEAP_DELAY)
+      sexp_release_heap_pages(h);
+#endif
+    hp = &h->next;
+  }
+}
+#else
+#define sexp_shrink_heap(ctx)
+#endif
+
+#if SEXP_USE_ALLOC_BUFFERS
+/* Cover the unused part of an allocation buffer with a bytevector, */
+/* so the heap can still be walked object by object.  Nothing refers */
+/* to it, so the next sweep puts it back on the free list. */
+static void sexp_alloc_buffer_fill (char *p, size_t size) {
+  sexp x = (sexp)p;
+  if (size == 0) return;
+  sexp_pointer_tag(x) = SEXP_BYTES;
+#if SEXP_USE_HEADER_MAGIC
+  sexp_pointer_magic(x) = SEXP_POINTER_MAGIC;
+#endif
+  sexp_bytes_length(x) = size - (sexp_sizeof(bytes) + 1 + SEXP_GC_PAD);
+}
+
+/* Give up every context's allocation buffer, so the heap is fully */
+/* parseable again. */
+void sexp_retire_alloc_buffers (sexp ctx) {
+  sexp_heap h = sexp_context_heap(ctx);
+  sexp_uint_t i;
+  sexp c;
+  for (i=0; i<h->alloc_buffers_len; i++) {
+    c = h->alloc_buffers[i];
+    sexp_alloc_buffer_fill(sexp_context_alloc_ptr(c),
+                           sexp_context_alloc_end(c) - sexp_context_alloc_ptr(c));
+    sexp_context_alloc_ptr(c) = sexp_context_alloc_end(c) = NULL;
+  }
+  h->alloc_buffers_len = 0;
+}
+#endif
+
 #if SEXP_USE_GLOBAL_SYMBOLS
 void sexp_mark_global_symbols(sexp ctx) {
   int i;
@@ -550,30 +808,522 @@ void sexp_mark_global_symbols(sexp ctx) {
 #define sexp_mark_global_symbols(ctx)
 #endif
 
+#if SEXP_USE_GENERATIONAL_GC
+static void sexp_gc_update_full_limit (sexp ctx, size_t freed) {
+  sexp_heap h = sexp_context_heap(ctx);
+  size_t total = sexp_heap_total_size(h), live = total;
+  if (freed < total) live -= freed;
+  /* allow the old generation to double before the next full collection */
+  if (2*live > total) total = 2*live;
+  h->full_gc_limit = total + total / SEXP_NURSERY_GROWTH_RATIO + SEXP_NURSERY_SIZE;
+}
+
+/* Drop the objects a full collection found dead from the remembered */
+/* set, before they're swept. */
+static void sexp_forget_unmarked (sexp ctx) {
+  sexp_heap h = sexp_context_heap(ctx);
+  sexp_uint_t i, j;
+  for (i=j=0; i<h->remembered_len; i++)
+    if (sexp_markedp(h->remembered[i]))
+      h->remembered[j++] = h->remembered[i];
+  h->remembered_len = j;
+}
+#endif
+
+#if SEXP_USE_INCREMENTAL_GC || SEXP_USE_PARALLEL_MARK
+/* mark anything a marked object references which isn't yet marked */
+static void sexp_rescan_object (sexp ctx, sexp* types, sexp p) {
+  sexp_sint_t i, len;
+  sexp t = types[sexp_pointer_tag(p)], *v;
+  struct sexp_gc_var_t *saves;
+  len = sexp_type_num_slots_of_object(t, p);
+  v = (sexp*) (((char*)p) + sexp_type_field_base(t));
+  for (i=0; i<len; i++)
+    if (v[i] && sexp_pointerp(v[i]) && !sexp_markedp(v[i]))
+      sexp_mark(ctx, v[i]);
+  if (sexp_contextp(p))
+    for (saves=sexp_context_saves(p); saves; saves=saves->next)
+      if (saves->var) sexp_mark(ctx, *(saves->var));
+}
+
+/* Scan every marked object in a linear pass, marking anything it */
+/* references.  Anything newly marked is traced fully by sexp_mark, */
+/* so after one pass the marked set is closed even if some marked */
+/* objects had never been scanned, or were modified after scanning. */
+static void sexp_rescan_marked (sexp ctx) {
+  sexp_sint_t num_types = sexp_context_num_types(ctx);
+  sexp_heap h;
+  sexp p, t, end, *types = sexp_context_types(ctx);
+  sexp_free_list q, r;
+  for (h=sexp_context_heap(ctx); h; h=h->next) {
+    p = sexp_heap_first_block(h);
+    q = h->free_list;
+    end = sexp_heap_end(h);
+    while (p < end) {
+      for (r=q->next; r && ((char*)r<(char*)p); q=r, r=r->next)
+        ;
+      if ((char*)r == (char*)p) {
+        p = (sexp) (((char*)p) + r->size);
+        continue;
+      }
+      if (sexp_pointer_tag(p) >= num_types) {
+        p = (sexp) (((char*)p) + sexp_heap_align(1));
+        continue;
+      }
+      t = types[sexp_pointer_tag(p)];
+      if (sexp_markedp(p))
+        sexp_rescan_object(ctx, types, p);
+      p = (sexp) (((char*)p)
+                  + sexp_heap_align(sexp_type_size_of_object(t, p) + SEXP_GC_PAD));
+    }
+  }
+}
+#endif
+
+#if SEXP_USE_INCREMENTAL_GC
+/* Finish an incremental marking cycle.  The write barrier shaded */
+/* everything the VM stored during the cycle, so only the remaining */
+/* gray ranges need tracing, and the running contexts and their */
+/* stacks, which the VM writes without the barrier, rescanning.  If */
+/* C code may have stored into already-scanned objects, all marked */
+/* objects are rescanned instead. */
+static void sexp_incremental_finish (sexp ctx) {
+  sexp_heap h = sexp_context_heap(ctx);
+  sexp c, *p, *q, *types = sexp_context_types(ctx);
+  h->marking = 0;
+  if (h->barrier_bypassed || !h->barrier_active) {
+    h->gray_len = 0;
+    sexp_rescan_marked(ctx);
+    return;
+  }
+  while (h->gray_len > 0) {
+    q = h->gray[--h->gray_len];
+    p = h->gray[--h->gray_len];
+    for ( ; p < q; p++)
+      sexp_mark(ctx, *p);
+  }
+  for (c=ctx; c && sexp_contextp(c); c=sexp_context_parent(c)) {
+    sexp_rescan_object(ctx, types, c);
+    sexp_rescan_object(ctx, types, sexp_context_stack(c));
+  }
+}
+#endif
+
+#if SEXP_USE_PARALLEL_MARK
+/* Each worker traces from a private stack of marked but unscanned */
+/* objects, moving the oldest half to its shared stack whenever that */
+/* is empty, for idle workers to steal.  Objects are claimed with an */
+/* atomic exchange on the mark byte, so each is scanned only once. */
+/* The other OS threads of the application must not touch the heap */
+/* during the collection, as for any other collection. */
+
+struct sexp_mark_worker_t {
+  sexp ctx;
+  struct sexp_mark_pool_t *pool;
+  sexp *stack, *shared;
+  size_t len, size, shared_len, shared_size;
+  pthread_mutex_t lock;
+  pthread_t thread;
+};
+
+struct sexp_mark_pool_t {
+  struct sexp_mark_worker_t *workers;
+  int num_workers, idle, started, overflowp;
+  size_t shared_total;
+};
+
+static int sexp_mark_threads = -1;
+
+static int sexp_mark_stack_reserve (sexp **stack, size_t *size, size_t len) {
+  sexp *tmp;
+  size_t new_size;
+  if (len <= *size) return 1;
+  new_size = *size ? 2 * *size : 4*SEXP_PARALLEL_MARK_SHARE;
+  while (new_size < len) new_size *= 2;
+  tmp = (sexp*) realloc(*stack, new_size * sizeof(sexp));
+  if (!tmp) return 0;
+  *stack = tmp;
+  *size = new_size;
+  return 1;
+}
+
+static void sexp_mark_worker_push (struct sexp_mark_worker_t *w, sexp x) {
+  if (!x || !sexp_pointerp(x) || !sexp_valid_object_p(w->ctx, x)
+      || __atomic_load_n(&sexp_markedp(x), __ATOMIC_RELAXED)
+      || !sexp_gc_in_range_p(sexp_context_heap(w->ctx), x)
+      || __atomic_exchange_n(&sexp_markedp(x), 1, __ATOMIC_ACQ_REL))
+    return;
+  /* if we can't remember x, sexp_rescan_marked will scan it later */
+  if (sexp_mark_stack_reserve(&w->stack, &w->size, w->len + 1))
+    w->stack[w->len++] = x;
+  else
+    w->pool->overflowp = 1;
+}
+
+static void sexp_mark_worker_scan (struct sexp_mark_worker_t *w, sexp* types, sexp x) {
+  sexp t, *p, *q;
+  struct sexp_gc_var_t *saves;
+  if (sexp_contextp(x))
+    for (saves=sexp_context_saves(x); saves; saves=saves->next)
+      if (saves->var) sexp_mark_worker_push(w, *(saves->var));
+  t = types[sexp_pointer_tag(x)];
+  p = (sexp*) (((char*)x) + sexp_type_field_base(t));
+  q = p + sexp_type_num_slots_of_object(t, x);
+  for ( ; p < q; p++)
+    sexp_mark_worker_push(w, *p);
+}
+
+static void sexp_mark_worker_share (struct sexp_mark_worker_t *w) {
+  size_t n = w->len / 2;
+  pthread_mutex_lock(&w->lock);
+  if (w->shared_len == 0
+      && sexp_mark_stack_reserve(&w->shared, &w->shared_size, n)) {
+    memcpy(w->shared, w->stack, n * sizeof(sexp));
+    memmove(w->stack, w->stack + n, (w->len - n) * sizeof(sexp));
+    w->shared_len = n;
+    w->len -= n;
+    __atomic_add_fetch(&w->pool->shared_total, n, __ATOMIC_SEQ_CST);
+  }
+  pthread_mutex_unlock(&w->lock);
+}
+
+/* take half of the first non-empty shared stack, starting with our own */
+static int sexp_mark_worker_steal (struct sexp_mark_worker_t *w) {
+  struct sexp_mark_pool_t *pool = w->pool;
+  struct sexp_mark_worker_t *v;
+  size_t n = 0;
+  int i;
+  for (i=0; i<pool->num_workers && !n; i++) {
+    v = &pool->workers[(w - pool->workers + i) % pool->num_workers];
+    if (__atomic_load_n(&v->shared_len, __ATOMIC_RELAXED) == 0)
+      continue;
+    pthread_mutex_lock(&v->lock);
+    n = (v->shared_len + 1) / 2;
+    if (n && sexp_mark_stack_reserve(&w->stack, &w->size, w->len + n)) {
+      v->shared_len -= n;
+      memcpy(w->stack + w->len, v->shared + v->shared_len, n * sizeof(sexp));
+      w->len += n;
+      __atomic_sub_fetch(&pool->shared_total, n, __ATOMIC_SEQ_CST);
+    } else {
+      n = 0;
+    }
+    pthread_mutex_unlock(&v->lock);
+  }
+  return n > 0;
+}
+
+static void* sexp_mark_worker_run (void *arg) {
+  struct sexp_mark_worker_t *w = (struct sexp_mark_worker_t*) arg;
+  struct sexp_mark_pool_t *pool = w->pool;
+  sexp *types = sexp_context_types(w->ctx);
+  while (!__atomic_load_n(&pool->started, __ATOMIC_ACQUIRE))
+    sched_yield();
+  for (;;) {
+    while (w->len > 0) {
+      sexp_mark_worker_scan(w, types, w->stack[--w->len]);
+      if (w->len >= 2*SEXP_PARALLEL_MARK_SHARE
+          && __atomic_load_n(&w->shared_len, __ATOMIC_RELAXED) == 0)
+        sexp_mark_worker_share(w);
+    }
+    if (sexp_mark_worker_steal(w))
+      continue;
+    /* we're done once every worker is idle with nothing to steal */
+    __atomic_add_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+    for (;;) {
+      if (__atomic_load_n(&pool->idle, __ATOMIC_SEQ_CST) == pool->num_workers
+          && __atomic_load_n(&pool->shared_total, __ATOMIC_SEQ_CST) == 0)
+        return NULL;
+      if (__atomic_load_n(&pool->shared_total, __ATOMIC_SEQ_CST) > 0) {
+        __atomic_sub_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+        if (sexp_mark_worker_steal(w))
+          break;
+        __atomic_add_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+      }
+      sched_yield();
+    }
+  }
+}
+
+/* Mark everything reachable from the roots with the worker threads, */
+/* returning false if the heap is too small to be worth it. */
+static int sexp_parallel_mark (sexp ctx) {
+  struct sexp_mark_pool_t pool;
+  struct sexp_mark_worker_t *w;
+  char *env;
+  int i, n;
+  if (sexp_mark_threads < 0) {
+    env = getenv("CHIBI_GC_MARK_THREADS");
+    sexp_mark_threads = env ? atoi(env) : SEXP_DEFAULT_MARK_THREADS;
+  }
+  if (sexp_mark_threads < 2
+      || sexp_heap_total_size(sexp_context_heap(ctx)) < SEXP_PARALLEL_MARK_MIN_HEAP)
+    return 0;
+  memset(&pool, 0, sizeof(pool));
+  pool.workers = (struct sexp_mark_worker_t*)
+    calloc(sexp_mark_threads, sizeof(struct sexp_mark_worker_t));
+  if (!pool.workers) return 0;
+  for (i=0; i<sexp_mark_threads; i++) {
+    pool.workers[i].ctx = ctx;
+    pool.workers[i].pool = &pool;
+    pthread_mutex_init(&pool.workers[i].lock, NULL);
+  }
+  w = &pool.workers[0];
+#if SEXP_USE_GLOBAL_SYMBOLS
+  for (i=0; i<SEXP_SYMBOL_TABLE_SIZE; i++)
+    sexp_mark_worker_push(w, sexp_symbol_table[i]);
+#endif
+  sexp_mark_worker_push(w, ctx);
+  /* the calling thread is worker 0 */
+  for (n=1; n<sexp_mark_threads; n++)
+    if (pthread_create(&pool.workers[n].thread, NULL, sexp_mark_worker_run,
+                       &pool.workers[n]))
+      break;
+  pool.num_workers = n;
+  __atomic_store_n(&pool.started, 1, __ATOMIC_RELEASE);
+  sexp_mark_worker_run(w);
+  for (i=0; i<sexp_mark_threads; i++) {
+    if (i > 0 && i < n)
+      pthread_join(pool.workers[i].thread, NULL);
+    pthread_mutex_destroy(&pool.workers[i].lock);
+    free(pool.workers[i].stack);
+    free(pool.workers[i].shared);
+  }
+  free(pool.workers);
+  if (pool.overflowp)
+    sexp_rescan_marked(ctx);
+  return 1;
+}
+#else
+#define sexp_parallel_mark(ctx) 0
+#endif
+
+static void sexp_gc_mark_phase (sexp ctx) {
+  sexp_retire_alloc_buffers(ctx);
+  if (!sexp_parallel_mark(ctx)) {
+    sexp_mark_global_symbols(ctx);
+    sexp_mark(ctx, ctx);
+  }
+#if SEXP_USE_INCREMENTAL_GC
+  if (sexp_context_heap(ctx)->marking)
+    sexp_incremental_finish(ctx);
+  /* don't start another cycle until this one has been swept */
+  sexp_context_heap(ctx)->incremental_trigger = SEXP_UINT_T_MAX;
+#endif
+  sexp_conservative_mark(ctx);
+  sexp_reset_weak_references(ctx);
+#if SEXP_USE_GENERATIONAL_GC
+  sexp_forget_unmarked(ctx);
+#endif
+}
+
+#if SEXP_USE_INCREMENTAL_GC
+static void sexp_incremental_arm (sexp_heap h, size_t freed) {
+  h->alloc_since_gc = 0;
+  h->incremental_trigger = freed * SEXP_INCREMENTAL_GC_START_RATIO;
+}
+#else
+#define sexp_incremental_arm(h, freed)
+#endif
+
+#if SEXP_USE_COMPACTION
+/* flag the heap for compaction by the next allocation when the */
+/* space freed is scattered over many small blocks */
+static void sexp_compact_check (sexp_heap h, size_t max_freed, size_t sum_freed) {
+  h->compact_pending = h->next
+    && (max_freed < sum_freed * SEXP_COMPACT_FRAGMENTATION_RATIO);
+}
+#else
+#define sexp_compact_check(h, max_freed, sum_freed)
+#endif
+
+#if SEXP_USE_LAZY_SWEEP
+/* Finalize and sweep a single chunk left marked by a lazy collection. */
+/* Returns true when this was the last chunk pending. */
+static int sexp_lazy_sweep_heap (sexp ctx, sexp_heap h) {
+  sexp_heap h0 = sexp_context_heap(ctx);
+  sexp finalized SEXP_NO_WARN_UNUSED;
+#if SEXP_USE_TIME_GC
+  sexp_uint_t gc_usecs;
+  struct rusage start;
+  getrusage(RUSAGE_SELF, &start);
+#endif
+  finalized = sexp_finalize_heaps(ctx, h, h->next);
+  sexp_sweep_heap(ctx, h, &h0->sweep_max_freed, &h0->sweep_freed);
+  h->sweep_pending = 0;
+  --h0->sweeps_pending;
+#if SEXP_USE_TIME_GC
+  gc_usecs = sexp_gc_usecs_since(&start);
+  sexp_context_gc_sweep_usecs(ctx) += gc_usecs;
+  sexp_context_gc_usecs(ctx) += gc_usecs;
+#endif
+  return h0->sweeps_pending == 0;
+}
+
+void sexp_finish_sweep (sexp ctx) {
+  sexp_heap h;
+  for (h=sexp_context_heap(ctx); h && sexp_context_heap(ctx)->sweeps_pending; h=h->next)
+    if (h->sweep_pending)
+      sexp_lazy_sweep_heap(ctx, h);
+}
+
+/* once every chunk has been swept we know how much the collection */
+/* freed, and grow the heap if it's still mostly full */
+static void sexp_lazy_sweep_done (sexp ctx, size_t size) {
+  sexp_heap h = sexp_context_heap(ctx);
+  size_t total_size = sexp_heap_total_size(h), sum_freed = h->sweep_freed;
+  sexp_debug_printf("%p (lazily freed: %lu max_freed: %lu)",
+                    ctx, sum_freed, h->sweep_max_freed);
+  sexp_incremental_arm(h, sum_freed);
+  sexp_compact_check(h, h->sweep_max_freed, sum_freed);
+  if ((total_size > sum_freed)
+      && ((total_size - sum_freed) > (total_size*SEXP_GROW_HEAP_RATIO))
+      && ((!h->max_size) || (total_size < h->max_size)))
+    sexp_grow_heap(ctx, size, 0);
+}
+
+/* Mark only, leaving every chunk to be swept on demand by the */
+/* allocator, so the pause doesn't depend on the heap size. */
+static void sexp_gc_lazy (sexp ctx) {
+  sexp_heap h0 = sexp_context_heap(ctx), h;
+#if SEXP_USE_TIME_GC
+  sexp_uint_t gc_usecs;
+  struct rusage start;
+#endif
+  sexp_finish_sweep(ctx);
+  sexp_shrink_heap(ctx);
+#if SEXP_USE_TIME_GC
+  getrusage(RUSAGE_SELF, &start);
+#endif
+  sexp_gc_mark_phase(ctx);
+  h0->sweep_freed = h0->sweep_max_freed = h0->sweeps_pending = 0;
+  for (h=h0; h; h=h->next) {
+    h->sweep_pending = 1;
+    ++h0->sweeps_pending;
+  }
+  ++sexp_context_gc_count(ctx);
+#if SEXP_USE_TIME_GC
+  gc_usecs = sexp_gc_usecs_since(&start);
+  sexp_context_gc_mark_usecs(ctx) += gc_usecs;
+  sexp_context_gc_usecs(ctx) += gc_usecs;
+  sexp_debug_printf("%p (lazy mark time: %luus)", ctx, gc_usecs);
+#endif
+}
+#endif
+
+#if SEXP_USE_INCREMENTAL_GC
+/* The incremental marker keeps its own stack of slot ranges still */
+/* to be scanned, which persists between slices.  If it can't grow */
+/* the range is just dropped, and sexp_incremental_finish told to */
+/* rescan every marked object. */
+static void sexp_gray_push (sexp_heap h, sexp *start, sexp *end) {
+  sexp **tmp;
+  if (start >= end) return;
+  if (h->gray_len + 2 > h->gray_size) {
+    tmp = (sexp**) realloc(h->gray, (h->gray_size ? 2*h->gray_size : 256)
+                                     * sizeof(sexp*));
+    if (!tmp) {
+      h->barrier_bypassed = 1;
+      return;
+    }
+    h->gray = tmp;
+    h->gray_size = h->gray_size ? 2*h->gray_size : 256;
+  }
+  h->gray[h->gray_len++] = start;
+  h->gray[h->gray_len++] = end;
+}
+
+static void sexp_gray_mark (sexp ctx, sexp* types, sexp_heap h, sexp x) {
+  sexp t, *p;
+  if (!x || !sexp_pointerp(x) || !sexp_valid_object_p(ctx, x) || sexp_markedp(x))
+    return;
+  sexp_markedp(x) = 1;
+  t = types[sexp_pointer_tag(x)];
+  p = (sexp*) (((char*)x) + sexp_type_field_base(t));
+  sexp_gray_push(h, p, p + sexp_type_num_slots_of_object(t, x));
+}
+
+void sexp_incremental_shade (sexp ctx, sexp x) {
+  sexp_gray_mark(ctx, sexp_context_types(ctx), sexp_context_heap(ctx), x);
+}
+
+/* Called from the VM each time a thread runs out of fuel.  Starts a */
+/* new cycle once enough has been allocated since the last one was */
+/* swept, then marks for up to gc_pause_usecs.  When nothing is left */
+/* to scan the cycle is finished and the heap left to be swept lazily. */
+void sexp_incremental_mark (sexp ctx) {
+  sexp_heap h = sexp_context_heap(ctx);
+  sexp *p, *q, *types = sexp_context_types(ctx);
+  sexp_uint_t n = 0;
+  struct timeval start, now;
+  if (!h->marking) {
+    if (h->alloc_since_gc < h->incremental_trigger || h->sweeps_pending)
+      return;
+    h->marking = 1;
+    h->barrier_bypassed = 0;
+#if SEXP_USE_GLOBAL_SYMBOLS
+    sexp_gray_push(h, sexp_symbol_table, sexp_symbol_table+SEXP_SYMBOL_TABLE_SIZE);
+#endif
+    sexp_gray_mark(ctx, types, h, ctx);
+  }
+  gettimeofday(&start, NULL);
+  while (h->gray_len > 0) {
+    p = h->gray[h->gray_len-2];
+    q = h->gray[h->gray_len-1];
+    if (q - p > SEXP_INCREMENTAL_GC_CHUNK) {   /* split large objects */
+      q = p + SEXP_INCREMENTAL_GC_CHUNK;
+      h->gray[h->gray_len-2] = q;
+    } else {
+      h->gray_len -= 2;
+    }
+    for ( ; p < q; p++)
+      sexp_gray_mark(ctx, types, h, *p);
+    if (++n % SEXP_INCREMENTAL_GC_CHUNK == 0) {
+      gettimeofday(&now, NULL);
+      if ((sexp_uint_t)(1000000*(now.tv_sec - start.tv_sec)
+                        + (now.tv_usec - start.tv_usec)) >= h->gc_pause_usecs)
+        return;
+    }
+  }
+  sexp_gc_lazy(ctx);
+}
+#endif
+
 sexp sexp_gc (sexp ctx, size_t *sum_freed) {
   sexp res, finalized SEXP_NO_WARN_UNUSED;
+  size_t freed = 0;
+#if SEXP_USE_TIME_GC
+  sexp_uint_t mark_usecs, sweep_usecs;
+  struct rusage start;
+#endif
+  sexp_finish_sweep(ctx);
 #if SEXP_USE_TIME_GC
-  sexp_uint_t gc_usecs;
-  struct rusage start, end;
   getrusage(RUSAGE_SELF, &start);
   sexp_debug_printf("%p (heap: %p size: %lu)", ctx, sexp_context_heap(ctx),
                     sexp_heap_total_size(sexp_context_heap(ctx)));
 #endif
-  sexp_mark_global_symbols(ctx);
-  sexp_mark(ctx, ctx);
-  sexp_conservative_mark(ctx);
-  sexp_reset_weak_references(ctx);
+  sexp_gc_mark_phase(ctx);
+#if SEXP_USE_TIME_GC
+  mark_usecs = sexp_gc_usecs_since(&start);
+  getrusage(RUSAGE_SELF, &start);
+#endif
   finalized = sexp_finalize(ctx);
-  res = sexp_sweep(ctx, sum_freed);
+  res = sexp_sweep(ctx, &freed);
+  if (sum_freed) *sum_freed = freed;
+  sexp_incremental_arm(sexp_context_heap(ctx), freed);
+  sexp_compact_check(sexp_context_heap(ctx), sexp_unbox_fixnum(res), freed);
+  sexp_shrink_heap(ctx);
   ++sexp_context_gc_count(ctx);
+#if SEXP_USE_GENERATIONAL_GC
+  sexp_gc_update_full_limit(ctx, freed);
+#endif
 #if SEXP_USE_TIME_GC
-  getrusage(RUSAGE_SELF, &end);
-  gc_usecs = (end.ru_utime.tv_sec - start.ru_utime.tv_sec) * 1000000 +
-    end.ru_utime.tv_usec - start.ru_utime.tv_usec;
-  sexp_context_gc_usecs(ctx) += gc_usecs;
-  sexp_debug_printf("%p (freed: %lu max_freed: %lu finalized: %lu time: %luus)",
-                    ctx, (sum_freed ? *sum_freed : 0), sexp_unbox_fixnum(res),
-                    sexp_unbox_fixnum(finalized), gc_usecs);
+  sweep_usecs = sexp_gc_usecs_since(&start);
+  sexp_context_gc_mark_usecs(ctx) += mark_usecs;
+  sexp_context_gc_sweep_usecs(ctx) += sweep_usecs;
+  sexp_context_gc_usecs(ctx) += mark_usecs + sweep_usecs;
+  sexp_debug_printf("%p (freed: %lu max_freed: %lu finalized: %lu mark: %luus sweep: %luus)",
+                    ctx, freed, sexp_unbox_fixnum(res),
+                    sexp_unbox_fixnum(finalized), mark_usecs, sweep_usecs);
 #endif
   return res;
 }
@@ -592,6 +1342,40 @@ sexp_heap sexp_make_heap (size_t size, size_t max_size, size_t chunk_size) {
   h->size = size;
   h->max_size = max_size;
   h->chunk_size = chunk_size;
+#if SEXP_USE_LAZY_SWEEP
+  h->sweep_pending = 0;
+  h->sweeps_pending = h->sweep_freed = h->sweep_max_freed = 0;
+#endif
+#if SEXP_USE_GENERATIONAL_GC
+  h->nursery = NULL;
+  h->full_gc_limit = 2*size;
+  h->mark_lo = NULL;
+  h->mark_hi = (char*)-1;
+  h->young_lo = h->young_hi = NULL;
+  h->remembered = NULL;
+  h->remembered_len = h->remembered_size = 0;
+#endif
+#if SEXP_USE_GENERATIONAL_GC || SEXP_USE_INCREMENTAL_GC
+  h->barrier_active = 0;
+  h->barrier_bypassed = 1;
+#endif
+#if SEXP_USE_INCREMENTAL_GC
+  h->marking = 0;
+  h->gray = NULL;
+  h->gray_len = h->gray_size = h->alloc_since_gc = 0;
+  h->incremental_trigger = size * SEXP_INCREMENTAL_GC_START_RATIO;
+  h->gc_pause_usecs = SEXP_DEFAULT_GC_PAUSE;
+#endif
+#if SEXP_USE_COMPACTION
+  h->compact_pending = 0;
+#endif
+#if SEXP_USE_ALLOC_BUFFERS
+  h->alloc_buffers = NULL;
+  h->alloc_buffers_len = h->alloc_buffers_size = 0;
+#endif
+#if SEXP_USE_SHRINK_HEAP
+  h->empty_count = 0;
+#endif
   h->data = (char*) sexp_heap_align(sizeof(h->data)+(sexp_uint_t)&(h->data));
   free = h->free_list = (sexp_free_list) h->data;
   h->next = NULL;
@@ -600,6 +1384,7 @@ sexp_heap sexp_make_heap (size_t size, size_t max_size, size_t chunk_size) {
   free->next = next;
   next->size = size - sexp_heap_align(sexp_free_chunk_size);
   next->next = NULL;
+  sexp_index_free_list(h);
 #if SEXP_USE_DEBUG_GC
   fprintf(stderr, SEXP_BANNER("heap: %p-%p data: %p-%p"),
           h, ((char*)h)+sexp_heap_pad_size(size), h->data, h->data + size);
@@ -634,8 +1419,75 @@ int sexp_grow_heap (sexp ctx, size_t size, size_t chunk_size) {
   return (h->next != NULL);
 }
 
-void* sexp_try_alloc (sexp ctx, size_t size) {
+#if SEXP_USE_SEGREGATED_FREE_LISTS
+static void* sexp_try_alloc_heap (sexp_heap h, size_t size) {
+  sexp_free_list *cls, ls2, ls3;
+  unsigned long bits;
+  int c = sexp_free_list_class(size), skip SEXP_NO_WARN_UNUSED;
+  /* blocks in classes below size's class are all too small, and */
+  /* usually the first block we look at fits */
+  for (bits=h->free_class_bits>>c; bits; bits>>=1, c++) {
+    /* skip to the next non-empty class */
+#if defined(__GNUC__)
+    skip = __builtin_ctzl(bits);
+    c += skip;
+    bits >>= skip;
+#else
+    for ( ; !(bits & 1); bits>>=1) c++;
+#endif
+    for (cls=&h->free_classes[c]; (ls2=*cls); cls=&ls2->class_next) {
+      if (ls2->size >= size) {
+        if (!(*cls = ls2->class_next) && cls == &h->free_classes[c])
+          h->free_class_bits &= ~(1uL << c);
+        if (ls2->size >= (size + SEXP_MINIMUM_OBJECT_SIZE)) {
+          ls3 = (sexp_free_list) (((char*)ls2)+size); /* the tail after ls2 */
+          ls3->size = ls2->size - size;
+          ls3->next = ls2->next;
+          ls3->prev = ls2->prev;
+          if (ls3->next) ls3->next->prev = ls3;
+          ls3->prev->next = ls3;
+          sexp_free_list_push_class(h, ls3);
+        } else {                /* take the whole chunk */
+          ls2->prev->next = ls2->next;
+          if (ls2->next) ls2->next->prev = ls2->prev;
+        }
+        memset((void*)ls2, 0, size);
+        return ls2;
+      }
+    }
+  }
+  return NULL;
+}
+#else
+static void* sexp_try_alloc_heap (sexp_heap h, size_t size) {
   sexp_free_list ls1, ls2, ls3;
+  for (ls1=h->free_list, ls2=ls1->next; ls2; ls1=ls2, ls2=ls2->next) {
+    if (ls2->size >= size) {
+#if SEXP_USE_DEBUG_GC > 1
+      ls3 = (sexp_free_list) sexp_heap_end(h);
+      if (ls2 >= ls3)
+        fprintf(stderr, "alloced %lu bytes past end of heap: %p (%lu) >= %p"
+                " next: %p (%lu)\n", size, ls2, ls2->size, ls3, ls2->next,
+                (ls2->next ? ls2->next->size : 0));
+#endif
+      if (ls2->size >= (size + SEXP_MINIMUM_OBJECT_SIZE)) {
+        ls3 = (sexp_free_list) (((char*)ls2)+size); /* the tail after ls2 */
+        ls3->size = ls2->size - size;
+        ls3->next = ls2->next;
+        ls1->next = ls3;
+      } else {                  /* take the whole chunk */
+        ls1->next = ls2->next;
+      }
+      memset((void*)ls2, 0, size);
+      return ls2;
+    }
+  }
+  return NULL;
+}
+#endif
+
+void* sexp_try_alloc (sexp ctx, size_t size) {
+  void *res;
   sexp_heap h;
 #if SEXP_USE_FIXED_CHUNK_SIZE_HEAPS
   int found_fixed = 0;
@@ -650,28 +1502,27 @@ void* sexp_try_alloc (sexp ctx, size_t size) {
       return NULL;
     }
 #endif
-    for (ls1=h->free_list, ls2=ls1->next; ls2; ls1=ls2, ls2=ls2->next) {
-      if (ls2->size >= size) {
-#if SEXP_USE_DEBUG_GC > 1
-        ls3 = (sexp_free_list) sexp_heap_end(h);
-        if (ls2 >= ls3)
-          fprintf(stderr, "alloced %lu bytes past end of heap: %p (%lu) >= %p"
-                  " next: %p (%lu)\n", size, ls2, ls2->size, ls3, ls2->next,
-                  (ls2->next ? ls2->next->size : 0));
+#if SEXP_USE_GENERATIONAL_GC
+    if (h == sexp_context_heap(ctx)->nursery)
+      continue;
 #endif
-        if (ls2->size >= (size + SEXP_MINIMUM_OBJECT_SIZE)) {
-          ls3 = (sexp_free_list) (((char*)ls2)+size); /* the tail after ls2 */
-          ls3->size = ls2->size - size;
-          ls3->next = ls2->next;
-          ls1->next = ls3;
-        } else {                  /* take the whole chunk */
-          ls1->next = ls2->next;
-        }
-        memset((void*)ls2, 0, size);
-        return ls2;
-      }
-    }
+#if SEXP_USE_LAZY_SWEEP
+    if (h->sweep_pending && sexp_lazy_sweep_heap(ctx, h))
+      sexp_lazy_sweep_done(ctx, size);
+#endif
+    if ((res = sexp_try_alloc_heap(h, size)))
+      return res;
+  }
+#if SEXP_USE_GENERATIONAL_GC
+  /* large objects only go in the nursery as a last resort */
+  if ((h = sexp_context_heap(ctx)->nursery)) {
+#if SEXP_USE_LAZY_SWEEP
+    if (h->sweep_pending && sexp_lazy_sweep_heap(ctx, h))
+      sexp_lazy_sweep_done(ctx, size);
+#endif
+    return sexp_try_alloc_heap(h, size);
   }
+#endif
   return NULL;
 }
 
@@ -696,10 +1547,369 @@ int sexp_find_fixed_chunk_heap_usage(sexp ctx, size_t size, size_t* sum_freed, s
 }
 #endif
 
+#if SEXP_USE_GENERATIONAL_GC
+
+struct sexp_weak_list_t {
+  sexp *data;
+  size_t len, size;
+  int overflowp;
+};
+
+static void sexp_weak_list_push (struct sexp_weak_list_t *ls, sexp x) {
+  sexp *tmp;
+  if (ls->overflowp) return;
+  if (ls->len >= ls->size) {
+    tmp = realloc(ls->data, (ls->size ? 2*ls->size : 64) * sizeof(sexp));
+    if (!tmp) {
+      ls->overflowp = 1;
+      return;
+    }
+    ls->data = tmp;
+    ls->size = ls->size ? 2*ls->size : 64;
+  }
+  ls->data[ls->len++] = x;
+}
+
+/* Mark x if it's in the nursery, returning true if it is. */
+static int sexp_mark_young (sexp ctx, sexp* types, sexp_heap n, sexp x) {
+  if (!(x && sexp_pointerp(x) && sexp_in_nursery_p(n, x)))
+    return 0;
+  if (!sexp_markedp(x))
+    sexp_mark_one_start(ctx, types, x);
+  return 1;
+}
+
+/* Mark the nursery objects referenced by the old object p, returning */
+/* true if there were any. */
+static int sexp_mark_old_object (sexp ctx, sexp* types, sexp_heap n, sexp p,
+                                 struct sexp_weak_list_t *weak) {
+  sexp_sint_t i, len;
+  sexp t, *v;
+  struct sexp_gc_var_t *saves;
+  int res = 0;
+  if (sexp_pointer_tag(p) >= sexp_context_num_types(ctx))
+    return 0;
+  t = types[sexp_pointer_tag(p)];
+  len = sexp_type_num_slots_of_object(t, p);
+  v = (sexp*) (((char*)p) + sexp_type_field_base(t));
+  for (i=0; i<len; i++)
+    res |= sexp_mark_young(ctx, types, n, v[i]);
+  if (sexp_contextp(p))
+    for (saves=sexp_context_saves(p); saves; saves=saves->next)
+      if (saves->var) res |= sexp_mark_young(ctx, types, n, *(saves->var));
+  if (sexp_type_weak_base(t) > 0) {
+    v = (sexp*) (((char*)p) + sexp_type_weak_base(t));
+    len = sexp_type_num_weak_slots_of_object(t, p);
+    /* conservatively keep young ephemeron values of old objects */
+    for (i=len; i<len+sexp_type_weak_len_extra(t); i++)
+      res |= sexp_mark_young(ctx, types, n, v[i]);
+    for (i=0; i<len; i++)
+      if (v[i] && sexp_pointerp(v[i]) && sexp_in_nursery_p(n, v[i])) {
+        sexp_weak_list_push(weak, p);
+        res = 1;
+        break;
+      }
+  }
+  return res;
+}
+
+/* Treat every object in the old chunk h as live, marking any nursery */
+/* objects it references and rebuilding the remembered set from */
+/* scratch.  This is needed whenever C code may have stored into the */
+/* heap since the last minor collection, since only the VM uses the */
+/* write barrier. */
+static void sexp_mark_old_heap (sexp ctx, sexp* types, sexp_heap n,
+                                sexp_heap h, struct sexp_weak_list_t *weak) {
+  sexp_sint_t num_types = sexp_context_num_types(ctx);
+  sexp p, end;
+  sexp_free_list q, r;
+  p = sexp_heap_first_block(h);
+  q = h->free_list;
+  end = sexp_heap_end(h);
+  while (p < end) {
+    /* find the preceding and succeeding free list pointers */
+    for (r=q->next; r && ((char*)r<(char*)p); q=r, r=r->next)
+      ;
+    if ((char*)r == (char*)p) { /* this is a free block, skip it */
+      p = (sexp) (((char*)p) + r->size);
+      continue;
+    }
+    if (sexp_pointer_tag(p) >= num_types) {
+      p = (sexp) (((char*)p) + sexp_heap_align(1));
+      continue;
+    }
+    sexp_rememberedp(p) = 0;
+    if (sexp_mark_old_object(ctx, types, n, p, weak))
+      sexp_remember(ctx, p);
+    p = (sexp) (((char*)p)
+                + sexp_heap_align(sexp_type_size_of_object(types[sexp_pointer_tag(p)], p) + SEXP_GC_PAD));
+  }
+}
+
+/* Mark from the remembered set, dropping the objects which no */
+/* longer reference the nursery.  The running contexts and their */
+/* stacks are written without the barrier, so are always scanned. */
+static void sexp_mark_remembered (sexp ctx, sexp* types, sexp_heap n,
+                                  struct sexp_weak_list_t *weak) {
+  sexp_heap h = sexp_context_heap(ctx);
+  sexp_uint_t i, j;
+  sexp x, c;
+  for (c=ctx; c && sexp_contextp(c); c=sexp_context_parent(c)) {
+    if (!sexp_in_nursery_p(n, c))
+      sexp_mark_old_object(ctx, types, n, c, weak);
+    x = sexp_context_stack(c);
+    if (x && !sexp_in_nursery_p(n, x))
+      sexp_mark_old_object(ctx, types, n, x, weak);
+  }
+  for (i=j=0; i<h->remembered_len; i++) {
+    x = h->remembered[i];
+    if (sexp_mark_old_object(ctx, types, n, x, weak))
+      h->remembered[j++] = x;
+    else
+      sexp_rememberedp(x) = 0;
+  }
+  h->remembered_len = j;
+}
+
+/* Add the old object x to the remembered set.  If the set can't */
+/* grow, the next minor collection just scans the whole heap. */
+void sexp_remember (sexp ctx, sexp x) {
+  sexp_heap h = sexp_context_heap(ctx);
+  sexp *tmp;
+  if (h->barrier_bypassed) return;
+  if (h->remembered_len >= h->remembered_size) {
+    tmp = (sexp*) realloc(h->remembered, (h->remembered_size ? 2*h->remembered_size : 256)
+                                         * sizeof(sexp));
+    if (!tmp) {
+      h->barrier_bypassed = 1;
+      return;
+    }
+    h->remembered = tmp;
+    h->remembered_size = h->remembered_size ? 2*h->remembered_size : 256;
+  }
+  sexp_rememberedp(x) = 1;
+  h->remembered[h->remembered_len++] = x;
+}
+
+sexp sexp_minor_gc (sexp ctx, size_t *sum_freed) {
+  size_t max_freed=0, freed=0;
+  sexp_heap h = sexp_context_heap(ctx), n = h->nursery, tmp;
+  sexp *types = sexp_context_types(ctx), finalized SEXP_NO_WARN_UNUSED;
+  struct sexp_weak_list_t weak = {NULL, 0, 0, 0};
+#if SEXP_USE_WEAK_REFERENCES
+  size_t i;
+#endif
+#if SEXP_USE_TIME_GC
+  sexp_uint_t mark_usecs, sweep_usecs;
+  struct rusage start;
+#endif
+  if (!n) return SEXP_ZERO;
+  sexp_finish_sweep(ctx);
+#if SEXP_USE_TIME_GC
+  getrusage(RUSAGE_SELF, &start);
+#endif
+  h->mark_lo = n->data;
+  h->mark_hi = n->data + n->size;
+  sexp_mark_global_symbols(ctx);
+  sexp_mark(ctx, ctx);
+  if (h->barrier_bypassed || !h->barrier_active) {
+    h->remembered_len = 0;
+    h->barrier_bypassed = 0;
+    for (tmp=h; tmp; tmp=tmp->next)
+      if (tmp != n)
+        sexp_mark_old_heap(ctx, types, n, tmp, &weak);
+  } else {
+    sexp_mark_remembered(ctx, types, n, &weak);
+  }
+  sexp_conservative_mark(ctx);
+#if SEXP_USE_WEAK_REFERENCES
+  if (sexp_truep(sexp_global(ctx, SEXP_G_WEAK_OBJECTS_PRESENT))) {
+    if (weak.overflowp) {
+      while (sexp_mark_weak_values(ctx, h, NULL))
+        ;
+      sexp_reset_weak_heaps(ctx, h, NULL);
+    } else {
+      while (sexp_mark_weak_values(ctx, n, n->next))
+        ;
+      for (i=0; i<weak.len; i++)
+        sexp_reset_weak_object(ctx, weak.data[i]);
+      sexp_reset_weak_heaps(ctx, n, n->next);
+    }
+  }
+#endif
+  free(weak.data);
+#if SEXP_USE_TIME_GC
+  mark_usecs = sexp_gc_usecs_since(&start);
+  getrusage(RUSAGE_SELF, &start);
+#endif
+  finalized = sexp_finalize_heaps(ctx, n, n->next);
+  sexp_sweep_heap(ctx, n, &max_freed, &freed);
+  h->mark_lo = NULL;
+  h->mark_hi = (char*)-1;
+  if (sum_freed) *sum_freed = freed;
+  ++sexp_context_gc_count(ctx);
+#if SEXP_USE_TIME_GC
+  sweep_usecs = sexp_gc_usecs_since(&start);
+  sexp_context_gc_mark_usecs(ctx) += mark_usecs;
+  sexp_context_gc_sweep_usecs(ctx) += sweep_usecs;
+  sexp_context_gc_usecs(ctx) += mark_usecs + sweep_usecs;
+  sexp_debug_printf("%p minor (freed: %lu max_freed: %lu finalized: %lu mark: %luus sweep: %luus)",
+                    ctx, freed, max_freed, sexp_unbox_fixnum(finalized),
+                    mark_usecs, sweep_usecs);
+#endif
+  return sexp_make_fixnum(max_freed);
+}
+
+static size_t sexp_heap_free_size (sexp_heap h) {
+  size_t res = 0;
+  sexp_free_list ls;
+  for (ls=h->free_list; ls; ls=ls->next)
+    res += ls->size;
+  return res;
+}
+
+/* Pick the chunk with the most free space as the new nursery, */
+/* promoting whatever survived in the current one.  Objects already */
+/* in the chosen chunk simply become young again.  The nursery grows */
+/* with the old generation so the cost of scanning the latter is */
+/* amortized over enough allocation.  A full collection is only run */
+/* when the old generation has outgrown its limit. */
+static int sexp_nursery_select (sexp ctx, sexp_heap h) {
+  sexp_heap tmp, best;
+  size_t free_size, best_free, total, want;
+  sexp_uint_t i, j;
+  sexp p;
+  int full_gc = !h->nursery;     /* don't collect while bootstrapping */
+ loop:
+  best = NULL;
+  best_free = 0;
+  for (tmp=h; tmp; tmp=tmp->next) {
+    free_size = sexp_heap_free_size(tmp);
+    if (free_size > best_free) {
+      best = tmp;
+      best_free = free_size;
+    }
+  }
+  total = sexp_heap_total_size(h);
+  want = total / SEXP_NURSERY_GROWTH_RATIO;
+  if (want < SEXP_NURSERY_SIZE) want = SEXP_NURSERY_SIZE;
+  want = sexp_heap_align(want);
+  if (best_free < want * (1 - SEXP_NURSERY_PROMOTE_RATIO)) {
+    if (!full_gc && (total + want > h->full_gc_limit
+                     || (h->max_size && total + want > h->max_size))) {
+      sexp_gc(ctx, NULL);
+      full_gc = 1;
+      goto loop;
+    }
+    if (h->max_size && total + want > h->max_size) {
+      if (!best) return 0;
+    } else {
+      tmp = sexp_make_heap(want, h->max_size, 0);
+      if (tmp) {
+        sexp_heap_last(h)->next = tmp;
+        best = tmp;
+      } else if (!best) {
+        return 0;
+      }
+    }
+  }
+  if (best != h->nursery) {
+    /* survivors in best become young again, so forget them, and */
+    /* unless best is empty there may be unrecorded old-to-young refs */
+    for (i=j=0; i<h->remembered_len; i++) {
+      p = h->remembered[i];
+      if ((char*)p >= best->data && (char*)p < best->data + best->size)
+        sexp_rememberedp(p) = 0;
+      else
+        h->remembered[j++] = p;
+    }
+    h->remembered_len = j;
+    if (!sexp_heap_emptyp(best))
+      h->barrier_bypassed = 1;
+    h->young_lo = best->data;
+    h->young_hi = best->data + best->size;
+  }
+  h->nursery = best;
+  return 1;
+}
+
+static void* sexp_nursery_alloc (sexp ctx, size_t size) {
+  sexp_heap h = sexp_context_heap(ctx);
+  void *res;
+  if (!h->nursery && !sexp_nursery_select(ctx, h))
+    return NULL;
+#if SEXP_USE_LAZY_SWEEP
+  if (h->nursery->sweep_pending && sexp_lazy_sweep_heap(ctx, h->nursery))
+    sexp_lazy_sweep_done(ctx, size);
+#endif
+  res = sexp_try_alloc_heap(h->nursery, size);
+  if (!res) {
+    sexp_minor_gc(ctx, NULL);
+    if (sexp_heap_free_size(h->nursery)
+        < h->nursery->size * (1 - SEXP_NURSERY_PROMOTE_RATIO))
+      sexp_nursery_select(ctx, h);
+    res = sexp_try_alloc_heap(h->nursery, size);
+  }
+  return res;
+}
+
+#endif
+
+#if SEXP_USE_ALLOC_BUFFERS
+/* Take a new allocation buffer for ctx from the heap, abandoning the */
+/* rest of the old one.  Buffers are only used once a context has */
+/* allocated a fair amount, so the many short-lived contexts the */
+/* compiler creates don't each hold on to one.  Each context with a */
+/* buffer is remembered in the heap so the unused tail can be filled */
+/* in before the heap is next walked. */
+static void* sexp_alloc_buffer_refill (sexp ctx, size_t size) {
+  sexp_heap h = sexp_context_heap(ctx);
+  char *p = sexp_context_alloc_ptr(ctx);
+  sexp *tmp;
+  if (sexp_context_alloc_direct(ctx) < SEXP_ALLOC_BUFFER_SIZE) {
+    sexp_context_alloc_direct(ctx) += size;
+    return NULL;
+  }
+  if (!p) {
+    if (h->alloc_buffers_len >= h->alloc_buffers_size) {
+      tmp = (sexp*) realloc(h->alloc_buffers, (h->alloc_buffers_size ? 2*h->alloc_buffers_size : 16)
+                                             * sizeof(sexp));
+      if (!tmp) return NULL;
+      h->alloc_buffers = tmp;
+      h->alloc_buffers_size = h->alloc_buffers_size ? 2*h->alloc_buffers_size : 16;
+    }
+  } else {
+    sexp_alloc_buffer_fill(p, sexp_context_alloc_end(ctx) - p);
+    sexp_context_alloc_ptr(ctx) = sexp_context_alloc_end(ctx);
+  }
+  if (! (p = sexp_try_alloc(ctx, SEXP_ALLOC_BUFFER_SIZE))) {
+    /* too fragmented for now, go back to allocating directly for a while */
+    sexp_context_alloc_direct(ctx) = 0;
+    return NULL;
+  }
+  if (!sexp_context_alloc_end(ctx))
+    h->alloc_buffers[h->alloc_buffers_len++] = ctx;
+  sexp_context_alloc_ptr(ctx) = p + size;
+  sexp_context_alloc_end(ctx) = p + SEXP_ALLOC_BUFFER_SIZE;
+  return p;
+}
+
+static void* sexp_alloc_buffer (sexp ctx, size_t size) {
+  char *p = sexp_context_alloc_ptr(ctx);
+  if (p && p + size <= sexp_context_alloc_end(ctx)) {
+    sexp_context_alloc_ptr(ctx) = p + size;
+    return p;
+  }
+  return sexp_alloc_buffer_refill(ctx, size);
+}
+#endif
+
 #if ! SEXP_USE_MALLOC
 void* sexp_alloc (sexp ctx, size_t size) {
   void *res;
+#if ! SEXP_USE_LAZY_SWEEP
   size_t max_freed, sum_freed, total_size=0;
+#endif
   sexp_heap h = sexp_context_heap(ctx);
 #if SEXP_USE_TRACK_ALLOC_SIZES
   size_t size_bucket;
@@ -710,11 +1920,39 @@ void* sexp_alloc (sexp ctx, size_t size) {
   gettimeofday(&start, NULL);
 #endif
   size = sexp_heap_align(size) + SEXP_GC_PAD;
+#if SEXP_USE_INCREMENTAL_GC
+  h->alloc_since_gc += size;
+#endif
+#if SEXP_USE_COMPACTION
+  if (h->compact_pending)
+    sexp_gc_heap_compact(ctx);
+#endif
 #if SEXP_USE_TRACK_ALLOC_SIZES
   size_bucket = (size - SEXP_GC_PAD) / sexp_heap_align(1) - 1;
   ++sexp_context_alloc_histogram(ctx)[size_bucket >= SEXP_ALLOC_HISTOGRAM_BUCKETS ? SEXP_ALLOC_HISTOGRAM_BUCKETS-1 : size_bucket];
 #endif
-  res = sexp_try_alloc(ctx, size);
+  res = NULL;
+#if SEXP_USE_ALLOC_BUFFERS
+  if (size <= SEXP_ALLOC_BUFFER_MAX_OBJECT)
+    res = sexp_alloc_buffer(ctx, size);
+#endif
+#if SEXP_USE_GENERATIONAL_GC
+  if (size <= SEXP_NURSERY_MAX_OBJECT_SIZE)
+    res = sexp_nursery_alloc(ctx, size);
+#endif
+  if (! res)
+    res = sexp_try_alloc(ctx, size);
+#if SEXP_USE_LAZY_SWEEP
+  if (! res) {
+    /* everything has been swept by now, start a new collection */
+    sexp_gc_lazy(ctx);
+    res = sexp_try_alloc(ctx, size);
+    /* nothing big enough was freed, so grow regardless */
+    if (! res && ((!h->max_size) || (sexp_heap_total_size(h) < h->max_size))) {
+      sexp_grow_heap(ctx, size, 0);
+      res = sexp_try_alloc(ctx, size);
+    }
+#else
   if (! res) {
     max_freed = sexp_unbox_fixnum(sexp_gc(ctx, &sum_freed));
 #if SEXP_USE_FIXED_CHUNK_SIZE_HEAPS
@@ -728,11 +1966,19 @@ void* sexp_alloc (sexp ctx, size_t size) {
         && ((!h->max_size) || (total_size < h->max_size)))
       sexp_grow_heap(ctx, size, 0);
     res = sexp_try_alloc(ctx, size);
+#endif
     if (! res) {
       res = sexp_global(ctx, SEXP_G_OOM_ERROR);
       sexp_debug_printf("ran out of memory allocating %lu bytes => %p", size, res);
     }
   }
+#if SEXP_USE_GENERATIONAL_GC
+  /* objects allocated directly in the old generation are initialized */
+  /* without the write barrier */
+  if (!sexp_young_p(h, res) && !h->barrier_bypassed
+      && res != sexp_global(ctx, SEXP_G_OOM_ERROR))
+    sexp_remember(ctx, res);
+#endif
 #if SEXP_USE_TRACK_ALLOC_TIMES
   gettimeofday(&end, NULL);
   alloc_time = 1000000*(end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec);
@@ -4,6 +4,10 @@
 
 #include "chibi/gc_heap.h"
 
+#if SEXP_USE_COMPACTION
+#include <pthread.h>
+#endif
+
 #if SEXP_USE_IMAGE_LOADING
 
 #define ERR_STR_SIZE 256
@@ -33,6 +37,8 @@ sexp sexp_gc_heap_walk(sexp ctx,
   sexp res = SEXP_FALSE;
 
   size_t size = 0;
+  if (h == sexp_context_heap(ctx))
+    sexp_retire_alloc_buffers(ctx);
   while (h) {
     sexp p = sexp_heap_first_block(h);
     sexp_free_list q = h->free_list;
@@ -169,16 +175,41 @@ static sexp sexp_adjust_fields(sexp dstp, sexp* types, sexp (* adjust_fn)(void *
     }
     vec[i] = dst;
   }
+
+  /* Weak fields, including any ephemeron values, move just the same */
+  if (sexp_type_weak_base(type_spec) > 0) {
+    vec = (sexp*)((unsigned char*)dstp + sexp_type_weak_base(type_spec));
+    type_sexp_cnt = sexp_type_num_weak_slots_of_object(type_spec, dstp)
+      + sexp_type_weak_len_extra(type_spec);
+    for (i = 0; i < type_sexp_cnt; i++) {
+      sexp src = vec[i];
+      if (src && sexp_pointerp(src)) {
+        sexp dst = adjust_fn(adata, src);
+        if (!sexp_pointerp(dst)) {
+          size_t sz = strlen(gc_heap_err_str);
+          snprintf(gc_heap_err_str + sz, ERR_STR_SIZE - sz, " from adjust weak fields, tag=%u i=%d", tag, i);
+          return SEXP_FALSE; }
+        vec[i] = dst;
+      }
+    }
+  }
   return SEXP_TRUE;
 }
 
 
-static sexp sexp_adjust_bytecode(sexp dstp, sexp (*adjust_fn)(void *, sexp), void *adata) {
+static sexp sexp_adjust_bytecode(sexp dstp, sexp (*adjust_fn)(void *, sexp),
+                                 int (*adjust_type_fn)(void *, sexp_uint_t *),
+                                 void *adata) {
   sexp res = SEXP_FALSE;
   sexp   src, dst;
   sexp*  vec;
   int    i;
-  
+
+#if SEXP_USE_JIT
+  /* native code isn't saved, recompile once hot again */
+  sexp_bytecode_jit(dstp) = NULL;
+  sexp_bytecode_calls(dstp) = 0;
+#endif
   for (i=0; i < sexp_bytecode_length(dstp); ) {
     switch (sexp_bytecode_data(dstp)[i++]) {
     case SEXP_OP_FCALL0:      case SEXP_OP_FCALL1:
@@ -206,12 +237,35 @@ static sexp sexp_adjust_bytecode(sexp dstp, sexp (*adjust_fn)(void *, sexp), voi
     case SEXP_OP_JUMP:        case SEXP_OP_JUMP_UNLESS:
     case SEXP_OP_STACK_REF:   case SEXP_OP_CLOSURE_REF:
     case SEXP_OP_LOCAL_REF:   case SEXP_OP_LOCAL_SET:
-    case SEXP_OP_TYPEP:
 #if SEXP_USE_RESERVE_OPCODE
     case SEXP_OP_RESERVE:
 #endif
       i += sizeof(sexp); break;
+    case SEXP_OP_LOCAL_REF_CAR: case SEXP_OP_LOCAL_REF_CDR:
+    case SEXP_OP_CLOSURE_REF_CDR: case SEXP_OP_LOCAL_REF_UNSAFE_CAR:
+    case SEXP_OP_LOCAL_REF_UNSAFE_CDR: case SEXP_OP_CLOSURE_REF_UNSAFE_CDR:
+      i += sizeof(sexp) + 1; break;
+    case SEXP_OP_TYPEP:
+      if (adjust_type_fn
+          && !adjust_type_fn(adata, (sexp_uint_t*)(&(sexp_bytecode_data(dstp)[i]))))
+        goto done;
+      i += sizeof(sexp); break;
     case SEXP_OP_MAKE: case SEXP_OP_SLOT_REF: case SEXP_OP_SLOT_SET:
+      if (adjust_type_fn
+          && !adjust_type_fn(adata, (sexp_uint_t*)(&(sexp_bytecode_data(dstp)[i]))))
+        goto done;
+      i += 2*sizeof(sexp); break;
+    case SEXP_OP_CACHED_CALL: case SEXP_OP_CACHED_TAIL_CALL:
+      vec = (sexp*)(&(sexp_bytecode_data(dstp)[i]));
+      src = vec[1];
+      if (src && sexp_pointerp(src)) {
+        dst = adjust_fn(adata, src);
+        if (!sexp_pointerp(dst)) {
+          size_t sz = strlen(gc_heap_err_str);
+          snprintf(gc_heap_err_str + sz, ERR_STR_SIZE - sz, " from adjust bytecode, CACHED_CALL");
+          goto done; }
+        vec[1] = dst;
+      }
       i += 2*sizeof(sexp); break;
     case SEXP_OP_MAKE_PROCEDURE:
       vec = (sexp*)(&(sexp_bytecode_data(dstp)[i]));
@@ -242,8 +296,11 @@ static sexp sexp_gc_heap_pack_adjust(sexp dstp, sexp* types, struct sexp_remap_s
   /* Other adjustments - context heap pointer, bytecode pointers */
   if (sexp_contextp(dstp)) {
     sexp_context_heap(dstp) = state->heap;
+#if SEXP_USE_ALLOC_BUFFERS
+    sexp_context_alloc_ptr(dstp) = sexp_context_alloc_end(dstp) = NULL;
+#endif
   } else if (sexp_bytecodep(dstp)) {
-    if ((res = sexp_adjust_bytecode(dstp, sexp_gc_heap_pack_src_to_dst, state)) != SEXP_TRUE) {
+    if ((res = sexp_adjust_bytecode(dstp, sexp_gc_heap_pack_src_to_dst, NULL, state)) != SEXP_TRUE) {
       goto done; }
   }
   res = SEXP_TRUE;
@@ -274,6 +331,7 @@ static sexp_heap sexp_gc_packed_heap_make(size_t packed_size, size_t free_size)
     heap->free_list->next->next = NULL;
     heap->free_list->next->size = free_size;
   }
+  sexp_index_free_list(heap);
   return heap;
 }
 
@@ -366,6 +424,216 @@ done:
 }
 
 
+#if SEXP_USE_COMPACTION
+
+/* Online compaction.  Sliding the whole heap would need every C */
+/* reference into it to be found precisely, so instead the live */
+/* objects of sparsely used chunks are evacuated into a single new */
+/* packed chunk, references to them from the rest of the heap are */
+/* adjusted as for packing an image, and the old chunks are freed. */
+/* A chunk is pinned in place if anything we can't adjust might */
+/* point into it. */
+
+struct sexp_compact_state {
+  struct sexp_remap_state remap;
+  sexp_heap *src;               /* chunks to evacuate, sorted by address */
+  char *pinned;
+  size_t src_count;
+};
+
+/* Return the index of the source chunk containing p, or -1 */
+static sexp_sint_t sexp_compact_find_src(struct sexp_compact_state *state, void *p) {
+  sexp_sint_t imin = 0;
+  sexp_sint_t imax = state->src_count - 1;
+
+  while (imin <= imax) {
+    sexp_sint_t imid = ((imax - imin) / 2) + imin;
+    sexp_heap h = state->src[imid];
+    if ((char*)p < h->data) {
+      imax = imid - 1;
+    } else if ((char*)p >= h->data + h->size) {
+      imin = imid + 1;
+    } else {
+      return imid;
+    }
+  }
+  return -1;
+}
+
+static void sexp_compact_pin(struct sexp_compact_state *state, void *p) {
+  sexp_sint_t i = sexp_compact_find_src(state, p);
+  if (i >= 0) state->pinned[i] = 1;
+}
+
+static void __attribute__((noinline))
+sexp_compact_scan_stack(struct sexp_compact_state *state, void **end) {
+  void **p = (void**)sexp_heap_align((sexp_uint_t)&p);
+  for ( ; p < end; p++)
+    sexp_compact_pin(state, *p);
+}
+
+/* Pin any chunk which the C stack might refer to, including interior */
+/* pointers.  Callee-saved registers are spilled to our frame first. */
+static int __attribute__((noinline))
+sexp_compact_pin_stack(struct sexp_compact_state *state) {
+  pthread_attr_t attr;
+  void *addr;
+  size_t size;
+  if (pthread_getattr_np(pthread_self(), &attr) != 0)
+    return 0;
+  if (pthread_attr_getstack(&attr, &addr, &size) != 0) {
+    pthread_attr_destroy(&attr);
+    return 0; }
+  pthread_attr_destroy(&attr);
+  __builtin_unwind_init();
+  sexp_compact_scan_stack(state, (void**)((char*)addr + size));
+  return 1;
+}
+
+static sexp sexp_callback_pin(sexp ctx, sexp s, void *user) {
+  struct sexp_compact_state* state = user;
+  /* C code may hold on to types, opcodes and contexts indefinitely, */
+  /* and objects hashed by address can't move */
+  if (sexp_pinnedp(s) || sexp_typep(s) || sexp_opcodep(s) || sexp_contextp(s))
+    sexp_compact_pin(state, s);
+  /* raw pointers into bytecode and string or bytevector data */
+  if (sexp_contextp(s))
+    sexp_compact_pin(state, sexp_context_ip(s));
+  else if (sexp_portp(s))
+    sexp_compact_pin(state, sexp_port_buf(s));
+  return SEXP_TRUE;
+}
+
+static sexp heap_callback_stop(sexp ctx, sexp_heap h, void *user) {
+  return SEXP_NULL;
+}
+
+static sexp sexp_compact_src_to_dst(void *adata, sexp srcp) {
+  struct sexp_compact_state* state = adata;
+  if (sexp_compact_find_src(state, srcp) < 0)
+    return srcp;
+  return sexp_gc_heap_pack_src_to_dst(&state->remap, srcp);
+}
+
+static sexp sexp_callback_compact_adjust(sexp ctx, sexp s, void *user) {
+  sexp res = sexp_adjust_fields(s, sexp_context_types(ctx), sexp_compact_src_to_dst, user);
+  if (res == SEXP_TRUE && sexp_bytecodep(s))
+    res = sexp_adjust_bytecode(s, sexp_compact_src_to_dst, NULL, user);
+  return res;
+}
+
+void sexp_gc_heap_compact(sexp ctx) {
+  sexp_heap h0 = sexp_context_heap(ctx), h, *hp;
+  sexp *types, ls, res = SEXP_FALSE;
+  size_t types_cnt, i, j;
+  struct sexp_compact_state state;
+  sexp_uint_t free_size;
+  sexp_free_list q;
+
+  h0->compact_pending = 0;
+  sexp_retire_alloc_buffers(ctx);
+  if (h0->sweeps_pending || !sexp_vectorp(sexp_context_globals(ctx))) return;
+#if SEXP_USE_INCREMENTAL_GC
+  if (h0->marking) return;
+#endif
+  types = sexp_context_types(ctx);
+  types_cnt = sexp_context_num_types(ctx);
+  memset(&state, 0, sizeof(struct sexp_compact_state));
+
+  /* 1.  Choose the sparse chunks, never the first, in address order */
+
+  for (h = h0->next; h; h = h->next) state.src_count++;
+  if (!state.src_count) return;
+  state.src = malloc(sizeof(sexp_heap) * state.src_count);
+  state.pinned = calloc(state.src_count, 1);
+  if (!state.src || !state.pinned) goto done;
+  for (i = 0, h = h0->next; h; h = h->next) {
+    for (free_size = sexp_heap_align(sexp_free_chunk_size), q = h->free_list; q; q = q->next)
+      free_size += q->size;
+    if (h->size - free_size < h->size * SEXP_COMPACT_OCCUPANCY_RATIO)
+      state.src[i++] = h;
+  }
+  state.src_count = i;
+  if (!state.src_count) goto done;
+  qsort(state.src, state.src_count, sizeof(sexp_heap), heaps_compar);
+
+  /* 2.  Pin chunks that anything we can't adjust refers to */
+
+  if (!sexp_compact_pin_stack(&state)) goto done;
+  for (ls = sexp_global(ctx, SEXP_G_PRESERVATIVES); sexp_pairp(ls); ls = sexp_cdr(ls))
+    sexp_compact_pin(&state, sexp_car(ls));
+  if (sexp_gc_heap_walk(ctx, h0, types, types_cnt, &state,
+                        NULL, NULL, sexp_callback_pin) != SEXP_TRUE)
+    goto done;
+  for (i = j = 0; i < state.src_count; i++)
+    if (!state.pinned[i])
+      state.src[j++] = state.src[i];
+  state.src_count = j;
+  if (!state.src_count) goto done;
+
+  /* 3.  Copy the live objects into a new packed chunk after the first */
+
+  for (i = 0; i < state.src_count; i++) {
+    res = sexp_gc_heap_walk(ctx, state.src[i], types, types_cnt, &state.remap,
+                            heap_callback_stop, NULL, sexp_callback_count);
+    if (res != SEXP_NULL) goto done;
+  }
+  if (state.remap.sexps_count > 0) {
+    state.remap.heap = sexp_gc_packed_heap_make(state.remap.sexps_size, 0);
+    state.remap.remap = malloc(sizeof(struct sexp_remap) * state.remap.sexps_count);
+    if (!state.remap.heap || !state.remap.remap) goto done;
+    state.remap.heap->max_size = h0->max_size;
+    state.remap.p   = sexp_heap_first_block(state.remap.heap);
+    state.remap.end = sexp_heap_end(state.remap.heap);
+    for (i = 0; i < state.src_count; i++) {
+      res = sexp_gc_heap_walk(ctx, state.src[i], types, types_cnt, &state.remap,
+                              heap_callback_stop, NULL, sexp_callback_remap);
+      if (res != SEXP_NULL) goto done;
+    }
+    state.remap.heap->next = h0->next;
+    h0->next = state.remap.heap;
+  }
+
+  /* 4.  Adjust every reference to the moved objects, including */
+  /*     those between the moved objects themselves */
+
+  res = SEXP_TRUE;
+  for (h = h0; h && res == SEXP_TRUE; h = h->next) {
+    if (sexp_compact_find_src(&state, h->data) >= 0) continue;
+    res = sexp_gc_heap_walk(ctx, h, types, types_cnt, &state, heap_callback_stop,
+                            NULL, sexp_callback_compact_adjust);
+    if (res == SEXP_NULL) res = SEXP_TRUE;
+  }
+#if SEXP_USE_GLOBAL_SYMBOLS
+  for (i = 0; i < SEXP_SYMBOL_TABLE_SIZE; i++)
+    sexp_symbol_table[i] = sexp_compact_src_to_dst(&state, sexp_symbol_table[i]);
+#endif
+
+  /* 5.  Release the evacuated chunks.  If some reference couldn't be */
+  /*     adjusted (which would be a bug) keep them, so nothing dangles. */
+
+  if (res == SEXP_TRUE) {
+    for (hp = &h0->next; *hp; ) {
+      if (sexp_compact_find_src(&state, (*hp)->data) >= 0)
+        *hp = (*hp)->next;
+      else
+        hp = &(*hp)->next;
+    }
+    for (i = 0; i < state.src_count; i++)
+      sexp_free_heap(state.src[i]);
+  }
+  state.remap.heap = NULL;
+
+done:
+  if (state.remap.heap) sexp_free_heap(state.remap.heap);
+  free(state.remap.remap);
+  free(state.pinned);
+  free(state.src);
+}
+
+#endif  /* SEXP_USE_COMPACTION */
+
+
 #define SEXP_IMAGE_MAGIC "\a\achibi\n\0"
 #define SEXP_IMAGE_MAJOR_VERSION 1
 #define SEXP_IMAGE_MINOR_VERSION 1
@@ -424,6 +692,461 @@ done:
 
 
 
+#if SEXP_USE_MODULE_CACHE
+
+/* Packing copies the objects reachable from a root into a flat     */
+/* byte string in their heap layout, replacing each pointer with    */
+/* the index of the object it refers to, so unpacking only has to   */
+/* allocate and relocate.  Objects which mustn't be copied, such as */
+/* symbols and global cells, are numbered by the caller's extern_fn */
+/* instead and supplied again, resolved, when unpacking.  Type tags */
+/* of non-core types in bytecode operands are relocated the same.   */
+
+#define sexp_pack_ref(i, externp) \
+  ((sexp)(((((sexp_uint_t)(i) << 1) | (externp)) + 1) << 4))
+#define sexp_pack_ref_index(x) ((((sexp_uint_t)(x) >> 4) - 1) >> 1)
+#define sexp_pack_ref_externp(x) ((((sexp_uint_t)(x) >> 4) - 1) & 1)
+
+#define SEXP_PACK_IMMUTABLE 1
+#define SEXP_PACK_SYNTACTIC 2
+
+struct sexp_pack_entry {
+  sexp obj, ref;
+};
+
+struct sexp_pack_state {
+  sexp ctx, externs, objv;
+  sexp *objs;
+  struct sexp_pack_entry *table;
+  size_t count, objs_size, table_count, table_size;
+  sexp_sint_t (*extern_fn)(sexp ctx, void *data, sexp x);
+  void *data;
+};
+
+static int sexp_pack_copyable_p (sexp x) {
+  switch (sexp_pointer_tag(x)) {
+  case SEXP_PAIR: case SEXP_VECTOR: case SEXP_BYTES: case SEXP_STRING:
+  case SEXP_FLONUM: case SEXP_BIGNUM:
+#if SEXP_USE_RATIOS
+  case SEXP_RATIO:
+#endif
+#if SEXP_USE_COMPLEX
+  case SEXP_COMPLEX:
+#endif
+  case SEXP_UNIFORM_VECTOR:
+  case SEXP_PROCEDURE: case SEXP_MACRO: case SEXP_SYNCLO: case SEXP_BYTECODE:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+static struct sexp_pack_entry* sexp_pack_find (struct sexp_pack_state *state, sexp x) {
+  size_t i = (((sexp_uint_t)x >> 4) * 2654435761u) & (state->table_size - 1);
+  while (state->table[i].obj && state->table[i].obj != x)
+    i = (i + 1) & (state->table_size - 1);
+  return &state->table[i];
+}
+
+static int sexp_pack_insert (struct sexp_pack_state *state, sexp x, sexp ref) {
+  struct sexp_pack_entry *old = state->table;
+  size_t i, old_size = state->table_size;
+  if (2 * (state->table_count + 1) > state->table_size) {
+    state->table_size *= 2;
+    state->table = calloc(state->table_size, sizeof(struct sexp_pack_entry));
+    if (!state->table) {
+      state->table = old;
+      state->table_size = old_size;
+      return 0;
+    }
+    for (i = 0; i < old_size; i++)
+      if (old[i].obj)
+        *sexp_pack_find(state, old[i].obj) = old[i];
+    free(old);
+  }
+  sexp_pack_find(state, x)->obj = x;
+  sexp_pack_find(state, x)->ref = ref;
+  state->table_count++;
+  return 1;
+}
+
+static sexp sexp_pack_src_to_ref (void *adata, sexp x) {
+  struct sexp_pack_state *state = adata;
+  struct sexp_pack_entry *e = sexp_pack_find(state, x);
+  sexp *objs, ref;
+  sexp_sint_t i;
+  if (e->obj) return e->ref;
+  i = state->extern_fn(state->ctx, state->data, x);
+  if (i >= 0) {
+    ref = sexp_pack_ref(i, 1);
+  } else if (i == -1 && sexp_pack_copyable_p(x)) {
+    if (state->count == state->objs_size) {
+      objs = realloc(state->objs, 2 * state->objs_size * sizeof(sexp));
+      if (!objs) goto fail;
+      state->objs = objs;
+      state->objs_size *= 2;
+    }
+    state->objs[state->count] = x;
+    ref = sexp_pack_ref(state->count++, 0);
+  } else {
+    goto fail;
+  }
+  if (sexp_pack_insert(state, x, ref))
+    return ref;
+ fail:
+  snprintf(gc_heap_err_str, ERR_STR_SIZE, "can't pack object with tag %u",
+           (unsigned)sexp_pointer_tag(x));
+  return SEXP_FALSE;
+}
+
+static int sexp_pack_type_to_ref (void *adata, sexp_uint_t *tag) {
+  struct sexp_pack_state *state = adata;
+  sexp ref;
+  if (*tag < SEXP_NUM_CORE_TYPES) return 1;
+  ref = sexp_pack_src_to_ref(state, sexp_type_by_index(state->ctx, *tag));
+  if (!sexp_pointerp(ref) || !sexp_pack_ref_externp(ref)) return 0;
+  *tag = SEXP_NUM_CORE_TYPES + sexp_pack_ref_index(ref);
+  return 1;
+}
+
+static int sexp_pack_append (unsigned char **buf, size_t *len, size_t *size,
+                             const void *data, size_t n) {
+  size_t pad = sexp_word_align(n) - n;
+  unsigned char *tmp;
+  if (*len + n + pad > *size) {
+    tmp = realloc(*buf, 2 * (*len + n + pad));
+    if (!tmp) return 0;
+    *buf = tmp;
+    *size = 2 * (*len + n + pad);
+  }
+  memcpy(*buf + *len, data, n);
+  memset(*buf + *len + n, 0, pad);
+  *len += n + pad;
+  return 1;
+}
+
+sexp sexp_pack_objects (sexp ctx, sexp root,
+                        sexp_sint_t (*extern_fn)(sexp ctx, void *data, sexp x),
+                        void *data) {
+  struct sexp_pack_state state;
+  sexp *types = sexp_context_types(ctx), x, res = SEXP_FALSE;
+  sexp_uint_t word[2];
+  unsigned char *buf = NULL, *scratch = NULL;
+  size_t i, len = 0, size = 0, scratch_size = 0, n;
+  memset(&state, 0, sizeof(state));
+  state.ctx = ctx;
+  state.extern_fn = extern_fn;
+  state.data = data;
+  state.objs_size = 64;
+  state.objs = malloc(state.objs_size * sizeof(sexp));
+  state.table_size = 128;
+  state.table = calloc(state.table_size, sizeof(struct sexp_pack_entry));
+  if (!state.objs || !state.table) goto done;
+  /* the header is the object count and the root */
+  word[0] = 0;
+  word[1] = (sexp_uint_t)root;
+  if (root && sexp_pointerp(root)) {
+    if (!sexp_pointerp(x = sexp_pack_src_to_ref(&state, root))) goto done;
+    word[1] = (sexp_uint_t)x;
+  }
+  if (!sexp_pack_append(&buf, &len, &size, word, sizeof(word)))
+    goto done;
+  /* each object follows as its size, tag and flags, then the body */
+  for (i = 0; i < state.count; i++) {
+    x = state.objs[i];
+    n = sexp_type_size_of_object(types[sexp_pointer_tag(x)], x);
+    if (n > scratch_size) {
+      free(scratch);
+      if (!(scratch = malloc(scratch_size = 2 * n))) goto done;
+    }
+    memcpy(scratch, x, n);
+    if (sexp_bytecodep(x))
+      sexp_bytecode_lambda((sexp)scratch) = SEXP_FALSE;
+    if (sexp_adjust_fields((sexp)scratch, types, sexp_pack_src_to_ref, &state) != SEXP_TRUE
+        || (sexp_bytecodep(x)
+            && sexp_adjust_bytecode((sexp)scratch, sexp_pack_src_to_ref,
+                                    sexp_pack_type_to_ref, &state) != SEXP_TRUE))
+      goto done;
+    word[0] = n;
+    word[1] = sexp_pointer_tag(x)
+      | ((sexp_immutablep(x) ? SEXP_PACK_IMMUTABLE : 0)
+         | (x->syntacticp ? SEXP_PACK_SYNTACTIC : 0)) << 16;
+    if (!(sexp_pack_append(&buf, &len, &size, word, sizeof(word))
+          && sexp_pack_append(&buf, &len, &size, scratch + sexp_sizeof_header,
+                              n - sexp_sizeof_header)))
+      goto done;
+  }
+  ((sexp_uint_t*)buf)[0] = state.count;
+  res = sexp_make_bytes(ctx, sexp_make_fixnum(len), SEXP_ZERO);
+  if (sexp_bytesp(res))
+    memcpy(sexp_bytes_data(res), buf, len);
+ done:
+  free(state.objs);
+  free(state.table);
+  free(scratch);
+  free(buf);
+  return res;
+}
+
+static sexp sexp_unpack_ref_check (void *adata, sexp ref) {
+  struct sexp_pack_state *state = adata;
+  if (sexp_pack_ref_index(ref) >= (sexp_pack_ref_externp(ref)
+                                   ? sexp_vector_length(state->externs)
+                                   : state->count)) {
+    snprintf(gc_heap_err_str, ERR_STR_SIZE, "packed reference out of range");
+    return SEXP_FALSE;
+  }
+  return state->objv;  /* a placeholder until everything is allocated */
+}
+
+static sexp sexp_unpack_ref_to_dst (void *adata, sexp ref) {
+  struct sexp_pack_state *state = adata;
+  return sexp_vector_ref(sexp_pack_ref_externp(ref) ? state->externs : state->objv,
+                         sexp_make_fixnum(sexp_pack_ref_index(ref)));
+}
+
+static int sexp_unpack_ref_to_type (void *adata, sexp_uint_t *tag) {
+  struct sexp_pack_state *state = adata;
+  sexp type;
+  if (*tag < SEXP_NUM_CORE_TYPES) return 1;
+  if (*tag - SEXP_NUM_CORE_TYPES >= sexp_vector_length(state->externs)) return 0;
+  type = sexp_vector_ref(state->externs, sexp_make_fixnum(*tag - SEXP_NUM_CORE_TYPES));
+  if (!sexp_typep(type)) return 0;
+  *tag = sexp_type_tag(type);
+  return 1;
+}
+
+/* The VM trusts bytecode, so check each instruction and its operands */
+/* fit within it, walking it as sexp_adjust_bytecode will, and that */
+/* every jump lands inside it and every stack offset inside the */
+/* largest stack.  Once relocated, the object operands must also be */
+/* of the type each instruction assumes. */
+static int sexp_unpack_bytecode_check (sexp bc, int relocatedp) {
+  unsigned char *data = sexp_bytecode_data(bc), op;
+  sexp_sint_t len = sexp_bytecode_length(bc), i, n, target;
+  sexp *vec;
+  if (sexp_bytecode_max_depth(bc) > SEXP_MAX_STACK_SIZE) {
+    i = 0;
+    goto fail;
+  }
+  for (i = 0; i < len; i += n) {
+    op = data[i++];
+    switch (op) {
+    case SEXP_OP_FCALL0:      case SEXP_OP_FCALL1:
+    case SEXP_OP_FCALL2:      case SEXP_OP_FCALL3:
+    case SEXP_OP_FCALL4:      case SEXP_OP_CALL:
+    case SEXP_OP_TAIL_CALL:   case SEXP_OP_PUSH:
+    case SEXP_OP_GLOBAL_REF:  case SEXP_OP_GLOBAL_KNOWN_REF:
+#if SEXP_USE_GREEN_THREADS
+    case SEXP_OP_PARAMETER_REF:
+#endif
+#if SEXP_USE_EXTENDED_FCALL
+    case SEXP_OP_FCALLN:
+#endif
+    case SEXP_OP_JUMP:        case SEXP_OP_JUMP_UNLESS:
+    case SEXP_OP_STACK_REF:   case SEXP_OP_CLOSURE_REF:
+    case SEXP_OP_LOCAL_REF:   case SEXP_OP_LOCAL_SET:
+#if SEXP_USE_RESERVE_OPCODE
+    case SEXP_OP_RESERVE:
+#endif
+    case SEXP_OP_TYPEP:
+      n = sizeof(sexp); break;
+    case SEXP_OP_LOCAL_REF_CAR: case SEXP_OP_LOCAL_REF_CDR:
+    case SEXP_OP_CLOSURE_REF_CDR: case SEXP_OP_LOCAL_REF_UNSAFE_CAR:
+    case SEXP_OP_LOCAL_REF_UNSAFE_CDR: case SEXP_OP_CLOSURE_REF_UNSAFE_CDR:
+      n = sizeof(sexp) + 1; break;
+    case SEXP_OP_MAKE: case SEXP_OP_SLOT_REF: case SEXP_OP_SLOT_SET:
+    case SEXP_OP_CACHED_CALL: case SEXP_OP_CACHED_TAIL_CALL:
+      n = 2*sizeof(sexp); break;
+    case SEXP_OP_MAKE_PROCEDURE:
+      n = 3*sizeof(sexp); break;
+    case SEXP_OP_LT_JUMP_UNLESS: case SEXP_OP_LE_JUMP_UNLESS:
+    case SEXP_OP_EQN_JUMP_UNLESS: case SEXP_OP_NULLP_JUMP_UNLESS:
+    case SEXP_OP_FX_LT_JUMP_UNLESS: case SEXP_OP_FX_LE_JUMP_UNLESS:
+    case SEXP_OP_FX_EQN_JUMP_UNLESS:
+      /* fused tests take their target from the jump left after them */
+      if (i >= len || data[i] != SEXP_OP_JUMP_UNLESS) goto fail;
+      n = 0; break;
+    default:
+      if (op >= SEXP_OP_NUM_OPCODES) goto fail;
+      n = 0; break;
+    }
+    if (n > len - i) goto fail;
+    switch (op) {
+    case SEXP_OP_JUMP: case SEXP_OP_JUMP_UNLESS:
+      target = i + ((sexp_sint_t*)(data+i))[0];
+      if (target < 0 || target > len) goto fail;
+      break;
+    case SEXP_OP_STACK_REF:     case SEXP_OP_LOCAL_REF:
+    case SEXP_OP_LOCAL_SET:     case SEXP_OP_LOCAL_REF_CAR:
+    case SEXP_OP_LOCAL_REF_CDR: case SEXP_OP_LOCAL_REF_UNSAFE_CAR:
+    case SEXP_OP_LOCAL_REF_UNSAFE_CDR:
+      target = ((sexp_sint_t*)(data+i))[0];
+      if (target < -SEXP_MAX_STACK_SIZE || target > SEXP_MAX_STACK_SIZE) goto fail;
+      break;
+    case SEXP_OP_CLOSURE_REF:   case SEXP_OP_CLOSURE_REF_CDR:
+    case SEXP_OP_CLOSURE_REF_UNSAFE_CDR:
+#if SEXP_USE_RESERVE_OPCODE
+    case SEXP_OP_RESERVE:
+#endif
+      target = ((sexp_sint_t*)(data+i))[0];
+      if (target < 0 || target > SEXP_MAX_STACK_SIZE) goto fail;
+      break;
+    }
+    if (!relocatedp) continue;
+    vec = (sexp*)(data+i);
+    switch (op) {
+    case SEXP_OP_GLOBAL_REF: case SEXP_OP_GLOBAL_KNOWN_REF:
+      if (!sexp_pairp(vec[0])) goto fail;
+      break;
+    case SEXP_OP_FCALL0: case SEXP_OP_FCALL1: case SEXP_OP_FCALL2:
+    case SEXP_OP_FCALL3: case SEXP_OP_FCALL4:
+#if SEXP_USE_GREEN_THREADS
+    case SEXP_OP_PARAMETER_REF:
+#endif
+#if SEXP_USE_EXTENDED_FCALL
+    case SEXP_OP_FCALLN:
+#endif
+      if (!sexp_opcodep(vec[0])) goto fail;
+      break;
+    case SEXP_OP_CALL: case SEXP_OP_TAIL_CALL:
+      if (!sexp_fixnump(vec[0])) goto fail;
+      break;
+    case SEXP_OP_CACHED_CALL: case SEXP_OP_CACHED_TAIL_CALL:
+      if (!(sexp_fixnump(vec[0]) && sexp_pairp(vec[1]))) goto fail;
+      break;
+    case SEXP_OP_MAKE_PROCEDURE:
+      if (!(sexp_fixnump(vec[0]) && sexp_fixnump(vec[1]) && sexp_bytecodep(vec[2])))
+        goto fail;
+      break;
+    }
+  }
+  return 1;
+ fail:
+  snprintf(gc_heap_err_str, ERR_STR_SIZE, "invalid packed bytecode at %ld", (long)i);
+  return 0;
+}
+
+/* Objects whose fields index into others, checked once relocated. */
+static int sexp_unpack_object_check (sexp x) {
+  switch (sexp_pointer_tag(x)) {
+#if ! SEXP_USE_PACKED_STRINGS
+  case SEXP_STRING:
+    return sexp_bytesp(sexp_string_bytes(x))
+      && sexp_string_offset(x) <= sexp_bytes_length(sexp_string_bytes(x))
+      && sexp_string_size(x)
+         <= sexp_bytes_length(sexp_string_bytes(x)) - sexp_string_offset(x);
+#endif
+  case SEXP_UNIFORM_VECTOR:
+    return sexp_bytesp(sexp_uvector_bytes(x))
+      && sexp_uvector_type(x) >= SEXP_U1
+      && sexp_uvector_type(x) < SEXP_END_OF_UNIFORM_TYPES
+      && sexp_uvector_length(x) >= 0
+      && (sexp_uint_t)sexp_uvector_length(x)
+         <= sexp_bytes_length(sexp_uvector_bytes(x)) * 8
+            / sexp_uvector_element_size(sexp_uvector_type(x));
+  case SEXP_BYTECODE:
+    return sexp_unpack_bytecode_check(x, 1);
+  case SEXP_PROCEDURE:
+    return sexp_bytecodep(sexp_procedure_code(x))
+      && (sexp_vectorp(sexp_procedure_vars(x)) || !sexp_pointerp(sexp_procedure_vars(x)));
+  default:
+    return 1;
+  }
+}
+
+sexp sexp_unpack_objects (sexp ctx, sexp bytes, sexp externs) {
+  struct sexp_pack_state state;
+  sexp *types = sexp_context_types(ctx), x;
+  sexp_uint_t *word, tag, root;
+  unsigned char *p, *end, *scratch = NULL;
+  size_t i, n, scratch_size = 0;
+  sexp_gc_var2(objv, res);
+  if (!sexp_bytesp(bytes) || !sexp_vectorp(externs)
+      || sexp_bytes_length(bytes) < 2 * sizeof(sexp_uint_t))
+    return SEXP_FALSE;
+  sexp_gc_preserve2(ctx, objv, res);
+  memset(&state, 0, sizeof(state));
+  p = (unsigned char*)sexp_bytes_data(bytes);
+  end = p + sexp_bytes_length(bytes);
+  word = (sexp_uint_t*)p;
+  state.count = word[0];
+  root = word[1];
+  res = SEXP_FALSE;
+  if (state.count > (size_t)(end - p) / (2 * sizeof(sexp_uint_t))) goto done;
+  objv = sexp_make_vector(ctx, sexp_make_fixnum(state.count), SEXP_FALSE);
+  if (sexp_exceptionp(objv)) goto done;
+  state.ctx = ctx;
+  state.objv = objv;
+  state.externs = externs;
+  /* allocate everything, leaving the pointers as placeholders */
+  p += 2 * sizeof(sexp_uint_t);
+  for (i = 0; i < state.count; i++) {
+    if (p + 2 * sizeof(sexp_uint_t) > end) goto done;
+    word = (sexp_uint_t*)p;
+    n = word[0];
+    tag = word[1] & 0xFFFF;
+    p += 2 * sizeof(sexp_uint_t);
+    if (n < sexp_sizeof_header || p + sexp_word_align(n - sexp_sizeof_header) > end
+        || tag >= sexp_context_num_types(ctx))
+      goto done;
+    if (n > scratch_size) {
+      free(scratch);
+      if (!(scratch = malloc(scratch_size = 2 * n))) goto done;
+    }
+    memset(scratch, 0, sexp_sizeof_header);
+    memcpy(scratch + sexp_sizeof_header, p, n - sexp_sizeof_header);
+    sexp_pointer_tag((sexp)scratch) = tag;
+    if (!sexp_pack_copyable_p((sexp)scratch)
+        || sexp_type_size_of_object(types[tag], (sexp)scratch) != n
+        || sexp_adjust_fields((sexp)scratch, types, sexp_unpack_ref_check, &state) != SEXP_TRUE
+        || (tag == SEXP_BYTECODE
+            && !(sexp_unpack_bytecode_check((sexp)scratch, 0)
+                 && sexp_adjust_bytecode((sexp)scratch, sexp_unpack_ref_check,
+                                         sexp_unpack_ref_to_type, &state) == SEXP_TRUE)))
+      goto done;
+    x = sexp_alloc_tagged(ctx, n, tag);
+    if (sexp_exceptionp(x)) goto done;
+    memcpy((unsigned char*)x + sexp_sizeof_header, scratch + sexp_sizeof_header,
+           n - sexp_sizeof_header);
+    sexp_immutablep(x) = (word[1] >> 16) & SEXP_PACK_IMMUTABLE ? 1 : 0;
+    x->syntacticp = (word[1] >> 16) & SEXP_PACK_SYNTACTIC ? 1 : 0;
+    sexp_vector_set(objv, sexp_make_fixnum(i), x);
+    p += sexp_word_align(n - sexp_sizeof_header);
+  }
+  if (root && sexp_pointerp((sexp)root)
+      && !sexp_pointerp(sexp_unpack_ref_check(&state, (sexp)root)))
+    goto done;
+  /* then relocate, which can't allocate */
+  p = (unsigned char*)sexp_bytes_data(bytes) + 2 * sizeof(sexp_uint_t);
+  for (i = 0; i < state.count; i++) {
+    n = ((sexp_uint_t*)p)[0];
+    p += 2 * sizeof(sexp_uint_t);
+    x = sexp_vector_ref(objv, sexp_make_fixnum(i));
+    memcpy((unsigned char*)x + sexp_sizeof_header, p, n - sexp_sizeof_header);
+    sexp_adjust_fields(x, types, sexp_unpack_ref_to_dst, &state);
+    if (sexp_bytecodep(x)
+        && sexp_adjust_bytecode(x, sexp_unpack_ref_to_dst, sexp_unpack_ref_to_type,
+                                &state) != SEXP_TRUE)
+      goto done;
+    p += sexp_word_align(n - sexp_sizeof_header);
+  }
+  for (i = 0; i < state.count; i++)
+    if (!sexp_unpack_object_check(sexp_vector_ref(objv, sexp_make_fixnum(i)))) {
+      snprintf(gc_heap_err_str, ERR_STR_SIZE, "invalid packed object %ld", (long)i);
+      goto done;
+    }
+  res = (root && sexp_pointerp((sexp)root))
+    ? sexp_unpack_ref_to_dst(&state, (sexp)root) : (sexp)root;
+ done:
+  free(scratch);
+  sexp_gc_release2(ctx);
+  return res;
+}
+
+#endif  /* SEXP_USE_MODULE_CACHE */
+
+
 #if SEXP_USE_DL
 
 #ifdef __APPLE__
@@ -463,7 +1186,7 @@ static sexp load_image_callback_p1 (sexp ctx, sexp p, void *user) {
     sexp_context_heap(p) = state->heap;
   
   } else if (sexp_bytecodep(p)) {
-    if ((res = sexp_adjust_bytecode(p, load_image_src_to_dst, state)) != SEXP_TRUE) {
+    if ((res = sexp_adjust_bytecode(p, load_image_src_to_dst, NULL, state)) != SEXP_TRUE) {
       goto done; }
     
   } else if (sexp_portp(p) && sexp_port_stream(p)) {
@@ -46,7 +46,7 @@ enum sexp_opcode_classes {
   SEXP_OPC_NUM_OP_CLASSES
 };
 
-#if SEXP_USE_DEBUG_VM || SEXP_USE_PROFILE_VM || SEXP_USE_STATIC_LIBS
+#if SEXP_USE_DEBUG_VM || SEXP_USE_PROFILE_VM || SEXP_USE_STATIC_LIBS || SEXP_USE_MODULE_CACHE
 SEXP_API const char** sexp_opcode_names;
 #endif
 
@@ -99,6 +99,14 @@ SEXP_API sexp sexp_current_module_path_op (sexp ctx, sexp self, sexp_sint_t n, s
 SEXP_API sexp sexp_find_module_file_op (sexp ctx, sexp self, sexp_sint_t n, sexp file);
 SEXP_API sexp sexp_load_module_file_op (sexp ctx, sexp self, sexp_sint_t n, sexp file, sexp env);
 SEXP_API sexp sexp_add_module_directory_op (sexp ctx, sexp self, sexp_sint_t n, sexp dir, sexp appendp);
+#if SEXP_USE_MODULE_CACHE
+SEXP_API sexp sexp_module_cache_begin_op (sexp ctx, sexp self, sexp_sint_t n, sexp env, sexp modules);
+SEXP_API sexp sexp_module_cache_end_op (sexp ctx, sexp self, sexp_sint_t n, sexp prev);
+SEXP_API sexp sexp_open_module_cache_op (sexp ctx, sexp self, sexp_sint_t n, sexp key);
+SEXP_API sexp sexp_save_module_cache_op (sexp ctx, sexp self, sexp_sint_t n, sexp key, sexp chunks);
+SEXP_API sexp sexp_module_cache_compile_op (sexp ctx, sexp self, sexp_sint_t n, sexp obj);
+SEXP_API sexp sexp_module_cache_entry_op (sexp ctx, sexp self, sexp_sint_t n, sexp entry, sexp env, sexp modules);
+#endif
 SEXP_API sexp sexp_current_environment (sexp ctx, sexp self, sexp_sint_t n);
 SEXP_API sexp sexp_set_current_environment (sexp ctx, sexp self, sexp_sint_t n, sexp env);
 SEXP_API sexp sexp_meta_environment (sexp ctx, sexp self, sexp_sint_t n);
@@ -249,6 +257,12 @@ SEXP_API int sexp_rest_unused_p (sexp lambda);
 #define sexp_rest_unused_p(lambda) 0
 #endif
 
+#if SEXP_USE_INLINE
+SEXP_API int sexp_inlinable_lambda_p (sexp lambda);
+#else
+#define sexp_inlinable_lambda_p(lambda) 0
+#endif
+
 /* simplify primitive API interface */
 #define sexp_make_synclo(ctx, a, b, c) sexp_make_synclo_op(ctx, NULL, 3, a, b, c)
 #define sexp_make_procedure(ctx, f, n, b, v) sexp_make_procedure_op(ctx, NULL, 4, f, n, b, v)
@@ -10,6 +10,13 @@
 /* uncomment this to disable interpreter-based threads */
 /* #define SEXP_USE_GREEN_THREADS 0 */
 
+/* uncomment this to wait on blocked fds with poll(2) on Linux */
+/*   By default on Linux the green thread scheduler keeps the fds */
+/*   threads are blocked on in an epoll set, so each check costs */
+/*   time proportional to the fds actually ready rather than all */
+/*   blocked fds.  Elsewhere poll(2) is always used. */
+/* #define SEXP_USE_EPOLL 0 */
+
 /* uncomment this to enable the experimental native x86 backend */
 /* #define SEXP_USE_NATIVE_X86 1 */
 
@@ -18,6 +25,14 @@
 /*   sets up an (import (module name)) macro. */
 /* #define SEXP_USE_MODULES 0 */
 
+/* uncomment this to disable the on-disk cache of compiled modules */
+/*   When a library is loaded from source, the compiled top-level */
+/*   forms and macros of each of its include and body declarations */
+/*   are packed and saved under $CHIBI_MODULE_CACHE, if set, and */
+/*   replayed instead of expanding and compiling the source again */
+/*   while the files, features and build match. */
+/* #define SEXP_USE_MODULE_CACHE 0 */
+
 /* uncomment this to disable dynamic loading */
 /*   If enabled, you can LOAD .so files with a */
 /*   sexp_init_library(ctx, env) function provided. */
@@ -60,6 +75,14 @@
 /*   expansions, so it's a good idea to leave it enabled. */
 /* #define SEXP_USE_SIMPLIFY 0 */
 
+/* uncomment this to disable inlining of small procedures */
+/*   As part of simplification, calls to small procedures with no */
+/*   free local variables, bound either by an internal define or an */
+/*   import which is never set!, are replaced by a copy of the */
+/*   procedure body.  Bodies larger than SEXP_INLINE_MAX_SIZE nodes */
+/*   are never inlined. */
+/* #define SEXP_USE_INLINE 0 */
+
 /* uncomment this to disable dynamic type definitions */
 /*   This enables register-simple-type and related */
 /*   opcodes for defining types, needed by the default */
@@ -90,6 +113,86 @@
 /* uncomment this to enable heap regions for fixed-size chunks */
 /* #define SEXP_USE_FIXED_CHUNK_SIZE_HEAPS 1 */
 
+/* uncomment this to disable size-segregated free lists */
+/*   By default each heap chunk indexes its free blocks by size */
+/*   class, so allocating a common small size is O(1) instead of a */
+/*   first-fit scan over the whole free list. */
+/* #define SEXP_USE_SEGREGATED_FREE_LISTS 0 */
+
+/* uncomment this to disable lazy sweeping */
+/*   By default a collection only marks, leaving each heap chunk to */
+/*   be finalized and swept when the allocator next needs space from */
+/*   it, so the pause is proportional to the live data rather than */
+/*   the heap size.  Explicit calls to sexp_gc still sweep the whole */
+/*   heap before returning. */
+/* #define SEXP_USE_LAZY_SWEEP 0 */
+
+/* uncomment this to disable per-context allocation buffers */
+/*   A context which has allocated more than SEXP_ALLOC_BUFFER_SIZE */
+/*   bytes takes a buffer of that size from the heap at a time, and */
+/*   small objects are then allocated by bumping a pointer through */
+/*   it instead of going to the shared free lists.  The unused tail */
+/*   of a buffer is reclaimed by the next collection. */
+/* #define SEXP_USE_ALLOC_BUFFERS 0 */
+
+/* uncomment this to never give memory back to the OS */
+/*   By default a heap chunk (other than the first) which has been */
+/*   completely empty for SEXP_SHRINK_HEAP_DELAY collections in a */
+/*   row is freed, as long as that leaves the heap above */
+/*   SEXP_SHRINK_HEAP_LOW_WATER and less than SEXP_SHRINK_HEAP_RATIO */
+/*   full.  With SEXP_USE_MMAP_GC the pages of empty chunks kept */
+/*   because of those limits are released with madvise. */
+/* #define SEXP_USE_SHRINK_HEAP 0 */
+
+/* uncomment this to enable a generational native GC */
+/*   Small objects are allocated by bumping a pointer through a */
+/*   nursery heap chunk, which is collected on its own (a minor */
+/*   collection) when it fills up.  Survivors stay in place and the */
+/*   chunk is promoted to the old generation once it is mostly */
+/*   live.  The whole heap is only marked and swept when the old */
+/*   generation grows past its limit.  Stores the VM makes into old */
+/*   objects record them in a remembered set, which is all a minor */
+/*   collection scans of the old generation.  C code stores into the */
+/*   heap directly, so after any C function which isn't flagged */
+/*   referentially transparent has run, the next minor collection */
+/*   falls back to a linear scan of the old chunks, and C extensions */
+/*   need no write barrier. */
+/* #define SEXP_USE_GENERATIONAL_GC 1 */
+
+/* uncomment this to enable incremental marking */
+/*   Once most of the space freed by the last collection has been */
+/*   used, the VM marks a bounded slice of the heap each time a */
+/*   thread runs out of fuel, for at most SEXP_DEFAULT_GC_PAUSE */
+/*   microseconds (see the -g option).  Values the VM stores during */
+/*   the cycle are shaded by a write barrier, so when the trace is */
+/*   done only the running contexts and stacks are re-scanned.  C */
+/*   code stores into the heap without the barrier, so if any C */
+/*   function which isn't flagged referentially transparent ran */
+/*   during the cycle, every marked object is re-scanned instead in */
+/*   a single linear pass.  Requires green threads and lazy */
+/*   sweeping, and can't be combined with the generational GC. */
+/* #define SEXP_USE_INCREMENTAL_GC 1 */
+
+/* uncomment this to mark the heap with multiple OS threads */
+/*   Full collections of heaps larger than SEXP_PARALLEL_MARK_MIN_HEAP */
+/*   are marked by SEXP_DEFAULT_MARK_THREADS threads (or the value of */
+/*   the CHIBI_GC_MARK_THREADS environment variable), which steal */
+/*   work from each other.  Requires pthreads, so when building with */
+/*   make or cmake set SEXP_USE_PARALLEL_MARK=1 to link against them. */
+/* #define SEXP_USE_PARALLEL_MARK 1 */
+
+/* uncomment this to compact fragmented heaps */
+/*   When a collection leaves the free space scattered over many */
+/*   small blocks, the live objects of sparsely used heap chunks are */
+/*   evacuated into a single new chunk and the old chunks are given */
+/*   back to the OS.  Chunks holding anything which can't be moved */
+/*   are left alone: objects referenced from the C stack (scanned */
+/*   conservatively), preserved with sexp_preserve_object, hashed by */
+/*   address, or types, contexts and port buffers.  Requires image */
+/*   loading and pthreads, and can't be combined with the */
+/*   generational GC. */
+/* #define SEXP_USE_COMPACTION 1 */
+
 /* uncomment this to just malloc manually instead of any GC */
 /*   Mostly for debugging purposes, this is the no GC option. */
 /*   You can use just the read/write API and */
@@ -173,6 +276,13 @@
 /*   This is experimental, enable at your own risk. */
 /* #define SEXP_USE_IMMEDIATE_FLONUMS 1 */
 
+/* uncomment this to make most flonums immediate on 64-bit */
+/*   Doubles with magnitudes in the range of single floats are */
+/*   stored in a tagged word without loss of precision, and only */
+/*   other values (infinities, NaNs, very large and small numbers) */
+/*   are boxed on the heap.  Heap pointers must be 8-byte aligned. */
+/* #define SEXP_USE_TAGGED_FLONUMS 1 */
+
 /* uncomment this if you don't want bignum support */
 /*   Bignums are implemented with a small, custom library  */
 /*   in opt/bignum.c. */
@@ -228,6 +338,14 @@
 /*   non-immediate symbols in a single list. */
 /* #define SEXP_USE_HASH_SYMS 0 */
 
+/* uncomment this to always search environments as plain lists */
+/*   By default, once a lookup has to walk more than */
+/*   SEXP_ENV_INDEX_THRESHOLD bindings of an environment frame, */
+/*   the frame gets a hash index from names to bindings, so */
+/*   resolving identifiers against large modules is constant */
+/*   time.  The bindings themselves are still kept as lists. */
+/* #define SEXP_USE_INDEXED_ENVS 0 */
+
 /* uncomment this to disable extended char names as defined in R7RS */
 /* #define SEXP_USE_EXTENDED_CHAR_NAMES 0 */
 
@@ -295,10 +413,50 @@
 /*   will just raise an error immediately. */
 /* #define SEXP_USE_GROW_STACK 0 */
 
+/* uncomment this to copy the whole stack on every call/cc */
+/*   By default a continuation only saves the part of the stack */
+/*   above the last captured frame and shares the rest with */
+/*   the previous continuation, so capturing in a loop (as with */
+/*   generators) costs time proportional to the frames pushed */
+/*   since the last capture rather than the total stack depth. */
+/* #define SEXP_USE_SEGMENTED_CONTINUATIONS 0 */
+
+/* uncomment this to disable inline caches for global calls */
+/*   By default a call whose operator is a global variable keeps */
+/*   the last procedure it called in the bytecode, and skips the */
+/*   procedure and arity checks while the variable still holds */
+/*   that procedure.  Redefining the variable just misses once. */
+/* #define SEXP_USE_INLINE_CACHES 0 */
+
 /* #define SEXP_USE_DEBUG_VM 0 */
 /*   Experts only. */
 /*   For *very* verbose output on every VM operation. */
 
+/* uncomment this to disable superinstructions */
+/*   By default the compiler fuses a few common pairs of opcodes, */
+/*   e.g. a local variable reference followed by car, into single */
+/*   instructions.  Use tools/rank-opcode-pairs.scm on the output */
+/*   of a SEXP_USE_PROFILE_VM build to find candidates. */
+/* #define SEXP_USE_SUPERINSTRUCTIONS 0 */
+
+/* uncomment this to always dispatch VM opcodes with a switch */
+/*   By default, when compiled with gcc or clang, each opcode */
+/*   jumps directly to the handler for the next one using the */
+/*   labels-as-values extension. */
+/* #define SEXP_USE_COMPUTED_GOTO 0 */
+
+/* uncomment this to compile hot procedures to x86-64 machine code */
+/*   Once a procedure's bytecode has been called SEXP_JIT_THRESHOLD */
+/*   times it's translated instruction by instruction into native */
+/*   code which keeps the VM's stack and frame layout, so anything */
+/*   the templates don't handle (allocation, call/cc, exceptions, */
+/*   running out of fuel) just exits back to the interpreter at */
+/*   that instruction.  Native code is kept in a single mmap'ed */
+/*   region of SEXP_JIT_CODE_SIZE bytes shared by all contexts and */
+/*   is never freed.  Only available for x86-64 Linux with gcc or */
+/*   clang, and not in combination with heap compaction. */
+/* #define SEXP_USE_JIT 1 */
+
 /* uncomment this to make the VM adhere to alignment rules */
 /*   This is required on some platforms, e.g. ARM */
 /* #define SEXP_USE_ALIGNED_BYTECODE 1 */
@@ -332,6 +490,113 @@
 #define SEXP_GROW_HEAP_FACTOR 2  /* 1.6180339887498948482 */
 #endif
 
+/* size of each context allocation buffer, objects larger than */
+/* SEXP_ALLOC_BUFFER_MAX_OBJECT are allocated from the heap directly */
+#ifndef SEXP_ALLOC_BUFFER_SIZE
+#define SEXP_ALLOC_BUFFER_SIZE 8192
+#endif
+
+#ifndef SEXP_ALLOC_BUFFER_MAX_OBJECT
+#define SEXP_ALLOC_BUFFER_MAX_OBJECT (SEXP_ALLOC_BUFFER_SIZE/16)
+#endif
+
+/* only free an empty heap chunk if the heap would then be less than */
+/* this fraction full - kept well below SEXP_GROW_HEAP_RATIO so we */
+/* don't immediately grow again */
+#ifndef SEXP_SHRINK_HEAP_RATIO
+#define SEXP_SHRINK_HEAP_RATIO 0.5
+#endif
+
+/* never shrink the heap below this many bytes */
+#ifndef SEXP_SHRINK_HEAP_LOW_WATER
+#define SEXP_SHRINK_HEAP_LOW_WATER (4*SEXP_INITIAL_HEAP_SIZE)
+#endif
+
+/* number of consecutive collections a chunk must be empty before */
+/* it's freed */
+#ifndef SEXP_SHRINK_HEAP_DELAY
+#define SEXP_SHRINK_HEAP_DELAY 2
+#endif
+
+/* the number of size classes for segregated free lists: the first */
+/* SEXP_FREE_LIST_EXACT_CLASSES hold blocks of exactly 1, 2, ... heap */
+/* alignment units, the rest hold power-of-two ranges above that; */
+/* there can be at most 32 classes */
+#ifndef SEXP_FREE_LIST_CLASSES
+#define SEXP_FREE_LIST_CLASSES 32
+#endif
+
+#ifndef SEXP_FREE_LIST_EXACT_CLASSES
+#define SEXP_FREE_LIST_EXACT_CLASSES 16
+#endif
+
+/* the size in bytes of a fresh nursery for the generational GC */
+#ifndef SEXP_NURSERY_SIZE
+#define SEXP_NURSERY_SIZE (4*1024*1024)
+#endif
+
+/* objects larger than this are allocated directly in the old generation */
+#ifndef SEXP_NURSERY_MAX_OBJECT_SIZE
+#define SEXP_NURSERY_MAX_OBJECT_SIZE 1024
+#endif
+
+/* a new nursery is at least 1/N the size of the whole heap */
+#ifndef SEXP_NURSERY_GROWTH_RATIO
+#define SEXP_NURSERY_GROWTH_RATIO 4
+#endif
+
+/* promote the nursery once less than this fraction of it is free */
+/* after a minor collection */
+#ifndef SEXP_NURSERY_PROMOTE_RATIO
+#define SEXP_NURSERY_PROMOTE_RATIO 0.5
+#endif
+
+/* maximum time in microseconds spent in a single incremental marking */
+/* slice, adjustable at runtime with -g */
+#ifndef SEXP_DEFAULT_GC_PAUSE
+#define SEXP_DEFAULT_GC_PAUSE 1000
+#endif
+
+/* start incremental marking once this fraction of the space freed */
+/* by the last collection has been allocated */
+#ifndef SEXP_INCREMENTAL_GC_START_RATIO
+#define SEXP_INCREMENTAL_GC_START_RATIO 0.5
+#endif
+
+/* number of threads used by the parallel marker, including the */
+/* collecting thread */
+#ifndef SEXP_DEFAULT_MARK_THREADS
+#define SEXP_DEFAULT_MARK_THREADS 4
+#endif
+
+/* only mark in parallel when the heap is at least this large */
+#ifndef SEXP_PARALLEL_MARK_MIN_HEAP
+#define SEXP_PARALLEL_MARK_MIN_HEAP (16*1024*1024)
+#endif
+
+/* a parallel mark worker offers half its stack for stealing once */
+/* it holds at least twice this many objects */
+#ifndef SEXP_PARALLEL_MARK_SHARE
+#define SEXP_PARALLEL_MARK_SHARE 32
+#endif
+
+/* compact after a collection once the largest free block is less */
+/* than this fraction of the total space freed */
+#ifndef SEXP_COMPACT_FRAGMENTATION_RATIO
+#define SEXP_COMPACT_FRAGMENTATION_RATIO 0.25
+#endif
+
+/* only evacuate heap chunks with less than this fraction in use */
+#ifndef SEXP_COMPACT_OCCUPANCY_RATIO
+#define SEXP_COMPACT_OCCUPANCY_RATIO 0.25
+#endif
+
+/* number of slots scanned at a time by the incremental marker, which */
+/* also checks the clock after scanning this many ranges */
+#ifndef SEXP_INCREMENTAL_GC_CHUNK
+#define SEXP_INCREMENTAL_GC_CHUNK 64
+#endif
+
 /* size of per-context stack that is used during gc cycles
  * increase if you can affort extra unused memory */
 #define SEXP_MARK_STACK_COUNT 1024
@@ -442,6 +707,14 @@
 #endif
 #endif
 
+#ifndef SEXP_USE_EPOLL
+#if defined(__linux__)
+#define SEXP_USE_EPOLL SEXP_USE_GREEN_THREADS
+#else
+#define SEXP_USE_EPOLL 0
+#endif
+#endif
+
 #ifndef SEXP_USE_DEBUG_THREADS
 #define SEXP_USE_DEBUG_THREADS 0
 #endif
@@ -503,6 +776,14 @@
 #define SEXP_USE_SIMPLIFY ! SEXP_USE_NO_FEATURES
 #endif
 
+#ifndef SEXP_USE_INLINE
+#define SEXP_USE_INLINE SEXP_USE_SIMPLIFY
+#endif
+
+#ifndef SEXP_INLINE_MAX_SIZE
+#define SEXP_INLINE_MAX_SIZE 16
+#endif
+
 #ifndef SEXP_USE_BOEHM
 #define SEXP_USE_BOEHM 0
 #endif
@@ -527,6 +808,38 @@
 #define SEXP_USE_MALLOC 0
 #endif
 
+#ifndef SEXP_USE_SEGREGATED_FREE_LISTS
+#define SEXP_USE_SEGREGATED_FREE_LISTS 1
+#endif
+
+#ifndef SEXP_USE_LAZY_SWEEP
+#define SEXP_USE_LAZY_SWEEP 1
+#endif
+
+#ifndef SEXP_USE_ALLOC_BUFFERS
+#define SEXP_USE_ALLOC_BUFFERS 1
+#endif
+
+#ifndef SEXP_USE_SHRINK_HEAP
+#define SEXP_USE_SHRINK_HEAP 1
+#endif
+
+#ifndef SEXP_USE_GENERATIONAL_GC
+#define SEXP_USE_GENERATIONAL_GC 0
+#endif
+
+#ifndef SEXP_USE_INCREMENTAL_GC
+#define SEXP_USE_INCREMENTAL_GC 0
+#endif
+
+#ifndef SEXP_USE_PARALLEL_MARK
+#define SEXP_USE_PARALLEL_MARK 0
+#endif
+
+#ifndef SEXP_USE_COMPACTION
+#define SEXP_USE_COMPACTION 0
+#endif
+
 #ifndef SEXP_USE_LIMITED_MALLOC
 #define SEXP_USE_LIMITED_MALLOC 0
 #endif
@@ -678,6 +991,15 @@
 #define SEXP_USE_IMMEDIATE_FLONUMS 0
 #endif
 
+#ifndef SEXP_USE_TAGGED_FLONUMS
+#define SEXP_USE_TAGGED_FLONUMS 0
+#endif
+
+#if ! SEXP_USE_FLONUMS || ! SEXP_64_BIT || SEXP_USE_IMMEDIATE_FLONUMS
+#undef SEXP_USE_TAGGED_FLONUMS
+#define SEXP_USE_TAGGED_FLONUMS 0
+#endif
+
 #ifndef SEXP_USE_IEEE_EQV
 #define SEXP_USE_IEEE_EQV SEXP_USE_FLONUMS
 #endif
@@ -747,6 +1069,14 @@
 #define SEXP_USE_HASH_SYMS ! SEXP_USE_NO_FEATURES
 #endif
 
+#ifndef SEXP_USE_INDEXED_ENVS
+#define SEXP_USE_INDEXED_ENVS ! SEXP_USE_NO_FEATURES
+#endif
+
+#ifndef SEXP_ENV_INDEX_THRESHOLD
+#define SEXP_ENV_INDEX_THRESHOLD 16
+#endif
+
 #ifndef SEXP_USE_FOLD_CASE_SYMS
 #define SEXP_USE_FOLD_CASE_SYMS ! SEXP_USE_NO_FEATURES
 #endif
@@ -755,20 +1085,28 @@
 #define SEXP_DEFAULT_FOLD_CASE_SYMS 0
 #endif
 
-/* experimental optimization to use jumps instead of the TAIL-CALL opcode */
+/* compile known self tail calls, such as named let loops, into */
+/* local updates and a backward jump instead of a TAIL-CALL */
 #ifndef SEXP_USE_TAIL_JUMPS
-/* #define SEXP_USE_TAIL_JUMPS ! SEXP_USE_NO_FEATURES */
-#define SEXP_USE_TAIL_JUMPS 0
+#define SEXP_USE_TAIL_JUMPS ! SEXP_USE_NO_FEATURES
 #endif
 
 #ifndef SEXP_USE_RESERVE_OPCODE
 #define SEXP_USE_RESERVE_OPCODE SEXP_USE_TAIL_JUMPS
 #endif
 
-/* experimental optimization to avoid boxing locals which aren't set! */
+#ifndef SEXP_USE_SEGMENTED_CONTINUATIONS
+#define SEXP_USE_SEGMENTED_CONTINUATIONS ! SEXP_USE_NO_FEATURES
+#endif
+
+#ifndef SEXP_USE_INLINE_CACHES
+#define SEXP_USE_INLINE_CACHES ! SEXP_USE_NO_FEATURES
+#endif
+
+/* avoid boxing internal procedure definitions which aren't set!, */
+/* and set! locals which no closure or continuation can see */
 #ifndef SEXP_USE_UNBOXED_LOCALS
-/* #define SEXP_USE_UNBOXED_LOCALS ! SEXP_USE_NO_FEATURES */
-#define SEXP_USE_UNBOXED_LOCALS 0
+#define SEXP_USE_UNBOXED_LOCALS ! SEXP_USE_NO_FEATURES
 #endif
 
 #ifndef SEXP_USE_DEBUG_VM
@@ -779,6 +1117,30 @@
 #define SEXP_USE_PROFILE_VM 0
 #endif
 
+#ifndef SEXP_USE_SUPERINSTRUCTIONS
+#define SEXP_USE_SUPERINSTRUCTIONS ! SEXP_USE_NO_FEATURES
+#endif
+
+#ifndef SEXP_USE_COMPUTED_GOTO
+#if defined(__GNUC__) && ! SEXP_USE_DEBUG_VM && ! SEXP_USE_PROFILE_VM
+#define SEXP_USE_COMPUTED_GOTO 1
+#else
+#define SEXP_USE_COMPUTED_GOTO 0
+#endif
+#endif
+
+#ifndef SEXP_USE_JIT
+#define SEXP_USE_JIT 0
+#endif
+
+#ifndef SEXP_JIT_THRESHOLD
+#define SEXP_JIT_THRESHOLD 1000
+#endif
+
+#ifndef SEXP_JIT_CODE_SIZE
+#define SEXP_JIT_CODE_SIZE (16*1024*1024)
+#endif
+
 #ifndef SEXP_USE_EXTENDED_CHAR_NAMES
 #define SEXP_USE_EXTENDED_CHAR_NAMES ! SEXP_USE_NO_FEATURES
 #endif
@@ -943,6 +1305,65 @@
 #define SEXP_USE_SIMPLIFY 0
 #endif
 
+#if SEXP_USE_INLINE && ! SEXP_USE_SIMPLIFY
+#undef SEXP_USE_INLINE
+#define SEXP_USE_INLINE 0
+#endif
+
+#if SEXP_USE_SEGREGATED_FREE_LISTS && (SEXP_USE_BOEHM || SEXP_USE_MALLOC)
+#undef SEXP_USE_SEGREGATED_FREE_LISTS
+#define SEXP_USE_SEGREGATED_FREE_LISTS 0
+#endif
+
+#if SEXP_USE_LAZY_SWEEP && (SEXP_USE_BOEHM || SEXP_USE_MALLOC || SEXP_USE_FIXED_CHUNK_SIZE_HEAPS)
+#undef SEXP_USE_LAZY_SWEEP
+#define SEXP_USE_LAZY_SWEEP 0
+#endif
+
+#if SEXP_USE_ALLOC_BUFFERS && (SEXP_USE_BOEHM || SEXP_USE_MALLOC || SEXP_USE_FIXED_CHUNK_SIZE_HEAPS || SEXP_USE_GENERATIONAL_GC)
+#undef SEXP_USE_ALLOC_BUFFERS
+#define SEXP_USE_ALLOC_BUFFERS 0
+#endif
+
+#if SEXP_USE_COMPUTED_GOTO && (SEXP_USE_DEBUG_VM || SEXP_USE_PROFILE_VM)
+#undef SEXP_USE_COMPUTED_GOTO
+#define SEXP_USE_COMPUTED_GOTO 0
+#endif
+
+#if SEXP_USE_SHRINK_HEAP && (SEXP_USE_BOEHM || SEXP_USE_MALLOC || SEXP_USE_FIXED_CHUNK_SIZE_HEAPS || SEXP_USE_GLOBAL_HEAP)
+#undef SEXP_USE_SHRINK_HEAP
+#define SEXP_USE_SHRINK_HEAP 0
+#endif
+
+#if SEXP_USE_GENERATIONAL_GC && (SEXP_USE_BOEHM || SEXP_USE_MALLOC || SEXP_USE_FIXED_CHUNK_SIZE_HEAPS)
+#undef SEXP_USE_GENERATIONAL_GC
+#define SEXP_USE_GENERATIONAL_GC 0
+#endif
+
+#if SEXP_USE_PARALLEL_MARK && (SEXP_USE_BOEHM || SEXP_USE_MALLOC || SEXP_USE_FIXED_CHUNK_SIZE_HEAPS || ! defined(__GNUC__))
+#undef SEXP_USE_PARALLEL_MARK
+#define SEXP_USE_PARALLEL_MARK 0
+#endif
+
+#if SEXP_USE_INCREMENTAL_GC && (! SEXP_USE_LAZY_SWEEP || ! SEXP_USE_GREEN_THREADS || SEXP_USE_GENERATIONAL_GC)
+#undef SEXP_USE_INCREMENTAL_GC
+#define SEXP_USE_INCREMENTAL_GC 0
+#endif
+
+#if SEXP_USE_COMPACTION && (! (SEXP_USE_IMAGE_LOADING) || SEXP_USE_GENERATIONAL_GC || SEXP_USE_FIXED_CHUNK_SIZE_HEAPS || SEXP_USE_MALLOC || ! defined(__GNUC__) || ! defined(__linux__))
+#undef SEXP_USE_COMPACTION
+#define SEXP_USE_COMPACTION 0
+#endif
+
+#ifndef SEXP_USE_MODULE_CACHE
+#define SEXP_USE_MODULE_CACHE SEXP_USE_MODULES && ! SEXP_USE_NO_FEATURES
+#endif
+
+#if SEXP_USE_MODULE_CACHE && (! (SEXP_USE_IMAGE_LOADING) || ! SEXP_USE_MODULES || SEXP_USE_COMPACTION || defined(_WIN32) || defined(PLAN9))
+#undef SEXP_USE_MODULE_CACHE
+#define SEXP_USE_MODULE_CACHE 0
+#endif
+
 #ifndef SEXP_USE_ALIGNED_BYTECODE
 #if defined(__arm__) || defined(__sparc__) || defined(__sparc64__) || defined(__mips__) || defined(__mips64__)
 #define SEXP_USE_ALIGNED_BYTECODE 1
@@ -951,6 +1372,18 @@
 #endif
 #endif
 
+/* superinstructions assume operands immediately follow the opcode */
+#if SEXP_USE_SUPERINSTRUCTIONS && SEXP_USE_ALIGNED_BYTECODE
+#undef SEXP_USE_SUPERINSTRUCTIONS
+#define SEXP_USE_SUPERINSTRUCTIONS 0
+#endif
+
+/* native code embeds object addresses, so nothing may move */
+#if SEXP_USE_JIT && (! defined(__x86_64__) || ! defined(__GNUC__) || ! defined(__linux__) || SEXP_USE_NATIVE_X86 || SEXP_USE_COMPACTION || SEXP_USE_MALLOC || SEXP_USE_ALIGNED_BYTECODE || SEXP_USE_DEBUG_VM || SEXP_USE_PROFILE_VM)
+#undef SEXP_USE_JIT
+#define SEXP_USE_JIT 0
+#endif
+
 #ifndef SEXP_USE_SIGNED_SHIFTS
 #define SEXP_USE_SIGNED_SHIFTS 0
 #endif
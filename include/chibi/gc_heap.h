@@ -96,6 +96,25 @@ SEXP_API sexp sexp_load_image (const char* filename, off_t offset, sexp_uint_t h
 */
 SEXP_API char* sexp_load_image_err();
 
+#if SEXP_USE_MODULE_CACHE
+
+/* Packs the objects reachable from root into a bytevector holding
+   their heap layout, with pointers replaced by indexes.  extern_fn
+   is called once for each object reached, and returns either an
+   index into a table of external objects maintained by the caller,
+   which are referenced rather than copied, -1 to copy the object, or
+   -2 to fail.  Returns SEXP_FALSE if anything couldn't be packed.
+*/
+SEXP_API sexp sexp_pack_objects (sexp ctx, sexp root, sexp_sint_t (*extern_fn)(sexp ctx, void *data, sexp x), void *data);
+
+/* Allocates a fresh copy of the objects packed in bytes, resolving
+   external references by index into the vector externs, and returns
+   the copy of the root, or SEXP_FALSE if the data is invalid.
+*/
+SEXP_API sexp sexp_unpack_objects (sexp ctx, sexp bytes, sexp externs);
+
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -14,6 +14,7 @@ extern "C" {
 
 #define SEXP_MODULE_PATH_VAR "CHIBI_MODULE_PATH"
 #define SEXP_NO_SYSTEM_PATH_VAR "CHIBI_IGNORE_SYSTEM_PATH"
+#define SEXP_MODULE_CACHE_VAR "CHIBI_MODULE_CACHE"
 
 #include "chibi/features.h"
 #include "chibi/install.h"
@@ -116,6 +117,8 @@ typedef s64int int64_t;
 /* tagging system
  *   bits end in     1:  fixnum
  *                  00:  pointer
+ *                 000:  pointer (with tagged flonums)
+ *                 100:  tagged flonum (optional, 64-bit only)
  *                 010:  string cursor (optional)
  *                0110:  immediate symbol (optional)
  *            00001110:  immediate flonum (optional)
@@ -125,7 +128,11 @@ typedef s64int int64_t;
  */
 
 #define SEXP_FIXNUM_BITS 1
+#if SEXP_USE_TAGGED_FLONUMS
+#define SEXP_POINTER_BITS 3
+#else
 #define SEXP_POINTER_BITS 2
+#endif
 #define SEXP_STRING_CURSOR_BITS 3
 #define SEXP_IMMEDIATE_BITS 4
 #define SEXP_EXTENDED_BITS 8
@@ -139,6 +146,7 @@ typedef s64int int64_t;
 #define SEXP_POINTER_TAG 0
 #define SEXP_FIXNUM_TAG 1
 #define SEXP_STRING_CURSOR_TAG 2
+#define SEXP_TFLONUM_TAG 4
 #define SEXP_ISYMBOL_TAG 6
 #define SEXP_IFLONUM_TAG 14
 #define SEXP_CHAR_TAG 30
@@ -375,6 +383,10 @@ typedef struct sexp_free_list_t *sexp_free_list;
 struct sexp_free_list_t {
   sexp_uint_t size;
   sexp_free_list next;
+#if SEXP_USE_SEGREGATED_FREE_LISTS
+  /* must fit in the minimum object size */
+  sexp_free_list prev, class_next;
+#endif
 };
 
 typedef struct sexp_heap_t *sexp_heap;
@@ -382,6 +394,53 @@ struct sexp_heap_t {
   sexp_uint_t size, max_size, chunk_size;
   sexp_free_list free_list;
   sexp_heap next;
+#if SEXP_USE_SEGREGATED_FREE_LISTS
+  sexp_free_list free_classes[SEXP_FREE_LIST_CLASSES];
+  unsigned long free_class_bits;  /* non-empty classes */
+#endif
+#if SEXP_USE_LAZY_SWEEP
+  /* set when this chunk has been marked but not yet swept */
+  int sweep_pending;
+  /* sweep progress, only used in the first heap of the chain */
+  sexp_uint_t sweeps_pending, sweep_freed, sweep_max_freed;
+#endif
+#if SEXP_USE_ALLOC_BUFFERS
+  /* contexts holding allocation buffers, only used in the first heap */
+  sexp *alloc_buffers;
+  sexp_uint_t alloc_buffers_len, alloc_buffers_size;
+#endif
+#if SEXP_USE_SHRINK_HEAP
+  /* number of consecutive collections this chunk has been empty */
+  sexp_uint_t empty_count;
+#endif
+#if SEXP_USE_GENERATIONAL_GC
+  /* generation state, only used in the first heap of the chain */
+  sexp_heap nursery;
+  sexp_uint_t full_gc_limit;
+  char *mark_lo, *mark_hi;
+  char *young_lo, *young_hi;    /* the nursery, for the write barrier */
+  /* old objects which may reference the nursery */
+  sexp *remembered;
+  sexp_uint_t remembered_len, remembered_size;
+#endif
+#if SEXP_USE_GENERATIONAL_GC || SEXP_USE_INCREMENTAL_GC
+  /* set while the VM is running bytecode, which only stores into */
+  /* the heap through the write barrier */
+  int barrier_active;
+  /* set when stores may have bypassed the write barrier */
+  int barrier_bypassed;
+#endif
+#if SEXP_USE_INCREMENTAL_GC
+  /* incremental marking state, only used in the first heap of the chain */
+  int marking;
+  sexp **gray;                  /* [start, end) ranges of slots to scan */
+  sexp_uint_t gray_len, gray_size;
+  sexp_uint_t alloc_since_gc, incremental_trigger, gc_pause_usecs;
+#endif
+#if SEXP_USE_COMPACTION
+  /* set when the last collection left the heap fragmented */
+  int compact_pending;
+#endif
   /* note this must be aligned on a proper heap boundary, */
   /* so we can't just use char data[] */
   char *data;
@@ -443,6 +502,8 @@ struct sexp_struct {
   unsigned int brokenp:1;
   unsigned int syntacticp:1;
   unsigned int copyonwritep:1;
+  unsigned int pinnedp:1;
+  unsigned int rememberedp:1;
 #if SEXP_USE_TRACK_ALLOC_SOURCE
   const char* source;
   void* backtrace[SEXP_BACKTRACE_SIZE];
@@ -528,11 +589,18 @@ struct sexp_struct {
       sexp parent, lambda, bindings;
 #if SEXP_USE_STABLE_ABI || SEXP_USE_RENAME_BINDINGS
       sexp renames;
+#endif
+#if SEXP_USE_STABLE_ABI || SEXP_USE_INDEXED_ENVS
+      sexp index;
 #endif
     } env;
     struct {
-      sexp name, literals, source;
+      sexp name, literals, source, lambda;
       sexp_uint_t length, max_depth;
+#if SEXP_USE_JIT
+      void **jit;               /* native entry points, by offset */
+      sexp_uint_t calls;
+#endif
     } bytecode;
     struct {
       sexp bc, vars;
@@ -591,12 +659,14 @@ struct sexp_struct {
       sexp_sint_t refuel;
       unsigned char* ip;
       struct timeval tval;
+      sexp_uint_t timer;
+      sexp_sint_t priority, quantum;
 #endif
       char tailp, tracep, timeoutp, waitp, errorp, interruptp;
       sexp_uint_t last_fp;
       sexp_uint_t gc_count;
 #if SEXP_USE_TIME_GC
-      sexp_uint_t gc_usecs;
+      sexp_uint_t gc_usecs, gc_mark_usecs, gc_sweep_usecs;
 #endif
 #if SEXP_USE_TRACK_ALLOC_TIMES
       sexp_uint_t alloc_count, alloc_usecs;
@@ -604,6 +674,10 @@ struct sexp_struct {
 #endif
 #if SEXP_USE_TRACK_ALLOC_SIZES
       sexp_uint_t alloc_histogram[SEXP_ALLOC_HISTOGRAM_BUCKETS];
+#endif
+#if SEXP_USE_ALLOC_BUFFERS
+      char *alloc_ptr, *alloc_end;
+      sexp_uint_t alloc_direct;
 #endif
     } context;
 #if SEXP_USE_STABLE_ABI || SEXP_USE_AUTO_FORCE
@@ -779,6 +853,8 @@ void* sexp_alloc(sexp ctx, size_t size);
 #define sexp_brokenp(x)          ((x)->brokenp)
 #define sexp_pointer_magic(x)    ((x)->magic)
 #define sexp_copy_on_writep(x)   ((x)->copyonwritep)
+#define sexp_pinnedp(x)          ((x)->pinnedp)
+#define sexp_rememberedp(x)      ((x)->rememberedp)
 
 #if SEXP_USE_TRACK_ALLOC_SOURCE
 #define sexp_pointer_source(x)   ((x)->source)
@@ -810,6 +886,27 @@ SEXP_API sexp sexp_make_flonum(sexp ctx, float f);
 #define sexp_make_flonum(ctx, x)  ((sexp) ((((union sexp_flonum_conv)((float)(x))).bits & ~SEXP_EXTENDED_MASK) + SEXP_IFLONUM_TAG))
 #define sexp_flonum_value(x) (((union sexp_flonum_conv)(((unsigned int)(x)) & ~SEXP_EXTENDED_MASK)).flonum)
 #endif
+#elif SEXP_USE_TAGGED_FLONUMS
+/* A double whose top four exponent bits are 0111 or 1000 is rotated */
+/* left by four, and the three redundant exponent bits now at the */
+/* bottom are replaced by the tag.  The codes for +/-2^-127 are used */
+/* for +/-0.0 instead, and all other doubles are boxed on the heap. */
+union sexp_double_conv {
+  double flonum;
+  sexp_uint_t bits;
+};
+#define SEXP_TFLONUM_SIGN (1<<SEXP_POINTER_BITS)
+#define SEXP_TFLONUM_ZERO ((sexp_uint_t)7<<59)
+#define sexp_tflonump(x)     (((sexp_uint_t)(x) & SEXP_POINTER_MASK) == SEXP_TFLONUM_TAG)
+#define sexp_tflonum_word(x) (((sexp_uint_t)(x) & ~(sexp_uint_t)SEXP_POINTER_MASK) | (4 - ((sexp_uint_t)(x) >> 63)))
+#define sexp_tflonum_rotr(b) (((b) >> 4) | ((b) << 60))
+#define sexp_tflonum_unzero(b) ((b) ^ ((((b) << 1) == (SEXP_TFLONUM_ZERO << 1)) * SEXP_TFLONUM_ZERO))
+#define sexp_tflonum_value(x) (((union sexp_double_conv)sexp_tflonum_unzero(sexp_tflonum_rotr(sexp_tflonum_word(x)))).flonum)
+#define sexp_flonump(x)      (sexp_tflonump(x) || sexp_check_tag(x, SEXP_FLONUM))
+#define sexp_flonum_value(f) (sexp_tflonump(f) ? sexp_tflonum_value(f) : (f)->value.flonum)
+#define sexp_flonum_value_set(f, x) ((f)->value.flonum = x)
+#define sexp_flonum_bits(f) ((f)->value.flonum_bits)
+SEXP_API sexp sexp_make_flonum(sexp ctx, double f);
 #else
 #define sexp_flonump(x)      (sexp_check_tag(x, SEXP_FLONUM))
 #define sexp_flonum_value(f) ((f)->value.flonum)
@@ -1075,6 +1172,8 @@ SEXP_API sexp sexp_make_unsigned_integer(sexp ctx, sexp_luint_t x);
 
 #if SEXP_USE_IMMEDIATE_FLONUMS
 #define sexp_negate_flonum(x) (x) = sexp_make_flonum(NULL, -(sexp_flonum_value(x)))
+#elif SEXP_USE_TAGGED_FLONUMS
+#define sexp_negate_flonum(x) (x) = (sexp_tflonump(x) ? (sexp)((sexp_uint_t)(x) ^ SEXP_TFLONUM_SIGN) : ((x)->value.flonum = -((x)->value.flonum), (x)))
 #else
 #define sexp_negate_flonum(x) sexp_flonum_value(x) = -(sexp_flonum_value(x))
 #endif
@@ -1295,14 +1394,21 @@ enum sexp_uniform_vector_type {
 #define sexp_bytecode_name(x)     (sexp_field(x, bytecode, SEXP_BYTECODE, name))
 #define sexp_bytecode_literals(x) (sexp_field(x, bytecode, SEXP_BYTECODE, literals))
 #define sexp_bytecode_source(x)   (sexp_field(x, bytecode, SEXP_BYTECODE, source))
+#define sexp_bytecode_lambda(x)   (sexp_field(x, bytecode, SEXP_BYTECODE, lambda))
 #define sexp_bytecode_data(x)     sexp_flexible_array_field(x, bytecode, unsigned char)
+#if SEXP_USE_JIT
+#define sexp_bytecode_jit(x)      (sexp_field(x, bytecode, SEXP_BYTECODE, jit))
+#define sexp_bytecode_calls(x)    (sexp_field(x, bytecode, SEXP_BYTECODE, calls))
+#endif
 
 #define sexp_env_cell_syntactic_p(x)   ((x)->syntacticp)
+#define sexp_env_cell_assigned_p(x)    ((x)->copyonwritep)
 
 #define sexp_env_syntactic_p(x)   ((x)->syntacticp)
 #define sexp_env_parent(x)        (sexp_field(x, env, SEXP_ENV, parent))
 #define sexp_env_bindings(x)      (sexp_field(x, env, SEXP_ENV, bindings))
 #define sexp_env_renames(x)       (sexp_field(x, env, SEXP_ENV, renames))
+#define sexp_env_index(x)         (sexp_field(x, env, SEXP_ENV, index))
 #define sexp_env_local_p(x)       (sexp_env_parent(x))
 #define sexp_env_global_p(x)      (! sexp_env_local_p(x))
 #define sexp_env_lambda(x)        (sexp_field(x, env, SEXP_ENV, lambda))
@@ -1409,8 +1515,12 @@ enum sexp_uniform_vector_type {
 #define sexp_context_gc_count(x) (sexp_field(x, context, SEXP_CONTEXT, gc_count))
 #if SEXP_USE_TIME_GC
 #define sexp_context_gc_usecs(x) (sexp_field(x, context, SEXP_CONTEXT, gc_usecs))
+#define sexp_context_gc_mark_usecs(x) (sexp_field(x, context, SEXP_CONTEXT, gc_mark_usecs))
+#define sexp_context_gc_sweep_usecs(x) (sexp_field(x, context, SEXP_CONTEXT, gc_sweep_usecs))
 #else
 #define sexp_context_gc_usecs(x) 0
+#define sexp_context_gc_mark_usecs(x) 0
+#define sexp_context_gc_sweep_usecs(x) 0
 #endif
 #if SEXP_USE_TRACK_ALLOC_TIMES
 #define sexp_context_alloc_count(x) (sexp_field(x, context, SEXP_CONTEXT, alloc_count))
@@ -1420,10 +1530,18 @@ enum sexp_uniform_vector_type {
 #if SEXP_USE_TRACK_ALLOC_SIZES
 #define sexp_context_alloc_histogram(x) (sexp_field(x, context, SEXP_CONTEXT, alloc_histogram))
 #endif
+#if SEXP_USE_ALLOC_BUFFERS
+#define sexp_context_alloc_ptr(x) (sexp_field(x, context, SEXP_CONTEXT, alloc_ptr))
+#define sexp_context_alloc_end(x) (sexp_field(x, context, SEXP_CONTEXT, alloc_end))
+#define sexp_context_alloc_direct(x) (sexp_field(x, context, SEXP_CONTEXT, alloc_direct))
+#endif
 #define sexp_context_refuel(x)   (sexp_field(x, context, SEXP_CONTEXT, refuel))
 #define sexp_context_ip(x)       (sexp_field(x, context, SEXP_CONTEXT, ip))
 #define sexp_context_proc(x)     (sexp_field(x, context, SEXP_CONTEXT, proc))
 #define sexp_context_timeval(x)  (sexp_field(x, context, SEXP_CONTEXT, tval))
+#define sexp_context_timer(x)    (sexp_field(x, context, SEXP_CONTEXT, timer))
+#define sexp_context_priority(x) (sexp_field(x, context, SEXP_CONTEXT, priority))
+#define sexp_context_quantum(x)  (sexp_field(x, context, SEXP_CONTEXT, quantum))
 #define sexp_context_name(x)     (sexp_field(x, context, SEXP_CONTEXT, name))
 #define sexp_context_specific(x) (sexp_field(x, context, SEXP_CONTEXT, specific))
 #define sexp_context_event(x)    (sexp_field(x, context, SEXP_CONTEXT, event))
@@ -1592,6 +1710,9 @@ enum sexp_context_globals {
   SEXP_G_ERR_HANDLER,
   SEXP_G_RESUMECC_BYTECODE,
   SEXP_G_FINAL_RESUMER,
+#if SEXP_USE_STABLE_ABI || SEXP_USE_SEGMENTED_CONTINUATIONS
+  SEXP_G_UNDERFLOW_BYTECODE,
+#endif
   SEXP_G_RANDOM_SOURCE,
   SEXP_G_STRICT_P,
   SEXP_G_NO_TAIL_CALLS_P,
@@ -1606,18 +1727,25 @@ enum sexp_context_globals {
 #if SEXP_USE_STABLE_ABI || ! SEXP_USE_BOEHM
   SEXP_G_PRESERVATIVES,
 #endif
+#if SEXP_USE_STABLE_ABI || SEXP_USE_INDEXED_ENVS
+  SEXP_G_ENV_INDEX_GENERATION,
+#endif
+#if SEXP_USE_STABLE_ABI || SEXP_USE_MODULE_CACHE
+  SEXP_G_MODULE_CACHE_LOG,
+#endif
 #if SEXP_USE_STABLE_ABI || SEXP_USE_GREEN_THREADS
   SEXP_G_IO_BLOCK_ERROR,
   SEXP_G_IO_BLOCK_ONCE_ERROR,
   SEXP_G_THREAD_TERMINATE_ERROR,
   SEXP_G_THREADS_SCHEDULER,
-  SEXP_G_THREADS_FRONT,
-  SEXP_G_THREADS_BACK,
+  SEXP_G_THREADS_RUNNABLE,
   SEXP_G_THREADS_PAUSED,
+  SEXP_G_THREADS_TIMERS,
   SEXP_G_THREADS_SIGNALS,
   SEXP_G_THREADS_SIGNAL_RUNNER,
   SEXP_G_THREADS_POLL_FDS,
   SEXP_G_THREADS_FD_THREADS,
+  SEXP_G_THREADS_BLOCKED,
   SEXP_G_THREADS_BLOCKER,
   SEXP_G_THREADS_MUTEX_ID,
   SEXP_G_THREADS_POLLFDS_ID,
@@ -1875,8 +2003,53 @@ SEXP_API void sexp_maybe_unblock_port (sexp ctx, sexp in);
 SEXP_API void sexp_gc_init (void);
 SEXP_API int sexp_grow_heap (sexp ctx, size_t size, size_t chunk_size);
 SEXP_API sexp_heap sexp_make_heap (size_t size, size_t max_size, size_t chunk_size);
+#if SEXP_USE_SEGREGATED_FREE_LISTS
+SEXP_API void sexp_index_free_list (sexp_heap h);
+#else
+#define sexp_index_free_list(h)
+#endif
 SEXP_API void sexp_mark (sexp ctx, sexp x);
 SEXP_API sexp sexp_sweep (sexp ctx, size_t *sum_freed_ptr);
+#if SEXP_USE_LAZY_SWEEP
+SEXP_API void sexp_finish_sweep (sexp ctx);
+#else
+#define sexp_finish_sweep(ctx)
+#endif
+#if SEXP_USE_GENERATIONAL_GC
+SEXP_API sexp sexp_minor_gc (sexp ctx, size_t *sum_freed);
+SEXP_API void sexp_remember (sexp ctx, sexp x);
+#define sexp_young_p(h, x) \
+  (((char*)(x) >= (h)->young_lo) && ((char*)(x) < (h)->young_hi))
+/* record a store of v into x, where x may be in the old generation */
+#define sexp_write_barrier(ctx, x, v) do {                              \
+    sexp_heap _h = sexp_context_heap(ctx);                              \
+    if (sexp_pointerp(v) && sexp_young_p(_h, v)                         \
+        && !sexp_young_p(_h, x) && !sexp_rememberedp(x))                \
+      sexp_remember(ctx, x);                                            \
+  } while (0)
+#elif SEXP_USE_INCREMENTAL_GC
+SEXP_API void sexp_incremental_shade (sexp ctx, sexp x);
+/* shade v when it's stored during a marking cycle, in case x has */
+/* already been scanned */
+#define sexp_write_barrier(ctx, x, v) do {                              \
+    if (sexp_context_heap(ctx)->marking && sexp_pointerp(v)             \
+        && !sexp_markedp(v))                                            \
+      sexp_incremental_shade(ctx, v);                                   \
+  } while (0)
+#else
+#define sexp_write_barrier(ctx, x, v)
+#endif
+#if SEXP_USE_INCREMENTAL_GC
+SEXP_API void sexp_incremental_mark (sexp ctx);
+#endif
+#if SEXP_USE_ALLOC_BUFFERS
+SEXP_API void sexp_retire_alloc_buffers (sexp ctx);
+#else
+#define sexp_retire_alloc_buffers(ctx)
+#endif
+#if SEXP_USE_COMPACTION
+SEXP_API void sexp_gc_heap_compact (sexp ctx);
+#endif
 #if SEXP_USE_FINALIZERS
 SEXP_API sexp sexp_finalize (sexp ctx);
 #else
@@ -2066,6 +2239,29 @@ enum sexp_opcode_names {
   SEXP_OP_SCP,
   SEXP_OP_SC_LT,
   SEXP_OP_SC_LE,
+  SEXP_OP_LOCAL_REF_CAR,
+  SEXP_OP_LOCAL_REF_CDR,
+  SEXP_OP_CLOSURE_REF_CDR,
+  SEXP_OP_LT_JUMP_UNLESS,
+  SEXP_OP_LE_JUMP_UNLESS,
+  SEXP_OP_EQN_JUMP_UNLESS,
+  SEXP_OP_NULLP_JUMP_UNLESS,
+  SEXP_OP_UNSAFE_CAR,
+  SEXP_OP_UNSAFE_CDR,
+  SEXP_OP_FX_ADD,
+  SEXP_OP_FX_SUB,
+  SEXP_OP_FX_LT,
+  SEXP_OP_FX_LE,
+  SEXP_OP_FX_EQN,
+  SEXP_OP_LOCAL_REF_UNSAFE_CAR,
+  SEXP_OP_LOCAL_REF_UNSAFE_CDR,
+  SEXP_OP_CLOSURE_REF_UNSAFE_CDR,
+  SEXP_OP_FX_LT_JUMP_UNLESS,
+  SEXP_OP_FX_LE_JUMP_UNLESS,
+  SEXP_OP_FX_EQN_JUMP_UNLESS,
+  SEXP_OP_UNDERFLOW,
+  SEXP_OP_CACHED_CALL,
+  SEXP_OP_CACHED_TAIL_CALL,
   SEXP_OP_NUM_OPCODES
 };
 
@@ -260,7 +260,7 @@ sexp sexp_type_of (sexp ctx, sexp self, sexp_sint_t n, sexp x) {
   else if (sexp_symbolp(x))
     return sexp_type_by_index(ctx, SEXP_SYMBOL);
 #endif
-#if SEXP_USE_IMMEDIATE_FLONUMS
+#if SEXP_USE_IMMEDIATE_FLONUMS || SEXP_USE_TAGGED_FLONUMS
   else if (sexp_flonump(x))
     return sexp_type_by_index(ctx, SEXP_FLONUM);
 #endif
@@ -390,6 +390,10 @@ sexp sexp_integer_to_immediate (sexp ctx, sexp self, sexp_sint_t n, sexp i, sexp
 }
 
 sexp sexp_object_to_integer (sexp ctx, sexp self, sexp_sint_t n, sexp x) {
+#if SEXP_USE_COMPACTION
+  if (sexp_pointerp(x))
+    sexp_pinnedp(x) = 1;
+#endif
   return sexp_make_integer(ctx, (sexp_uint_t)x);
 }
 
@@ -506,6 +510,14 @@ sexp sexp_gc_usecs_op (sexp ctx, sexp self, sexp_sint_t n) {
   return sexp_make_unsigned_integer(ctx, sexp_context_gc_usecs(ctx));
 }
 
+sexp sexp_gc_mark_usecs_op (sexp ctx, sexp self, sexp_sint_t n) {
+  return sexp_make_unsigned_integer(ctx, sexp_context_gc_mark_usecs(ctx));
+}
+
+sexp sexp_gc_sweep_usecs_op (sexp ctx, sexp self, sexp_sint_t n) {
+  return sexp_make_unsigned_integer(ctx, sexp_context_gc_sweep_usecs(ctx));
+}
+
 #if SEXP_USE_GREEN_THREADS
 sexp sexp_set_atomic (sexp ctx, sexp self, sexp_sint_t n, sexp new_val) {
   sexp res = sexp_global(ctx, SEXP_G_ATOMIC_P);
@@ -525,11 +537,31 @@ sexp sexp_thread_list (sexp ctx, sexp self, sexp_sint_t n) {
   sexp_gc_preserve1(ctx, res);
   res = SEXP_NULL;
 #if SEXP_USE_GREEN_THREADS
-  sexp ls;
-  for (ls=sexp_global(ctx, SEXP_G_THREADS_FRONT); sexp_pairp(ls); ls=sexp_cdr(ls))
-    sexp_push(ctx, res, sexp_car(ls));
+  sexp ls, q;
+  sexp_uint_t i, j;
+  /* runnable threads are in ring buffers per priority, after the */
+  /* total count: #(head length thread ...) */
+  if (sexp_vectorp(sexp_global(ctx, SEXP_G_THREADS_RUNNABLE)))
+    for (i=1; i<sexp_vector_length(sexp_global(ctx, SEXP_G_THREADS_RUNNABLE)); i++) {
+      q = sexp_vector_ref(sexp_global(ctx, SEXP_G_THREADS_RUNNABLE), sexp_make_fixnum(i));
+      if (sexp_vectorp(q))
+        for (j=0; j<sexp_unbox_fixnum(sexp_vector_ref(q, SEXP_ONE)); j++)
+          sexp_push(ctx, res, sexp_vector_ref(q, sexp_make_fixnum(2 + (sexp_unbox_fixnum(sexp_vector_ref(q, SEXP_ZERO)) + j) % (sexp_vector_length(q) - 2))));
+    }
   for (ls=sexp_global(ctx, SEXP_G_THREADS_PAUSED); sexp_pairp(ls); ls=sexp_cdr(ls))
     sexp_push(ctx, res, sexp_car(ls));
+  /* threads waiting with a timeout are in the timer heap, from slot 1 */
+  if (sexp_vectorp(sexp_global(ctx, SEXP_G_THREADS_TIMERS)))
+    for (i=1; i<=sexp_unbox_fixnum(sexp_vector_ref(sexp_global(ctx, SEXP_G_THREADS_TIMERS), SEXP_ZERO)); i++)
+      sexp_push(ctx, res, sexp_vector_ref(sexp_global(ctx, SEXP_G_THREADS_TIMERS), sexp_make_fixnum(i)));
+  /* threads blocked on an fd without a timeout aren't paused */
+  if (sexp_vectorp(sexp_global(ctx, SEXP_G_THREADS_FD_THREADS)))
+    for (i=0; i<sexp_vector_length(sexp_global(ctx, SEXP_G_THREADS_FD_THREADS)); i++)
+      for (ls=sexp_vector_ref(sexp_global(ctx, SEXP_G_THREADS_FD_THREADS), sexp_make_fixnum(i));
+           sexp_pairp(ls); ls=sexp_cdr(ls))
+        if (sexp_context_waitp(sexp_car(ls))
+            && sexp_not(sexp_memq(ctx, sexp_car(ls), res)))
+          sexp_push(ctx, res, sexp_car(ls));
 #endif
   if (sexp_not(sexp_memq(ctx, ctx, res))) sexp_push(ctx, res, ctx);
   sexp_gc_release1(ctx);
@@ -698,12 +730,14 @@ sexp sexp_init_library (sexp ctx, sexp self, sexp_sint_t n, sexp env, const char
   sexp_define_accessors(ctx, env, SEXP_CND, 0, "cnd-test", "cnd-test-set!");
   sexp_define_accessors(ctx, env, SEXP_CND, 1, "cnd-pass", "cnd-pass-set!");
   sexp_define_accessors(ctx, env, SEXP_CND, 2, "cnd-fail", "cnd-fail-set!");
+  sexp_define_accessors(ctx, env, SEXP_CND, 3, "cnd-source", "cnd-source-set!");
   sexp_define_accessors(ctx, env, SEXP_SET, 0, "set-var", "set-var-set!");
   sexp_define_accessors(ctx, env, SEXP_SET, 1, "set-value", "set-value-set!");
   sexp_define_accessors(ctx, env, SEXP_SET, 2, "set-source", "set-source-set!");
   sexp_define_accessors(ctx, env, SEXP_REF, 0, "ref-name", "ref-name-set!");
   sexp_define_accessors(ctx, env, SEXP_REF, 1, "ref-cell", "ref-cell-set!");
   sexp_define_accessors(ctx, env, SEXP_SEQ, 0, "seq-ls", "seq-ls-set!");
+  sexp_define_accessors(ctx, env, SEXP_SEQ, 1, "seq-source", "seq-source-set!");
   sexp_define_accessors(ctx, env, SEXP_LIT, 0, "lit-value", "lit-value-set!");
   sexp_define_accessors(ctx, env, SEXP_BYTECODE, 0, "bytecode-name", "bytecode-name-set!");
   sexp_define_accessors(ctx, env, SEXP_BYTECODE, 1, "bytecode-literals", NULL);
@@ -769,6 +803,8 @@ sexp sexp_init_library (sexp ctx, sexp self, sexp_sint_t n, sexp env, const char
   sexp_define_foreign(ctx, env, "gc", 0, sexp_gc_op);
   sexp_define_foreign(ctx, env, "gc-count", 0, sexp_gc_count_op);
   sexp_define_foreign(ctx, env, "gc-usecs", 0, sexp_gc_usecs_op);
+  sexp_define_foreign(ctx, env, "gc-mark-usecs", 0, sexp_gc_mark_usecs_op);
+  sexp_define_foreign(ctx, env, "gc-sweep-usecs", 0, sexp_gc_sweep_usecs_op);
 #if SEXP_USE_GREEN_THREADS
   sexp_define_foreign(ctx, env, "%set-atomic!", 1, sexp_set_atomic);
 #endif
@@ -320,6 +320,8 @@
 ;;> \item{\scheme{(cnd-pass-set! cnd x)}}
 ;;> \item{\scheme{(cnd-fail cnd)} - the failure branch}
 ;;> \item{\scheme{(cnd-fail-set! cnd x)}}
+;;> \item{\scheme{(cnd-source cnd)} - the source code of the conditional}
+;;> \item{\scheme{(cnd-source-set! cnd x)}}
 ;;> ]
 
 ;;> \subsection{Sequences}
@@ -327,6 +329,8 @@
 ;;> \itemlist[
 ;;> \item{\scheme{(seq-ls seq)} - the list of sequence expressions}
 ;;> \item{\scheme{(seq-ls-set! seq x)}}
+;;> \item{\scheme{(seq-source seq)} - the source code of the sequence}
+;;> \item{\scheme{(seq-source-set! seq x)}}
 ;;> ]
 
 ;;> \subsection{References}
@@ -3,7 +3,7 @@
 /*  BSD-style license: http://synthcode.com/license.txt       */
 
 #include "chibi/eval.h"
-#if ! SEXP_USE_STATIC_LIBS
+#if ! (SEXP_USE_STATIC_LIBS || SEXP_USE_MODULE_CACHE)
 #include "../../opt/opcode_names.h"
 #endif
 
@@ -111,9 +111,19 @@ static sexp disasm (sexp ctx, sexp self, sexp bc, sexp out, int depth) {
     case SEXP_OP_TYPEP:
       ip += sizeof(sexp);
       break;
+    case SEXP_OP_LOCAL_REF_CAR:
+    case SEXP_OP_LOCAL_REF_CDR:
+    case SEXP_OP_CLOSURE_REF_CDR:
+    case SEXP_OP_LOCAL_REF_UNSAFE_CAR:
+    case SEXP_OP_LOCAL_REF_UNSAFE_CDR:
+    case SEXP_OP_CLOSURE_REF_UNSAFE_CDR:
+      ip += sizeof(sexp) + 1;
+      break;
     case SEXP_OP_SLOT_REF:
     case SEXP_OP_SLOT_SET:
     case SEXP_OP_MAKE:
+    case SEXP_OP_CACHED_CALL:
+    case SEXP_OP_CACHED_TAIL_CALL:
       ip += sizeof(sexp)*2;
       break;
     case SEXP_OP_MAKE_PROCEDURE:
@@ -169,6 +179,16 @@ static sexp disasm (sexp ctx, sexp self, sexp bc, sexp out, int depth) {
     sexp_write_integer(ctx, ((sexp_sint_t*)ip)[0], out);
     ip += sizeof(sexp);
     break;
+  case SEXP_OP_LOCAL_REF_CAR:
+  case SEXP_OP_LOCAL_REF_CDR:
+  case SEXP_OP_CLOSURE_REF_CDR:
+  case SEXP_OP_LOCAL_REF_UNSAFE_CAR:
+  case SEXP_OP_LOCAL_REF_UNSAFE_CDR:
+  case SEXP_OP_CLOSURE_REF_UNSAFE_CDR:
+    /* skip the fused CAR/CDR which follows */
+    sexp_write_integer(ctx, ((sexp_sint_t*)ip)[0], out);
+    ip += sizeof(sexp) + 1;
+    break;
   case SEXP_OP_JUMP:
   case SEXP_OP_JUMP_UNLESS:
     sexp_write_integer(ctx, ((sexp_sint_t*)ip)[0], out);
@@ -195,6 +215,11 @@ static sexp disasm (sexp ctx, sexp self, sexp bc, sexp out, int depth) {
   case SEXP_OP_MAKE:
     ip += sizeof(sexp)*2;
     break;
+  case SEXP_OP_CACHED_CALL:
+  case SEXP_OP_CACHED_TAIL_CALL:
+    sexp_write(ctx, ((sexp*)ip)[0], out);
+    ip += sizeof(sexp)*2;
+    break;
   case SEXP_OP_MAKE_PROCEDURE:
     sexp_write_integer(ctx, ((sexp_sint_t*)ip)[0], out);
     sexp_write_char(ctx, ' ', out);
@@ -1,18 +1,28 @@
 
+;; Rebuilt nodes keep the source info of the originals, for error
+;; messages.
+(define (copy-source! from to)
+  (cond
+   ((cnd? to) (cnd-source-set! to (cnd-source from)))
+   ((seq? to) (seq-source-set! to (seq-source from)))
+   ((set? to) (set-source-set! to (set-source from)))
+   ((pair? to) (pair-source-set! to (pair-source from))))
+  to)
+
 (define (register-lambda-optimization! proc . o)
   (define (optimize ast)
     (match ast
       (($ Set ref value)
-       (make-set ref (optimize value)))
+       (copy-source! ast (make-set ref (optimize value))))
       (($ Cnd test pass fail)
-       (make-cnd (optimize test) (optimize pass) (optimize fail)))
+       (copy-source! ast (make-cnd (optimize test) (optimize pass) (optimize fail))))
       (($ Seq ls)
-       (make-seq (map optimize ls)))
+       (copy-source! ast (make-seq (map optimize ls))))
       (($ Lam name params body)
        (lambda-body-set! ast (optimize body))
        (proc ast))
       ((app ...)
-       (map optimize app))
+       (copy-source! ast (map optimize app)))
       (else
        ast)))
   (register-optimization! optimize (if (pair? o) (car o) 600)))
@@ -25,16 +35,16 @@
            new
            x))
       (($ Set ref value)
-       (make-set (replace ref) (replace value)))
+       (copy-source! x (make-set (replace ref) (replace value))))
       (($ Cnd test pass fail)
-       (make-cnd (replace test) (replace pass) (replace fail)))
+       (copy-source! x (make-cnd (replace test) (replace pass) (replace fail))))
       (($ Seq ls)
-       (make-seq (map replace ls)))
+       (copy-source! x (make-seq (map replace ls))))
       (($ Lam name params body)
        (lambda-body-set! x (replace body))
        x)
       ((app ...)
-       (map replace app))
+       (copy-source! x (map replace app)))
       (else
        x))))
 
@@ -0,0 +1,37 @@
+/*  types.c -- unchecked opcodes for proven argument types    */
+/*  BSD-style license: http://synthcode.com/license.txt       */
+
+#include <chibi/eval.h>
+
+/* returns a copy of op which skips its type checks, or #f if there */
+/* is no unchecked variant */
+
+static sexp sexp_unchecked_opcode (sexp ctx, sexp self, sexp_sint_t n, sexp op) {
+  int code;
+  sexp res;
+  if (! sexp_opcodep(op))
+    return sexp_type_exception(ctx, self, SEXP_OPCODE, op);
+  switch (sexp_opcode_code(op)) {
+  case SEXP_OP_CAR: code = SEXP_OP_UNSAFE_CAR; break;
+  case SEXP_OP_CDR: code = SEXP_OP_UNSAFE_CDR; break;
+  case SEXP_OP_ADD: code = SEXP_OP_FX_ADD; break;
+  case SEXP_OP_SUB: code = SEXP_OP_FX_SUB; break;
+  case SEXP_OP_LT:  code = SEXP_OP_FX_LT; break;
+  case SEXP_OP_LE:  code = SEXP_OP_FX_LE; break;
+  case SEXP_OP_EQN: code = SEXP_OP_FX_EQN; break;
+  default: return SEXP_FALSE;
+  }
+  res = sexp_alloc_type(ctx, opcode, SEXP_OPCODE);
+  if (sexp_exceptionp(res)) return res;
+  memcpy(&(res->value), &(op->value), sizeof(op->value.opcode));
+  sexp_opcode_code(res) = code;
+  return res;
+}
+
+sexp sexp_init_library (sexp ctx, sexp self, sexp_sint_t n, sexp env, const char* version, const sexp_abi_identifier_t abi) {
+  if (!(sexp_version_compatible(ctx, version, sexp_version)
+        && sexp_abi_compatible(ctx, abi, SEXP_ABI_IDENTIFIER)))
+    return SEXP_ABI_ERROR;
+  sexp_define_foreign(ctx, env, "unchecked-opcode", 1, sexp_unchecked_opcode);
+  return SEXP_VOID;
+}
@@ -0,0 +1,127 @@
+
+;; Replace type-checked primitives with unchecked variants where the
+;; types of the arguments have been proven.  Unlike the inferred
+;; parameter types, which only record how a value is used, a fact
+;; here is only recorded for a variable which is never set! and has
+;; been tested with pair? or fixnum? in an enclosing conditional, or
+;; is bound to a fixnum literal or the result of a primitive which
+;; always returns a fixnum.
+
+(define fixnum-primitives
+  (filter opcode?
+          (list vector-length string-length bytevector-length
+                char->integer bytevector-u8-ref)))
+
+(define pair-primitives (list car cdr))
+
+(define fixnum-binary-primitives (list + - < <= > >= =))
+
+(define unchecked-opcodes '())
+
+(define (unchecked op)
+  (cond
+   ((assq op unchecked-opcodes) => cdr)
+   (else
+    (let ((res (unchecked-opcode op)))
+      (set! unchecked-opcodes (cons (cons op res) unchecked-opcodes))
+      res))))
+
+;; Facts are lists of (name lambda type) for immutable local variables.
+
+(define (immutable-ref x)
+  (match x
+    (($ Ref name (_ . (? lambda? f)))
+     (and (not (memq name (lambda-set-vars f))) (cons name f)))
+    (else #f)))
+
+(define (add-fact x type facts)
+  (let ((ref (immutable-ref x)))
+    (if ref (cons (list (car ref) (cdr ref) type) facts) facts)))
+
+(define (known-type x facts)
+  (match x
+    ((? fixnum?) 'fixnum)
+    (($ Lit (? fixnum?)) 'fixnum)
+    (($ Ref name (_ . (? lambda? f)))
+     (cond ((find (lambda (r) (and (eq? name (car r)) (eq? f (cadr r)))) facts)
+            => third)
+           (else #f)))
+    (((? opcode? op) . _)
+     (and (memq op fixnum-primitives) 'fixnum))
+    (else #f)))
+
+;; Returns two values, the facts which hold when test is true and
+;; when it is false.
+
+(define (test-facts test facts)
+  (match test
+    (((? (lambda (op) (eq? op pair?))) x)
+     (values (add-fact x 'pair facts) facts))
+    (((? (lambda (op) (eq? op fixnum?))) x)
+     (values (add-fact x 'fixnum facts) facts))
+    ((or (($ Ref _ (_ . (? (lambda (f) (eq? f not))))) x)
+         ($ Cnd x (or #f ($ Lit #f)) (or #t ($ Lit #t))))
+     (call-with-values (lambda () (test-facts x facts))
+       (lambda (pass fail) (values fail pass))))
+    (($ Cnd x y (or #f ($ Lit #f)))
+     (call-with-values (lambda () (test-facts x facts))
+       (lambda (pass fail)
+         (call-with-values (lambda () (test-facts y pass))
+           (lambda (pass2 fail2) (values pass2 facts))))))
+    (else
+     (values facts facts))))
+
+(define (optimize-types ast)
+  (define (optimize x facts)
+    (match x
+      (($ Set ref value)
+       (copy-source! x (make-set ref (optimize value facts))))
+      (($ Cnd test pass fail)
+       (let ((test (optimize test facts)))
+         (call-with-values (lambda () (test-facts test facts))
+           (lambda (pass-facts fail-facts)
+             (copy-source! x (make-cnd test
+                                       (optimize pass pass-facts)
+                                       (optimize fail fail-facts)))))))
+      (($ Seq ls)
+       (copy-source! x (make-seq (map (lambda (y) (optimize y facts)) ls))))
+      (($ Lam name params body)
+       (lambda-body-set! x (optimize body facts))
+       x)
+      (((and ($ Lam _ (params ...) body) f) args ...)
+       (let ((args (map (lambda (y) (optimize y facts)) args)))
+         (if (= (length params) (length args))
+             (let ((inner
+                    (fold (lambda (p a acc)
+                            (let ((type (known-type a facts)))
+                              (if (and type (not (memq p (lambda-set-vars f))))
+                                  (cons (list p f type) acc)
+                                  acc)))
+                          facts
+                          params
+                          args)))
+               (lambda-body-set! f (optimize body inner)))
+             (lambda-body-set! f (optimize body facts)))
+         (copy-source! x (cons f args))))
+      (((? opcode? op) args ...)
+       (let* ((args (map (lambda (y) (optimize y facts)) args))
+              (op2 (cond
+                    ((and (memq op pair-primitives)
+                          (= 1 (length args))
+                          (eq? 'pair (known-type (car args) facts)))
+                     (unchecked op))
+                    ((and (memq op fixnum-binary-primitives)
+                          (= 2 (length args))
+                          (eq? 'fixnum (known-type (car args) facts))
+                          (eq? 'fixnum (known-type (cadr args) facts)))
+                     (unchecked op))
+                    (else #f))))
+         (copy-source! x (cons (or op2 op) args))))
+      ((app ...)
+       (copy-source! x (map (lambda (y) (optimize y facts)) app)))
+      (else
+       x)))
+  (lambda-body-set! ast (optimize (lambda-body ast) '()))
+  ast)
+
+(register-lambda-optimization! optimize-types)
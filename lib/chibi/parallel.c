@@ -0,0 +1,653 @@
+/*  parallel.c -- independent VMs in OS threads, and channels  */
+/*  BSD-style license: http://synthcode.com/license.txt        */
+
+#include <chibi/eval.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/* Each VM has its own heap, so nothing is shared between them */
+/* except shared channels.  Values sent over a channel are */
+/* serialized into a malloced message and rebuilt in the receiving */
+/* heap.  Only plain data can be sent: numbers, characters, */
+/* booleans, strings, symbols, bytevectors, pairs, vectors and */
+/* shared channels themselves. */
+
+#define SEXP_MESSAGE_MAX_DEPTH 10000
+
+struct sexp_message_t;
+
+struct sexp_shared_channel_t {
+  pthread_mutex_t lock;
+  struct sexp_message_t *head, *tail;
+  /* the read end is readable exactly while there are messages, */
+  /* so green threads can block on it like any other fd */
+  int fds[2];
+  int refs;
+};
+
+struct sexp_message_t {
+  struct sexp_message_t *next;
+  unsigned char *data;
+  size_t len;
+  struct sexp_shared_channel_t **channels;
+  size_t num_channels;
+};
+
+enum sexp_message_tags {
+  SEXP_MSG_NULL = 'n',
+  SEXP_MSG_TRUE = 't',
+  SEXP_MSG_FALSE = 'f',
+  SEXP_MSG_VOID = 'v',
+  SEXP_MSG_EOF = 'e',
+  SEXP_MSG_FIXNUM = 'i',
+  SEXP_MSG_FLONUM = 'd',
+  SEXP_MSG_NUMBER = 'N',      /* any other number, as its external form */
+  SEXP_MSG_CHAR = 'c',
+  SEXP_MSG_STRING = 's',
+  SEXP_MSG_SYMBOL = 'y',
+  SEXP_MSG_BYTES = 'b',
+  SEXP_MSG_LIST = 'l',        /* count, elements, then the tail */
+  SEXP_MSG_VECTOR = 'V',
+  SEXP_MSG_CHANNEL = 'C'      /* index into the message's channels */
+};
+
+#define sexp_shared_channelp(x, tag) (sexp_pointerp(x) && sexp_pointer_tag(x) == (tag))
+#define sexp_shared_channel(x) ((struct sexp_shared_channel_t*)sexp_cpointer_value(x))
+
+/**************************** channels ************************************/
+
+static struct sexp_shared_channel_t *sexp_shared_channel_new (void) {
+  struct sexp_shared_channel_t *ch = malloc(sizeof(struct sexp_shared_channel_t));
+  if (!ch) return NULL;
+  if (pipe(ch->fds) != 0) {
+    free(ch);
+    return NULL;
+  }
+  fcntl(ch->fds[0], F_SETFL, fcntl(ch->fds[0], F_GETFL) | O_NONBLOCK);
+  fcntl(ch->fds[1], F_SETFL, fcntl(ch->fds[1], F_GETFL) | O_NONBLOCK);
+  fcntl(ch->fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(ch->fds[1], F_SETFD, FD_CLOEXEC);
+  pthread_mutex_init(&ch->lock, NULL);
+  ch->head = ch->tail = NULL;
+  ch->refs = 1;
+  return ch;
+}
+
+static void sexp_shared_channel_ref (struct sexp_shared_channel_t *ch) {
+  pthread_mutex_lock(&ch->lock);
+  ch->refs++;
+  pthread_mutex_unlock(&ch->lock);
+}
+
+static void sexp_message_free (struct sexp_message_t *msg);
+
+static void sexp_shared_channel_release (struct sexp_shared_channel_t *ch) {
+  struct sexp_message_t *msg, *next;
+  int refs;
+  pthread_mutex_lock(&ch->lock);
+  refs = --ch->refs;
+  pthread_mutex_unlock(&ch->lock);
+  if (refs > 0) return;
+  /* undelivered messages can hold references to other channels */
+  for (msg=ch->head; msg; msg=next) {
+    next = msg->next;
+    sexp_message_free(msg);
+  }
+  close(ch->fds[0]);
+  close(ch->fds[1]);
+  pthread_mutex_destroy(&ch->lock);
+  free(ch);
+}
+
+static void sexp_shared_channel_push (struct sexp_shared_channel_t *ch,
+                                      struct sexp_message_t *msg) {
+  pthread_mutex_lock(&ch->lock);
+  msg->next = NULL;
+  if (ch->tail) {
+    ch->tail->next = msg;
+  } else {
+    ch->head = msg;
+    if (write(ch->fds[1], "m", 1) < 0) {}   /* now readable */
+  }
+  ch->tail = msg;
+  pthread_mutex_unlock(&ch->lock);
+}
+
+static struct sexp_message_t *sexp_shared_channel_pop (struct sexp_shared_channel_t *ch) {
+  struct sexp_message_t *msg;
+  char c;
+  pthread_mutex_lock(&ch->lock);
+  msg = ch->head;
+  if (msg) {
+    ch->head = msg->next;
+    if (!ch->head) {
+      ch->tail = NULL;
+      if (read(ch->fds[0], &c, 1) < 0) {}   /* no longer readable */
+    }
+  }
+  pthread_mutex_unlock(&ch->lock);
+  return msg;
+}
+
+sexp sexp_free_shared_channel (sexp ctx, sexp self, sexp_sint_t n, sexp x) {
+  if (sexp_cpointer_freep(x) && sexp_cpointer_value(x)) {
+    sexp_shared_channel_release(sexp_shared_channel(x));
+    sexp_cpointer_value(x) = NULL;
+    sexp_cpointer_freep(x) = 0;
+  }
+  return SEXP_VOID;
+}
+
+/* a new Scheme reference to ch, taking over one reference count */
+static sexp sexp_wrap_shared_channel (sexp ctx, sexp_uint_t tag,
+                                      struct sexp_shared_channel_t *ch) {
+  sexp res = sexp_make_cpointer(ctx, tag, ch, SEXP_FALSE, 1);
+  if (sexp_exceptionp(res))
+    sexp_shared_channel_release(ch);
+  return res;
+}
+
+/**************************** messages ************************************/
+
+struct sexp_encoder_t {
+  sexp ctx, bad;
+  sexp_uint_t channel_tag;
+  unsigned char *buf;
+  size_t len, size;
+  struct sexp_shared_channel_t **channels;
+  size_t num_channels, max_channels;
+  int depth;
+};
+
+static void sexp_message_free (struct sexp_message_t *msg) {
+  size_t i;
+  for (i=0; i<msg->num_channels; i++)
+    sexp_shared_channel_release(msg->channels[i]);
+  free(msg->channels);
+  free(msg->data);
+  free(msg);
+}
+
+static int sexp_encode_bytes (struct sexp_encoder_t *enc, const void *data, size_t n) {
+  unsigned char *tmp;
+  if (enc->len + n > enc->size) {
+    tmp = realloc(enc->buf, 2 * (enc->len + n));
+    if (!tmp) return 0;
+    enc->buf = tmp;
+    enc->size = 2 * (enc->len + n);
+  }
+  memcpy(enc->buf + enc->len, data, n);
+  enc->len += n;
+  return 1;
+}
+
+static int sexp_encode_tag (struct sexp_encoder_t *enc, int tag) {
+  unsigned char c = tag;
+  return sexp_encode_bytes(enc, &c, 1);
+}
+
+static int sexp_encode_size (struct sexp_encoder_t *enc, size_t n) {
+  return sexp_encode_bytes(enc, &n, sizeof(n));
+}
+
+static int sexp_encode_string (struct sexp_encoder_t *enc, int tag, sexp str) {
+  return sexp_encode_tag(enc, tag)
+    && sexp_encode_size(enc, sexp_string_size(str))
+    && sexp_encode_bytes(enc, sexp_string_data(str), sexp_string_size(str));
+}
+
+static int sexp_encode_channel (struct sexp_encoder_t *enc, sexp x) {
+  struct sexp_shared_channel_t **tmp;
+  if (enc->num_channels == enc->max_channels) {
+    enc->max_channels = enc->max_channels ? 2 * enc->max_channels : 4;
+    tmp = realloc(enc->channels, enc->max_channels * sizeof(*tmp));
+    if (!tmp) return 0;
+    enc->channels = tmp;
+  }
+  sexp_shared_channel_ref(sexp_shared_channel(x));
+  enc->channels[enc->num_channels++] = sexp_shared_channel(x);
+  return sexp_encode_tag(enc, SEXP_MSG_CHANNEL)
+    && sexp_encode_size(enc, enc->num_channels - 1);
+}
+
+static int sexp_encode (struct sexp_encoder_t *enc, sexp x) {
+  sexp_sint_t fx;
+  double d;
+  sexp_uint_t i, n;
+  sexp ls, slow;
+  int res = 0, c;
+  if (++enc->depth > SEXP_MESSAGE_MAX_DEPTH) {
+    enc->bad = x;
+    return 0;
+  }
+  if (x == SEXP_NULL) {
+    res = sexp_encode_tag(enc, SEXP_MSG_NULL);
+  } else if (x == SEXP_TRUE) {
+    res = sexp_encode_tag(enc, SEXP_MSG_TRUE);
+  } else if (x == SEXP_FALSE) {
+    res = sexp_encode_tag(enc, SEXP_MSG_FALSE);
+  } else if (x == SEXP_VOID) {
+    res = sexp_encode_tag(enc, SEXP_MSG_VOID);
+  } else if (x == SEXP_EOF) {
+    res = sexp_encode_tag(enc, SEXP_MSG_EOF);
+  } else if (sexp_fixnump(x)) {
+    fx = sexp_unbox_fixnum(x);
+    res = sexp_encode_tag(enc, SEXP_MSG_FIXNUM) && sexp_encode_bytes(enc, &fx, sizeof(fx));
+  } else if (sexp_charp(x)) {
+    c = sexp_unbox_character(x);
+    res = sexp_encode_tag(enc, SEXP_MSG_CHAR) && sexp_encode_bytes(enc, &c, sizeof(c));
+#if SEXP_USE_FLONUMS
+  } else if (sexp_flonump(x)) {
+    d = sexp_flonum_value(x);
+    res = sexp_encode_tag(enc, SEXP_MSG_FLONUM) && sexp_encode_bytes(enc, &d, sizeof(d));
+#endif
+  } else if (sexp_symbolp(x)) {
+    res = sexp_encode_string(enc, SEXP_MSG_SYMBOL, sexp_symbol_to_string(enc->ctx, x));
+  } else if (sexp_numberp(x)) {
+    res = sexp_encode_string(enc, SEXP_MSG_NUMBER, sexp_write_to_string(enc->ctx, x));
+  } else if (sexp_stringp(x)) {
+    res = sexp_encode_string(enc, SEXP_MSG_STRING, x);
+  } else if (sexp_bytesp(x)) {
+    res = sexp_encode_tag(enc, SEXP_MSG_BYTES)
+      && sexp_encode_size(enc, sexp_bytes_length(x))
+      && sexp_encode_bytes(enc, sexp_bytes_data(x), sexp_bytes_length(x));
+  } else if (sexp_pairp(x)) {
+    /* lists are encoded iteratively, so only nesting uses the C stack */
+    for (n=0, ls=slow=x; sexp_pairp(ls); n++, ls=sexp_cdr(ls))
+      if ((n & 1) && (slow=sexp_cdr(slow)) == sexp_cdr(ls))
+        break;              /* circular */
+    if (sexp_pairp(ls)) {
+      enc->bad = x;
+    } else if (sexp_encode_tag(enc, SEXP_MSG_LIST) && sexp_encode_size(enc, n)) {
+      for (res=1, ls=x; res && sexp_pairp(ls); ls=sexp_cdr(ls))
+        res = sexp_encode(enc, sexp_car(ls));
+      res = res && sexp_encode(enc, ls);
+    }
+  } else if (sexp_vectorp(x)) {
+    n = sexp_vector_length(x);
+    res = sexp_encode_tag(enc, SEXP_MSG_VECTOR) && sexp_encode_size(enc, n);
+    for (i=0; res && i<n; i++)
+      res = sexp_encode(enc, sexp_vector_data(x)[i]);
+  } else if (sexp_shared_channelp(x, enc->channel_tag)
+             && sexp_cpointer_value(x)) {
+    res = sexp_encode_channel(enc, x);
+  } else {
+    enc->bad = x;
+  }
+  enc->depth--;
+  return res;
+}
+
+/* serialize x into a new message, or return an exception */
+static sexp sexp_make_message (sexp ctx, sexp self, sexp_uint_t channel_tag,
+                               sexp x, struct sexp_message_t **res) {
+  struct sexp_encoder_t enc;
+  struct sexp_message_t *msg;
+  size_t i;
+  memset(&enc, 0, sizeof(enc));
+  enc.ctx = ctx;
+  enc.channel_tag = channel_tag;
+  enc.bad = SEXP_FALSE;
+  msg = calloc(1, sizeof(struct sexp_message_t));
+  if (!msg || !sexp_encode(&enc, x)) {
+    free(msg);
+    for (i=0; i<enc.num_channels; i++)
+      sexp_shared_channel_release(enc.channels[i]);
+    free(enc.channels);
+    free(enc.buf);
+    if (msg && enc.bad != SEXP_FALSE)
+      return sexp_user_exception(ctx, self, "can't send object to another VM", enc.bad);
+    return sexp_global(ctx, SEXP_G_OOM_ERROR);
+  }
+  msg->data = enc.buf;
+  msg->len = enc.len;
+  msg->channels = enc.channels;
+  msg->num_channels = enc.num_channels;
+  *res = msg;
+  return SEXP_VOID;
+}
+
+struct sexp_decoder_t {
+  sexp_uint_t channel_tag;
+  struct sexp_message_t *msg;
+  size_t pos;
+};
+
+static int sexp_decode_bytes (struct sexp_decoder_t *dec, void *data, size_t n) {
+  if (dec->pos + n > dec->msg->len) return 0;
+  memcpy(data, dec->msg->data + dec->pos, n);
+  dec->pos += n;
+  return 1;
+}
+
+static sexp sexp_decode (sexp ctx, struct sexp_decoder_t *dec) {
+  unsigned char tag;
+  sexp_sint_t fx = 0;
+  double d;
+  size_t i, n = 0;
+  int c = 0;
+  sexp_gc_var3(res, tmp, tail);
+  if (!sexp_decode_bytes(dec, &tag, 1))
+    return sexp_global(ctx, SEXP_G_OOM_ERROR);
+  switch (tag) {
+  case SEXP_MSG_NULL: return SEXP_NULL;
+  case SEXP_MSG_TRUE: return SEXP_TRUE;
+  case SEXP_MSG_FALSE: return SEXP_FALSE;
+  case SEXP_MSG_VOID: return SEXP_VOID;
+  case SEXP_MSG_EOF: return SEXP_EOF;
+  case SEXP_MSG_FIXNUM:
+    sexp_decode_bytes(dec, &fx, sizeof(fx));
+    return sexp_make_fixnum(fx);
+  case SEXP_MSG_CHAR:
+    sexp_decode_bytes(dec, &c, sizeof(c));
+    return sexp_make_character(c);
+#if SEXP_USE_FLONUMS
+  case SEXP_MSG_FLONUM:
+    sexp_decode_bytes(dec, &d, sizeof(d));
+    return sexp_make_flonum(ctx, d);
+#endif
+  case SEXP_MSG_CHANNEL:
+    sexp_decode_bytes(dec, &n, sizeof(n));
+    if (n >= dec->msg->num_channels) break;
+    sexp_shared_channel_ref(dec->msg->channels[n]);
+    return sexp_wrap_shared_channel(ctx, dec->channel_tag, dec->msg->channels[n]);
+  }
+  sexp_gc_preserve3(ctx, res, tmp, tail);
+  res = sexp_global(ctx, SEXP_G_OOM_ERROR);
+  switch (tag) {
+  case SEXP_MSG_STRING: case SEXP_MSG_SYMBOL: case SEXP_MSG_NUMBER:
+  case SEXP_MSG_BYTES:
+    sexp_decode_bytes(dec, &n, sizeof(n));
+    if (dec->pos + n > dec->msg->len) break;
+    if (tag == SEXP_MSG_BYTES) {
+      res = sexp_make_bytes(ctx, sexp_make_fixnum(n), SEXP_ZERO);
+      if (sexp_bytesp(res))
+        memcpy(sexp_bytes_data(res), dec->msg->data + dec->pos, n);
+    } else if (tag == SEXP_MSG_SYMBOL) {
+      res = sexp_intern(ctx, (char*)dec->msg->data + dec->pos, n);
+    } else {
+      res = sexp_c_string(ctx, (char*)dec->msg->data + dec->pos, n);
+      if (tag == SEXP_MSG_NUMBER && sexp_stringp(res))
+        res = sexp_string_to_number(ctx, res, SEXP_TEN);
+    }
+    dec->pos += n;
+    break;
+  case SEXP_MSG_LIST:
+    sexp_decode_bytes(dec, &n, sizeof(n));
+    res = tail = SEXP_NULL;
+    for (i=0; i<n; i++) {
+      tmp = sexp_decode(ctx, dec);
+      if (sexp_exceptionp(tmp)) {
+        res = tmp;
+        goto done;
+      }
+      tmp = sexp_cons(ctx, tmp, SEXP_NULL);
+      if (sexp_pairp(tail))
+        sexp_cdr(tail) = tmp;
+      else
+        res = tmp;
+      tail = tmp;
+    }
+    tmp = sexp_decode(ctx, dec);
+    if (sexp_exceptionp(tmp))
+      res = tmp;
+    else if (sexp_pairp(tail))
+      sexp_cdr(tail) = tmp;
+    break;
+  case SEXP_MSG_VECTOR:
+    sexp_decode_bytes(dec, &n, sizeof(n));
+    if (n > dec->msg->len - dec->pos) break;
+    res = sexp_make_vector(ctx, sexp_make_fixnum(n), SEXP_VOID);
+    for (i=0; i<n && sexp_vectorp(res); i++) {
+      tmp = sexp_decode(ctx, dec);
+      if (sexp_exceptionp(tmp))
+        res = tmp;
+      else
+        sexp_vector_data(res)[i] = tmp;
+    }
+    break;
+  }
+ done:
+  sexp_gc_release3(ctx);
+  return res;
+}
+
+/* rebuild the value sent in msg, which is freed */
+static sexp sexp_open_message (sexp ctx, sexp_uint_t channel_tag,
+                               struct sexp_message_t *msg) {
+  struct sexp_decoder_t dec;
+  sexp res;
+  dec.channel_tag = channel_tag;
+  dec.msg = msg;
+  dec.pos = 0;
+  res = sexp_decode(ctx, &dec);
+  sexp_message_free(msg);
+  return res;
+}
+
+/**************************** primitives **********************************/
+
+sexp sexp_make_shared_channel (sexp ctx, sexp self, sexp_sint_t n) {
+  struct sexp_shared_channel_t *ch = sexp_shared_channel_new();
+  if (!ch)
+    return sexp_user_exception(ctx, self, "couldn't create channel", SEXP_NULL);
+  return sexp_wrap_shared_channel(ctx, sexp_unbox_fixnum(sexp_opcode_return_type(self)), ch);
+}
+
+#define sexp_assert_shared_channel(ctx, self, x)                        \
+  if (!sexp_shared_channelp(x, sexp_unbox_fixnum(sexp_opcode_arg1_type(self))) \
+      || !sexp_cpointer_value(x))                                       \
+    return sexp_type_exception(ctx, self, sexp_unbox_fixnum(sexp_opcode_arg1_type(self)), x)
+
+sexp sexp_shared_channel_send (sexp ctx, sexp self, sexp_sint_t n, sexp ch, sexp x) {
+  struct sexp_message_t *msg = NULL;
+  sexp res;
+  sexp_assert_shared_channel(ctx, self, ch);
+  res = sexp_make_message(ctx, self, sexp_pointer_tag(ch), x, &msg);
+  if (msg)
+    sexp_shared_channel_push(sexp_shared_channel(ch), msg);
+  return res;
+}
+
+sexp sexp_shared_channel_try_receive (sexp ctx, sexp self, sexp_sint_t n, sexp ch, sexp dflt) {
+  struct sexp_message_t *msg;
+  sexp_assert_shared_channel(ctx, self, ch);
+  msg = sexp_shared_channel_pop(sexp_shared_channel(ch));
+  return msg ? sexp_open_message(ctx, sexp_pointer_tag(ch), msg) : dflt;
+}
+
+sexp sexp_shared_channel_receive (sexp ctx, sexp self, sexp_sint_t n, sexp ch) {
+  struct sexp_message_t *msg;
+  struct pollfd pfd;
+#if SEXP_USE_GREEN_THREADS
+  sexp f;
+#endif
+  sexp_assert_shared_channel(ctx, self, ch);
+  while (!(msg = sexp_shared_channel_pop(sexp_shared_channel(ch)))) {
+#if SEXP_USE_GREEN_THREADS
+    /* let other green threads run until a message arrives */
+    f = sexp_global(ctx, SEXP_G_THREADS_BLOCKER);
+    if (sexp_applicablep(f)) {
+      sexp_apply2(ctx, f, sexp_make_fixnum(sexp_shared_channel(ch)->fds[0]), SEXP_FALSE);
+      return sexp_global(ctx, SEXP_G_IO_BLOCK_ERROR);
+    }
+#endif
+    pfd.fd = sexp_shared_channel(ch)->fds[0];
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+      return sexp_user_exception(ctx, self, "poll failed", ch);
+  }
+  return sexp_open_message(ctx, sexp_pointer_tag(ch), msg);
+}
+
+/**************************** VMs *****************************************/
+
+struct sexp_vm_start_t {
+  /* (module-path module-name proc-name), then the arguments, which */
+  /* are opened separately once the channel type is known */
+  struct sexp_message_t *init, *args;
+  struct sexp_shared_channel_t *done;
+  /* the new VM's own tag for shared channels, once it's loaded them */
+  sexp_uint_t channel_tag;
+};
+
+static void sexp_vm_start_free (struct sexp_vm_start_t *start) {
+  if (start->init) sexp_message_free(start->init);
+  if (start->args) sexp_message_free(start->args);
+  if (start->done) sexp_shared_channel_release(start->done);
+  free(start);
+}
+
+/* run (apply proc args) in a fresh context, and send back either */
+/* (ok . result) or (error . message) on the done channel */
+static sexp sexp_vm_run (sexp ctx, struct sexp_vm_start_t *start) {
+  sexp_uint_t tag = 0;
+  sexp_gc_var4(env, x, res, tmp);
+  sexp_gc_preserve4(ctx, env, x, res, tmp);
+  x = sexp_open_message(ctx, 0, start->init);
+  start->init = NULL;
+  res = x;
+  if (!sexp_exceptionp(x)) {
+    /* the standard env is found on the parent's module path */
+    sexp_global(ctx, SEXP_G_MODULE_PATH) = sexp_car(x);
+    env = res = sexp_load_standard_env(ctx, NULL, SEXP_SEVEN);
+  }
+  if (!sexp_exceptionp(res)) {
+    sexp_load_standard_ports(ctx, env, stdin, stdout, stderr, 1);
+    /* (environment '(chibi parallel) '<module>) */
+    tmp = sexp_list2(ctx, sexp_intern(ctx, "quote", -1), sexp_cadr(x));
+    res = sexp_list2(ctx, sexp_intern(ctx, "chibi", -1), sexp_intern(ctx, "parallel", -1));
+    res = sexp_list2(ctx, sexp_intern(ctx, "quote", -1), res);
+    res = sexp_list3(ctx, sexp_intern(ctx, "environment", -1), res, tmp);
+    env = sexp_eval(ctx, res, sexp_global(ctx, SEXP_G_META_ENV));
+    res = env;
+  }
+  if (!sexp_exceptionp(res)) {
+    tmp = sexp_env_ref(ctx, env, sexp_intern(ctx, "SharedChannel", -1), SEXP_FALSE);
+    if (sexp_typep(tmp)) start->channel_tag = tag = sexp_type_tag(tmp);
+    res = sexp_open_message(ctx, tag, start->args);
+    start->args = NULL;
+  }
+  if (!sexp_exceptionp(res)) {
+    tmp = sexp_env_ref(ctx, env, sexp_caddr(x), SEXP_FALSE);
+    res = sexp_procedurep(tmp) || sexp_opcodep(tmp)
+      ? sexp_apply(ctx, tmp, res)
+      : sexp_user_exception(ctx, SEXP_FALSE, "undefined procedure", sexp_caddr(x));
+  }
+  if (sexp_exceptionp(res)) {
+    tmp = sexp_open_output_string(ctx);
+    sexp_print_exception(ctx, res, tmp);
+    res = sexp_cons(ctx, sexp_intern(ctx, "error", -1), sexp_get_output_string(ctx, tmp));
+  } else {
+    res = sexp_cons(ctx, sexp_intern(ctx, "ok", -1), res);
+  }
+  sexp_gc_release4(ctx);
+  return res;
+}
+
+static void* sexp_vm_main (void *data) {
+  struct sexp_vm_start_t *start = (struct sexp_vm_start_t*)data;
+  struct sexp_message_t *msg = NULL;
+  sexp ctx, tmp;
+  ctx = sexp_make_eval_context(NULL, NULL, NULL, 0, 0);
+  if (ctx && !sexp_exceptionp(ctx)) {
+    tmp = sexp_vm_run(ctx, start);
+    if (sexp_exceptionp(sexp_make_message(ctx, NULL, start->channel_tag, tmp, &msg))) {
+      tmp = sexp_c_string(ctx, "can't send the result of a VM", -1);
+      tmp = sexp_cons(ctx, sexp_intern(ctx, "error", -1), tmp);
+      sexp_make_message(ctx, NULL, start->channel_tag, tmp, &msg);
+    }
+    sexp_destroy_context(ctx);
+  }
+  if (msg)
+    sexp_shared_channel_push(start->done, msg);
+  sexp_vm_start_free(start);
+  return NULL;
+}
+
+/* start running (apply proc args), with proc imported from module, */
+/* in a new VM in its own OS thread, and return the channel its */
+/* result will be sent on */
+sexp sexp_spawn_vm (sexp ctx, sexp self, sexp_sint_t n, sexp module, sexp proc, sexp args) {
+#if SEXP_USE_GLOBAL_HEAP || SEXP_USE_GLOBAL_SYMBOLS
+  return sexp_user_exception(ctx, self, "VMs need separate heaps", SEXP_NULL);
+#else
+  struct sexp_vm_start_t *start;
+  sexp_uint_t tag = sexp_unbox_fixnum(sexp_opcode_return_type(self));
+  pthread_attr_t attr;
+  pthread_t thread;
+  sexp ls;
+  sexp_gc_var2(res, tmp);
+  sexp_assert_type(ctx, sexp_symbolp, SEXP_SYMBOL, proc);
+  if (!sexp_nullp(args)) sexp_assert_type(ctx, sexp_pairp, SEXP_PAIR, args);
+  start = calloc(1, sizeof(struct sexp_vm_start_t));
+  if (!start) return sexp_global(ctx, SEXP_G_OOM_ERROR);
+  sexp_gc_preserve2(ctx, res, tmp);
+  /* the new VM searches the same module path */
+  for (tmp=SEXP_NULL, ls=sexp_global(ctx, SEXP_G_MODULE_PATH); sexp_pairp(ls); ls=sexp_cdr(ls))
+    if (sexp_stringp(sexp_car(ls)))
+      tmp = sexp_cons(ctx, sexp_car(ls), tmp);
+  tmp = sexp_nreverse(ctx, tmp);
+  tmp = sexp_list3(ctx, tmp, module, proc);
+  res = sexp_make_message(ctx, self, tag, tmp, &start->init);
+  if (!sexp_exceptionp(res))
+    res = sexp_make_message(ctx, self, tag, args, &start->args);
+  if (!sexp_exceptionp(res)) {
+    start->done = sexp_shared_channel_new();
+    res = start->done
+      ? sexp_wrap_shared_channel(ctx, tag, start->done)
+      : sexp_user_exception(ctx, self, "couldn't create channel", SEXP_NULL);
+  }
+  if (!sexp_exceptionp(res)) {
+    sexp_shared_channel_ref(start->done);   /* for the new thread */
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, sexp_vm_main, start) != 0) {
+      res = sexp_user_exception(ctx, self, "couldn't create thread", SEXP_NULL);
+      sexp_vm_start_free(start);
+    }
+    pthread_attr_destroy(&attr);
+  } else {
+    if (start->done && sexp_exceptionp(res))
+      sexp_shared_channel_release(start->done);
+    start->done = NULL;
+    sexp_vm_start_free(start);
+  }
+  sexp_gc_release2(ctx);
+  return res;
+#endif
+}
+
+/**************************************************************************/
+
+sexp sexp_init_library (sexp ctx, sexp self, sexp_sint_t n, sexp env, const char* version, const sexp_abi_identifier_t abi) {
+  sexp type, op;
+  sexp_gc_var2(name, tmp);
+  if (!(sexp_version_compatible(ctx, version, sexp_version)
+        && sexp_abi_compatible(ctx, abi, SEXP_ABI_IDENTIFIER)))
+    return SEXP_ABI_ERROR;
+  sexp_gc_preserve2(ctx, name, tmp);
+  name = sexp_c_string(ctx, "shared-channel", -1);
+  type = sexp_register_c_type(ctx, name, sexp_free_shared_channel);
+  if (sexp_typep(type)) {
+    tmp = sexp_make_fixnum(sexp_type_tag(type));
+    sexp_env_define(ctx, env, sexp_intern(ctx, "SharedChannel", -1), type);
+    op = sexp_make_type_predicate(ctx, name, type);
+    sexp_env_define(ctx, env, sexp_intern(ctx, "shared-channel?", -1), op);
+    op = sexp_define_foreign(ctx, env, "make-shared-channel", 0, sexp_make_shared_channel);
+    if (sexp_opcodep(op)) sexp_opcode_return_type(op) = tmp;
+    op = sexp_define_foreign(ctx, env, "shared-channel-send!", 2, sexp_shared_channel_send);
+    if (sexp_opcodep(op)) sexp_opcode_arg1_type(op) = tmp;
+    op = sexp_define_foreign(ctx, env, "shared-channel-receive!", 1, sexp_shared_channel_receive);
+    if (sexp_opcodep(op)) sexp_opcode_arg1_type(op) = tmp;
+    op = sexp_define_foreign(ctx, env, "%shared-channel-try-receive!", 2, sexp_shared_channel_try_receive);
+    if (sexp_opcodep(op)) sexp_opcode_arg1_type(op) = tmp;
+    op = sexp_define_foreign(ctx, env, "%spawn-vm", 3, sexp_spawn_vm);
+    if (sexp_opcodep(op)) sexp_opcode_return_type(op) = tmp;
+  }
+  sexp_gc_release2(ctx);
+  return SEXP_VOID;
+}
@@ -0,0 +1,34 @@
+;; parallel.scm -- independent VMs in OS threads
+;; BSD-style license: http://synthcode.com/license.txt
+
+;;> Removes and returns the oldest value sent on \var{ch}, or returns
+;;> \var{default} (\scheme{#f} if not given) without waiting if
+;;> there is none.
+
+(define (shared-channel-try-receive! ch . o)
+  (%shared-channel-try-receive! ch (if (pair? o) (car o) #f)))
+
+(define-record-type VM
+  (%make-vm done result)
+  vm?
+  (done vm-done)
+  (result vm-result vm-result-set!))
+
+;;> Starts a new VM in a new OS thread, which imports \var{module}
+;;> and calls the procedure it exports named \var{proc} on copies of
+;;> \var{args}.  Returns immediately with the VM.
+
+(define (spawn-vm module proc . args)
+  (%make-vm (%spawn-vm module proc args) #f))
+
+;;> Waits for \var{vm} to finish and returns a copy of its result.
+;;> If the VM raised an error, an error with the printed exception is
+;;> raised in the caller instead.
+
+(define (vm-join! vm)
+  (if (not (vm-result vm))
+      (vm-result-set! vm (shared-channel-receive! (vm-done vm))))
+  (let ((res (vm-result vm)))
+    (if (eq? 'ok (car res))
+        (cdr res)
+        (error "VM failed" (cdr res)))))
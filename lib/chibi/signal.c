@@ -138,9 +138,13 @@ static pid_t sexp_fork_and_kill_threads (sexp ctx) {
   pid_t res = fork();
 #if SEXP_USE_GREEN_THREADS
   if (res == 0) {               /* child */
-    sexp_global(ctx, SEXP_G_THREADS_FRONT) = SEXP_NULL;
-    sexp_global(ctx, SEXP_G_THREADS_BACK) = SEXP_NULL;
+    sexp_global(ctx, SEXP_G_THREADS_RUNNABLE) = SEXP_FALSE;
     sexp_global(ctx, SEXP_G_THREADS_PAUSED) = SEXP_NULL;
+    sexp_global(ctx, SEXP_G_THREADS_TIMERS) = SEXP_FALSE;
+    sexp_global(ctx, SEXP_G_THREADS_FD_THREADS) = SEXP_FALSE;
+    sexp_global(ctx, SEXP_G_THREADS_BLOCKED) = SEXP_FALSE;
+    /* don't share the parent's epoll set */
+    sexp_global(ctx, SEXP_G_THREADS_POLL_FDS) = SEXP_FALSE;
   }
 #endif
   return res;
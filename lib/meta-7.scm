@@ -171,18 +171,188 @@
          (cdr x)))))
    meta))
 
+;; Compiled module cache.  The code of a library is recorded as it's
+;; loaded from source, one chunk per included file or body, and on
+;; later loads replayed in place of compiling the source, so long as
+;; the build, features and source files of the library and everything
+;; it imports are unchanged.  A cache is a vector #(key envs chunks
+;; recorded prev) where chunks is the list of chunks left to replay, or
+;; #t while recording.
+
+(cond-expand
+ (module-cache
+  (define (module-import-names meta)
+    (let lp ((ls meta) (res '()))
+      (cond
+       ((null? ls) (reverse res))
+       ((and (pair? (car ls)) (memq (caar ls) '(import import-immutable)))
+        (lp (cdr ls)
+            (append (reverse (map (lambda (m) (car (%resolve-import m)))
+                                  (cdar ls)))
+                    res)))
+       (else (lp (cdr ls) res)))))
+
+  (define (module-dependencies meta)
+    (let lp ((ls (module-import-names meta)) (res '()))
+      (cond
+       ((null? ls) (reverse res))
+       ((assoc (car ls) res) (lp (cdr ls) res))
+       (else
+        (let* ((mod (find-module (car ls)))
+               (meta2 (and mod (module-meta-data mod))))
+          (lp (if (pair? meta2)
+                  (append (cdr ls) (module-import-names meta2))
+                  (cdr ls))
+              (if mod (cons (cons (car ls) mod) res) res)))))))
+
+  ;; The .sld defining a library followed by the files it includes,
+  ;; or #f if it wasn't loaded from a file.
+  (define (module-source-files name meta)
+    (let ((dir (module-name-prefix name)))
+      (define (find-files files ext res)
+        (if (null? files)
+            res
+            (find-files (cdr files) ext
+                        (cond ((find-module-file
+                                (string-append dir (car files) ext))
+                               => (lambda (path) (cons path res)))
+                              (else res)))))
+      (cond
+       ((find-module-file (module-name->file name))
+        => (lambda (sld)
+             (let lp ((ls meta) (res (list sld)))
+               (if (null? ls)
+                   (reverse res)
+                   (let ((x (car ls)))
+                     (lp (cdr ls)
+                         (case (and (pair? x) (car x))
+                           ((include include-ci)
+                            (find-files (cdr x) "" res))
+                           ((include-shared)
+                            (find-files (cdr x) *shared-object-extension* res))
+                           ((include-shared-optionally)
+                            (let ((so (find-files (list (cadr x))
+                                                  *shared-object-extension*
+                                                  res)))
+                              (if (eq? so res)
+                                  (find-files (cddr x) "" res)
+                                  so)))
+                           (else res))))))))
+       (else #f))))
+
+  (define (module-cache-key name meta deps)
+    (let ((files (module-source-files name meta)))
+      (and files
+           (let lp ((ls deps) (res (reverse files)))
+             (if (null? ls)
+                 (cons name (cons *features* (reverse res)))
+                 (let ((meta2 (module-meta-data (cdar ls))))
+                   (lp (cdr ls)
+                       (if (pair? meta2)
+                           (append (reverse
+                                    (or (module-source-files (caar ls) meta2)
+                                        '()))
+                                   res)
+                           res))))))))
+
+  (define (open-module-cache name meta)
+    (let* ((deps (module-dependencies meta))
+           (key (module-cache-key name meta deps))
+           (chunks (and key (%open-module-cache key))))
+      (and chunks
+           (vector key
+                   (let lp ((ls deps) (res '()))
+                     (cond ((null? ls) (reverse res))
+                           ((module-env (cdar ls))
+                            => (lambda (env)
+                                 (lp (cdr ls) (cons (cons (caar ls) env) res))))
+                           (else (lp (cdr ls) res))))
+                   chunks
+                   '()
+                   #f))))
+
+  ;; Runs (proc skip eval-form) to evaluate all but the first skip
+  ;; forms of the next chunk, replaying what it can from the cache.
+  (define (module-cache-run cache env proc)
+    (let ((chunks (and cache (vector-ref cache 2))))
+      (cond
+       ((pair? chunks)
+        (vector-set! cache 2 (cdr chunks))
+        (let lp ((ls (car chunks)) (i 0))
+          (if (pair? ls)
+              (let ((x (%module-cache-entry (car ls) env (vector-ref cache 1))))
+                (cond
+                 ((procedure? x) (x) (lp (cdr ls) (+ i 1)))
+                 (x (lp (cdr ls) i))
+                 (else
+                  (%save-module-cache (vector-ref cache 0) #f)
+                  (vector-set! cache 2 #f)
+                  (proc i (lambda (x) (eval x env)))))))))
+       ((eq? chunks #t)
+        (let ((prev (%module-cache-begin! env (vector-ref cache 1))))
+          (vector-set! cache 4 prev)
+          (proc 0 (lambda (x)
+                    (let ((thunk (%module-cache-compile x)))
+                      (if (procedure? thunk) (thunk) (raise thunk)))))
+          (vector-set! cache 3 (cons (%module-cache-end! prev)
+                                     (vector-ref cache 3)))))
+       (else
+        (proc 0 (lambda (x) (eval x env)))))))
+
+  (define (close-module-cache cache)
+    (if (and cache
+             (eq? #t (vector-ref cache 2))
+             (pair? (vector-ref cache 3))
+             (not (memq #f (vector-ref cache 3))))
+        (%save-module-cache (vector-ref cache 0)
+                            (reverse (vector-ref cache 3)))))
+
+  (define (abort-module-cache cache)
+    (cond
+     ((and cache (eq? #t (vector-ref cache 2)))
+      (%module-cache-end! (vector-ref cache 4))
+      (vector-set! cache 2 #f)))))
+ (else
+  (define (open-module-cache name meta) #f)
+  (define (module-cache-run cache env proc)
+    (proc 0 (lambda (x) (eval x env))))
+  (define (close-module-cache cache) #f)
+  (define (abort-module-cache cache) #f)))
+
 (define (eval-module name mod . o)
   (let ((env (if (pair? o) (car o) (make-environment)))
         (meta (module-meta-data mod))
         (dir (module-name-prefix name)))
-    (define (load-modules files extension fold? . o)
+    (define (load-source path fold? cache)
+      (let ((old-env (current-environment)))
+        (dynamic-wind
+          (lambda () (set-current-environment! env))
+          (lambda ()
+            (module-cache-run
+             cache env
+             (lambda (skip eval-form)
+               (let ((in (open-input-file path)))
+                 (if fold? (set-port-fold-case! in #t))
+                 (set-port-line! in 1)
+                 (let lp ((i 0))
+                   (let ((x (read in)))
+                     (cond
+                      ((eof-object? x)
+                       (close-input-port in))
+                      (else
+                       (if (>= i skip) (eval-form x))
+                       (lp (+ i 1))))))))))
+          (lambda () (set-current-environment! old-env)))))
+    (define (load-modules files extension fold? cache . o)
       (for-each
        (lambda (f)
          (let ((f (string-append dir f extension)))
            (cond
             ((find-module-file f)
              => (lambda (path)
-                  (cond (fold?
+                  (cond ((and cache (equal? extension ""))
+                         (load-source path fold? cache))
+                        (fold?
                          (let ((in (open-input-file path)))
                            (set-port-fold-case! in #t)
                            (load in env)))
@@ -200,32 +370,38 @@
        mod
        `((error "module attempted to reference itself while loading" ,name)))
       (resolve-module-imports env meta)
-      (protect
-          (exn (else
-                (module-meta-data-set! mod meta)
-                (if (not (any (lambda (x)
-                                (and (pair? x)
-                                     (memq (car x) '(import import-immutable))))
-                              meta))
-                    (warn "WARNING: exception inside module with no imports - did you forget to (import (scheme base)) in" name))
-                (raise-continuable exn)))
-        (for-each
-         (lambda (x)
-           (case (and (pair? x) (car x))
-             ((include)
-              (load-modules (cdr x) "" #f))
-             ((include-ci)
-              (load-modules (cdr x) "" #t))
-             ((include-shared)
-              (load-modules (cdr x) *shared-object-extension* #f))
-             ((include-shared-optionally)
-              (load-modules (list (cadr x)) *shared-object-extension* #f
-                            (lambda () (load-modules (cddr x) "" #f))))
-             ((body begin)
-              (for-each (lambda (expr) (eval expr env)) (cdr x)))
-             ((error)
-              (apply error (cdr x)))))
-         meta))
+      (let ((cache (open-module-cache name meta)))
+        (protect
+            (exn (else
+                  (abort-module-cache cache)
+                  (module-meta-data-set! mod meta)
+                  (if (not (any (lambda (x)
+                                  (and (pair? x)
+                                       (memq (car x) '(import import-immutable))))
+                                meta))
+                      (warn "WARNING: exception inside module with no imports - did you forget to (import (scheme base)) in" name))
+                  (raise-continuable exn)))
+          (for-each
+           (lambda (x)
+             (case (and (pair? x) (car x))
+               ((include)
+                (load-modules (cdr x) "" #f cache))
+               ((include-ci)
+                (load-modules (cdr x) "" #t cache))
+               ((include-shared)
+                (load-modules (cdr x) *shared-object-extension* #f #f))
+               ((include-shared-optionally)
+                (load-modules (list (cadr x)) *shared-object-extension* #f #f
+                              (lambda () (load-modules (cddr x) "" #f cache))))
+               ((body begin)
+                (module-cache-run
+                 cache env
+                 (lambda (skip eval-form)
+                   (for-each eval-form (list-tail (cdr x) skip)))))
+               ((error)
+                (apply error (cdr x)))))
+           meta))
+        (close-module-cache cache))
       (module-meta-data-set! mod meta)
       (warn-undefs env #f)
       env))))
@@ -7,28 +7,42 @@
 #include <sys/time.h>
 #include <unistd.h>
 #include <poll.h>
+#if SEXP_USE_EPOLL
+#include <sys/epoll.h>
+#endif
 
 #define sexp_mutexp(ctx, x)      (sexp_check_tag(x, sexp_unbox_fixnum(sexp_global(ctx, SEXP_G_THREADS_MUTEX_ID))))
 #define sexp_mutex_name(x)       sexp_slot_ref(x, 0)
 #define sexp_mutex_specific(x)   sexp_slot_ref(x, 1)
 #define sexp_mutex_thread(x)     sexp_slot_ref(x, 2)
 #define sexp_mutex_lockp(x)      sexp_slot_ref(x, 3)
+#define sexp_mutex_timers(x)     sexp_slot_ref(x, SEXP_MUTEX_TIMERS)
 
 #define sexp_condvar_name(x)     sexp_slot_ref(x, 0)
 #define sexp_condvar_specific(x) sexp_slot_ref(x, 1)
-#define sexp_condvar_threads(x)  sexp_slot_ref(x, 2)
+#define sexp_condvar_threads(x)  sexp_slot_ref(x, SEXP_CONDVAR_THREADS)
+
+#define SEXP_MUTEX_TIMERS 4
+#define SEXP_CONDVAR_THREADS 2
 
 struct sexp_pollfds_t {
   struct pollfd *fds;
   nfds_t nfds, mfds;
+#if SEXP_USE_EPOLL
+  int epfd;
+#endif
 };
 
 #define SEXP_INIT_POLLFDS_MAX_FDS 16
+#define SEXP_INIT_FD_THREADS_SIZE 64
+#define SEXP_INIT_TIMERS_SIZE 64
+#define SEXP_MAX_EPOLL_EVENTS 64
 
 #define sexp_pollfdsp(ctx, x)    (sexp_check_tag(x, sexp_unbox_fixnum(sexp_global(ctx, SEXP_G_THREADS_POLLFDS_ID))))
 #define sexp_pollfds_fds(x)      (((struct sexp_pollfds_t*)(&(x)->value))->fds)
 #define sexp_pollfds_num_fds(x)  (((struct sexp_pollfds_t*)(&(x)->value))->nfds)
 #define sexp_pollfds_max_fds(x)  (((struct sexp_pollfds_t*)(&(x)->value))->mfds)
+#define sexp_pollfds_epfd(x)     (((struct sexp_pollfds_t*)(&(x)->value))->epfd)
 
 #define sexp_sizeof_pollfds (sexp_sizeof_header + sizeof(struct sexp_pollfds_t))
 
@@ -68,6 +82,45 @@ sexp sexp_thread_specific_set (sexp ctx, sexp self, sexp_sint_t n, sexp thread,
   return SEXP_VOID;
 }
 
+/* priorities are clamped to a few levels, one run queue each */
+#define SEXP_MIN_THREAD_PRIORITY -2
+#define SEXP_MAX_THREAD_PRIORITY 2
+
+sexp sexp_thread_base_priority (sexp ctx, sexp self, sexp_sint_t n, sexp thread) {
+  sexp_assert_type(ctx, sexp_contextp, SEXP_CONTEXT, thread);
+  return sexp_make_fixnum(sexp_context_priority(thread));
+}
+
+sexp sexp_thread_base_priority_set (sexp ctx, sexp self, sexp_sint_t n, sexp thread, sexp priority) {
+  sexp_sint_t p;
+  sexp_assert_type(ctx, sexp_contextp, SEXP_CONTEXT, thread);
+  sexp_assert_type(ctx, sexp_fixnump, SEXP_FIXNUM, priority);
+  p = sexp_unbox_fixnum(priority);
+  if (p < SEXP_MIN_THREAD_PRIORITY) p = SEXP_MIN_THREAD_PRIORITY;
+  if (p > SEXP_MAX_THREAD_PRIORITY) p = SEXP_MAX_THREAD_PRIORITY;
+  /* takes effect the next time the thread is queued */
+  sexp_context_priority(thread) = p;
+  return SEXP_VOID;
+}
+
+/* the number of VM instructions a thread runs before others get a */
+/* turn, kept apart from its refuel, which only says whether it has */
+/* terminated */
+sexp sexp_thread_quantum (sexp ctx, sexp self, sexp_sint_t n, sexp thread) {
+  sexp_assert_type(ctx, sexp_contextp, SEXP_CONTEXT, thread);
+  return sexp_make_fixnum(sexp_context_quantum(thread));
+}
+
+sexp sexp_thread_quantum_set (sexp ctx, sexp self, sexp_sint_t n, sexp thread, sexp quantum) {
+  sexp_assert_type(ctx, sexp_contextp, SEXP_CONTEXT, thread);
+  sexp_assert_type(ctx, sexp_fixnump, SEXP_FIXNUM, quantum);
+  if (sexp_unbox_fixnum(quantum) <= 0)
+    return sexp_xtype_exception(ctx, self, "quantum must be positive", quantum);
+  /* takes effect from the thread's next turn */
+  sexp_context_quantum(thread) = sexp_unbox_fixnum(quantum);
+  return SEXP_VOID;
+}
+
 sexp sexp_thread_end_result (sexp ctx, sexp self, sexp_sint_t n, sexp thread) {
   sexp_assert_type(ctx, sexp_contextp, SEXP_CONTEXT, thread);
   return sexp_context_result(thread) ? sexp_context_result(thread) : SEXP_VOID;
@@ -109,17 +162,106 @@ sexp sexp_make_thread (sexp ctx, sexp self, sexp_sint_t n, sexp thunk, sexp name
   return res;
 }
 
+/**************************** run queue ***********************************/
+
+/* Runnable threads are kept in SEXP_G_THREADS_RUNNABLE, a vector of */
+/* the total number of runnable threads followed by a ring buffer for */
+/* each priority level, highest first.  A ring buffer is a vector of */
+/* its head index and length followed by the threads, and only grows */
+/* when full, so switching threads doesn't allocate.  The oldest */
+/* thread of the highest non-empty level always runs next. */
+
+#define SEXP_NUM_THREAD_PRIORITIES (SEXP_MAX_THREAD_PRIORITY - SEXP_MIN_THREAD_PRIORITY + 1)
+#define SEXP_INIT_RUN_QUEUE_SIZE 16
+
+#define sexp_run_queue_head(q)   sexp_unbox_fixnum(sexp_vector_data(q)[0])
+#define sexp_run_queue_length(q) sexp_unbox_fixnum(sexp_vector_data(q)[1])
+#define sexp_run_queue_size(q)   (sexp_vector_length(q) - 2)
+#define sexp_run_queue_ref(q, i) \
+  (sexp_vector_data(q)[2 + (sexp_run_queue_head(q) + (i)) % sexp_run_queue_size(q)])
+
+static sexp_uint_t sexp_num_runnable (sexp ctx) {
+  sexp vec = sexp_global(ctx, SEXP_G_THREADS_RUNNABLE);
+  return sexp_vectorp(vec) ? sexp_unbox_fixnum(sexp_vector_data(vec)[0]) : 0;
+}
+
+/* the index of the highest non-empty run queue, or 0 if none */
+static sexp_uint_t sexp_next_run_queue (sexp ctx) {
+  sexp_uint_t level;
+  sexp q;
+  if (sexp_num_runnable(ctx) > 0)
+    for (level=1; level<=SEXP_NUM_THREAD_PRIORITIES; level++) {
+      q = sexp_vector_data(sexp_global(ctx, SEXP_G_THREADS_RUNNABLE))[level];
+      if (sexp_vectorp(q) && sexp_run_queue_length(q) > 0)
+        return level;
+    }
+  return 0;
+}
+
+#define sexp_run_queue_priority(level) (SEXP_MAX_THREAD_PRIORITY + 1 - (sexp_sint_t)(level))
+
+/* add thread to the back (or front) of the queue for its priority */
+static void sexp_add_runnable (sexp ctx, sexp thread, int frontp) {
+  sexp_uint_t level = SEXP_MAX_THREAD_PRIORITY + 1 - sexp_context_priority(thread);
+  sexp_uint_t i, n, len;
+  sexp_gc_var4(vec, q, tmp, th);
+  sexp_gc_preserve4(ctx, vec, q, tmp, th);
+  th = thread;                  /* may no longer be referenced elsewhere */
+  vec = sexp_global(ctx, SEXP_G_THREADS_RUNNABLE);
+  if (!sexp_vectorp(vec)) {
+    vec = sexp_make_vector(ctx, sexp_make_fixnum(SEXP_NUM_THREAD_PRIORITIES + 1), SEXP_FALSE);
+    if (!sexp_vectorp(vec)) goto done;
+    sexp_vector_data(vec)[0] = SEXP_ZERO;
+    sexp_global(ctx, SEXP_G_THREADS_RUNNABLE) = vec;
+  }
+  q = sexp_vector_data(vec)[level];
+  n = sexp_vectorp(q) ? sexp_run_queue_length(q) : 0;
+  if (!sexp_vectorp(q) || n == (sexp_uint_t)sexp_run_queue_size(q)) {
+    len = sexp_vectorp(q) ? 2 * sexp_run_queue_size(q) : SEXP_INIT_RUN_QUEUE_SIZE;
+    tmp = sexp_make_vector(ctx, sexp_make_fixnum(len + 2), SEXP_FALSE);
+    if (!sexp_vectorp(tmp)) goto done;
+    for (i=0; i<n; i++)         /* unwrap the ring */
+      sexp_vector_data(tmp)[2 + i] = sexp_run_queue_ref(q, i);
+    sexp_vector_data(tmp)[0] = SEXP_ZERO;
+    sexp_vector_data(tmp)[1] = sexp_make_fixnum(n);
+    sexp_vector_data(vec)[level] = q = tmp;
+  }
+  if (frontp) {
+    sexp_vector_data(q)[0] = sexp_make_fixnum((sexp_run_queue_head(q) + sexp_run_queue_size(q) - 1) % sexp_run_queue_size(q));
+    sexp_run_queue_ref(q, 0) = th;
+  } else {
+    sexp_run_queue_ref(q, n) = th;
+  }
+  sexp_vector_data(q)[1] = sexp_make_fixnum(n + 1);
+  sexp_vector_data(vec)[0] = sexp_make_fixnum(sexp_num_runnable(ctx) + 1);
+ done:
+  sexp_gc_release4(ctx);
+}
+
+/* remove and return the next thread to run, or false if none */
+static sexp sexp_pop_runnable (sexp ctx) {
+  sexp_uint_t level = sexp_next_run_queue(ctx);
+  sexp vec, q, res;
+  if (level == 0)
+    return SEXP_FALSE;
+  vec = sexp_global(ctx, SEXP_G_THREADS_RUNNABLE);
+  q = sexp_vector_data(vec)[level];
+  res = sexp_run_queue_ref(q, 0);
+  sexp_run_queue_ref(q, 0) = SEXP_FALSE;
+  sexp_vector_data(q)[0] = sexp_make_fixnum((sexp_run_queue_head(q) + 1) % sexp_run_queue_size(q));
+  sexp_vector_data(q)[1] = sexp_make_fixnum(sexp_run_queue_length(q) - 1);
+  sexp_vector_data(vec)[0] = sexp_make_fixnum(sexp_num_runnable(ctx) - 1);
+  return res;
+}
+
+static void sexp_enqueue_thread (sexp ctx, sexp thread) {
+  sexp_add_runnable(ctx, thread, 0);
+}
+
 sexp sexp_thread_start (sexp ctx, sexp self, sexp_sint_t n, sexp thread) {
-  sexp cell;
   sexp_assert_type(ctx, sexp_contextp, SEXP_CONTEXT, thread);
   sexp_context_errorp(thread) = 0;
-  cell = sexp_cons(ctx, thread, SEXP_NULL);
-  if (sexp_pairp(sexp_global(ctx, SEXP_G_THREADS_BACK))) {
-    sexp_cdr(sexp_global(ctx, SEXP_G_THREADS_BACK)) = cell;
-    sexp_global(ctx, SEXP_G_THREADS_BACK) = cell;
-  } else {            /* init queue */
-    sexp_global(ctx, SEXP_G_THREADS_BACK) = sexp_global(ctx, SEXP_G_THREADS_FRONT) = cell;
-  }
+  sexp_enqueue_thread(ctx, thread);
   return thread;
 }
 
@@ -136,6 +278,314 @@ static int sexp_delete_list (sexp ctx, int global, sexp x) {
   }
 }
 
+/**************************** timers **************************************/
+
+/* Threads waiting with a timeout are kept in a binary min-heap on */
+/* their timeval in SEXP_G_THREADS_TIMERS.  Slot 0 of the vector is */
+/* the number of timers and slots 1..n hold the threads, each of */
+/* which records its slot in sexp_context_timer (0 if it has none). */
+/* The next deadline is always slot 1, and adding or cancelling a */
+/* timer is O(log n).  The paused list only holds threads waiting */
+/* without a timeout. */
+
+#define sexp_timer_before(a, b) timeval_le(sexp_context_timeval(a), sexp_context_timeval(b))
+
+static sexp_uint_t sexp_num_timers (sexp ctx) {
+  sexp vec = sexp_global(ctx, SEXP_G_THREADS_TIMERS);
+  return sexp_vectorp(vec) ? sexp_unbox_fixnum(sexp_vector_data(vec)[0]) : 0;
+}
+
+/* the thread with the earliest deadline, or false if none */
+static sexp sexp_next_timer (sexp ctx) {
+  if (sexp_num_timers(ctx) == 0)
+    return SEXP_FALSE;
+  return sexp_vector_data(sexp_global(ctx, SEXP_G_THREADS_TIMERS))[1];
+}
+
+static void sexp_timers_sift_up (sexp *timers, sexp_uint_t i) {
+  sexp thread = timers[i];
+  for ( ; i > 1 && sexp_timer_before(thread, timers[i/2]); i /= 2) {
+    timers[i] = timers[i/2];
+    sexp_context_timer(timers[i]) = i;
+  }
+  timers[i] = thread;
+  sexp_context_timer(thread) = i;
+}
+
+static void sexp_timers_sift_down (sexp *timers, sexp_uint_t n, sexp_uint_t i) {
+  sexp_uint_t j;
+  sexp thread = timers[i];
+  for ( ; (j = 2*i) <= n; i = j) {
+    if (j < n && sexp_timer_before(timers[j+1], timers[j]))
+      j++;
+    if (! sexp_timer_before(timers[j], thread))
+      break;
+    timers[i] = timers[j];
+    sexp_context_timer(timers[i]) = i;
+  }
+  timers[i] = thread;
+  sexp_context_timer(thread) = i;
+}
+
+static void sexp_add_timer (sexp ctx, sexp thread) {
+  sexp_uint_t n = sexp_num_timers(ctx), len;
+  sexp_gc_var2(vec, tmp);
+  sexp_gc_preserve2(ctx, vec, tmp);
+  vec = sexp_global(ctx, SEXP_G_THREADS_TIMERS);
+  if (!sexp_vectorp(vec) || n + 1 >= sexp_vector_length(vec)) {
+    len = sexp_vectorp(vec) ? 2 * sexp_vector_length(vec) : SEXP_INIT_TIMERS_SIZE;
+    tmp = sexp_make_vector(ctx, sexp_make_fixnum(len), SEXP_FALSE);
+    if (sexp_vectorp(tmp)) {
+      if (sexp_vectorp(vec))
+        memcpy(sexp_vector_data(tmp), sexp_vector_data(vec), (n + 1) * sizeof(sexp));
+      else
+        sexp_vector_data(tmp)[0] = SEXP_ZERO;
+      sexp_global(ctx, SEXP_G_THREADS_TIMERS) = tmp;
+    }
+    vec = tmp;
+  }
+  if (sexp_vectorp(vec)) {
+    sexp_vector_data(vec)[0] = sexp_make_fixnum(n + 1);
+    sexp_vector_data(vec)[n + 1] = thread;
+    sexp_timers_sift_up(sexp_vector_data(vec), n + 1);
+  }
+  sexp_gc_release2(ctx);
+}
+
+/* return true if thread had a timer */
+static int sexp_cancel_timer (sexp ctx, sexp thread) {
+  sexp_uint_t i = sexp_context_timer(thread), n = sexp_num_timers(ctx);
+  sexp last, *timers;
+  sexp_context_timer(thread) = 0;
+  if (i == 0 || i > n)
+    return 0;
+  timers = sexp_vector_data(sexp_global(ctx, SEXP_G_THREADS_TIMERS));
+  if (timers[i] != thread)   /* stale, e.g. from before a fork */
+    return 0;
+  timers[0] = sexp_make_fixnum(n - 1);
+  if (i < n) {                  /* move the last timer into the hole */
+    last = timers[n];
+    timers[i] = last;
+    sexp_timers_sift_down(timers, n - 1, i);
+    if (sexp_context_timer(last) == i)
+      sexp_timers_sift_up(timers, i);
+  }
+  timers[n] = SEXP_FALSE;
+  return 1;
+}
+
+/* true if thread is still waiting on evt with a timer */
+static int sexp_timed_waiterp (sexp ctx, sexp thread, sexp evt) {
+  sexp_uint_t i = sexp_context_timer(thread);
+  return sexp_context_event(thread) == evt && i > 0 && i <= sexp_num_timers(ctx)
+    && sexp_vector_data(sexp_global(ctx, SEXP_G_THREADS_TIMERS))[i] == thread;
+}
+
+/* Threads waiting on a mutex or condition variable with a timeout */
+/* are also listed in slot i of the event, so waking one only looks */
+/* at that event's waiters instead of every timer.  Entries for */
+/* threads which have since timed out or been woken are dropped */
+/* lazily, whenever the list is next added to or searched. */
+
+static void sexp_add_event_timer (sexp ctx, sexp thread, sexp evt, int i) {
+  sexp ls1=SEXP_NULL, ls2;
+  for (ls2=sexp_slot_ref(evt, i); sexp_pairp(ls2); ls2=sexp_cdr(ls2)) {
+    if (sexp_timed_waiterp(ctx, sexp_car(ls2), evt))
+      ls1 = ls2;
+    else if (ls1==SEXP_NULL)
+      sexp_slot_ref(evt, i) = sexp_cdr(ls2);
+    else
+      sexp_cdr(ls1) = sexp_cdr(ls2);
+  }
+  if (sexp_timed_waiterp(ctx, thread, evt))
+    sexp_push(ctx, sexp_slot_ref(evt, i), thread);
+}
+
+/* remove and return the thread in slot i of evt with the earliest */
+/* deadline, or false if none */
+static sexp sexp_take_event_timer (sexp ctx, sexp evt, int i) {
+  sexp ls1=SEXP_NULL, ls2, prev=SEXP_NULL, res=SEXP_FALSE;
+  for (ls2=sexp_slot_ref(evt, i); sexp_pairp(ls2); ls2=sexp_cdr(ls2)) {
+    if (sexp_timed_waiterp(ctx, sexp_car(ls2), evt)) {
+      if (sexp_not(res) || sexp_timer_before(sexp_car(ls2), res)) {
+        res = sexp_car(ls2);
+        prev = ls1;
+      }
+      ls1 = ls2;
+    } else if (ls1==SEXP_NULL) {
+      sexp_slot_ref(evt, i) = sexp_cdr(ls2);
+    } else {
+      sexp_cdr(ls1) = sexp_cdr(ls2);
+    }
+  }
+  if (sexp_contextp(res)) {
+    if (prev==SEXP_NULL)
+      sexp_slot_ref(evt, i) = sexp_cdr(sexp_slot_ref(evt, i));
+    else
+      sexp_cdr(prev) = sexp_cdr(sexp_cdr(prev));
+  }
+  return res;
+}
+
+/* the waiting thread with a timer on evt with the earliest deadline, */
+/* for events without their own list of timed waiters */
+static sexp sexp_find_timer (sexp ctx, sexp evt) {
+  sexp_uint_t i, n = sexp_num_timers(ctx);
+  sexp res = SEXP_FALSE, *timers;
+  if (n > 0) {
+    timers = sexp_vector_data(sexp_global(ctx, SEXP_G_THREADS_TIMERS));
+    for (i=1; i<=n; i++)
+      if (sexp_context_event(timers[i]) == evt
+          && (sexp_not(res) || sexp_timer_before(timers[i], res)))
+        res = timers[i];
+  }
+  return res;
+}
+
+/**************************** fd waiters **********************************/
+
+/* SEXP_G_THREADS_FD_THREADS is a vector indexed by fd of the threads */
+/* blocked on that fd, so an event only has to look at its own fd's */
+/* waiters.  Threads blocked without a timeout are kept only here and */
+/* not in the paused list.  Entries for threads which have since timed */
+/* out or been woken otherwise are dropped lazily. */
+
+static int sexp_event_fd (sexp evt) {
+  if (sexp_portp(evt))
+    return sexp_port_fileno(evt);
+  else if (sexp_filenop(evt))
+    return sexp_fileno_fd(evt);
+  else if (sexp_fixnump(evt))
+    return sexp_unbox_fixnum(evt);
+  return -1;
+}
+
+#define sexp_event_events(evt) (sexp_oportp(evt) ? POLLOUT : POLLIN)
+
+#define sexp_fd_waitingp(x) (sexp_context_waitp(x) && sexp_event_fd(sexp_context_event(x)) >= 0)
+
+static sexp sexp_fd_waiters (sexp ctx, int fd) {
+  sexp vec = sexp_global(ctx, SEXP_G_THREADS_FD_THREADS);
+  if (sexp_vectorp(vec) && fd >= 0 && fd < (int)sexp_vector_length(vec))
+    return sexp_vector_data(vec)[fd];
+  return SEXP_NULL;
+}
+
+/* the events wanted by the threads still waiting on fd */
+static int sexp_fd_events (sexp ctx, int fd) {
+  int events = 0;
+  sexp ls, evt;
+  for (ls=sexp_fd_waiters(ctx, fd); sexp_pairp(ls); ls=sexp_cdr(ls)) {
+    evt = sexp_context_event(sexp_car(ls));
+    if (sexp_context_waitp(sexp_car(ls)) && sexp_event_fd(evt) == fd)
+      events |= sexp_event_events(evt);
+  }
+  return events;
+}
+
+static void sexp_add_fd_waiter (sexp ctx, int fd, sexp thread) {
+  sexp_uint_t len;
+  sexp_gc_var2(vec, tmp);
+  sexp_gc_preserve2(ctx, vec, tmp);
+  vec = sexp_global(ctx, SEXP_G_THREADS_FD_THREADS);
+  if (!sexp_vectorp(vec) || fd >= (int)sexp_vector_length(vec)) {
+    len = sexp_vectorp(vec) ? sexp_vector_length(vec) : SEXP_INIT_FD_THREADS_SIZE;
+    while ((int)len <= fd)
+      len *= 2;
+    tmp = sexp_make_vector(ctx, sexp_make_fixnum(len), SEXP_NULL);
+    if (sexp_vectorp(tmp)) {
+      if (sexp_vectorp(vec))
+        memcpy(sexp_vector_data(tmp), sexp_vector_data(vec),
+               sexp_vector_length(vec) * sizeof(sexp));
+      sexp_global(ctx, SEXP_G_THREADS_FD_THREADS) = tmp;
+    }
+    vec = tmp;
+  }
+  if (sexp_vectorp(vec)
+      && sexp_not(sexp_memq(ctx, thread, sexp_vector_data(vec)[fd]))) {
+    tmp = sexp_cons(ctx, thread, sexp_vector_data(vec)[fd]);
+    sexp_vector_data(vec)[fd] = tmp;
+  }
+  sexp_gc_release2(ctx);
+}
+
+/* return true if thread was waiting on an fd */
+static int sexp_remove_fd_waiter (sexp ctx, sexp thread) {
+  int fd = sexp_event_fd(sexp_context_event(thread));
+  sexp vec = sexp_global(ctx, SEXP_G_THREADS_FD_THREADS), ls1=NULL, ls2;
+  if (!sexp_vectorp(vec) || fd < 0 || fd >= (int)sexp_vector_length(vec))
+    return 0;
+  for (ls2=sexp_vector_data(vec)[fd]; sexp_pairp(ls2) && sexp_car(ls2) != thread;
+       ls1=ls2, ls2=sexp_cdr(ls2))
+    ;
+  if (!sexp_pairp(ls2))
+    return 0;
+  if (ls1) sexp_cdr(ls1) = sexp_cdr(ls2);
+  else     sexp_vector_data(vec)[fd] = sexp_cdr(ls2);
+  return sexp_context_waitp(thread);
+}
+
+/* wake the threads blocked on fd for any of revents, queueing all */
+/* but current, and return the events the remaining waiters want */
+static int sexp_wake_fd (sexp ctx, sexp current, int fd, int revents) {
+  int events = 0;
+  sexp vec = sexp_global(ctx, SEXP_G_THREADS_FD_THREADS), ls1=NULL, ls2, next, evt;
+  sexp_gc_var1(thread);
+  if (!sexp_vectorp(vec) || fd < 0 || fd >= (int)sexp_vector_length(vec))
+    return 0;
+  sexp_gc_preserve1(ctx, thread);
+  revents |= POLLERR | POLLHUP | POLLNVAL;
+  for (ls2=sexp_vector_data(vec)[fd]; sexp_pairp(ls2); ls2=next) {
+    next = sexp_cdr(ls2);
+    thread = sexp_car(ls2);
+    evt = sexp_context_event(thread);
+    if (sexp_context_waitp(thread) && sexp_event_fd(evt) == fd
+        && !(revents & sexp_event_events(evt))) {
+      events |= sexp_event_events(evt);
+      ls1 = ls2;              /* keep waiting */
+      continue;
+    }
+    if (ls1) sexp_cdr(ls1) = next;
+    else     sexp_vector_data(vec)[fd] = next;
+    if (sexp_context_waitp(thread) && sexp_event_fd(evt) == fd) {
+      sexp_context_waitp(thread) = 0;
+      sexp_context_timeoutp(thread) = 0;
+      sexp_context_event(thread) = SEXP_FALSE;
+      /* threads blocked with a timeout also have a timer */
+      sexp_cancel_timer(ctx, thread);
+      if (thread != current)
+        sexp_enqueue_thread(ctx, thread);
+    }
+  }
+  sexp_gc_release1(ctx);
+  return events;
+}
+
+/* true if any thread is blocked on an fd */
+static int sexp_fd_waitersp (sexp ctx) {
+  sexp_uint_t i;
+  sexp ls, vec = sexp_global(ctx, SEXP_G_THREADS_FD_THREADS);
+  if (sexp_vectorp(vec))
+    for (i=0; i<sexp_vector_length(vec); i++)
+      for (ls=sexp_vector_data(vec)[i]; sexp_pairp(ls); ls=sexp_cdr(ls))
+        if (sexp_fd_waitingp(sexp_car(ls)))
+          return 1;
+  return 0;
+}
+
+/* any thread blocked on an fd, or ctx if there are none */
+static sexp sexp_any_fd_waiter (sexp ctx) {
+  sexp_uint_t i;
+  sexp ls, vec = sexp_global(ctx, SEXP_G_THREADS_FD_THREADS);
+  if (sexp_vectorp(vec))
+    for (i=0; i<sexp_vector_length(vec); i++)
+      for (ls=sexp_vector_data(vec)[i]; sexp_pairp(ls); ls=sexp_cdr(ls))
+        if (sexp_fd_waitingp(sexp_car(ls))
+            && sexp_event_fd(sexp_context_event(sexp_car(ls))) == (int)i)
+          return sexp_car(ls);
+  return ctx;
+}
+
 sexp sexp_thread_terminate (sexp ctx, sexp self, sexp_sint_t n, sexp thread) {
   sexp res = sexp_make_boolean(ctx == thread);
   sexp_assert_type(ctx, sexp_contextp, SEXP_CONTEXT, thread);
@@ -150,7 +600,9 @@ sexp sexp_thread_terminate (sexp ctx, sexp self, sexp_sint_t n, sexp thread) {
       sexp_context_refuel(thread) = 0;
     }
     /* unblock the thread if needed so it can be scheduled and terminated */
-    if (sexp_delete_list(ctx, SEXP_G_THREADS_PAUSED, thread))
+    if ((sexp_cancel_timer(ctx, thread)
+         || sexp_delete_list(ctx, SEXP_G_THREADS_PAUSED, thread))
+        | sexp_remove_fd_waiter(ctx, thread))
       sexp_thread_start(ctx, self, 1, thread);
   }
   /* return true if terminating self, then we can yield */
@@ -161,9 +613,8 @@ static void sexp_insert_timed (sexp ctx, sexp thread, sexp timeout) {
 #if SEXP_USE_FLONUMS
   double d;
 #endif
-  sexp ls1=SEXP_NULL, ls2;
-  sexp_delete_list(ctx, SEXP_G_THREADS_PAUSED, thread);
-  ls2 = sexp_global(ctx, SEXP_G_THREADS_PAUSED);
+  if (! sexp_cancel_timer(ctx, thread))
+    sexp_delete_list(ctx, SEXP_G_THREADS_PAUSED, thread);
   if (sexp_realp(timeout))
     gettimeofday(&sexp_context_timeval(thread), NULL);
   if (sexp_fixnump(timeout)) {
@@ -195,17 +646,36 @@ static void sexp_insert_timed (sexp ctx, sexp thread, sexp timeout) {
     sexp_context_timeval(thread).tv_sec = 0;
     sexp_context_timeval(thread).tv_usec = 0;
   }
-  if (sexp_realp(timeout) || sexp_contextp(timeout))
-    while (sexp_pairp(ls2)
-           && sexp_context_before(sexp_car(ls2), sexp_context_timeval(thread)))
-      ls1=ls2, ls2=sexp_cdr(ls2);
-  else
-    while (sexp_pairp(ls2) && sexp_context_timeval(sexp_car(ls2)).tv_sec)
-      ls1=ls2, ls2=sexp_cdr(ls2);
-  if (ls1 == SEXP_NULL)
-    sexp_global(ctx, SEXP_G_THREADS_PAUSED) = sexp_cons(ctx, thread, ls2);
+  if (sexp_context_timeval(thread).tv_sec || sexp_context_timeval(thread).tv_usec)
+    sexp_add_timer(ctx, thread);
   else
-    sexp_cdr(ls1) = sexp_cons(ctx, thread, ls2);
+    sexp_push(ctx, sexp_global(ctx, SEXP_G_THREADS_PAUSED), thread);
+}
+
+/* move the first thread waiting on evt to the front of the run queue, */
+/* where slot i of evt lists its timed waiters */
+static int sexp_wake_paused (sexp ctx, sexp evt, int i) {
+  sexp ls1=SEXP_NULL, ls2, thread;
+  /* timed waiters first, earliest deadline first */
+  thread = sexp_take_event_timer(ctx, evt, i);
+  if (sexp_contextp(thread)) {
+    sexp_cancel_timer(ctx, thread);
+  } else {
+    for (ls2=sexp_global(ctx, SEXP_G_THREADS_PAUSED);
+         sexp_pairp(ls2) && sexp_context_event(sexp_car(ls2)) != evt;
+         ls1=ls2, ls2=sexp_cdr(ls2))
+      ;
+    if (! sexp_pairp(ls2))
+      return 0;
+    if (ls1==SEXP_NULL)
+      sexp_global(ctx, SEXP_G_THREADS_PAUSED) = sexp_cdr(ls2);
+    else
+      sexp_cdr(ls1) = sexp_cdr(ls2);
+    thread = sexp_car(ls2);
+  }
+  sexp_add_runnable(ctx, thread, 1);
+  sexp_context_waitp(thread) = sexp_context_timeoutp(thread) = 0;
+  return 1;
 }
 
 sexp sexp_thread_join (sexp ctx, sexp self, sexp_sint_t n, sexp thread, sexp timeout) {
@@ -256,38 +726,25 @@ sexp sexp_mutex_lock (sexp ctx, sexp self, sexp_sint_t n, sexp mutex, sexp timeo
     sexp_context_waitp(ctx) = 1;
     sexp_context_event(ctx) = mutex;
     sexp_insert_timed(ctx, ctx, timeout);
+    sexp_add_event_timer(ctx, ctx, mutex, SEXP_MUTEX_TIMERS);
     return SEXP_FALSE;
   }
 }
 
 sexp sexp_mutex_unlock (sexp ctx, sexp self, sexp_sint_t n, sexp mutex, sexp condvar, sexp timeout) {
-  sexp ls1, ls2;
   /* first unlock and unblock threads */
   if (sexp_truep(sexp_mutex_lockp(mutex))) {
     sexp_mutex_lockp(mutex) = SEXP_FALSE;
     sexp_mutex_thread(mutex) = ctx;
-    /* search for threads blocked on this mutex */
-    for (ls1=SEXP_NULL, ls2=sexp_global(ctx, SEXP_G_THREADS_PAUSED);
-         sexp_pairp(ls2); ls1=ls2, ls2=sexp_cdr(ls2))
-      if (sexp_context_event(sexp_car(ls2)) == mutex) {
-        if (ls1==SEXP_NULL)
-          sexp_global(ctx, SEXP_G_THREADS_PAUSED) = sexp_cdr(ls2);
-        else
-          sexp_cdr(ls1) = sexp_cdr(ls2);
-        sexp_cdr(ls2) = sexp_global(ctx, SEXP_G_THREADS_FRONT);
-        sexp_global(ctx, SEXP_G_THREADS_FRONT) = ls2;
-        if (! sexp_pairp(sexp_cdr(ls2)))
-          sexp_global(ctx, SEXP_G_THREADS_BACK) = ls2;
-        sexp_context_waitp(sexp_car(ls2))
-          = sexp_context_timeoutp(sexp_car(ls2)) = 0;
-        break;
-      }
+    /* wake a thread blocked on this mutex */
+    sexp_wake_paused(ctx, mutex, SEXP_MUTEX_TIMERS);
   }
   if (sexp_truep(condvar)) {
     /* wait on condition var if specified */
     sexp_context_waitp(ctx) = 1;
     sexp_context_event(ctx) = condvar;
     sexp_insert_timed(ctx, ctx, timeout);
+    sexp_add_event_timer(ctx, ctx, condvar, SEXP_CONDVAR_THREADS);
     return SEXP_FALSE;
   }
   return SEXP_TRUE;
@@ -296,21 +753,7 @@ sexp sexp_mutex_unlock (sexp ctx, sexp self, sexp_sint_t n, sexp mutex, sexp con
 /**************************** condition variables *************************/
 
 sexp sexp_condition_variable_signal (sexp ctx, sexp self, sexp_sint_t n, sexp condvar) {
-  sexp ls1=SEXP_NULL, ls2=sexp_global(ctx, SEXP_G_THREADS_PAUSED);
-  for ( ; sexp_pairp(ls2); ls1=ls2, ls2=sexp_cdr(ls2))
-    if (sexp_context_event(sexp_car(ls2)) == condvar) {
-      if (ls1==SEXP_NULL)
-        sexp_global(ctx, SEXP_G_THREADS_PAUSED) = sexp_cdr(ls2);
-      else
-        sexp_cdr(ls1) = sexp_cdr(ls2);
-      sexp_cdr(ls2) = sexp_global(ctx, SEXP_G_THREADS_FRONT);
-      sexp_global(ctx, SEXP_G_THREADS_FRONT) = ls2;
-      if (! sexp_pairp(sexp_cdr(ls2)))
-        sexp_global(ctx, SEXP_G_THREADS_BACK) = ls2;
-      sexp_context_waitp(sexp_car(ls2)) = sexp_context_timeoutp(sexp_car(ls2)) = 0;
-      return SEXP_TRUE;
-    }
-  return SEXP_FALSE;
+  return sexp_make_boolean(sexp_wake_paused(ctx, condvar, SEXP_CONDVAR_THREADS));
 }
 
 sexp sexp_condition_variable_broadcast (sexp ctx, sexp self, sexp_sint_t n, sexp condvar) {
@@ -355,6 +798,9 @@ static sexp sexp_make_pollfds (sexp ctx) {
   sexp_pollfds_fds(res) = (struct pollfd*)malloc(SEXP_INIT_POLLFDS_MAX_FDS * sizeof(struct pollfd));
   sexp_pollfds_num_fds(res) = 0;
   sexp_pollfds_max_fds(res) = SEXP_INIT_POLLFDS_MAX_FDS;
+#if SEXP_USE_EPOLL
+  sexp_pollfds_epfd(res) = epoll_create1(EPOLL_CLOEXEC);
+#endif
   return res;
 }
 
@@ -365,17 +811,28 @@ sexp sexp_free_pollfds (sexp ctx, sexp self, sexp_sint_t n, sexp pollfds) {
     sexp_pollfds_num_fds(pollfds) = 0;
     sexp_pollfds_max_fds(pollfds) = 0;
   }
+#if SEXP_USE_EPOLL
+  if (sexp_pollfds_epfd(pollfds) >= 0) {
+    close(sexp_pollfds_epfd(pollfds));
+    sexp_pollfds_epfd(pollfds) = -1;
+  }
+#endif
   return SEXP_VOID;
 }
 
-/* return true if this fd was already being polled */
-static sexp sexp_insert_pollfd (sexp ctx, int fd, int events) {
-  int i;
-  struct pollfd *pfd;
+static sexp sexp_get_pollfds (sexp ctx) {
   sexp pollfds = sexp_global(ctx, SEXP_G_THREADS_POLL_FDS);
   if (! (pollfds && sexp_pollfdsp(ctx, pollfds))) {
     sexp_global(ctx, SEXP_G_THREADS_POLL_FDS) = pollfds = sexp_make_pollfds(ctx);
   }
+  return pollfds;
+}
+
+/* return true if this fd was already being polled */
+static sexp sexp_insert_pollfd (sexp ctx, int fd, int events) {
+  int i;
+  struct pollfd *pfd;
+  sexp pollfds = sexp_get_pollfds(ctx);
   for (i=0; i<sexp_pollfds_num_fds(pollfds); ++i) {
     if (sexp_pollfds_fds(pollfds)[i].fd == fd) {
       sexp_pollfds_fds(pollfds)[i].events |= events;
@@ -396,6 +853,75 @@ static sexp sexp_insert_pollfd (sexp ctx, int fd, int events) {
   return SEXP_FALSE;
 }
 
+/* watch fd for the given events until the next time it's ready */
+static void sexp_watch_fd (sexp ctx, int fd, int events) {
+#if SEXP_USE_EPOLL
+  struct epoll_event ev;
+  sexp pollfds = sexp_get_pollfds(ctx);
+  if (sexp_pollfds_epfd(pollfds) >= 0) {
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events | EPOLLONESHOT;
+    ev.data.fd = fd;
+    if (epoll_ctl(sexp_pollfds_epfd(pollfds), EPOLL_CTL_MOD, fd, &ev) == 0
+        || (errno == ENOENT
+            && epoll_ctl(sexp_pollfds_epfd(pollfds), EPOLL_CTL_ADD, fd, &ev) == 0))
+      return;
+    /* otherwise e.g. a regular file, which poll says is always ready */
+  }
+#endif
+  sexp_insert_pollfd(ctx, fd, events);
+}
+
+/* wake threads blocked on ready fds, waiting up to usecs for one */
+static void sexp_poll_fds (sexp ctx, sexp current, suseconds_t usecs) {
+  int i, k, events, timeout = (usecs + 999) / 1000;
+  struct pollfd *pfds;
+  sexp pollfds = sexp_global(ctx, SEXP_G_THREADS_POLL_FDS);
+#if SEXP_USE_EPOLL
+  struct epoll_event evs[SEXP_MAX_EPOLL_EVENTS];
+#endif
+  if (! (pollfds && sexp_pollfdsp(ctx, pollfds))) {
+    if (usecs > 0) usleep(usecs);
+    return;
+  }
+  if (sexp_pollfds_num_fds(pollfds) > 0) {
+    pfds = sexp_pollfds_fds(pollfds);
+#if SEXP_USE_EPOLL
+    k = poll(pfds, sexp_pollfds_num_fds(pollfds), sexp_pollfds_epfd(pollfds) >= 0 ? 0 : timeout);
+#else
+    k = poll(pfds, sexp_pollfds_num_fds(pollfds), timeout);
+#endif
+    if (k > 0) timeout = 0;
+    for (i=sexp_pollfds_num_fds(pollfds)-1; i>=0 && k>0; --i) {
+      if (pfds[i].revents > 0) {
+        k--;
+        events = sexp_wake_fd(ctx, current, pfds[i].fd, pfds[i].revents);
+        if (events) {
+          pfds[i].events = events;
+        } else {
+          if (i < (int)(sexp_pollfds_num_fds(pollfds) - 1))
+            pfds[i] = pfds[sexp_pollfds_num_fds(pollfds) - 1];
+          sexp_pollfds_num_fds(pollfds) -= 1;
+        }
+      }
+    }
+  }
+#if SEXP_USE_EPOLL
+  if (sexp_pollfds_epfd(pollfds) >= 0) {
+    k = epoll_wait(sexp_pollfds_epfd(pollfds), evs, SEXP_MAX_EPOLL_EVENTS, timeout);
+    for (i=0; i<k; i++) {
+      /* the EPOLL* event bits are the same as the POLL* bits */
+      events = sexp_wake_fd(ctx, current, evs[i].data.fd, evs[i].events);
+      if (events)
+        sexp_watch_fd(ctx, evs[i].data.fd, events);
+    }
+    return;
+  }
+#endif
+  if (sexp_pollfds_num_fds(pollfds) == 0 && usecs > 0)
+    usleep(usecs);
+}
+
 /* block the current thread on the specified port */
 sexp sexp_blocker (sexp ctx, sexp self, sexp_sint_t n, sexp portorfd, sexp timeout) {
   int fd;
@@ -408,25 +934,31 @@ sexp sexp_blocker (sexp ctx, sexp self, sexp_sint_t n, sexp portorfd, sexp timeo
     fd = sexp_unbox_fixnum(portorfd);
   else
     return sexp_type_exception(ctx, self, SEXP_IPORT, portorfd);
-  if (fd >= 0)
-    sexp_insert_pollfd(ctx, fd, sexp_oportp(portorfd) ? POLLOUT : POLLIN);
   /* pause the current thread */
   sexp_context_waitp(ctx) = 1;
   sexp_context_event(ctx) = portorfd;
-  sexp_insert_timed(ctx, ctx, timeout);
+  if (fd >= 0) {
+    sexp_add_fd_waiter(ctx, fd, ctx);
+    sexp_watch_fd(ctx, fd, sexp_fd_events(ctx, fd));
+  }
+  if (fd >= 0 && sexp_not(timeout)) {
+    /* without a timeout the fd table is all we need */
+    sexp_context_timeval(ctx).tv_sec = 0;
+    sexp_context_timeval(ctx).tv_usec = 0;
+  } else {
+    sexp_insert_timed(ctx, ctx, timeout);
+  }
   return SEXP_VOID;
 }
 
 sexp sexp_scheduler (sexp ctx, sexp self, sexp_sint_t n, sexp root_thread) {
-  int i, k;
   struct timeval tval;
-  struct pollfd *pfds;
   suseconds_t usecs = 0;
-  sexp res, ls1, ls2, evt, runner, paused, front, pollfds;
-  sexp_gc_var1(tmp);
-  sexp_gc_preserve1(ctx, tmp);
+  sexp_uint_t i;
+  sexp ls1, ls2, evt, runner, paused;
+  sexp_gc_var2(res, tmp);
+  sexp_gc_preserve2(ctx, res, tmp);
 
-  front  = sexp_global(ctx, SEXP_G_THREADS_FRONT);
   paused = sexp_global(ctx, SEXP_G_THREADS_PAUSED);
 
   /* check signals */
@@ -439,8 +971,6 @@ sexp sexp_scheduler (sexp ctx, sexp self, sexp_sint_t n, sexp root_thread) {
           runner = sexp_make_thread(ctx, self, 2, sexp_cdr(tmp), SEXP_FALSE);
           sexp_global(ctx, SEXP_G_THREADS_SIGNAL_RUNNER) = runner;
           sexp_thread_start(ctx, self, 1, runner);
-          if (!sexp_pairp(front))
-            front = sexp_global(ctx, SEXP_G_THREADS_FRONT);
         }
       }
     } else if (sexp_context_waitp(runner)) { /* wake it if it's sleeping */
@@ -450,61 +980,18 @@ sexp sexp_scheduler (sexp ctx, sexp self, sexp_sint_t n, sexp root_thread) {
   }
 
   /* check blocked fds */
-  pollfds = sexp_global(ctx, SEXP_G_THREADS_POLL_FDS);
-  if (sexp_pollfdsp(ctx, pollfds) && sexp_pollfds_num_fds(pollfds) > 0) {
-    pfds = sexp_pollfds_fds(pollfds);
-    k = poll(sexp_pollfds_fds(pollfds), sexp_pollfds_num_fds(pollfds), 0);
-    for (i=sexp_pollfds_num_fds(pollfds)-1; i>=0 && k>0; --i) {
-      if (pfds[i].revents > 0) { /* free all threads blocked on this fd */
-        k--;
-        /* maybe unblock the current thread */
-        evt = sexp_context_event(ctx);
-        if ((sexp_portp(evt) && (sexp_port_fileno(evt) == pfds[i].fd))
-            || (sexp_fixnump(evt) && (sexp_unbox_fixnum(evt) == pfds[i].fd))) {
-          sexp_context_waitp(ctx) = 0;
-          sexp_context_timeoutp(ctx) = 0;
-          sexp_context_event(ctx) = SEXP_FALSE;
-        }
-        /* maybe unblock paused threads */
-        for (ls1=SEXP_NULL, ls2=paused; sexp_pairp(ls2); ) {
-          /* TODO: distinguish input and output on the same fd? */
-          evt = sexp_context_event(sexp_car(ls2));
-          if ((sexp_portp(evt) && sexp_port_fileno(evt) == pfds[i].fd)
-              || (sexp_fixnump(evt) && sexp_unbox_fixnum(evt) == pfds[i].fd)) {
-            sexp_context_waitp(sexp_car(ls2)) = 0;
-            sexp_context_timeoutp(sexp_car(ls2)) = 0;
-            sexp_context_event(sexp_car(ls2)) = SEXP_FALSE;
-            if (ls1==SEXP_NULL)
-              sexp_global(ctx, SEXP_G_THREADS_PAUSED) = paused = sexp_cdr(ls2);
-            else
-              sexp_cdr(ls1) = sexp_cdr(ls2);
-            tmp = sexp_cdr(ls2);
-            sexp_cdr(ls2) = SEXP_NULL;
-            if (sexp_car(ls2) != ctx) {
-              if (! sexp_pairp(sexp_global(ctx, SEXP_G_THREADS_BACK))) {
-                sexp_global(ctx, SEXP_G_THREADS_FRONT) = front = ls2;
-              } else {
-                sexp_cdr(sexp_global(ctx, SEXP_G_THREADS_BACK)) = ls2;
-              }
-              sexp_global(ctx, SEXP_G_THREADS_BACK) = ls2;
-            }
-            ls2 = tmp;
-          } else {
-            ls1 = ls2;
-            ls2 = sexp_cdr(ls2);
-          }
-        }
-        if (i < (sexp_pollfds_num_fds(pollfds) - 1)) {
-          pfds[i] = pfds[sexp_pollfds_num_fds(pollfds) - 1];
-        }
-        sexp_pollfds_num_fds(pollfds) -= 1;
-      }
-    }
-  }
+  sexp_poll_fds(ctx, ctx, 0);
+  paused = sexp_global(ctx, SEXP_G_THREADS_PAUSED);
 
   /* if we've terminated, check threads joining us */
   if (sexp_context_refuel(ctx) <= 0) {
-    for (ls1=SEXP_NULL, ls2=paused; sexp_pairp(ls2); ) {
+    while (sexp_contextp(tmp = sexp_find_timer(ctx, ctx))) {
+      sexp_cancel_timer(ctx, tmp);
+      sexp_context_waitp(tmp) = 0;
+      sexp_context_timeoutp(tmp) = 0;
+      sexp_enqueue_thread(ctx, tmp);
+    }
+    for (ls1=SEXP_NULL, ls2=paused; sexp_pairp(ls2); ls2=sexp_cdr(ls2)) {
       if (sexp_context_event(sexp_car(ls2)) == ctx) {
         sexp_context_waitp(sexp_car(ls2)) = 0;
         sexp_context_timeoutp(sexp_car(ls2)) = 0;
@@ -512,124 +999,111 @@ sexp sexp_scheduler (sexp ctx, sexp self, sexp_sint_t n, sexp root_thread) {
           sexp_global(ctx, SEXP_G_THREADS_PAUSED) = paused = sexp_cdr(ls2);
         else
           sexp_cdr(ls1) = sexp_cdr(ls2);
-        tmp = sexp_cdr(ls2);
-        sexp_cdr(ls2) = SEXP_NULL;
-        if (! sexp_pairp(sexp_global(ctx, SEXP_G_THREADS_BACK))) {
-          sexp_global(ctx, SEXP_G_THREADS_FRONT) = front = ls2;
-        } else {
-          sexp_cdr(sexp_global(ctx, SEXP_G_THREADS_BACK)) = ls2;
-        }
-        sexp_global(ctx, SEXP_G_THREADS_BACK) = ls2;
-        ls2 = tmp;
+        sexp_enqueue_thread(ctx, sexp_car(ls2));
       } else {
         ls1 = ls2;
-        ls2 = sexp_cdr(ls2);
       }
     }
   }
 
   /* check timeouts */
-  if (sexp_pairp(paused)) {
-    if (gettimeofday(&tval, NULL) == 0) {
-      ls1 = SEXP_NULL;
-      ls2 = paused;
-      while (sexp_pairp(ls2) && sexp_context_before(sexp_car(ls2), tval)) {
-        sexp_context_timeoutp(sexp_car(ls2)) = 1;
-        sexp_context_waitp(sexp_car(ls2)) = 0;
-        ls1 = ls2;
-        ls2 = sexp_cdr(ls2);
-      }
-      if (sexp_pairp(ls1)) {
-        sexp_cdr(ls1) = SEXP_NULL;
-        if (! sexp_pairp(sexp_global(ctx, SEXP_G_THREADS_BACK))) {
-          sexp_global(ctx, SEXP_G_THREADS_FRONT) = front = paused;
-        } else {
-          sexp_cdr(sexp_global(ctx, SEXP_G_THREADS_BACK)) = paused;
-        }
-        sexp_global(ctx, SEXP_G_THREADS_BACK) = ls1;
-        sexp_global(ctx, SEXP_G_THREADS_PAUSED) = paused = ls2;
-      }
+  if (sexp_contextp(sexp_next_timer(ctx)) && gettimeofday(&tval, NULL) == 0) {
+    while (sexp_contextp(tmp = sexp_next_timer(ctx))
+           && sexp_context_before(tmp, tval)) {
+      sexp_cancel_timer(ctx, tmp);
+      sexp_remove_fd_waiter(ctx, tmp);
+      sexp_context_timeoutp(tmp) = 1;
+      sexp_context_waitp(tmp) = 0;
+      sexp_enqueue_thread(ctx, tmp);
     }
   }
 
   /* dequeue next thread */
-  if (sexp_pairp(front)) {
-    res = sexp_car(front);
+  if (sexp_num_runnable(ctx) > 0) {
     if ((sexp_context_refuel(ctx) <= 0) || sexp_context_waitp(ctx)) {
       /* orig ctx is either terminated or paused */
-      sexp_global(ctx, SEXP_G_THREADS_FRONT) = sexp_cdr(front);
-      if (! sexp_pairp(sexp_cdr(front)))
-        sexp_global(ctx, SEXP_G_THREADS_BACK) = SEXP_NULL;
-      if (sexp_context_refuel(ctx) > 0 && sexp_not(sexp_memq(ctx, ctx, paused)))
+      res = sexp_pop_runnable(ctx);
+      /* threads blocked on an fd are already in the fd table */
+      if (sexp_context_refuel(ctx) > 0 && !sexp_fd_waitingp(ctx)
+          && !sexp_context_timer(ctx) && sexp_not(sexp_memq(ctx, ctx, paused)))
         sexp_insert_timed(ctx, ctx, SEXP_FALSE);
       paused = sexp_global(ctx, SEXP_G_THREADS_PAUSED);
+    } else if (sexp_context_priority(ctx)
+               > sexp_run_queue_priority(sexp_next_run_queue(ctx))) {
+      /* nothing as urgent is runnable, keep going */
+      res = ctx;
     } else {
-      /* swap with front of queue */
-      sexp_car(sexp_global(ctx, SEXP_G_THREADS_FRONT)) = ctx;
-      /* rotate front of queue to back */
-      sexp_cdr(sexp_global(ctx, SEXP_G_THREADS_BACK))
-        = sexp_global(ctx, SEXP_G_THREADS_FRONT);
-      sexp_global(ctx, SEXP_G_THREADS_FRONT)
-        = sexp_cdr(sexp_global(ctx, SEXP_G_THREADS_FRONT));
-      sexp_global(ctx, SEXP_G_THREADS_BACK)
-        = sexp_cdr(sexp_global(ctx, SEXP_G_THREADS_BACK));
-      sexp_cdr(sexp_global(ctx, SEXP_G_THREADS_BACK)) = SEXP_NULL;
+      /* rotate to the back of our queue and run the next thread */
+      sexp_enqueue_thread(ctx, ctx);
+      res = sexp_pop_runnable(ctx);
     }
   } else {
     /* no threads to dequeue */
     res = ctx;
     /* prefer a thread we can wait on instead of spinning */
     if (sexp_context_refuel(ctx) <= 0) {
-      for (ls1=paused; sexp_pairp(ls1); ls1=sexp_cdr(ls1)) {
-        evt = sexp_context_event(sexp_car(ls1));
+      for (i=1; i<=sexp_num_timers(ctx); i++) {
+        ls1 = sexp_vector_data(sexp_global(ctx, SEXP_G_THREADS_TIMERS))[i];
+        evt = sexp_context_event(ls1);
         if (sexp_fixnump(evt) || sexp_portp(evt)) {
-          res = sexp_car(ls1);
+          res = ls1;
           break;
         }
       }
+      if (res == ctx)
+        res = sexp_any_fd_waiter(ctx);
     }
   }
 
   if (sexp_context_waitp(res)) {
     /* the only thread available was waiting */
-    /* TODO: if another thread is blocked on I/O, wait on that with
-     * the appropriate minimum timeout */
-    if (sexp_pairp(paused)
-        && sexp_context_before(sexp_car(paused), sexp_context_timeval(res))) {
-      tmp = res;
-      res = sexp_car(paused);
-      paused = sexp_global(ctx, SEXP_G_THREADS_PAUSED) = sexp_cdr(paused);
-      if (sexp_not(sexp_memq(ctx, tmp, paused)))
+    tmp = sexp_next_timer(ctx);
+    if (sexp_contextp(tmp)
+        && sexp_context_before(tmp, sexp_context_timeval(res))) {
+      /* prefer the thread with the earliest deadline */
+      ls1 = res;
+      res = tmp;
+      tmp = ls1;
+      if (!sexp_context_timer(tmp) && sexp_not(sexp_memq(ctx, tmp, paused)))
         sexp_insert_timed(ctx, tmp, tmp);
-    } else {
+      sexp_cancel_timer(ctx, res);
+    } else if (! sexp_cancel_timer(ctx, res)) {
       sexp_delete_list(ctx, SEXP_G_THREADS_PAUSED, res);
     }
     paused = sexp_global(ctx, SEXP_G_THREADS_PAUSED);
-    usecs = 0;
-    if ((sexp_context_timeval(res).tv_sec == 0)
-        && (sexp_context_timeval(res).tv_usec == 0)) {
-      /* no timeout, wait for default 10ms */
-      usecs = 10*1000;
-    } else {
-      /* wait until the next timeout, or at most 10ms */
-      gettimeofday(&tval, NULL);
-      if (tval.tv_sec <= sexp_context_timeval(res).tv_sec) {
-        usecs = (sexp_context_timeval(res).tv_sec - tval.tv_sec) * 1000000;
-        if (tval.tv_usec < sexp_context_timeval(res).tv_usec || usecs > 0)
-          usecs += sexp_context_timeval(res).tv_usec - tval.tv_usec;
+    /* wait until the next timeout, or at most 10ms */
+    usecs = 10*1000;
+    if (sexp_context_timeval(res).tv_sec || sexp_context_timeval(res).tv_usec)
+      tmp = res;
+    else
+      tmp = sexp_next_timer(ctx);
+    if (sexp_contextp(tmp) && gettimeofday(&tval, NULL) == 0) {
+      usecs = 0;
+      if (tval.tv_sec <= sexp_context_timeval(tmp).tv_sec) {
+        usecs = (sexp_context_timeval(tmp).tv_sec - tval.tv_sec) * 1000000;
+        if (tval.tv_usec < sexp_context_timeval(tmp).tv_usec || usecs > 0)
+          usecs += sexp_context_timeval(tmp).tv_usec - tval.tv_usec;
       }
       if (usecs > 10*1000) {
         usecs = 10*1000;
-      } else {
+      } else if (tmp == res) {
         sexp_context_waitp(res) = 0;
         sexp_context_timeoutp(res) = 1;
       }
     }
-    /* take a nap to avoid busy looping */
-    usleep(usecs);
+    /* take a nap to avoid busy looping, or until an fd is ready */
+    sexp_poll_fds(ctx, res, usecs);
   }
 
-  sexp_gc_release1(ctx);
+  /* Only a thread blocking through here can add an fd waiter, so */
+  /* until the next scheduler run the VM can tell from this flag and */
+  /* the run queue, timers and signals whether it needs us at all. */
+  /* It's only worth scanning for fd waiters if the rest are empty. */
+  sexp_global(ctx, SEXP_G_THREADS_BLOCKED)
+    = sexp_make_boolean(sexp_num_runnable(ctx) > 0 || sexp_num_timers(ctx) > 0
+                        || sexp_fd_waitersp(ctx));
+
+  sexp_gc_release2(ctx);
   return res;
 }
 
@@ -676,6 +1150,10 @@ sexp sexp_init_library (sexp ctx, sexp self, sexp_sint_t n, sexp env, const char
   sexp_define_foreign(ctx, env, "thread-name", 1, sexp_thread_name);
   sexp_define_foreign(ctx, env, "thread-specific", 1, sexp_thread_specific);
   sexp_define_foreign(ctx, env, "thread-specific-set!", 2, sexp_thread_specific_set);
+  sexp_define_foreign(ctx, env, "thread-base-priority", 1, sexp_thread_base_priority);
+  sexp_define_foreign(ctx, env, "thread-base-priority-set!", 2, sexp_thread_base_priority_set);
+  sexp_define_foreign(ctx, env, "thread-quantum", 1, sexp_thread_quantum);
+  sexp_define_foreign(ctx, env, "thread-quantum-set!", 2, sexp_thread_quantum_set);
   sexp_define_foreign(ctx, env, "%thread-end-result", 1, sexp_thread_end_result);
   sexp_define_foreign(ctx, env, "%thread-exception?", 1, sexp_thread_exceptionp);
   sexp_define_foreign(ctx, env, "mutex-state", 1, sexp_mutex_state);
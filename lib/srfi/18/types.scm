@@ -3,15 +3,16 @@
 ;; BSD-style license: http://synthcode.com/license.txt
 
 (define-record-type Mutex
-  (%make-mutex name specific thread lock)
+  (%make-mutex name specific thread lock timers)
   mutex?
   (name mutex-name)
   (specific mutex-specific mutex-specific-set!)
   (thread %mutex-thread %mutex-thread-set!)
-  (lock %mutex-lock %mutex-lock-set!))
+  (lock %mutex-lock %mutex-lock-set!)
+  (timers %mutex-timers %mutex-timers-set!))
 
 (define (make-mutex . o)
-  (%make-mutex (and (pair? o) (car o)) #f #f #f))
+  (%make-mutex (and (pair? o) (car o)) #f #f #f '()))
 
 (define-record-type Condition-Variable
   (%make-condition-variable name specific threads)
@@ -21,4 +22,4 @@
   (threads %condition-variable-threads %condition-variable-threads-set!))
 
 (define (make-condition-variable . o)
-  (%make-condition-variable (and (pair? o) (car o)) #f #f))
+  (%make-condition-variable (and (pair? o) (car o)) #f '()))
@@ -102,6 +102,10 @@ sexp sexp_hash (sexp ctx, sexp self, sexp_sint_t n, sexp obj, sexp bound) {
 sexp sexp_hash_by_identity (sexp ctx, sexp self, sexp_sint_t n, sexp obj, sexp bound) {
   if (! sexp_exact_integerp(bound))
     return sexp_type_exception(ctx, self, SEXP_FIXNUM, bound);
+#if SEXP_USE_COMPACTION
+  if (sexp_pointerp(obj))       /* the hash is only valid if obj stays put */
+    sexp_pinnedp(obj) = 1;
+#endif
   return sexp_make_fixnum((sexp_uint_t)obj % sexp_unbox_fixnum(bound));
 }
 
@@ -87,6 +87,10 @@ static sexp_sint_t sexp_object_compare (sexp ctx, sexp a, sexp b, int depth) {
   sexp_sint_t i, res, len;
   if (a == b)
     return 0;
+#if SEXP_USE_TAGGED_FLONUMS
+  if ((sexp_tflonump(a) || sexp_tflonump(b)) && sexp_realp(a) && sexp_realp(b))
+    return sexp_unbox_fixnum(sexp_compare(ctx, a, b));
+#endif
   if (sexp_pointerp(a)) {
     if (sexp_pointerp(b)) {
       if (sexp_pointer_tag(a) == sexp_pointer_tag(b)) {
@@ -45,6 +45,9 @@ void sexp_usage(int err) {
 #if ! SEXP_USE_BOEHM
          "  -h <size>    - specify the initial heap size\n"
 #endif
+#if SEXP_USE_INCREMENTAL_GC
+         "  -g <usecs>   - specify the incremental GC pause target\n"
+#endif
 #if SEXP_USE_MODULES
          "  -A <dir>     - append a module search directory\n"
          "  -I <dir>     - prepend a module search directory\n"
@@ -265,12 +268,16 @@ static sexp sexp_load_standard_repl_env (sexp ctx, sexp env, sexp k, int bootp,
 }
 
 static void do_init_context (sexp* ctx, sexp* env, sexp_uint_t heap_size,
-                             sexp_uint_t heap_max_size, sexp_sint_t fold_case) {
+                             sexp_uint_t heap_max_size, sexp_uint_t gc_pause,
+                             sexp_sint_t fold_case) {
   *ctx = sexp_make_eval_context(NULL, NULL, NULL, heap_size, heap_max_size);
   if (! *ctx) {
     fprintf(stderr, "chibi-scheme: out of memory\n");
     exit_failure();
   }
+#if SEXP_USE_INCREMENTAL_GC
+  if (gc_pause) sexp_context_heap(*ctx)->gc_pause_usecs = gc_pause;
+#endif
 #if SEXP_USE_FOLD_CASE_SYMS
   sexp_global(*ctx, SEXP_G_FOLD_CASE_P) = sexp_make_boolean(fold_case);
 #endif
@@ -283,7 +290,8 @@ static void do_init_context (sexp* ctx, sexp* env, sexp_uint_t heap_size,
   }
 
 #define init_context() if (! ctx) do {                                  \
-      do_init_context(&ctx, &env, heap_size, heap_max_size, fold_case); \
+      do_init_context(&ctx, &env, heap_size, heap_max_size, gc_pause,   \
+                      fold_case);                                       \
       sexp_gc_preserve4(ctx, tmp, sym, args, env);                      \
     } while (0)
 
@@ -306,7 +314,7 @@ sexp run_main (int argc, char **argv) {
   const char *prefix=NULL, *suffix=NULL, *main_symbol=NULL, *main_module=NULL;
   sexp_sint_t i, j, c, quit=0, print=0, init_loaded=0, mods_loaded=0,
     fold_case=SEXP_DEFAULT_FOLD_CASE_SYMS, nonblocking=0;
-  sexp_uint_t heap_size=0, heap_max_size=SEXP_MAXIMUM_HEAP_SIZE;
+  sexp_uint_t heap_size=0, heap_max_size=SEXP_MAXIMUM_HEAP_SIZE, gc_pause=0;
   sexp out=SEXP_FALSE, ctx=NULL, ls, res=SEXP_ZERO, standard=SEXP_SEVEN;
   sexp_gc_var4(tmp, sym, args, env);
   args = SEXP_NULL;
@@ -442,6 +450,14 @@ sexp run_main (int argc, char **argv) {
       }
 #endif
       break;
+#if SEXP_USE_INCREMENTAL_GC
+    case 'g':
+      arg = ((argv[i][2] == '\0') ? argv[++i] : argv[i]+2);
+      check_nonull_arg('g', arg);
+      gc_pause = strtoul(arg, NULL, 0);
+      if (ctx) sexp_context_heap(ctx)->gc_pause_usecs = gc_pause;
+      break;
+#endif
     case 'i':
       arg = ((argv[i][2] == '\0') ? argv[++i] : argv[i]+2);
 #if SEXP_USE_IMAGE_LOADING
@@ -459,6 +475,9 @@ sexp run_main (int argc, char **argv) {
       } else {
         env = sexp_load_standard_params(ctx, sexp_context_env(ctx), nonblocking);
         init_loaded++;
+#if SEXP_USE_INCREMENTAL_GC
+        if (gc_pause) sexp_context_heap(ctx)->gc_pause_usecs = gc_pause;
+#endif
       }
 #endif
       break;
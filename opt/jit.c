@@ -0,0 +1,797 @@
+/*  jit.c -- baseline x86-64 compiler for hot bytecode        */
+/*  BSD-style license: http://synthcode.com/license.txt       */
+
+/* Each instruction of a hot procedure's bytecode is replaced by a */
+/* fixed template of machine code working directly on the VM stack, */
+/* with the VM registers held in machine registers: */
+/* */
+/*   rbx  struct sexp_jit_regs *     r13  &stack[top] */
+/*   r12  stack                      r14  &stack[fp] */
+/*   rbp  cp                         r15  self */
+/* */
+/* Frames are laid out exactly as by the interpreter, so whenever a */
+/* template can't handle its operands, or for any instruction without */
+/* a template, we store the bytecode offset in regs->ip and return to */
+/* sexp_apply, which carries on from that instruction.  Calls, tail */
+/* calls and returns between compiled procedures, and loops, stay in */
+/* native code as long as there's fuel and stack to spare. */
+
+#include <sys/mman.h>
+
+#if SEXP_FIXNUM_BITS != 1 || SEXP_FIXNUM_TAG != 1
+#error "SEXP_USE_JIT requires 1-bit fixnum tags"
+#endif
+
+struct sexp_jit_regs {
+  sexp *stack, *limit;
+  sexp_sint_t top, fp;
+  sexp self;
+  sexp_sint_t ip, fuel;
+};
+
+typedef void (*sexp_jit_run_fn) (struct sexp_jit_regs *regs, void *entry);
+
+enum sexp_jit_reg {
+  JIT_RAX, JIT_RCX, JIT_RDX, JIT_RBX, JIT_RSP, JIT_RBP, JIT_RSI, JIT_RDI,
+  JIT_R8, JIT_R9, JIT_R10, JIT_R11, JIT_R12, JIT_R13, JIT_R14, JIT_R15
+};
+
+#define JIT_REGS  JIT_RBX
+#define JIT_STACK JIT_R12
+#define JIT_SP    JIT_R13
+#define JIT_FP    JIT_R14
+#define JIT_SELF  JIT_R15
+#define JIT_CP    JIT_RBP
+
+enum sexp_jit_cc {
+  JIT_O = 0x0, JIT_NO = 0x1, JIT_B = 0x2, JIT_AE = 0x3, JIT_E = 0x4,
+  JIT_NE = 0x5, JIT_L = 0xC, JIT_GE = 0xD, JIT_LE = 0xE, JIT_G = 0xF,
+  JIT_ALWAYS = -1
+};
+
+enum sexp_jit_fixup_kind {
+  JIT_TO_LABEL,                 /* bytecode offset, else exit there */
+  JIT_TO_EXIT,                  /* return to the VM at bytecode offset */
+  JIT_TO_CODE,                  /* offset in the code being compiled */
+  JIT_TO_ADDRESS                /* anywhere else in the code cache */
+};
+
+struct sexp_jit_fixup {
+  sexp_sint_t at, target;
+  int kind;
+};
+
+struct sexp_jit {
+  unsigned char *code;
+  sexp_sint_t len, size;
+  sexp_sint_t *labels, *exits;
+  struct sexp_jit_fixup *fixups;
+  sexp_sint_t num_fixups, fixups_size;
+  int error;
+};
+
+#define JIT_REG_OFF(f)  ((sexp_sint_t)offsetof(struct sexp_jit_regs, f))
+#define JIT_TAG_OFF     ((sexp_sint_t)offsetof(struct sexp_struct, tag))
+#define JIT_CAR_OFF     ((sexp_sint_t)sexp_offsetof(pair, car))
+#define JIT_CDR_OFF     ((sexp_sint_t)sexp_offsetof(pair, cdr))
+#define JIT_VECTOR_OFF  ((sexp_sint_t)sexp_sizeof(vector))
+#define JIT_PROC_OFF(f) ((sexp_sint_t)sexp_offsetof(procedure, f))
+#define JIT_BC_OFF(f)   ((sexp_sint_t)sexp_offsetof(bytecode, f))
+
+static unsigned char *sexp_jit_cache, *sexp_jit_cache_ptr, *sexp_jit_cache_end;
+static unsigned char *sexp_jit_exit, *sexp_jit_ret;
+static sexp_jit_run_fn sexp_jit_run;
+static int sexp_jit_disabled;
+
+/* The code cache is shared by every context in the process, which */
+/* may be running in different OS threads (see (chibi parallel)), */
+/* so setting it up and allocating from it is serialized. */
+static volatile int sexp_jit_lock;
+#define sexp_jit_acquire() while (__sync_lock_test_and_set(&sexp_jit_lock, 1))
+#define sexp_jit_release() __sync_lock_release(&sexp_jit_lock)
+
+/************************** assembler *********************************/
+
+static void jit_byte (struct sexp_jit *j, int x) {
+  unsigned char *tmp;
+  if (j->len >= j->size) {
+    tmp = (unsigned char*) realloc(j->code, j->size*2);
+    if (!tmp) {
+      j->error = 1;
+      return;
+    }
+    j->code = tmp;
+    j->size *= 2;
+  }
+  j->code[j->len++] = x;
+}
+
+static void jit_int16 (struct sexp_jit *j, sexp_sint_t x) {
+  jit_byte(j, x & 0xFF);
+  jit_byte(j, (x >> 8) & 0xFF);
+}
+
+static void jit_int32 (struct sexp_jit *j, sexp_sint_t x) {
+  int i;
+  for (i=0; i<4; i++, x >>= 8)
+    jit_byte(j, x & 0xFF);
+}
+
+static void jit_rex (struct sexp_jit *j, int w, int reg, int index, int base) {
+  int rex = 0x40 | (w<<3) | ((reg&8)>>1) | ((index&8)>>2) | ((base&8)>>3);
+  if (rex != 0x40) jit_byte(j, rex);
+}
+
+static void jit_opcode (struct sexp_jit *j, int op) {
+  if (op > 0xFF) jit_byte(j, op >> 8);
+  jit_byte(j, op & 0xFF);
+}
+
+/* op reg, [base+disp] (reg is an opcode extension for group ops) */
+static void jit_mem (struct sexp_jit *j, int w, int op, int reg, int base, sexp_sint_t disp) {
+  jit_rex(j, w, reg, 0, base);
+  jit_opcode(j, op);
+  jit_byte(j, 0x80 | ((reg&7)<<3) | (base&7));
+  if ((base&7) == JIT_RSP) jit_byte(j, 0x24);
+  jit_int32(j, disp);
+}
+
+/* op reg, [base+index*8+disp] */
+static void jit_mem_index (struct sexp_jit *j, int w, int op, int reg, int base, int index, sexp_sint_t disp) {
+  jit_rex(j, w, reg, index, base);
+  jit_opcode(j, op);
+  jit_byte(j, 0x84 | ((reg&7)<<3));
+  jit_byte(j, 0xC0 | ((index&7)<<3) | (base&7));
+  jit_int32(j, disp);
+}
+
+/* op rm, reg (or op reg, rm depending on the opcode's direction) */
+static void jit_reg (struct sexp_jit *j, int w, int op, int reg, int rm) {
+  jit_rex(j, w, reg, 0, rm);
+  jit_opcode(j, op);
+  jit_byte(j, 0xC0 | ((reg&7)<<3) | (rm&7));
+}
+
+#define jit_load(j, r, base, d)    jit_mem(j, 1, 0x8B, r, base, d)
+#define jit_store(j, base, d, r)   jit_mem(j, 1, 0x89, r, base, d)
+#define jit_lea(j, r, base, d)     jit_mem(j, 1, 0x8D, r, base, d)
+#define jit_mov(j, dst, src)       jit_reg(j, 1, 0x89, src, dst)
+#define jit_test(j, a, b)          jit_reg(j, 1, 0x85, b, a)
+#define jit_sar(j, r, n)           (jit_reg(j, 1, 0xC1, 7, r), jit_byte(j, n))
+#define jit_push(j, r)             (jit_rex(j, 0, 0, 0, r), jit_byte(j, 0x50+((r)&7)))
+#define jit_pop(j, r)              (jit_rex(j, 0, 0, 0, r), jit_byte(j, 0x58+((r)&7)))
+#define jit_jump_reg(j, r)         jit_reg(j, 0, 0xFF, 4, r)
+
+/* mov qword [base+disp], imm32 */
+static void jit_store_imm (struct sexp_jit *j, int base, sexp_sint_t disp, sexp_sint_t x) {
+  jit_mem(j, 1, 0xC7, 0, base, disp);
+  jit_int32(j, x);
+}
+
+static void jit_load_imm (struct sexp_jit *j, int r, sexp_uint_t x) {
+  int i, wide = x > 0xFFFFFFFFuL;
+  jit_rex(j, wide, 0, 0, r);
+  jit_byte(j, 0xB8 + (r&7));
+  for (i=0; i < (wide ? 8 : 4); i++, x >>= 8)
+    jit_byte(j, x & 0xFF);
+}
+
+/* test the low byte of rax, rcx or rdx against a mask */
+static void jit_test_low (struct sexp_jit *j, int r, int mask) {
+  jit_byte(j, 0xF6);
+  jit_byte(j, 0xC0 | r);
+  jit_byte(j, mask);
+}
+
+static void jit_cmp_tag (struct sexp_jit *j, int r, sexp_uint_t tag) {
+  switch (sizeof(sexp_tag_t)) {
+  case 1: jit_mem(j, 0, 0x80, 7, r, JIT_TAG_OFF); jit_byte(j, tag); break;
+  case 2: jit_byte(j, 0x66); jit_mem(j, 0, 0x81, 7, r, JIT_TAG_OFF); jit_int16(j, tag); break;
+  case 4: jit_mem(j, 0, 0x81, 7, r, JIT_TAG_OFF); jit_int32(j, tag); break;
+  default: jit_mem(j, 1, 0x81, 7, r, JIT_TAG_OFF); jit_int32(j, tag); break;
+  }
+}
+
+static void jit_fixup (struct sexp_jit *j, int kind, sexp_sint_t target) {
+  struct sexp_jit_fixup *tmp;
+  if (j->num_fixups >= j->fixups_size) {
+    tmp = (struct sexp_jit_fixup*) realloc(j->fixups, 2*j->fixups_size*sizeof(struct sexp_jit_fixup));
+    if (!tmp) {
+      j->error = 1;
+      return;
+    }
+    j->fixups = tmp;
+    j->fixups_size *= 2;
+  }
+  j->fixups[j->num_fixups].at = j->len;
+  j->fixups[j->num_fixups].target = target;
+  j->fixups[j->num_fixups].kind = kind;
+  j->num_fixups++;
+  if (kind == JIT_TO_EXIT) j->exits[target] = 0;
+  jit_int32(j, 0);
+}
+
+static void jit_jump (struct sexp_jit *j, int cc, int kind, sexp_sint_t target) {
+  if (cc == JIT_ALWAYS) {
+    jit_byte(j, 0xE9);
+  } else {
+    jit_byte(j, 0x0F);
+    jit_byte(j, 0x80 | cc);
+  }
+  jit_fixup(j, kind, target);
+}
+
+#define jit_exit_if(j, cc, p) jit_jump(j, cc, JIT_TO_EXIT, p)
+
+/**************************** templates *******************************/
+
+#define jit_push_rax(j)                         \
+  (jit_store(j, JIT_SP, 0, JIT_RAX), jit_lea(j, JIT_SP, JIT_SP, 8))
+
+static void jit_guard_pair (struct sexp_jit *j, sexp_sint_t p) {
+  jit_test_low(j, JIT_RAX, SEXP_POINTER_MASK);
+  jit_exit_if(j, JIT_NE, p);
+  jit_cmp_tag(j, JIT_RAX, SEXP_PAIR);
+  jit_exit_if(j, JIT_NE, p);
+}
+
+/* load _ARG1 into rax and _ARG2 into rcx, and if guardp exit unless */
+/* both are fixnums */
+static void jit_fixnum_args (struct sexp_jit *j, sexp_sint_t p, int guardp) {
+  jit_load(j, JIT_RAX, JIT_SP, -8);
+  jit_load(j, JIT_RCX, JIT_SP, -16);
+  if (! guardp) return;
+  jit_reg(j, 0, 0x89, JIT_RAX, JIT_RDX);
+  jit_reg(j, 0, 0x21, JIT_RCX, JIT_RDX);
+  jit_test_low(j, JIT_RDX, SEXP_FIXNUM_MASK);
+  jit_exit_if(j, JIT_E, p);
+}
+
+/* rax = cc ? SEXP_TRUE : SEXP_FALSE, flags already set */
+static void jit_boolean (struct sexp_jit *j, int cc) {
+  jit_load_imm(j, JIT_RAX, (sexp_uint_t)SEXP_FALSE);
+  jit_load_imm(j, JIT_RDX, (sexp_uint_t)SEXP_TRUE);
+  jit_reg(j, 1, 0x0F40 | cc, JIT_RAX, JIT_RDX);
+}
+
+/* replace _ARG1 and _ARG2 with rax */
+static void jit_replace2 (struct sexp_jit *j) {
+  jit_lea(j, JIT_SP, JIT_SP, -8);
+  jit_store(j, JIT_SP, -8, JIT_RAX);
+}
+
+/* Check that the procedure in _ARG1 can be entered directly from */
+/* native code with n args, leaving it in rax and its entry in rcx. */
+/* consume one unit of fuel, leaving the last for the VM to notice */
+static void jit_use_fuel (struct sexp_jit *j, sexp_sint_t p) {
+  jit_mem(j, 1, 0x83, 7, JIT_REGS, JIT_REG_OFF(fuel));
+  jit_byte(j, 1);
+  jit_exit_if(j, JIT_LE, p);
+  jit_mem(j, 1, 0x83, 5, JIT_REGS, JIT_REG_OFF(fuel));
+  jit_byte(j, 1);
+}
+
+static void jit_call_guard (struct sexp_jit *j, sexp_sint_t n, sexp_sint_t p) {
+  jit_load(j, JIT_RAX, JIT_SP, -8);
+  jit_test_low(j, JIT_RAX, SEXP_POINTER_MASK);
+  jit_exit_if(j, JIT_NE, p);
+  jit_cmp_tag(j, JIT_RAX, SEXP_PROCEDURE);
+  jit_exit_if(j, JIT_NE, p);
+  /* the flags are a boxed fixnum, so variadic is bit 1 */
+  jit_mem(j, 0, 0xF6, 0, JIT_RAX, JIT_PROC_OFF(flags));
+  jit_byte(j, SEXP_PROC_VARIADIC << SEXP_FIXNUM_BITS);
+  jit_exit_if(j, JIT_NE, p);
+  if (sizeof(sexp_proc_num_args_t) == 2) {
+    jit_byte(j, 0x66);
+    jit_mem(j, 0, 0x81, 7, JIT_RAX, JIT_PROC_OFF(num_args));
+    jit_int16(j, n);
+  } else {
+    jit_mem(j, 0, 0x81, 7, JIT_RAX, JIT_PROC_OFF(num_args));
+    jit_int32(j, n);
+  }
+  jit_exit_if(j, JIT_NE, p);
+  jit_load(j, JIT_RDX, JIT_RAX, JIT_PROC_OFF(bc));
+  jit_load(j, JIT_RCX, JIT_RDX, JIT_BC_OFF(jit));
+  jit_test(j, JIT_RCX, JIT_RCX);
+  jit_exit_if(j, JIT_E, p);
+  jit_load(j, JIT_RCX, JIT_RCX, 0);
+  jit_test(j, JIT_RCX, JIT_RCX);
+  jit_exit_if(j, JIT_E, p);
+  /* same stack check as make_call */
+  jit_load(j, JIT_RSI, JIT_RDX, JIT_BC_OFF(max_depth));
+  jit_mem_index(j, 1, 0x8D, JIT_RSI, JIT_SP, JIT_RSI, 64*sizeof(sexp));
+  jit_mem(j, 1, 0x3B, JIT_RSI, JIT_REGS, JIT_REG_OFF(limit));
+  jit_exit_if(j, JIT_AE, p);
+  jit_use_fuel(j, p);
+}
+
+/* switch to the procedure in rax with the frame at r14 set up */
+static void jit_enter_callee (struct sexp_jit *j) {
+  jit_mov(j, JIT_SELF, JIT_RAX);
+  jit_load(j, JIT_CP, JIT_RAX, JIT_PROC_OFF(vars));
+  jit_jump_reg(j, JIT_RCX);
+}
+
+static void jit_call (struct sexp_jit *j, sexp_sint_t n, sexp_sint_t p, sexp_sint_t next) {
+  jit_call_guard(j, n, p);
+  jit_store_imm(j, JIT_SP, -8, (sexp_sint_t)sexp_make_fixnum(n));
+  jit_store_imm(j, JIT_SP, 0, (sexp_sint_t)sexp_make_fixnum(next));
+  jit_store(j, JIT_SP, 8, JIT_SELF);
+  /* box fp: ((r14 - r12) >> 3 << 1) | 1 */
+  jit_mov(j, JIT_RSI, JIT_FP);
+  jit_reg(j, 1, 0x29, JIT_STACK, JIT_RSI);
+  jit_sar(j, JIT_RSI, 2);
+  jit_reg(j, 1, 0x83, 1, JIT_RSI);
+  jit_byte(j, SEXP_FIXNUM_TAG);
+  jit_store(j, JIT_SP, 16, JIT_RSI);
+  jit_lea(j, JIT_FP, JIT_SP, -8);
+  jit_lea(j, JIT_SP, JIT_SP, 24);
+  jit_enter_callee(j);
+}
+
+static void jit_tail_call (struct sexp_jit *j, sexp_sint_t n, sexp_sint_t p) {
+  sexp_sint_t k;
+  jit_call_guard(j, n, p);
+  jit_load(j, JIT_RDX, JIT_FP, 0);
+  jit_sar(j, JIT_RDX, 1);
+  jit_reg(j, 1, 0xF7, 3, JIT_RDX);
+  jit_load(j, JIT_R8, JIT_FP, 8);
+  jit_load(j, JIT_R9, JIT_FP, 16);
+  jit_load(j, JIT_R10, JIT_FP, 24);
+  jit_mem_index(j, 1, 0x8D, JIT_RDI, JIT_FP, JIT_RDX, 0);
+  for (k=0; k<n; k++) {
+    jit_load(j, JIT_RSI, JIT_SP, (k-n-1)*(sexp_sint_t)sizeof(sexp));
+    jit_store(j, JIT_RDI, k*sizeof(sexp), JIT_RSI);
+  }
+  jit_lea(j, JIT_FP, JIT_RDI, n*sizeof(sexp));
+  jit_store_imm(j, JIT_FP, 0, (sexp_sint_t)sexp_make_fixnum(n));
+  jit_store(j, JIT_FP, 8, JIT_R8);
+  jit_store(j, JIT_FP, 16, JIT_R9);
+  jit_store(j, JIT_FP, 24, JIT_R10);
+  jit_lea(j, JIT_SP, JIT_FP, 32);
+  jit_enter_callee(j);
+}
+
+/* The fixed code shared by all compiled procedures: the entry point */
+/* called from sexp_apply, the common exit back to it, and RET. */
+static sexp_sint_t jit_runtime (struct sexp_jit *j, sexp_sint_t *exit_at, sexp_sint_t *ret_at) {
+  sexp_sint_t ret_exit;
+  jit_push(j, JIT_RBX);
+  jit_push(j, JIT_RBP);
+  jit_push(j, JIT_R12);
+  jit_push(j, JIT_R13);
+  jit_push(j, JIT_R14);
+  jit_push(j, JIT_R15);
+  jit_mov(j, JIT_REGS, JIT_RDI);
+  jit_load(j, JIT_STACK, JIT_REGS, JIT_REG_OFF(stack));
+  jit_load(j, JIT_SP, JIT_REGS, JIT_REG_OFF(top));
+  jit_mem_index(j, 1, 0x8D, JIT_SP, JIT_STACK, JIT_SP, 0);
+  jit_load(j, JIT_FP, JIT_REGS, JIT_REG_OFF(fp));
+  jit_mem_index(j, 1, 0x8D, JIT_FP, JIT_STACK, JIT_FP, 0);
+  jit_load(j, JIT_SELF, JIT_REGS, JIT_REG_OFF(self));
+  jit_load(j, JIT_CP, JIT_SELF, JIT_PROC_OFF(vars));
+  jit_jump_reg(j, JIT_RSI);
+  /* exit, with regs->ip already set */
+  *exit_at = j->len;
+  jit_mov(j, JIT_RAX, JIT_SP);
+  jit_reg(j, 1, 0x29, JIT_STACK, JIT_RAX);
+  jit_sar(j, JIT_RAX, 3);
+  jit_store(j, JIT_REGS, JIT_REG_OFF(top), JIT_RAX);
+  jit_mov(j, JIT_RAX, JIT_FP);
+  jit_reg(j, 1, 0x29, JIT_STACK, JIT_RAX);
+  jit_sar(j, JIT_RAX, 3);
+  jit_store(j, JIT_REGS, JIT_REG_OFF(fp), JIT_RAX);
+  jit_store(j, JIT_REGS, JIT_REG_OFF(self), JIT_SELF);
+  jit_pop(j, JIT_R15);
+  jit_pop(j, JIT_R14);
+  jit_pop(j, JIT_R13);
+  jit_pop(j, JIT_R12);
+  jit_pop(j, JIT_RBP);
+  jit_pop(j, JIT_RBX);
+  jit_byte(j, 0xC3);
+  /* RET, continuing natively if the caller has been compiled */
+  *ret_at = j->len;
+  jit_load(j, JIT_RAX, JIT_SP, -8);
+  jit_load(j, JIT_RCX, JIT_FP, 0);
+  jit_sar(j, JIT_RCX, 1);
+  jit_reg(j, 1, 0xF7, 3, JIT_RCX);
+  jit_mem_index(j, 1, 0x8D, JIT_RDX, JIT_FP, JIT_RCX, 0);
+  jit_store(j, JIT_RDX, 0, JIT_RAX);
+  jit_lea(j, JIT_SP, JIT_RDX, 8);
+  jit_load(j, JIT_RSI, JIT_FP, 8);
+  jit_sar(j, JIT_RSI, 1);
+  jit_load(j, JIT_SELF, JIT_FP, 16);
+  jit_load(j, JIT_RAX, JIT_FP, 24);
+  jit_sar(j, JIT_RAX, 1);
+  jit_mem_index(j, 1, 0x8D, JIT_FP, JIT_STACK, JIT_RAX, 0);
+  jit_load(j, JIT_CP, JIT_SELF, JIT_PROC_OFF(vars));
+  jit_load(j, JIT_RAX, JIT_SELF, JIT_PROC_OFF(bc));
+  jit_load(j, JIT_RAX, JIT_RAX, JIT_BC_OFF(jit));
+  jit_test(j, JIT_RAX, JIT_RAX);
+  jit_jump(j, JIT_E, JIT_TO_CODE, -1);
+  ret_exit = j->num_fixups - 1;
+  jit_mem_index(j, 1, 0x8B, JIT_RAX, JIT_RAX, JIT_RSI, 0);
+  jit_test(j, JIT_RAX, JIT_RAX);
+  jit_jump(j, JIT_E, JIT_TO_CODE, -1);
+  jit_jump_reg(j, JIT_RAX);
+  j->fixups[ret_exit].target = j->fixups[ret_exit+1].target = j->len;
+  jit_store(j, JIT_REGS, JIT_REG_OFF(ip), JIT_RSI);
+  jit_jump(j, JIT_ALWAYS, JIT_TO_CODE, *exit_at);
+  return j->error ? -1 : 0;
+}
+
+/**************************** compiler ********************************/
+
+static int jit_init (struct sexp_jit *j, sexp_sint_t len) {
+  sexp_sint_t i;
+  memset(j, 0, sizeof(*j));
+  j->size = 64 + 32*len;
+  j->fixups_size = 16 + len/4;
+  j->code = (unsigned char*) malloc(j->size);
+  j->labels = (sexp_sint_t*) malloc((len+1)*sizeof(sexp_sint_t));
+  j->exits = (sexp_sint_t*) malloc((len+1)*sizeof(sexp_sint_t));
+  j->fixups = (struct sexp_jit_fixup*) malloc(j->fixups_size*sizeof(struct sexp_jit_fixup));
+  if (!(j->code && j->labels && j->exits && j->fixups))
+    return 0;
+  for (i=0; i<=len; i++)
+    j->labels[i] = j->exits[i] = -1;
+  return 1;
+}
+
+static void jit_free (struct sexp_jit *j) {
+  free(j->code);
+  free(j->labels);
+  free(j->exits);
+  free(j->fixups);
+}
+
+static unsigned char *sexp_jit_alloc (sexp_uint_t size) {
+  unsigned char *res;
+  size = (size + 15) & ~(sexp_uint_t)15;
+  if (!sexp_jit_cache || sexp_jit_cache_end - sexp_jit_cache_ptr < (sexp_sint_t)size)
+    return NULL;
+  res = sexp_jit_cache_ptr;
+  sexp_jit_cache_ptr += size;
+  return res;
+}
+
+/* copy the finished code into the cache and resolve its jumps */
+static unsigned char *jit_install (struct sexp_jit *j, sexp_uint_t extra) {
+  sexp_sint_t i, at, dst;
+  unsigned char *res = sexp_jit_alloc(j->len + extra);
+  if (!res) return NULL;
+  memcpy(res, j->code, j->len);
+  for (i=0; i<j->num_fixups; i++) {
+    at = j->fixups[i].at;
+    switch (j->fixups[i].kind) {
+    case JIT_TO_LABEL:
+      dst = j->labels[j->fixups[i].target];
+      if (dst < 0) dst = j->exits[j->fixups[i].target];
+      dst = (sexp_sint_t)(res + dst);
+      break;
+    case JIT_TO_EXIT: dst = (sexp_sint_t)(res + j->exits[j->fixups[i].target]); break;
+    case JIT_TO_CODE: dst = (sexp_sint_t)(res + j->fixups[i].target); break;
+    default: dst = j->fixups[i].target; break;
+    }
+    dst -= (sexp_sint_t)(res + at + 4);
+    res[at] = dst & 0xFF;
+    res[at+1] = (dst >> 8) & 0xFF;
+    res[at+2] = (dst >> 16) & 0xFF;
+    res[at+3] = (dst >> 24) & 0xFF;
+  }
+  return res;
+}
+
+static int sexp_jit_setup (void) {
+  struct sexp_jit j;
+  sexp_sint_t exit_at, ret_at;
+  unsigned char *code;
+  sexp_jit_disabled = 1;
+  sexp_jit_cache = (unsigned char*) mmap(NULL, SEXP_JIT_CODE_SIZE, PROT_READ|PROT_WRITE|PROT_EXEC, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+  if (sexp_jit_cache == MAP_FAILED) {
+    sexp_jit_cache = NULL;
+    return 0;
+  }
+  sexp_jit_cache_ptr = sexp_jit_cache;
+  sexp_jit_cache_end = sexp_jit_cache + SEXP_JIT_CODE_SIZE;
+  code = NULL;
+  if (jit_init(&j, 0) && jit_runtime(&j, &exit_at, &ret_at) == 0)
+    code = jit_install(&j, 0);
+  jit_free(&j);
+  if (!code) return 0;
+  sexp_jit_run = (sexp_jit_run_fn) code;
+  sexp_jit_exit = code + exit_at;
+  sexp_jit_ret = code + ret_at;
+  sexp_jit_disabled = 0;
+  return 1;
+}
+
+static sexp_sint_t jit_op_length (unsigned char op) {
+  switch (op) {
+  case SEXP_OP_CALL: case SEXP_OP_TAIL_CALL:
+  case SEXP_OP_FCALL0: case SEXP_OP_FCALL1: case SEXP_OP_FCALL2:
+  case SEXP_OP_FCALL3: case SEXP_OP_FCALL4: case SEXP_OP_FCALLN:
+  case SEXP_OP_JUMP: case SEXP_OP_JUMP_UNLESS: case SEXP_OP_PUSH:
+  case SEXP_OP_RESERVE: case SEXP_OP_GLOBAL_REF:
+  case SEXP_OP_GLOBAL_KNOWN_REF: case SEXP_OP_PARAMETER_REF:
+  case SEXP_OP_STACK_REF: case SEXP_OP_LOCAL_REF: case SEXP_OP_LOCAL_SET:
+  case SEXP_OP_CLOSURE_REF: case SEXP_OP_TYPEP:
+    return 1 + sizeof(sexp);
+  case SEXP_OP_LOCAL_REF_CAR: case SEXP_OP_LOCAL_REF_CDR:
+  case SEXP_OP_CLOSURE_REF_CDR: case SEXP_OP_LOCAL_REF_UNSAFE_CAR:
+  case SEXP_OP_LOCAL_REF_UNSAFE_CDR: case SEXP_OP_CLOSURE_REF_UNSAFE_CDR:
+    return 2 + sizeof(sexp);
+  case SEXP_OP_MAKE: case SEXP_OP_SLOT_REF: case SEXP_OP_SLOT_SET:
+  case SEXP_OP_CACHED_CALL: case SEXP_OP_CACHED_TAIL_CALL:
+    return 1 + 2*sizeof(sexp);
+  case SEXP_OP_MAKE_PROCEDURE:
+    return 1 + 3*sizeof(sexp);
+  default:
+    return 1;
+  }
+}
+
+#define jit_valid_target(t, len) (0 <= (t) && (t) <= (len))
+
+static int jit_cmp_cc (unsigned char op) {
+  switch (op) {
+  case SEXP_OP_LT: case SEXP_OP_FX_LT: case SEXP_OP_LT_JUMP_UNLESS:
+  case SEXP_OP_FX_LT_JUMP_UNLESS:
+    return JIT_L;
+  case SEXP_OP_LE: case SEXP_OP_FX_LE: case SEXP_OP_LE_JUMP_UNLESS:
+  case SEXP_OP_FX_LE_JUMP_UNLESS:
+    return JIT_LE;
+  default: return JIT_E;
+  }
+}
+
+/* Compile bc, setting sexp_bytecode_jit(bc) to a table mapping each */
+/* instruction offset to its native code (or NULL if that instruction */
+/* would just exit to the VM).  Returns 0 if the code cache is full. */
+static int sexp_jit_compile (sexp ctx, sexp bc) {
+  struct sexp_jit j;
+  unsigned char *data = sexp_bytecode_data(bc), *code;
+  sexp_sint_t len = sexp_bytecode_length(bc), p, next, n, k;
+  char *native;
+  void **table;
+  int op;
+  sexp_jit_acquire();
+  k = !sexp_jit_disabled && (sexp_jit_run || sexp_jit_setup());
+  sexp_jit_release();
+  if (!k)
+    return 0;
+  native = (char*) calloc(len+1, 1);
+  if (!native || !jit_init(&j, len)) {
+    free(native);
+    jit_free(&j);
+    return 0;
+  }
+  for (p=0; p<len && !j.error; p=next) {
+    op = data[p];
+    next = p + jit_op_length(op);
+    if (next > len) break;
+    n = (next > p+1) ? ((sexp_sint_t*)(data+p+1))[0] : 0;
+    j.labels[p] = j.len;
+    native[p] = 1;
+    switch (op) {
+    case SEXP_OP_PUSH:
+      jit_load_imm(&j, JIT_RAX, (sexp_uint_t)n);
+      jit_push_rax(&j);
+      break;
+    case SEXP_OP_DROP:
+      jit_lea(&j, JIT_SP, JIT_SP, -8);
+      break;
+    case SEXP_OP_GLOBAL_REF:
+      /* the cell may be patched by the VM, so load it from the code */
+      jit_load_imm(&j, JIT_RAX, (sexp_uint_t)(data+p+1));
+      jit_load(&j, JIT_RAX, JIT_RAX, 0);
+      jit_load(&j, JIT_RAX, JIT_RAX, JIT_CDR_OFF);
+      jit_reg(&j, 1, 0x81, 7, JIT_RAX);
+      jit_int32(&j, (sexp_sint_t)SEXP_UNDEF);
+      jit_exit_if(&j, JIT_E, p);
+      jit_push_rax(&j);
+      break;
+    case SEXP_OP_GLOBAL_KNOWN_REF:
+      jit_load_imm(&j, JIT_RAX, (sexp_uint_t)n);
+      jit_load(&j, JIT_RAX, JIT_RAX, JIT_CDR_OFF);
+      jit_push_rax(&j);
+      break;
+    case SEXP_OP_RESERVE:
+      if (n < 0 || n > 16) goto vm;
+      for (k=0; k<n; k++)
+        jit_store_imm(&j, JIT_SP, k*sizeof(sexp), (sexp_sint_t)SEXP_VOID);
+      jit_lea(&j, JIT_SP, JIT_SP, n*sizeof(sexp));
+      break;
+    case SEXP_OP_STACK_REF:
+      jit_load(&j, JIT_RAX, JIT_SP, -n*(sexp_sint_t)sizeof(sexp));
+      jit_push_rax(&j);
+      break;
+    case SEXP_OP_LOCAL_REF:
+      jit_load(&j, JIT_RAX, JIT_FP, (-1-n)*(sexp_sint_t)sizeof(sexp));
+      jit_push_rax(&j);
+      break;
+    case SEXP_OP_LOCAL_SET:
+      jit_load(&j, JIT_RAX, JIT_SP, -8);
+      jit_store(&j, JIT_FP, (-1-n)*(sexp_sint_t)sizeof(sexp), JIT_RAX);
+      jit_lea(&j, JIT_SP, JIT_SP, -8);
+      break;
+    case SEXP_OP_CLOSURE_REF:
+      jit_load(&j, JIT_RAX, JIT_CP, JIT_VECTOR_OFF + n*sizeof(sexp));
+      jit_push_rax(&j);
+      break;
+    case SEXP_OP_JUMP:
+      if (! jit_valid_target(p+1+n, len)) goto vm;
+      /* backward jumps are loops, so they have to let threads switch */
+      if (n < 0) jit_use_fuel(&j, p);
+      jit_jump(&j, JIT_ALWAYS, JIT_TO_LABEL, p+1+n);
+      break;
+    case SEXP_OP_JUMP_UNLESS:
+      if (! jit_valid_target(p+1+n, len)) goto vm;
+      jit_load(&j, JIT_RAX, JIT_SP, -8);
+      jit_lea(&j, JIT_SP, JIT_SP, -8);
+      jit_reg(&j, 1, 0x81, 7, JIT_RAX);
+      jit_int32(&j, (sexp_sint_t)SEXP_FALSE);
+      jit_jump(&j, JIT_E, JIT_TO_LABEL, p+1+n);
+      break;
+    case SEXP_OP_CAR:
+    case SEXP_OP_CDR:
+    case SEXP_OP_UNSAFE_CAR:
+    case SEXP_OP_UNSAFE_CDR:
+      jit_load(&j, JIT_RAX, JIT_SP, -8);
+      if (op == SEXP_OP_CAR || op == SEXP_OP_CDR)
+        jit_guard_pair(&j, p);
+      jit_load(&j, JIT_RAX, JIT_RAX, (op == SEXP_OP_CAR || op == SEXP_OP_UNSAFE_CAR)
+               ? JIT_CAR_OFF : JIT_CDR_OFF);
+      jit_store(&j, JIT_SP, -8, JIT_RAX);
+      break;
+    case SEXP_OP_LOCAL_REF_CAR:
+    case SEXP_OP_LOCAL_REF_CDR:
+    case SEXP_OP_CLOSURE_REF_CDR:
+    case SEXP_OP_LOCAL_REF_UNSAFE_CAR:
+    case SEXP_OP_LOCAL_REF_UNSAFE_CDR:
+    case SEXP_OP_CLOSURE_REF_UNSAFE_CDR:
+      if (op == SEXP_OP_CLOSURE_REF_CDR || op == SEXP_OP_CLOSURE_REF_UNSAFE_CDR)
+        jit_load(&j, JIT_RAX, JIT_CP, JIT_VECTOR_OFF + n*sizeof(sexp));
+      else
+        jit_load(&j, JIT_RAX, JIT_FP, (-1-n)*(sexp_sint_t)sizeof(sexp));
+      if (op == SEXP_OP_LOCAL_REF_CAR || op == SEXP_OP_LOCAL_REF_CDR
+          || op == SEXP_OP_CLOSURE_REF_CDR)
+        jit_guard_pair(&j, p);
+      jit_load(&j, JIT_RAX, JIT_RAX, (op == SEXP_OP_LOCAL_REF_CAR || op == SEXP_OP_LOCAL_REF_UNSAFE_CAR)
+               ? JIT_CAR_OFF : JIT_CDR_OFF);
+      jit_push_rax(&j);
+      break;
+    case SEXP_OP_NULLP:
+    case SEXP_OP_FIXNUMP:
+      jit_load(&j, JIT_RAX, JIT_SP, -8);
+      if (op == SEXP_OP_NULLP) {
+        jit_reg(&j, 1, 0x81, 7, JIT_RAX);
+        jit_int32(&j, (sexp_sint_t)SEXP_NULL);
+        jit_boolean(&j, JIT_E);
+      } else {
+        jit_test_low(&j, JIT_RAX, SEXP_FIXNUM_MASK);
+        jit_boolean(&j, JIT_NE);
+      }
+      jit_store(&j, JIT_SP, -8, JIT_RAX);
+      break;
+    case SEXP_OP_EQ:
+      jit_load(&j, JIT_RAX, JIT_SP, -8);
+      jit_mem(&j, 1, 0x3B, JIT_RAX, JIT_SP, -16);
+      jit_boolean(&j, JIT_E);
+      jit_replace2(&j);
+      break;
+    case SEXP_OP_LT:
+    case SEXP_OP_LE:
+    case SEXP_OP_EQN:
+    case SEXP_OP_FX_LT:
+    case SEXP_OP_FX_LE:
+    case SEXP_OP_FX_EQN:
+      jit_fixnum_args(&j, p, (op == SEXP_OP_LT || op == SEXP_OP_LE
+                              || op == SEXP_OP_EQN));
+      jit_reg(&j, 1, 0x39, JIT_RCX, JIT_RAX);
+      jit_boolean(&j, jit_cmp_cc(op));
+      jit_replace2(&j);
+      break;
+    case SEXP_OP_LT_JUMP_UNLESS:
+    case SEXP_OP_LE_JUMP_UNLESS:
+    case SEXP_OP_EQN_JUMP_UNLESS:
+    case SEXP_OP_NULLP_JUMP_UNLESS:
+    case SEXP_OP_FX_LT_JUMP_UNLESS:
+    case SEXP_OP_FX_LE_JUMP_UNLESS:
+    case SEXP_OP_FX_EQN_JUMP_UNLESS:
+      /* compile the fused JUMP_UNLESS along with the test */
+      if (p + 2 + (sexp_sint_t)sizeof(sexp) > len || data[p+1] != SEXP_OP_JUMP_UNLESS)
+        goto vm;
+      n = ((sexp_sint_t*)(data+p+2))[0];
+      if (! jit_valid_target(p+2+n, len)) goto vm;
+      next = p + 2 + sizeof(sexp);
+      if (op == SEXP_OP_NULLP_JUMP_UNLESS) {
+        jit_load(&j, JIT_RAX, JIT_SP, -8);
+        jit_lea(&j, JIT_SP, JIT_SP, -8);
+        jit_reg(&j, 1, 0x81, 7, JIT_RAX);
+        jit_int32(&j, (sexp_sint_t)SEXP_NULL);
+        jit_jump(&j, JIT_NE, JIT_TO_LABEL, p+2+n);
+      } else {
+        jit_fixnum_args(&j, p, (op == SEXP_OP_LT_JUMP_UNLESS
+                                || op == SEXP_OP_LE_JUMP_UNLESS
+                                || op == SEXP_OP_EQN_JUMP_UNLESS));
+        jit_lea(&j, JIT_SP, JIT_SP, -16);
+        jit_reg(&j, 1, 0x39, JIT_RCX, JIT_RAX);
+        jit_jump(&j, jit_cmp_cc(op) ^ 1, JIT_TO_LABEL, p+2+n);
+      }
+      break;
+    case SEXP_OP_ADD:
+    case SEXP_OP_SUB:
+    case SEXP_OP_FX_ADD:
+    case SEXP_OP_FX_SUB:
+      /* on overflow the VM promotes to a bignum */
+      jit_fixnum_args(&j, p, op == SEXP_OP_ADD || op == SEXP_OP_SUB);
+      if (op == SEXP_OP_ADD || op == SEXP_OP_FX_ADD) {
+        jit_lea(&j, JIT_RDX, JIT_RAX, -SEXP_FIXNUM_TAG);
+        jit_reg(&j, 1, 0x01, JIT_RCX, JIT_RDX);
+        jit_exit_if(&j, JIT_O, p);
+      } else {
+        jit_mov(&j, JIT_RDX, JIT_RAX);
+        jit_reg(&j, 1, 0x29, JIT_RCX, JIT_RDX);
+        jit_exit_if(&j, JIT_O, p);
+        jit_reg(&j, 1, 0x83, 1, JIT_RDX);
+        jit_byte(&j, SEXP_FIXNUM_TAG);
+      }
+      jit_mov(&j, JIT_RAX, JIT_RDX);
+      jit_replace2(&j);
+      break;
+    case SEXP_OP_CALL:
+    case SEXP_OP_TAIL_CALL:
+    case SEXP_OP_CACHED_CALL:
+    case SEXP_OP_CACHED_TAIL_CALL:
+      /* the native guard does its own checks, ignore the cache */
+      n = sexp_unbox_fixnum((sexp)n);
+      if (n < 0 || n > 0x7FFF) goto vm;
+      if (op == SEXP_OP_CALL || op == SEXP_OP_CACHED_CALL)
+        jit_call(&j, n, p, next);
+      else
+        jit_tail_call(&j, n, p);
+      break;
+    case SEXP_OP_RET:
+      jit_jump(&j, JIT_ALWAYS, JIT_TO_ADDRESS, (sexp_sint_t)sexp_jit_ret);
+      break;
+    default:
+    vm:
+      native[p] = 0;
+      jit_store_imm(&j, JIT_REGS, JIT_REG_OFF(ip), p);
+      jit_jump(&j, JIT_ALWAYS, JIT_TO_ADDRESS, (sexp_sint_t)sexp_jit_exit);
+      break;
+    }
+  }
+  /* shouldn't be reachable, but don't run off the end */
+  j.labels[p] = j.len;
+  jit_store_imm(&j, JIT_REGS, JIT_REG_OFF(ip), p);
+  jit_jump(&j, JIT_ALWAYS, JIT_TO_ADDRESS, (sexp_sint_t)sexp_jit_exit);
+  /* exits to the VM, including jumps to offsets we didn't compile */
+  for (n=0; n<j.num_fixups; n++)
+    if (j.fixups[n].kind == JIT_TO_LABEL && j.labels[j.fixups[n].target] < 0)
+      j.exits[j.fixups[n].target] = 0;
+  for (p=0; p<=len; p++) {
+    if (j.exits[p] == 0) {
+      j.exits[p] = j.len;
+      jit_store_imm(&j, JIT_REGS, JIT_REG_OFF(ip), p);
+      jit_jump(&j, JIT_ALWAYS, JIT_TO_ADDRESS, (sexp_sint_t)sexp_jit_exit);
+    }
+  }
+  while (j.len % sizeof(void*)) jit_byte(&j, 0xCC);
+  sexp_jit_acquire();
+  code = j.error ? NULL : jit_install(&j, (len+1)*sizeof(void*));
+  sexp_jit_release();
+  if (code) {
+    table = (void**)(code + j.len);
+    for (p=0; p<=len; p++)
+      table[p] = native[p] ? code + j.labels[p] : NULL;
+    sexp_bytecode_jit(bc) = table;
+  }
+  jit_free(&j);
+  free(native);
+  return code != NULL;
+}
+
+#define sexp_jit_entry(bc, off) \
+  (sexp_bytecode_jit(bc) ? sexp_bytecode_jit(bc)[off] : NULL)
@@ -18,7 +18,14 @@ static const char* sexp_opcode_names_[] =
    "LT", "LE", "EQN", "EQ",
    "CHAR->INTEGER", "INTEGER->CHAR", "CHAR-UPCASE", "CHAR-DOWNCASE",
    "WRITE-CHAR", "WRITE-STRING", "READ-CHAR", "PEEK-CHAR",
-   "YIELD", "FORCE", "RET", "DONE", "SC?", "SC<", "SC<="
+   "YIELD", "FORCE", "RET", "DONE", "SC?", "SC<", "SC<=",
+   "LOCAL-REF+CAR", "LOCAL-REF+CDR", "CLOSURE-REF+CDR",
+   "LT+JUMP-UNLESS", "LE+JUMP-UNLESS", "EQN+JUMP-UNLESS",
+   "NULL?+JUMP-UNLESS",
+   "UNSAFE-CAR", "UNSAFE-CDR", "FX-ADD", "FX-SUB", "FX-LT", "FX-LE", "FX-EQN",
+   "LOCAL-REF+UNSAFE-CAR", "LOCAL-REF+UNSAFE-CDR", "CLOSURE-REF+UNSAFE-CDR",
+   "FX-LT+JUMP-UNLESS", "FX-LE+JUMP-UNLESS", "FX-EQN+JUMP-UNLESS",
+   "UNDERFLOW", "CACHED-CALL", "CACHED-TAIL-CALL"
   };
 
 const char** sexp_opcode_names = sexp_opcode_names_;
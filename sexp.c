@@ -139,7 +139,12 @@ sexp sexp_write_uvector(sexp ctx, sexp self, sexp_sint_t n, sexp obj, sexp write
   char* str;
   sexp_gc_var2(f, tmp);
   sexp_gc_preserve2(ctx, f, tmp);
+#if SEXP_USE_TAGGED_FLONUMS
+  /* box f so its value can be set for each element */
+  f = sexp_alloc_type(ctx, flonum, SEXP_FLONUM);
+#else
   f = sexp_make_flonum(ctx, 0.0f);
+#endif
   sexp_write_char(ctx, '#', out);
   sexp_write_char(ctx, sexp_uvector_prefix(sexp_uvector_type(obj)), out);
   sexp_write(ctx, sexp_make_fixnum(sexp_uvector_element_size(sexp_uvector_type(obj))), out);
@@ -287,8 +292,8 @@ static struct sexp_type_struct _sexp_type_specs[] = {
   {(sexp)"Procedure", SEXP_FALSE, SEXP_FALSE, SEXP_FALSE, SEXP_FALSE, SEXP_FALSE, NULL, NULL, NULL, SEXP_PROCEDURE, sexp_offsetof(procedure, bc), 2, 2, 0, 0, sexp_sizeof(procedure), 0, 0, 0, 0, 0, 0, 0, 0, NULL},
   {(sexp)"Macro", SEXP_FALSE, SEXP_FALSE, SEXP_FALSE, SEXP_FALSE, SEXP_FALSE, NULL, NULL, NULL, SEXP_MACRO, sexp_offsetof(macro, proc), 4, 4, 0, 0, sexp_sizeof(macro), 0, 0, 0, 0, 0, 0, 0, 0, NULL},
   {(sexp)"Sc", SEXP_FALSE, SEXP_FALSE, SEXP_FALSE, SEXP_FALSE, SEXP_FALSE, (sexp)sexp_write_simple_object, NULL, NULL, SEXP_SYNCLO, sexp_offsetof(synclo, env), 4, 4, 0, 0, sexp_sizeof(synclo), 0, 0, 0, 0, 0, 0, 0, 0, NULL},
-  {(sexp)"Environment", SEXP_FALSE, SEXP_FALSE, SEXP_FALSE, SEXP_FALSE, SEXP_FALSE, NULL, NULL, NULL, SEXP_ENV, sexp_offsetof(env, parent), 3+(SEXP_USE_STABLE_ABI||SEXP_USE_RENAME_BINDINGS), 3+(SEXP_USE_STABLE_ABI||SEXP_USE_RENAME_BINDINGS), 0, 0, sexp_sizeof(env), 0, 0, 0, 0, 0, 0, 0, 0, NULL},
-  {(sexp)"Bytecode", SEXP_FALSE, SEXP_FALSE, SEXP_FALSE, SEXP_FALSE, SEXP_FALSE, NULL, NULL, NULL, SEXP_BYTECODE, sexp_offsetof(bytecode, name), 3, 3, 0, 0, sexp_sizeof(bytecode), offsetof(struct sexp_struct, value.bytecode.length), 1, 0, 0, 0, 0, 0, 0, NULL},
+  {(sexp)"Environment", SEXP_FALSE, SEXP_FALSE, SEXP_FALSE, SEXP_FALSE, SEXP_FALSE, NULL, NULL, NULL, SEXP_ENV, sexp_offsetof(env, parent), 3+(SEXP_USE_STABLE_ABI||SEXP_USE_RENAME_BINDINGS)+(SEXP_USE_STABLE_ABI||SEXP_USE_INDEXED_ENVS), 3+(SEXP_USE_STABLE_ABI||SEXP_USE_RENAME_BINDINGS)+(SEXP_USE_STABLE_ABI||SEXP_USE_INDEXED_ENVS), 0, 0, sexp_sizeof(env), 0, 0, 0, 0, 0, 0, 0, 0, NULL},
+  {(sexp)"Bytecode", SEXP_FALSE, SEXP_FALSE, SEXP_FALSE, SEXP_FALSE, SEXP_FALSE, NULL, NULL, NULL, SEXP_BYTECODE, sexp_offsetof(bytecode, name), 4, 4, 0, 0, sexp_sizeof(bytecode), offsetof(struct sexp_struct, value.bytecode.length), 1, 0, 0, 0, 0, 0, 0, NULL},
   {(sexp)"Core-Form", SEXP_FALSE, SEXP_FALSE, SEXP_FALSE, SEXP_FALSE, SEXP_FALSE, NULL, NULL, NULL, SEXP_CORE, sexp_offsetof(core, name), 1, 1, 0, 0, sexp_sizeof(core), 0, 0, 0, 0, 0, 0, 0, 0, NULL},
 #if SEXP_USE_STABLE_ABI || SEXP_USE_DL
   {(sexp)"Dynamic-Library", SEXP_FALSE, SEXP_FALSE, SEXP_FALSE, SEXP_FALSE, SEXP_FALSE, NULL, NULL, SEXP_FINALIZE_DLN, SEXP_DL, sexp_offsetof(dl, file), 1, 1, 0, 0, sexp_sizeof(dl), 0, 0, 0, 0, 0, 0, 0, 0, SEXP_FINALIZE_DL},
@@ -500,6 +505,9 @@ static const char* sexp_initial_features[] = {
 #if SEXP_USE_MODULES
   "modules",
 #endif
+#if SEXP_USE_MODULE_CACHE
+  "module-cache",
+#endif
 #if SEXP_USE_BOEHM
   "boehm-gc",
 #endif
@@ -679,6 +687,8 @@ sexp sexp_make_context (sexp ctx, size_t size, size_t max_size) {
 #if SEXP_USE_TIME_GC
   sexp_context_gc_count(res) = 0;
   sexp_context_gc_usecs(res) = 0;
+  sexp_context_gc_mark_usecs(res) = 0;
+  sexp_context_gc_sweep_usecs(res) = 0;
 #endif
 #if SEXP_USE_TRACK_ALLOC_TIMES
   sexp_context_alloc_count(res) = 0;
@@ -692,6 +702,9 @@ sexp sexp_make_context (sexp ctx, size_t size, size_t max_size) {
   sexp_context_errorp(res) = 0;
   sexp_context_event(res) = SEXP_FALSE;
   sexp_context_refuel(res) = SEXP_DEFAULT_QUANTUM;
+  sexp_context_timer(res) = 0;
+  sexp_context_priority(res) = 0;
+  sexp_context_quantum(res) = SEXP_DEFAULT_QUANTUM;
 #endif
 #if SEXP_USE_DL
   sexp_context_dl(res) = ctx ? sexp_context_dl(ctx) : SEXP_FALSE;
@@ -720,6 +733,11 @@ sexp sexp_destroy_context (sexp ctx) {
 #endif
 #if SEXP_USE_TRACK_ALLOC_SIZES
     sexp_debug_alloc_sizes(ctx);
+#endif
+    sexp_finish_sweep(ctx);
+    sexp_retire_alloc_buffers(ctx);
+#if SEXP_USE_INCREMENTAL_GC
+    if (heap->marking) sexp_gc(ctx, NULL);  /* clear the partial marks */
 #endif
     sexp_markedp(ctx) = 1;
     sexp_markedp(sexp_context_globals(ctx)) = 1;
@@ -1143,7 +1161,26 @@ sexp sexp_flonump_op (sexp ctx, sexp self, sexp_sint_t n, sexp x) {
   return sexp_make_boolean(sexp_flonump(x));
 }
 
-#if ! SEXP_USE_IMMEDIATE_FLONUMS
+#if SEXP_USE_TAGGED_FLONUMS
+sexp sexp_make_flonum (sexp ctx, double f) {
+  union sexp_double_conv r;
+  sexp_uint_t b;
+  sexp x;
+  r.flonum = f;
+  b = r.bits;
+  if ((b << 1) == 0)
+    b |= SEXP_TFLONUM_ZERO;
+  else if ((b << 1) == (SEXP_TFLONUM_ZERO << 1))
+    b = 0;
+  if (((b >> 59) & 0xF) - 7 < 2)
+    return (sexp)((((b << 4) | (b >> 60)) & ~(sexp_uint_t)SEXP_POINTER_MASK)
+                  | SEXP_TFLONUM_TAG);
+  x = sexp_alloc_type(ctx, flonum, SEXP_FLONUM);
+  if (sexp_exceptionp(x)) return x;
+  x->value.flonum = f;
+  return x;
+}
+#elif ! SEXP_USE_IMMEDIATE_FLONUMS
 sexp sexp_make_flonum (sexp ctx, double f) {
   sexp x = sexp_alloc_type(ctx, flonum, SEXP_FLONUM);
   if (sexp_exceptionp(x)) return x;
@@ -1373,6 +1410,7 @@ void sexp_update_string_index_lookup(sexp ctx, sexp s) {
   numchunks = ((len + SEXP_STRING_INDEX_TABLE_CHUNK_SIZE - 1) / SEXP_STRING_INDEX_TABLE_CHUNK_SIZE) - 1;
   sexp_string_charlens(s) =
     sexp_make_bytes_op(ctx, NULL, 2, sexp_make_fixnum(numchunks * sizeof(sexp_sint_t)), SEXP_VOID);
+  sexp_write_barrier(ctx, s, sexp_string_charlens(s));
   chunks = (sexp_sint_t*)sexp_bytes_data(sexp_string_charlens(s));
   p = (unsigned char*) sexp_string_data(s);
   i = 0;
@@ -1771,6 +1809,7 @@ int sexp_buffered_flush (sexp ctx, sexp p, int forcep) {
       tmp = sexp_c_string(ctx, sexp_port_buf(p), off);
       if (tmp && sexp_stringp(tmp)) {
         sexp_push(ctx, sexp_cdr(sexp_port_cookie(p)), tmp);
+        sexp_write_barrier(ctx, sexp_port_cookie(p), sexp_cdr(sexp_port_cookie(p)));
         sexp_port_offset(p) = 0;
         res = 0;
       } else {
@@ -2172,14 +2211,68 @@ static struct {const char* name; char ch;} sexp_char_names[] = {
 
 #define sexp_num_char_names (sizeof(sexp_char_names)/sizeof(sexp_char_names[0]))
 
+#if SEXP_USE_FLONUMS && ! SEXP_USE_IMMEDIATE_FLONUMS
+static void sexp_write_flonum (sexp ctx, double f, sexp out) {
+  sexp_sint_t i, j;
+#if SEXP_USE_PATCH_NON_DECIMAL_NUMERIC_FORMATS
+  sexp_sint_t k;
+#endif
+  double ftmp;
+  char numbuf[NUMBUF_LEN];
+#if SEXP_USE_INFINITIES
+  if (isinf(f) || isnan(f)) {
+    numbuf[0] = (isinf(f) && f < 0 ? '-' : '+');
+    strncpy(numbuf+1, isinf(f) ? "inf.0" : "nan.0", NUMBUF_LEN-1);
+  } else
+#endif
+  {
+    /* snprintf doesn't guarantee the shortest accurate */
+    /* representation, so we try successively longer formats until */
+    /* we find the one that scans back as the original number */
+    i = snprintf(numbuf, sizeof(numbuf), "%.15lg", f);
+    if (sscanf(numbuf, "%lg", &ftmp) == 1 && ftmp != f) {
+      i = snprintf(numbuf, sizeof(numbuf), "%.16lg", f);
+      if (sscanf(numbuf, "%lg", &ftmp) == 1 && ftmp != f) {
+        i = snprintf(numbuf, sizeof(numbuf), "%.17lg", f);
+      }
+    }
+    for (j = 0; j < i; ++j) {
+      if (numbuf[j] == '.' || numbuf[j] == 'e') {
+        break;
+#if SEXP_USE_PATCH_NON_DECIMAL_NUMERIC_FORMATS
+      } else if (!sexp_isdigit(numbuf[j]) && numbuf[j] != '-') {
+        /* handle the case where we're embedded in an app which has */
+        /* called setlocale to something which doesn't use a decimal */
+        /* separator (e.g. a comma), by replacing any */
+        /* non-digit/decimal char with a decimal */
+        for (k = j+1; k < i && !sexp_isdigit(numbuf[k]); ++k)
+          ;
+        numbuf[j++] = '.';
+        while (k < i)
+          numbuf[j++] = numbuf[k++];
+        numbuf[j++] = '\0';
+        j = 0;
+        break;
+      }
+#endif
+    }
+    /* regardless, append a decimal if there wasn't any */
+    if (j >= i) {
+      numbuf[i++] = '.'; numbuf[i++] = '0'; numbuf[i++] = '\0';
+    }
+  }
+  sexp_write_string(ctx, numbuf, out);
+}
+#endif
+
 sexp sexp_write_one (sexp ctx, sexp obj, sexp out, sexp_sint_t bound) {
 #if SEXP_USE_HUFF_SYMS
   sexp_uint_t res;
 #endif
   sexp_uint_t len, c;
-  sexp_sint_t i=0, j, k;
-#if SEXP_USE_FLONUMS
-  double f, ftmp;
+  sexp_sint_t i=0;
+#if SEXP_USE_IMMEDIATE_FLONUMS
+  double f;
 #endif
 #if SEXP_USE_BYTEVECTOR_LITERALS && SEXP_BYTEVECTOR_HEX_LITERALS
   char buf[5];
@@ -2231,50 +2324,7 @@ sexp sexp_write_one (sexp ctx, sexp obj, sexp out, sexp_sint_t bound) {
 #if SEXP_USE_FLONUMS
 #if ! SEXP_USE_IMMEDIATE_FLONUMS
     case SEXP_FLONUM:
-      f = sexp_flonum_value(obj);
-#if SEXP_USE_INFINITIES
-      if (isinf(f) || isnan(f)) {
-        numbuf[0] = (isinf(f) && f < 0 ? '-' : '+');
-        strncpy(numbuf+1, isinf(f) ? "inf.0" : "nan.0", NUMBUF_LEN-1);
-      } else
-#endif
-      {
-        /* snprintf doesn't guarantee the shortest accurate */
-        /* representation, so we try successively longer formats until */
-        /* we find the one that scans back as the original number */
-        i = snprintf(numbuf, sizeof(numbuf), "%.15lg", f);
-        if (sscanf(numbuf, "%lg", &ftmp) == 1 && ftmp != f) {
-          i = snprintf(numbuf, sizeof(numbuf), "%.16lg", f);
-          if (sscanf(numbuf, "%lg", &ftmp) == 1 && ftmp != f) {
-            i = snprintf(numbuf, sizeof(numbuf), "%.17lg", f);
-          }
-        }
-        for (j = 0; j < i; ++j) {
-          if (numbuf[j] == '.' || numbuf[j] == 'e') {
-            break;
-#if SEXP_USE_PATCH_NON_DECIMAL_NUMERIC_FORMATS
-          } else if (!sexp_isdigit(numbuf[j]) && numbuf[j] != '-') {
-            /* handle the case where we're embedded in an app which has */
-            /* called setlocale to something which doesn't use a decimal */
-            /* separator (e.g. a comma), by replacing any */
-            /* non-digit/decimal char with a decimal */
-            for (k = j+1; k < i && !sexp_isdigit(numbuf[k]); ++k)
-              ;
-            numbuf[j++] = '.';
-            while (k < i)
-              numbuf[j++] = numbuf[k++];
-            numbuf[j++] = '\0';
-            j = 0;
-            break;
-          }
-#endif
-        }
-        /* regardless, append a decimal if there wasn't any */
-        if (j >= i) {
-          numbuf[i++] = '.'; numbuf[i++] = '0'; numbuf[i++] = '\0';
-        }
-      }
-      sexp_write_string(ctx, numbuf, out);
+      sexp_write_flonum(ctx, sexp_flonum_value(obj), out);
       break;
 #endif
 #endif
@@ -2464,7 +2514,10 @@ sexp sexp_write_one (sexp ctx, sexp obj, sexp out, sexp_sint_t bound) {
   } else if (sexp_fixnump(obj)) {
     snprintf(numbuf, sizeof(numbuf), "%" SEXP_PRIdFIXNUM, (sexp_sint_t)sexp_unbox_fixnum(obj));
     sexp_write_string(ctx, numbuf, out);
-#if SEXP_USE_IMMEDIATE_FLONUMS
+#if SEXP_USE_TAGGED_FLONUMS
+  } else if (sexp_tflonump(obj)) {
+    sexp_write_flonum(ctx, sexp_tflonum_value(obj), out);
+#elif SEXP_USE_IMMEDIATE_FLONUMS
   } else if (sexp_flonump(obj)) {
     f = sexp_flonum_value(obj);
 #if SEXP_USE_INFINITIES
@@ -3830,7 +3883,7 @@ sexp sexp_read_raw (sexp ctx, sexp in, sexp *shares) {
       if ((c1 == '-') && ! sexp_exceptionp(res)) {
 #if SEXP_USE_FLONUMS
         if (sexp_flonump(res))
-#if SEXP_USE_IMMEDIATE_FLONUMS
+#if SEXP_USE_IMMEDIATE_FLONUMS || SEXP_USE_TAGGED_FLONUMS
           res = sexp_make_flonum(ctx, -1 * sexp_flonum_value(res));
 #else
           sexp_flonum_value(res) = -1 * sexp_flonum_value(res);
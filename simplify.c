@@ -8,6 +8,234 @@
 
 #define simplify_it(it) ((it) = simplify(ctx, it, substs, lambda))
 
+#if SEXP_USE_INLINE
+
+/* the number of AST nodes in the body of an inlining candidate, or
+   -1 if it can't be inlined: closures would need to be copied,
+   references to other frames can't be resolved at an arbitrary call
+   site, and recursive references would never terminate */
+static int inline_size (sexp lambda, sexp x) {
+  int n, res;
+  sexp ls;
+  if (! sexp_pointerp(x))
+    return 1;
+  switch (sexp_pointer_tag(x)) {
+  case SEXP_REF:
+    if (sexp_ref_name(x) == sexp_lambda_name(lambda)
+        || (sexp_lambdap(sexp_ref_loc(x)) && sexp_ref_loc(x) != lambda))
+      return -1;
+    return 1;
+  case SEXP_SET:
+    if (sexp_lambdap(sexp_ref_loc(sexp_set_var(x))))
+      return -1;
+    n = inline_size(lambda, sexp_set_value(x));
+    return n < 0 ? -1 : n + 1;
+  case SEXP_CND:
+    if ((res = inline_size(lambda, sexp_cnd_test(x))) < 0
+        || (n = inline_size(lambda, sexp_cnd_pass(x))) < 0)
+      return -1;
+    res += n;
+    n = inline_size(lambda, sexp_cnd_fail(x));
+    return n < 0 ? -1 : res + n + 1;
+  case SEXP_SEQ:
+    x = sexp_seq_ls(x);
+    /* ... FALLTHROUGH ... */
+  case SEXP_PAIR:
+    for (res=0, ls=x; sexp_pairp(ls); ls=sexp_cdr(ls)) {
+      if ((n = inline_size(lambda, sexp_car(ls))) < 0)
+        return -1;
+      if ((res += n) > SEXP_INLINE_MAX_SIZE)
+        return -1;
+    }
+    return res;
+  case SEXP_LIT:
+  case SEXP_OPCODE:
+    return 1;
+  }
+  return -1;
+}
+
+int sexp_inlinable_lambda_p (sexp lambda) {
+  int size;
+  sexp ls;
+  for (ls=sexp_lambda_params(lambda); sexp_pairp(ls); ls=sexp_cdr(ls))
+    ;
+  if (! sexp_nullp(ls) || sexp_pairp(sexp_lambda_locals(lambda))
+      || sexp_pairp(sexp_lambda_sv(lambda)) || sexp_pairp(sexp_lambda_defs(lambda)))
+    return 0;
+  size = inline_size(lambda, sexp_lambda_body(lambda));
+  return 0 < size && size <= SEXP_INLINE_MAX_SIZE;
+}
+
+/* the lambda a reference is known to call, either an internal define
+   which is never set!, or an imported global which hasn't been assigned
+   so far (toplevel definitions of the env being compiled can still be
+   redefined, so aren't considered) - the latter can still be set! after
+   the caller is compiled, so inline_app guards its copy */
+static sexp inline_known_lambda (sexp ctx, sexp ref) {
+  sexp ls, loc = sexp_ref_loc(ref);
+  if (sexp_lambdap(loc)) {
+    if (sexp_truep(sexp_memq(ctx, sexp_ref_name(ref), sexp_lambda_sv(loc)))
+        || ! sexp_seqp(sexp_lambda_body(loc)))
+      return NULL;
+    for (ls=sexp_seq_ls(sexp_lambda_body(loc));
+         sexp_pairp(ls) && sexp_setp(sexp_car(ls)); ls=sexp_cdr(ls))
+      if (sexp_ref_name(sexp_set_var(sexp_car(ls))) == sexp_ref_name(ref)
+          && sexp_ref_loc(sexp_set_var(sexp_car(ls))) == loc)
+        return sexp_lambdap(sexp_set_value(sexp_car(ls)))
+          ? sexp_set_value(sexp_car(ls)) : NULL;
+  } else if (sexp_procedurep(loc)
+             && sexp_lambdap(sexp_bytecode_lambda(sexp_procedure_code(loc)))
+             && ! sexp_env_cell_assigned_p(sexp_ref_cell(ref))
+             && sexp_env_cell(ctx, sexp_context_env(ctx), sexp_ref_name(ref), 1)
+                != sexp_ref_cell(ref)) {
+    return sexp_bytecode_lambda(sexp_procedure_code(loc));
+  }
+  return NULL;
+}
+
+/* copy the body of lambda replacing references to its parameters,
+   keeping the original source info for error reporting */
+static sexp inline_copy (sexp ctx, sexp lambda, sexp x, sexp substs) {
+  sexp ls;
+  sexp_gc_var4(res, a, b, c);
+  if (! sexp_pointerp(x))
+    return x;
+  sexp_gc_preserve4(ctx, res, a, b, c);
+  res = x;
+  switch (sexp_pointer_tag(x)) {
+  case SEXP_REF:
+    if (sexp_ref_loc(x) == lambda)
+      for (ls=substs; sexp_pairp(ls); ls=sexp_cdr(ls))
+        if (sexp_caar(ls) == sexp_ref_name(x)) {
+          res = sexp_cdar(ls);
+          break;
+        }
+    break;
+  case SEXP_SET:
+    a = inline_copy(ctx, lambda, sexp_set_value(x), substs);
+    res = sexp_alloc_type(ctx, set, SEXP_SET);
+    sexp_set_var(res) = sexp_set_var(x);
+    sexp_set_value(res) = a;
+    sexp_set_source(res) = sexp_set_source(x);
+    break;
+  case SEXP_CND:
+    a = inline_copy(ctx, lambda, sexp_cnd_test(x), substs);
+    b = inline_copy(ctx, lambda, sexp_cnd_pass(x), substs);
+    c = inline_copy(ctx, lambda, sexp_cnd_fail(x), substs);
+    res = sexp_alloc_type(ctx, cnd, SEXP_CND);
+    sexp_cnd_test(res) = a;
+    sexp_cnd_pass(res) = b;
+    sexp_cnd_fail(res) = c;
+    sexp_cnd_source(res) = sexp_cnd_source(x);
+    break;
+  case SEXP_SEQ:
+    a = inline_copy(ctx, lambda, sexp_seq_ls(x), substs);
+    res = sexp_alloc_type(ctx, seq, SEXP_SEQ);
+    sexp_seq_ls(res) = a;
+    sexp_seq_source(res) = sexp_seq_source(x);
+    break;
+  case SEXP_PAIR:
+    res = SEXP_NULL;
+    for (ls=x; sexp_pairp(ls); ls=sexp_cdr(ls)) {
+      a = inline_copy(ctx, lambda, sexp_car(ls), substs);
+      sexp_push(ctx, res, a);
+      sexp_pair_source(res) = sexp_pair_source(ls);
+    }
+    res = sexp_nreverse(ctx, res);
+    break;
+  }
+  sexp_gc_release4(ctx);
+  return res;
+}
+
+/* the eq? opcode used to guard inlined globals, or NULL if it's not */
+/* visible from the env being compiled or the meta env               */
+static sexp inline_eq_opcode (sexp ctx) {
+  sexp op, name = sexp_intern(ctx, "eq?", -1);
+  op = sexp_env_ref(ctx, sexp_context_env(ctx), name, SEXP_FALSE);
+  if (! (sexp_opcodep(op) && sexp_opcode_code(op) == SEXP_OP_EQ)
+      && sexp_envp(sexp_global(ctx, SEXP_G_META_ENV)))
+    op = sexp_env_ref(ctx, sexp_global(ctx, SEXP_G_META_ENV), name, SEXP_FALSE);
+  return (sexp_opcodep(op) && sexp_opcode_code(op) == SEXP_OP_EQ) ? op : NULL;
+}
+
+/* replace a call to a small known procedure with its body, binding
+   any non-trivial arguments to new locals of the enclosing lambda -
+   an imported global may be set! later, so its copy is only used
+   while the global still holds the procedure we copied:
+
+     (if (eq? f <f>) <body of f> (f args ...))  */
+static sexp inline_app (sexp ctx, sexp app, sexp lambda) {
+  sexp ls1, ls2, arg, eq = NULL, callee = inline_known_lambda(ctx, sexp_car(app));
+  sexp_gc_var7(res, substs, sets, tmps, tmp, assign, args);
+  if (! callee || ! sexp_inlinable_lambda_p(callee)
+      || sexp_length(ctx, sexp_cdr(app))
+         != sexp_length(ctx, sexp_lambda_params(callee)))
+    return NULL;
+  if (! sexp_lambdap(sexp_ref_loc(sexp_car(app)))
+      && ! (eq = inline_eq_opcode(ctx)))
+    return NULL;
+  sexp_gc_preserve7(ctx, res, substs, sets, tmps, tmp, assign, args);
+  res = NULL;
+  substs = sets = tmps = args = SEXP_NULL;
+  for (ls1=sexp_lambda_params(callee), ls2=sexp_cdr(app); sexp_pairp(ls1);
+       ls1=sexp_cdr(ls1), ls2=sexp_cdr(ls2)) {
+    arg = sexp_car(ls2);
+    if (! sexp_pointerp(arg) || sexp_litp(arg)
+        || (sexp_refp(arg) && sexp_lambdap(sexp_ref_loc(arg))
+            && sexp_not(sexp_memq(ctx, sexp_ref_name(arg),
+                                  sexp_lambda_sv(sexp_ref_loc(arg)))))) {
+      tmp = sexp_cons(ctx, sexp_car(ls1), arg);
+    } else if (! lambda) {
+      goto done;                /* no frame to hold the argument */
+    } else {
+      tmp = sexp_make_synclo(ctx, sexp_context_env(ctx), SEXP_NULL, sexp_car(ls1));
+      sexp_push(ctx, tmps, tmp);
+      tmp = sexp_cons(ctx, tmp, lambda);
+      tmp = sexp_make_ref(ctx, sexp_car(tmp), tmp);
+      assign = sexp_alloc_type(ctx, set, SEXP_SET);
+      sexp_set_var(assign) = tmp;
+      sexp_set_value(assign) = arg;
+      sexp_set_source(assign) = sexp_pair_source(app);
+      sexp_push(ctx, sets, assign);
+      tmp = sexp_cons(ctx, sexp_car(ls1), tmp);
+    }
+    sexp_push(ctx, substs, tmp);
+    sexp_push(ctx, args, sexp_cdr(tmp));
+  }
+  res = inline_copy(ctx, callee, sexp_lambda_body(callee), substs);
+  if (eq) {
+    /* the fallback call reuses the already evaluated arguments */
+    args = sexp_nreverse(ctx, args);
+    args = sexp_cons(ctx, sexp_car(app), args);
+    sexp_pair_source(args) = sexp_pair_source(app);
+    tmp = sexp_make_lit(ctx, sexp_ref_loc(sexp_car(app)));
+    tmp = sexp_list3(ctx, eq, sexp_car(app), tmp);
+    sexp_pair_source(tmp) = sexp_pair_source(app);
+    assign = sexp_alloc_type(ctx, cnd, SEXP_CND);
+    sexp_cnd_test(assign) = tmp;
+    sexp_cnd_pass(assign) = res;
+    sexp_cnd_fail(assign) = args;
+    sexp_cnd_source(assign) = sexp_pair_source(app);
+    res = assign;
+  }
+  if (sexp_pairp(sets)) {
+    tmp = sexp_list1(ctx, res);
+    sets = sexp_append2(ctx, sexp_nreverse(ctx, sets), tmp);
+    res = sexp_alloc_type(ctx, seq, SEXP_SEQ);
+    sexp_seq_ls(res) = sets;
+    sexp_seq_source(res) = sexp_pair_source(app);
+    sexp_lambda_locals(lambda)
+      = sexp_append2(ctx, tmps, sexp_lambda_locals(lambda));
+  }
+ done:
+  sexp_gc_release7(ctx);
+  return res;
+}
+
+#endif
+
 static sexp simplify (sexp ctx, sexp ast, sexp init_substs, sexp lambda) {
   int check;
   sexp ls1, ls2, p1, p2, sv;
@@ -98,6 +326,11 @@ static sexp simplify (sexp ctx, sexp ast, sexp init_substs, sexp lambda) {
         sexp_lambda_body(sexp_car(app))
           = simplify(ctx, sexp_lambda_body(sexp_car(app)), substs, sexp_car(app));
       }
+#if SEXP_USE_INLINE
+    } else if (sexp_refp(sexp_car(app))
+               && (tmp = inline_app(ctx, app, lambda))) {
+      app = tmp;
+#endif
     }
     res = app;
     break;
@@ -0,0 +1,4 @@
+4999950000
+(2 3 1)
+(30 20 10 0)
+rebound
@@ -0,0 +1,28 @@
+(define (sum n)
+  (let lp ((i 0) (acc 0))
+    (if (= i n) acc (lp (+ i 1) (+ acc i)))))
+
+(define (rotate a b c)
+  (let lp ((n 4) (a a) (b b) (c c))
+    (if (zero? n) (list a b c) (lp (- n 1) b c a))))
+
+(define (thunks n)
+  (let lp ((i 0) (res '()))
+    (if (= i n)
+        (map (lambda (f) (f)) res)
+        (lp (+ i 1) (cons (lambda () (set! i (* i 10)) i) res)))))
+
+(define (rebound n)
+  (let lp ((i n))
+    (cond ((zero? i) 'done)
+          (else (if (= i 2) (set! lp (lambda (i) 'rebound)))
+                (lp (- i 1))))))
+
+(write (sum 100000))
+(newline)
+(write (rotate 1 2 3))
+(newline)
+(write (thunks 4))
+(newline)
+(write (rebound 5))
+(newline)
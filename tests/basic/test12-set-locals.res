@@ -0,0 +1,3 @@
+285
+2
+3
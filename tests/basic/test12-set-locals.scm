@@ -0,0 +1,27 @@
+(define (sum-squares n)
+  (let lp ((i 0) (acc 0))
+    (cond ((= i n) acc)
+          (else (set! acc (+ acc (* i i)))
+                (set! i (+ i 1))
+                (lp i acc)))))
+
+(define (counter)
+  (let ((n 0))
+    (lambda () (set! n (+ n 1)) n)))
+
+(define (grab) (call-with-current-continuation (lambda (k) k)))
+
+(define (reenter)
+  (let ((n 0) (k #f))
+    (set! k (grab))
+    (set! n (+ n 1))
+    (if (< n 3) (k k) n)))
+
+(write (sum-squares 10))
+(newline)
+(let ((c (counter)))
+  (c)
+  (write (c))
+  (newline))
+(write (reenter))
+(newline)
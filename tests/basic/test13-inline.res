@@ -0,0 +1,5 @@
+30
+(2 1)
+-3
+25
+(#t redefined #t)
@@ -0,0 +1,42 @@
+(define (sum-squares ls)
+  (define (sq x) (* x x))
+  (let lp ((ls ls) (acc 0))
+    (if (null? ls) acc (lp (cdr ls) (+ acc (sq (car ls)))))))
+
+(define (count-args)
+  (define n 0)
+  (define (next!) (set! n (+ n 1)) n)
+  (define (twice x) (+ x x))
+  (let ((res (twice (next!))))
+    (list res n)))
+
+(define (rebound)
+  (define (f x) (* x 10))
+  (define (g y) (f y))
+  (set! f (lambda (x) (- x)))
+  (g 3))
+
+(define (nested a b)
+  (define (sq x) (* x x))
+  (define (hyp x y) (+ (sq x) (sq y)))
+  (hyp (+ a 1) (- b 1)))
+
+(write (sum-squares '(1 2 3 4)))
+(newline)
+(write (count-args))
+(newline)
+(write (rebound))
+(newline)
+(write (nested 2 5))
+(newline)
+
+;; callers compiled before an imported procedure is redefined must see
+;; the new definition
+(define (digit? ch) (char-numeric? ch))
+(define digit-before (digit? #\7))
+(define orig-char-numeric? char-numeric?)
+(set! char-numeric? (lambda (ch) 'redefined))
+(define digit-after (digit? #\7))
+(set! char-numeric? orig-char-numeric?)
+(write (list digit-before digit-after (digit? #\7)))
+(newline)
@@ -0,0 +1,12 @@
+(1 0)
+((2) atom)
+((7 -1 #t #t #f #f) not-fixnums)
+#t
+error
+3
+(#t #f #f)
+(#t #f #f)
+(#t #t #t #t #t #f #f)
+(#t #f #f)
+(#f)
+21
@@ -0,0 +1,86 @@
+(import (chibi optimize types) (chibi disasm) (chibi string) (chibi ast))
+
+(define (first-or-zero x)
+  (if (pair? x) (car x) 0))
+
+(define (rest-unless-atom x)
+  (if (not (pair? x)) 'atom (cdr x)))
+
+(define (fx-ops a b)
+  (if (and (fixnum? a) (fixnum? b))
+      (list (+ a b) (- a b) (< a b) (<= a b) (> a b) (= a b))
+      'not-fixnums))
+
+(define (fx-min a b)
+  (if (and (fixnum? a) (fixnum? b))
+      (if (< a b) a b)
+      #f))
+
+(define (car-of-second x y)
+  (if (pair? x)
+      (list (car x)
+            (car y))
+      #f))
+
+(define (reassigned x)
+  (if (pair? x)
+      (begin (set! x 5) (car x))
+      'atom))
+
+(write (list (first-or-zero '(1 2)) (first-or-zero 3)))
+(newline)
+(write (list (rest-unless-atom '(1 2)) (rest-unless-atom 'a)))
+(newline)
+(write (list (fx-ops 3 4) (fx-ops 3 'x)))
+(newline)
+(define max-fixnum
+  (let lp ((n 1))
+    (if (fixnum? (* n 2)) (lp (* n 2)) (+ n (- n 1)))))
+
+(write (equal? (fx-ops max-fixnum 1)
+               (list (+ max-fixnum 1) (- max-fixnum 1) #f #f #t #f)))
+(newline)
+(write (call-with-current-continuation
+        (lambda (k)
+          (with-exception-handler
+           (lambda (e) (k 'error))
+           (lambda () (reassigned '(1)))))))
+(newline)
+(write (fx-min 3 4))
+(newline)
+
+;; the unchecked opcodes are emitted, also when fused with the
+;; instruction before or after them, and the checked ones aren't
+(define (opcodes f)
+  (let ((out (open-output-string)))
+    (disasm f out)
+    (get-output-string out)))
+(define (emits? f op)
+  (and (string-contains (opcodes f) (string-append " " op " ")) #t))
+(define (emits-unchecked? f op)
+  (and (string-contains (opcodes f) (string-append "UNSAFE-" op " ")) #t))
+(write (list (emits-unchecked? first-or-zero "CAR")
+             (emits? first-or-zero "CAR")
+             (emits? first-or-zero "LOCAL-REF+CAR")))
+(newline)
+(write (list (emits-unchecked? rest-unless-atom "CDR")
+             (emits? rest-unless-atom "CDR")
+             (emits? rest-unless-atom "LOCAL-REF+CDR")))
+(newline)
+(write (map (lambda (op) (and (string-contains (opcodes fx-ops) op) #t))
+            '("FX-ADD" "FX-SUB" "FX-LT" "FX-LE" "FX-EQN" " ADD " " LT ")))
+(newline)
+(write (list (and (string-contains (opcodes fx-min) "FX-LT") #t)
+             (emits? fx-min "LT")
+             (emits? fx-min "LT+JUMP-UNLESS")))
+(newline)
+(write (list (emits-unchecked? reassigned "CAR")))
+(newline)
+
+;; errors from rebuilt expressions keep their source line
+(write (call-with-current-continuation
+        (lambda (k)
+          (with-exception-handler
+           (lambda (e) (k (cdr (exception-source e))))
+           (lambda () (car-of-second '(1) 2))))))
+(newline)
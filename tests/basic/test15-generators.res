@@ -0,0 +1,4 @@
+(a b c d e f g)
+(#t #f)
+(1 2 3 4)
+(3 4)
@@ -0,0 +1,49 @@
+
+(define (tree-walker tree)
+  (define caller #f)
+  (define resume #f)
+  (define (walk t)
+    (cond ((null? t) #t)
+          ((pair? t) (walk (car t)) (walk (cdr t)))
+          (else (call-with-current-continuation
+                 (lambda (k) (set! resume k) (caller t))))))
+  (lambda ()
+    (call-with-current-continuation
+     (lambda (c)
+       (set! caller c)
+       (if resume (resume #f) (walk tree))
+       (caller 'eof)))))
+
+(define (same-fringe? a b)
+  (let ((ga (tree-walker a)) (gb (tree-walker b)))
+    (let lp ()
+      (let* ((x (ga)) (y (gb)))
+        (cond ((not (eqv? x y)) #f)
+              ((eq? x 'eof) #t)
+              (else (lp)))))))
+
+(define (at-depth n thunk)
+  (if (zero? n) (thunk) (car (list (at-depth (- n 1) thunk)))))
+
+(define (collect gen)
+  (let lp ((res '()))
+    (let ((x (gen)))
+      (if (eq? x 'eof) (reverse res) (lp (cons x res))))))
+
+(write (collect (tree-walker '((a (b c)) d ((e) f) (((g)))))))
+(newline)
+(write (list (same-fringe? '(1 (2 3) 4) '((1 2) (3 (4))))
+             (same-fringe? '(1 (2 3) 4) '((1 2) (5 (4))))))
+(newline)
+(write (at-depth 1000 (lambda () (collect (tree-walker '(1 (2 (3 (4)))))))))
+(newline)
+
+(define k #f)
+(define n 0)
+(let ((x (at-depth 100 (lambda ()
+                         (call-with-current-continuation
+                          (lambda (c) (set! k c) 0))))))
+  (set! n (+ n 1))
+  (if (< x 3)
+      (k (+ x 1))
+      (begin (write (list x n)) (newline))))
@@ -0,0 +1,6 @@
+(0 17 39)
+redefined
+now-syntax
+(25 10)
+(local 22)
+77
@@ -0,0 +1,41 @@
+
+;; enough bindings to index the interaction environment
+(define-syntax define-many
+  (er-macro-transformer
+   (lambda (expr rename compare)
+     (let lp ((i 0) (res '()))
+       (if (= i 40)
+           (cons (rename 'begin) res)
+           (lp (+ i 1)
+               (cons (list (rename 'define)
+                           (string->symbol
+                            (string-append "var-" (number->string i)))
+                           i)
+                     res)))))))
+
+(define-many)
+
+(write (list var-0 var-17 var-39))
+(newline)
+
+(define var-17 'redefined)
+(write var-17)
+(newline)
+
+(define var-3 3)
+(define-syntax var-3 (syntax-rules () ((var-3) 'now-syntax)))
+(write (var-3))
+(newline)
+
+(define (square x) (* x x))
+(define square-of-5 (square 5))
+(define (square x) (+ x x))
+(write (list square-of-5 (square 5)))
+(newline)
+
+(let ((var-21 'local))
+  (write (list var-21 var-22)))
+(newline)
+
+(write (eval '(+ var-38 var-39) (interaction-environment)))
+(newline)
@@ -0,0 +1,6 @@
+(2 3 4)
+(10 30)
+((1) (3))
+(-1 -3)
+arity-error
+(ok 4)
@@ -0,0 +1,31 @@
+;; call sites through globals cache the last callee
+(define (f x) (+ x 1))
+(define (call-f x) (f x))
+(define (tail-call-f x) (if (> x 0) (f x) 0))
+
+(write (list (call-f 1) (call-f 2) (tail-call-f 3)))
+(newline)
+
+(set! f (lambda (x) (* x 10)))
+(write (list (call-f 1) (tail-call-f 3)))
+(newline)
+
+(set! f (lambda (x . rest) (cons x rest)))
+(write (list (call-f 1) (tail-call-f 3)))
+(newline)
+
+(define (f x) (- x))
+(write (list (call-f 1) (tail-call-f 3)))
+(newline)
+
+(set! f (lambda (x y) (+ x y)))
+(write (call-with-current-continuation
+        (lambda (k)
+          (with-exception-handler
+           (lambda (e) (k 'arity-error))
+           (lambda () (call-f 1))))))
+(newline)
+
+(set! f (lambda (x) x))
+(write (list (call-f 'ok) (tail-call-f 4)))
+(newline)
@@ -0,0 +1,145 @@
+(import (scheme base) (chibi)
+        (only (chibi test) test-begin test test-assert test-end)
+        (only (chibi filesystem) create-directory* delete-file delete-file-hierarchy
+              directory-files file-size)
+        (only (chibi process) current-process-id)
+        (only (chibi string) string-suffix?)
+        (only (meta) load-module delete-module! module-env)
+        (scheme process-context)
+        (srfi 1))
+
+(test-begin "module cache")
+
+;; The libraries loaded here live in a fresh directory, and count how
+;; often their macro is expanded, which only happens when they're
+;; compiled from source rather than replayed from the cache.
+
+(define (write-file path str)
+  (call-with-output-file path (lambda (out) (write-string str out))))
+
+(define (read-file-bytes path . o)
+  (call-with-input-file path
+    (lambda (in)
+      (read-bytevector (if (pair? o) (min (car o) (file-size path)) (file-size path))
+                       in))))
+
+(define (write-file-bytes path bv)
+  (let ((out (open-binary-output-file path)))
+    (write-bytevector bv out)
+    (close-output-port out)))
+
+(define (bytevector-search bv str start)
+  (let ((n (string-length str)))
+    (let lp ((i start))
+      (cond
+       ((> (+ i n) (bytevector-length bv)) #f)
+       ((let match ((j 0))
+          (or (= j n)
+              (and (= (bytevector-u8-ref bv (+ i j))
+                      (char->integer (string-ref str j)))
+                   (match (+ j 1)))))
+        i)
+       (else (lp (+ i 1)))))))
+
+(define counter-source
+  "(define-library (cache-test counter)
+     (import (chibi))
+     (export expansions)
+     (begin (define expansions (list 0))))")
+
+(define (lib-source answer)
+  (string-append
+   "(define-library (cache-test lib)
+      (import (chibi) (cache-test counter))
+      (export answer)
+      (begin
+        (define-syntax counted
+          (er-macro-transformer
+           (lambda (expr rename compare)
+             (set-car! expansions (+ (car expansions) 1))
+             " (number->string answer) ")))
+        (define answer (counted))))"))
+
+(define (run-module-cache-tests cache-dir)
+  (let* ((src (string-append cache-dir "/src-"
+                             (number->string (current-process-id))))
+         (lib-path (string-append src "/cache-test/lib.sld")))
+    ;; the libraries here only import (chibi), so the source files
+    ;; listed in the header are near the start
+    (define (lib-cache-files)
+      (filter (lambda (path)
+                (bytevector-search (read-file-bytes path 1024) lib-path 0))
+              (map (lambda (f) (string-append cache-dir "/" f))
+                   (filter (lambda (f) (string-suffix? ".cache" f))
+                           (directory-files cache-dir)))))
+    (define (load-lib)
+      (delete-module! '(cache-test lib))
+      (eval 'answer (module-env (load-module '(cache-test lib)))))
+    (define (expansions)
+      (car (eval 'expansions (module-env (load-module '(cache-test counter))))))
+    ;; change the last digit of the build hash in the cache header
+    (define (corrupt-build-key! path)
+      (let* ((bv (read-file-bytes path))
+             (start (bytevector-search bv "(\"" 8))
+             (end (and start (bytevector-search bv "\"" (+ start 2)))))
+        (bytevector-u8-set! bv (- end 1)
+                            (if (= (bytevector-u8-ref bv (- end 1))
+                                   (char->integer #\0))
+                                (char->integer #\1)
+                                (char->integer #\0)))
+        (write-file-bytes path bv)))
+    ;; flip a bit in the last packed object
+    (define (corrupt-payload! path)
+      (let* ((bv (read-file-bytes path))
+             (i (- (bytevector-length bv) 1))
+             (b (bytevector-u8-ref bv i)))
+        (bytevector-u8-set! bv i (if (odd? b) (- b 1) (+ b 1)))
+        (write-file-bytes path bv)))
+    (create-directory* (string-append src "/cache-test"))
+    (write-file (string-append src "/cache-test/counter.sld") counter-source)
+    (write-file lib-path (lib-source 42))
+    (add-module-directory src #f)
+
+    ;; miss: compiled from source and saved
+    (test '() (lib-cache-files))
+    (test 42 (load-lib))
+    (test 1 (expansions))
+    (test 1 (length (lib-cache-files)))
+
+    ;; hit: replayed without expanding the macro again
+    (test 42 (load-lib))
+    (test 1 (expansions))
+
+    ;; a cache written by a different build is rejected and replaced
+    (corrupt-build-key! (car (lib-cache-files)))
+    (test 42 (load-lib))
+    (test 2 (expansions))
+    (test 42 (load-lib))
+    (test 2 (expansions))
+
+    ;; as is one whose contents don't match its checksum
+    (corrupt-payload! (car (lib-cache-files)))
+    (test 42 (load-lib))
+    (test 3 (expansions))
+    (test 42 (load-lib))
+    (test 3 (expansions))
+
+    ;; and one for a different version of the source
+    (write-file lib-path (lib-source 4242))
+    (test 4242 (load-lib))
+    (test 4 (expansions))
+    (test 1 (length (lib-cache-files)))
+
+    (for-each delete-file (lib-cache-files))
+    (delete-file-hierarchy src)))
+
+(cond-expand
+ (module-cache
+  (let ((cache-dir (get-environment-variable "CHIBI_MODULE_CACHE")))
+    ;; the cache is only used when a directory is set, as the test
+    ;; suite does
+    (if (and cache-dir (not (equal? cache-dir "")))
+        (run-module-cache-tests cache-dir))))
+ (else))
+
+(test-end)
@@ -0,0 +1,79 @@
+#!/usr/bin/env chibi-scheme
+
+;; Rank VM opcode pairs by how often they were dispatched, to choose
+;; candidates for superinstructions.
+;;
+;; Usage:
+;;   rank-opcode-pairs.scm [-n count] profile.txt ...
+;;
+;; Each file is the stderr output of (print-vm-profile) from a
+;; chibi-scheme built with SEXP_USE_PROFILE_VM, e.g.
+;;
+;;   chibi-scheme -e '(reset-vm-profile)' -e '(load "bench.scm")' \
+;;                -e '(print-vm-profile)' 2> profile.txt
+;;
+;; Counts are summed over all files and the most frequent pairs are
+;; printed with their share of all dispatches.  Pairs which already
+;; have a superinstruction show up as the fused name (with a "+").
+
+(import (scheme base) (scheme write) (scheme file)
+        (scheme process-context) (srfi 1) (srfi 69) (srfi 95)
+        (chibi string))
+
+(define (read-profile file singles pairs)
+  (call-with-input-file file
+    (lambda (in)
+      (let lp ()
+        (let ((line (read-line in)))
+          (cond
+           ((eof-object? line))
+           (else
+            (let* ((fields (remove string-null? (string-split line #\space)))
+                   (count (and (pair? fields) (string->number (last fields)))))
+              (cond
+               ((not count))
+               ((= 2 (length fields))
+                (hash-table-update!/default singles (car fields)
+                                            (lambda (n) (+ n count)) 0))
+               ((= 3 (length fields))
+                (hash-table-update!/default pairs (list (car fields) (cadr fields))
+                                            (lambda (n) (+ n count)) 0))))
+            (lp))))))))
+
+(define (pad-left str width)
+  (string-append (make-string (max 0 (- width (string-length str))) #\space)
+                 str))
+
+(define (percent n total)
+  (if (zero? total)
+      0
+      (/ (round (/ (* n 1000) total)) 10.)))
+
+(define (rank-pairs files limit)
+  (let ((singles (make-hash-table equal?))
+        (pairs (make-hash-table equal?)))
+    (for-each (lambda (f) (read-profile f singles pairs)) files)
+    (let ((total (hash-table-fold singles (lambda (k v acc) (+ v acc)) 0))
+          (ranked (sort (hash-table->alist pairs) > cdr)))
+      (let lp ((ls ranked) (i 0))
+        (cond
+         ((and (pair? ls) (< i limit) (positive? (cdar ls)))
+          (write-string (pad-left (number->string (cdar ls)) 12))
+          (write-string (pad-left (number->string (percent (cdar ls) total)) 7))
+          (write-string "%  ")
+          (write-string (car (caar ls)))
+          (write-string " ")
+          (write-string (cadr (caar ls)))
+          (newline)
+          (lp (cdr ls) (+ i 1))))))))
+
+(let lp ((ls (cdr (command-line))) (limit 20))
+  (cond
+   ((and (pair? ls) (member (car ls) '("-n" "--count")) (pair? (cdr ls)))
+    (lp (cddr ls) (string->number (cadr ls))))
+   ((null? ls)
+    (write-string "usage: rank-opcode-pairs.scm [-n count] profile.txt ...\n"
+                  (current-error-port))
+    (exit 1))
+   (else
+    (rank-pairs ls limit))))
@@ -41,6 +41,13 @@ static sexp sexp_lookup_source_info (sexp src, int ip) {
 }
 #endif
 
+#if SEXP_USE_SEGMENTED_CONTINUATIONS
+#define sexp_underflowp(ctx, x)                                         \
+  (sexp_procedurep(x) && sexp_procedure_code(x)                         \
+   == sexp_global(ctx, SEXP_G_UNDERFLOW_BYTECODE))
+
+#endif
+
 sexp sexp_get_stack_trace (sexp ctx) {
   sexp_sint_t i, fp=sexp_context_last_fp(ctx);
   sexp self, bc, src, *stack = sexp_stack_data(sexp_context_stack(ctx));
@@ -49,6 +56,10 @@ sexp sexp_get_stack_trace (sexp ctx) {
   res = SEXP_NULL;
   for (i=fp; i>4; i=sexp_unbox_fixnum(stack[i+3])) {
     self = stack[i+2];
+#if SEXP_USE_SEGMENTED_CONTINUATIONS
+    if (sexp_underflowp(ctx, self))
+      self = sexp_vector_ref(sexp_procedure_vars(self), SEXP_ZERO);
+#endif
     if (self && sexp_procedurep(self)) {
       bc = sexp_procedure_code(self);
       src = sexp_bytecode_source(bc);
@@ -214,6 +225,49 @@ static void sexp_context_patch_label (sexp ctx, sexp_sint_t label) {
     *((sexp_sint_t*)data) = sexp_unbox_fixnum(sexp_context_pos(ctx))-label;
 }
 
+#if SEXP_USE_SUPERINSTRUCTIONS
+static const unsigned char sexp_superinstructions[][3] = {
+  {SEXP_OP_LOCAL_REF,   SEXP_OP_CAR,         SEXP_OP_LOCAL_REF_CAR},
+  {SEXP_OP_LOCAL_REF,   SEXP_OP_CDR,         SEXP_OP_LOCAL_REF_CDR},
+  {SEXP_OP_CLOSURE_REF, SEXP_OP_CDR,         SEXP_OP_CLOSURE_REF_CDR},
+  {SEXP_OP_LT,          SEXP_OP_JUMP_UNLESS, SEXP_OP_LT_JUMP_UNLESS},
+  {SEXP_OP_LE,          SEXP_OP_JUMP_UNLESS, SEXP_OP_LE_JUMP_UNLESS},
+  {SEXP_OP_EQN,         SEXP_OP_JUMP_UNLESS, SEXP_OP_EQN_JUMP_UNLESS},
+  {SEXP_OP_NULLP,       SEXP_OP_JUMP_UNLESS, SEXP_OP_NULLP_JUMP_UNLESS},
+  {SEXP_OP_LOCAL_REF,   SEXP_OP_UNSAFE_CAR,  SEXP_OP_LOCAL_REF_UNSAFE_CAR},
+  {SEXP_OP_LOCAL_REF,   SEXP_OP_UNSAFE_CDR,  SEXP_OP_LOCAL_REF_UNSAFE_CDR},
+  {SEXP_OP_CLOSURE_REF, SEXP_OP_UNSAFE_CDR,  SEXP_OP_CLOSURE_REF_UNSAFE_CDR},
+  {SEXP_OP_FX_LT,       SEXP_OP_JUMP_UNLESS, SEXP_OP_FX_LT_JUMP_UNLESS},
+  {SEXP_OP_FX_LE,       SEXP_OP_JUMP_UNLESS, SEXP_OP_FX_LE_JUMP_UNLESS},
+  {SEXP_OP_FX_EQN,      SEXP_OP_JUMP_UNLESS, SEXP_OP_FX_EQN_JUMP_UNLESS},
+};
+
+/* The caller has just emitted an opcode immediately following the */
+/* instruction at pos, and knows nothing can jump between the two. */
+/* If the pair has a superinstruction we rewrite the first opcode in */
+/* place, leaving the second (and any label after it) where it is. */
+static void generate_fused (sexp ctx, sexp_sint_t pos) {
+  unsigned char *data;
+  sexp_sint_t i, next;
+  if (pos < 0 || sexp_exceptionp(sexp_context_exception(ctx)))
+    return;
+  data = sexp_bytecode_data(sexp_context_bc(ctx));
+  next = pos + 1;
+  if (data[pos] == SEXP_OP_LOCAL_REF || data[pos] == SEXP_OP_CLOSURE_REF)
+    next += sizeof(sexp);
+  if (next != sexp_unbox_fixnum(sexp_context_pos(ctx)) - 1)
+    return;
+  for (i=0; i<(sexp_sint_t)(sizeof(sexp_superinstructions)/3); i++)
+    if (sexp_superinstructions[i][0] == data[pos]
+        && sexp_superinstructions[i][1] == data[next]) {
+      data[pos] = sexp_superinstructions[i][2];
+      break;
+    }
+}
+#else
+#define generate_fused(ctx, pos) (void)(pos)
+#endif
+
 static void generate_lit (sexp ctx, sexp value) {
   sexp_emit_push(ctx, value);
 }
@@ -245,12 +299,21 @@ static void generate_seq (sexp ctx, sexp name, sexp loc, sexp lam, sexp app) {
 }
 
 static void generate_cnd (sexp ctx, sexp name, sexp loc, sexp lam, sexp cnd) {
-  sexp_sint_t label1, label2, tailp=sexp_context_tailp(ctx);
+  sexp_sint_t label1, label2, tailp=sexp_context_tailp(ctx), test_op=-1;
+  sexp test = sexp_cnd_test(cnd);
   sexp_push_source(ctx, sexp_cnd_source(cnd));
   sexp_context_tailp(ctx) = 0;
-  sexp_generate(ctx, name, loc, lam, sexp_cnd_test(cnd));
+  sexp_generate(ctx, name, loc, lam, test);
   sexp_context_tailp(ctx) = (char)tailp;
+  /* a test which is a single comparison or null? ends in that opcode */
+  if (sexp_pairp(test) && sexp_opcodep(sexp_car(test))
+      && ((sexp_opcode_class(sexp_car(test)) == SEXP_OPC_ARITHMETIC_CMP
+           && sexp_unbox_fixnum(sexp_length(ctx, sexp_cdr(test))) == 2)
+          || (sexp_opcode_class(sexp_car(test)) == SEXP_OPC_TYPE_PREDICATE
+              && sexp_opcode_code(sexp_car(test)) == SEXP_OP_NULLP)))
+    test_op = sexp_unbox_fixnum(sexp_context_pos(ctx)) - 1;
   sexp_emit(ctx, SEXP_OP_JUMP_UNLESS);
+  generate_fused(ctx, test_op);
   sexp_inc_context_depth(ctx, -1);
   label1 = sexp_context_make_label(ctx);
   sexp_generate(ctx, name, loc, lam, sexp_cnd_pass(cnd));
@@ -266,6 +329,7 @@ static void generate_cnd (sexp ctx, sexp name, sexp loc, sexp lam, sexp cnd) {
 static void generate_non_global_ref (sexp ctx, sexp name, sexp cell,
                                      sexp lambda, sexp fv, int unboxp) {
   sexp_uint_t i;
+  sexp_sint_t pos = sexp_unbox_fixnum(sexp_context_pos(ctx));
   sexp loc = sexp_cdr(cell);
   if (loc == lambda && sexp_lambdap(lambda)) {
     /* local ref */
@@ -280,8 +344,10 @@ static void generate_non_global_ref (sexp ctx, sexp name, sexp cell,
     sexp_emit(ctx, SEXP_OP_CLOSURE_REF);
     sexp_emit_word(ctx, i);
   }
-  if (unboxp && (sexp_truep(sexp_memq(ctx, name, sexp_lambda_sv(loc)))))
+  if (unboxp && (sexp_truep(sexp_memq(ctx, name, sexp_lambda_sv(loc))))) {
     sexp_emit(ctx, SEXP_OP_CDR);
+    generate_fused(ctx, pos);
+  }
   sexp_inc_context_depth(ctx, +1);
 }
 
@@ -347,7 +413,7 @@ static void generate_set (sexp ctx, sexp set) {
 
 static void generate_opcode_app (sexp ctx, sexp app) {
   sexp op = sexp_car(app);
-  sexp_sint_t i, num_args, inv_default=0;
+  sexp_sint_t i, num_args, inv_default=0, arg_pos=-1;
   sexp_gc_var1(ls);
   sexp_gc_preserve1(ctx, ls);
 
@@ -390,6 +456,8 @@ static void generate_opcode_app (sexp ctx, sexp app) {
       ls = ((sexp_opcode_inverse(op)
              && (sexp_opcode_class(op) != SEXP_OPC_ARITHMETIC))
             ? sexp_cdr(app) : sexp_reverse(ctx, sexp_cdr(app)));
+      if (sexp_pairp(ls) && sexp_nullp(sexp_cdr(ls)) && sexp_refp(sexp_car(ls)))
+        arg_pos = sexp_unbox_fixnum(sexp_context_pos(ctx));
       for ( ; sexp_pairp(ls); ls = sexp_cdr(ls)) {
         sexp_generate(ctx, 0, 0, 0, sexp_car(ls));
 #if SEXP_USE_AUTO_FORCE
@@ -485,6 +553,7 @@ static void generate_opcode_app (sexp ctx, sexp app) {
   default:
     sexp_emit(ctx, sexp_opcode_code(op));
   }
+  generate_fused(ctx, arg_pos);
 
   if (sexp_opcode_static_param_p(op))
     for (ls=sexp_cdr(app); sexp_pairp(ls); ls=sexp_cdr(ls))
@@ -502,7 +571,7 @@ static void generate_opcode_app (sexp ctx, sexp app) {
 
 static void generate_general_app (sexp ctx, sexp app) {
   sexp_uint_t len = sexp_unbox_fixnum(sexp_length(ctx, sexp_cdr(app))),
-    tailp = sexp_context_tailp(ctx);
+    tailp = sexp_context_tailp(ctx), tailcallp;
   sexp_gc_var1(ls);
   sexp_gc_preserve1(ctx, ls);
 
@@ -515,8 +584,21 @@ static void generate_general_app (sexp ctx, sexp app) {
   sexp_generate(ctx, 0, 0, 0, sexp_car(app));
 
   /* maybe overwrite the current frame */
-  sexp_emit(ctx, ((tailp && sexp_not(sexp_global(ctx, SEXP_G_NO_TAIL_CALLS_P))) ? SEXP_OP_TAIL_CALL : SEXP_OP_CALL));
-  sexp_emit_word(ctx, (sexp_uint_t)sexp_make_fixnum(len));
+  tailcallp = tailp && sexp_not(sexp_global(ctx, SEXP_G_NO_TAIL_CALLS_P));
+#if SEXP_USE_INLINE_CACHES
+  if (sexp_refp(sexp_car(app)) && !sexp_lambdap(sexp_ref_loc(sexp_car(app)))) {
+    /* calls through a global get a private (callee) cache */
+    sexp_emit(ctx, tailcallp ? SEXP_OP_CACHED_TAIL_CALL : SEXP_OP_CACHED_CALL);
+    sexp_emit_word(ctx, (sexp_uint_t)sexp_make_fixnum(len));
+    ls = sexp_list1(ctx, SEXP_FALSE);
+    sexp_emit_word(ctx, (sexp_uint_t)ls);
+    sexp_push(ctx, sexp_bytecode_literals(sexp_context_bc(ctx)), ls);
+  } else
+#endif
+  {
+    sexp_emit(ctx, tailcallp ? SEXP_OP_TAIL_CALL : SEXP_OP_CALL);
+    sexp_emit_word(ctx, (sexp_uint_t)sexp_make_fixnum(len));
+  }
 
   sexp_context_tailp(ctx) = (char)tailp;
   sexp_inc_context_depth(ctx, -len);
@@ -524,7 +606,35 @@ static void generate_general_app (sexp ctx, sexp app) {
 }
 
 #if SEXP_USE_TAIL_JUMPS
+/* count the assignments to the variable name bound in loc within x */
+static int count_sets (sexp name, sexp loc, sexp x) {
+  int res = 0;
+  if (sexp_pairp(x)) {
+    for ( ; sexp_pairp(x); x=sexp_cdr(x))
+      res += count_sets(name, loc, sexp_car(x));
+  } else if (sexp_pointerp(x)) {
+    switch (sexp_pointer_tag(x)) {
+    case SEXP_LAMBDA:
+      res = count_sets(name, loc, sexp_lambda_body(x)); break;
+    case SEXP_CND:
+      res = count_sets(name, loc, sexp_cnd_test(x))
+        + count_sets(name, loc, sexp_cnd_pass(x))
+        + count_sets(name, loc, sexp_cnd_fail(x));
+      break;
+    case SEXP_SEQ:
+      res = count_sets(name, loc, sexp_seq_ls(x)); break;
+    case SEXP_SET:
+      res = (sexp_ref_name(sexp_set_var(x)) == name
+             && sexp_ref_loc(sexp_set_var(x)) == loc)
+        + count_sets(name, loc, sexp_set_value(x));
+      break;
+    }
+  }
+  return res;
+}
+
 static void generate_tail_jump (sexp ctx, sexp name, sexp loc, sexp lam, sexp app) {
+  sexp_sint_t len = 0, start;
   sexp_gc_var3(ls1, ls2, ls3);
   sexp_gc_preserve3(ctx, ls1, ls2, ls3);
 
@@ -540,18 +650,31 @@ static void generate_tail_jump (sexp ctx, sexp name, sexp loc, sexp lam, sexp ap
       ls3 = sexp_cons(ctx, sexp_car(ls2), ls3);
     }
   }
-  for (ls1=ls3; sexp_pairp(ls1); ls1=sexp_cdr(ls1)) {
+  for (ls1=ls3; sexp_pairp(ls1); ls1=sexp_cdr(ls1), len++) {
     sexp_emit(ctx, SEXP_OP_LOCAL_SET);
     sexp_emit_word(ctx, sexp_param_index(ctx, lam, sexp_car(ls1)));
   }
 
-  /* drop the current result and jump */
+  sexp_inc_context_depth(ctx, -len);
+
+  /* jump back to just after the locals are allocated, re-boxing any */
+  /* mutable params; the VM checks fuel on every instruction */
   sexp_emit(ctx, SEXP_OP_JUMP);
   sexp_context_align_pos(ctx);
-  sexp_emit_word(ctx, (sexp_uint_t) (-sexp_unbox_fixnum(sexp_context_pos(ctx)) +
-				     (sexp_pairp(sexp_lambda_locals(lam))
-				      ? 1 + sizeof(sexp) : 0)));
+#if SEXP_USE_RESERVE_OPCODE
+  start = sexp_pairp(sexp_lambda_locals(lam)) ? 1 : 0;
+#else
+  start = sexp_unbox_fixnum(sexp_length(ctx, sexp_lambda_locals(lam)));
+#endif
+#if SEXP_USE_ALIGNED_BYTECODE
+  start *= 2 * sizeof(sexp);
+#else
+  start *= 1 + sizeof(sexp);
+#endif
+  sexp_emit_word(ctx, (sexp_uint_t) (start - sexp_unbox_fixnum(sexp_context_pos(ctx))));
 
+  /* never falls through, but account for the value of the call */
+  sexp_inc_context_depth(ctx, 1);
   sexp_context_tailp(ctx) = 1;
   sexp_gc_release3(ctx);
 }
@@ -564,7 +687,9 @@ static void generate_app (sexp ctx, sexp name, sexp loc, sexp lam, sexp app) {
 #if SEXP_USE_TAIL_JUMPS
   else if (sexp_context_tailp(ctx) && sexp_refp(sexp_car(app))
            && name == sexp_ref_name(sexp_car(app))
-           && loc == sexp_ref_loc(sexp_car(app))
+           && loc == sexp_ref_loc(sexp_car(app)) && loc && sexp_lambdap(loc)
+           && sexp_not(sexp_global(ctx, SEXP_G_NO_TAIL_CALLS_P))
+           && sexp_truep(sexp_listp(ctx, sexp_lambda_params(lam)))
            && (sexp_length(ctx, sexp_cdr(app))
                == sexp_length(ctx, sexp_lambda_params(lam))))
     generate_tail_jump(ctx, name, loc, lam, app);
@@ -604,7 +729,7 @@ static int generate_lambda_locals (sexp ctx, sexp name, sexp loc, sexp lam, sexp
 
 static int generate_lambda_body (sexp ctx, sexp name, sexp loc, sexp lam, sexp x, sexp prev_lam) {
   sexp_uint_t k, updatep, tailp;
-  sexp ls, ref, fv, prev_fv;
+  sexp ls, ref, fv;
   if (sexp_exceptionp(sexp_context_exception(ctx)))
     return 0;
   if (sexp_seqp(x)) {
@@ -632,7 +757,6 @@ static int generate_lambda_body (sexp ctx, sexp name, sexp loc, sexp lam, sexp x
     if (sexp_lambdap(sexp_set_value(x))) {
       /* update potentially changed bindings */
       fv = sexp_lambda_fv(sexp_set_value(x));
-      prev_fv = sexp_lambdap(prev_lam) ? sexp_lambda_fv(prev_lam) : SEXP_NULL;
       for (k=0; fv && sexp_pairp(fv); fv=sexp_cdr(fv), k++) {
         ref = sexp_car(fv);
         if (sexp_mutual_internal_definep(ctx, sexp_set_var(x), ref)) {
@@ -706,6 +830,11 @@ static void generate_lambda (sexp ctx, sexp name, sexp loc, sexp lam, sexp lambd
     sexp_emit_word(ctx2, k);
   }
   if (lam != lambda) loc = 0;
+#if SEXP_USE_TAIL_JUMPS
+  /* only jump to ourself if the binding is never set! after its definition */
+  else if (loc && sexp_lambdap(loc) && count_sets(name, loc, sexp_lambda_body(loc)) > 1)
+    loc = 0;
+#endif
 #if SEXP_USE_UNBOXED_LOCALS
   sexp_context_tailp(ctx2) = 0;
   generate_lambda_locals(ctx2, name, loc, lambda, sexp_lambda_body(lambda));
@@ -727,6 +856,8 @@ static void generate_lambda (sexp ctx, sexp name, sexp loc, sexp lam, sexp lambd
   sexp_bytecode_name(bc) = sexp_lambda_name(lambda);
   if (sexp_nullp(fv)) {
     /* shortcut, no free vars */
+    if (sexp_inlinable_lambda_p(lambda))
+      sexp_bytecode_lambda(bc) = lambda;
     tmp = sexp_make_vector(ctx2, SEXP_ZERO, SEXP_VOID);
     tmp = sexp_make_procedure(ctx2, flags, len, bc, tmp);
     bytecode_preserve(ctx, tmp);
@@ -821,8 +952,10 @@ static sexp make_opcode_procedure (sexp ctx, sexp op, sexp_uint_t i, sexp_sint_t
       bc = sexp_complete_bytecode(ctx2);
       sexp_bytecode_name(bc) = sexp_opcode_name(op);
       res=sexp_make_procedure(ctx2, sexp_make_fixnum(flags), sexp_make_fixnum(i), bc, SEXP_VOID);
-      if (j == sexp_opcode_num_args(op))
+      if (j == sexp_opcode_num_args(op)) {
         sexp_opcode_proc(op) = res;
+        sexp_write_barrier(ctx, op, res);
+      }
     }
   }
   sexp_gc_release6(ctx);
@@ -887,6 +1020,150 @@ static int sexp_grow_stack (sexp ctx, int min_size) {
 #define sexp_grow_stack(ctx, min_size) 0
 #endif
 
+#if SEXP_USE_SEGMENTED_CONTINUATIONS
+
+/* A continuation is a chain of stack segments #(data base end parent), */
+/* where data holds the slots from base up to end and the parent chain */
+/* holds the slots below base.  After a capture, the frame the */
+/* continuation was captured in becomes a barrier: its return address */
+/* is replaced by an underflow trampoline holding the real return */
+/* address and the segment chain.  Everything on the stack below the */
+/* barrier frame is unchanged since the capture, so the next capture */
+/* only needs to copy the slots above it, and reinstating a */
+/* continuation only copies the slots which differ from the current */
+/* stack.  Returning through the barrier moves it down to the caller. */
+
+#define sexp_segment_data(x) sexp_vector_ref(x, SEXP_ZERO)
+#define sexp_segment_base(x) sexp_unbox_fixnum(sexp_vector_ref(x, SEXP_ONE))
+#define sexp_segment_end(x) sexp_unbox_fixnum(sexp_vector_ref(x, SEXP_TWO))
+#define sexp_segment_parent(x) sexp_vector_ref(x, SEXP_THREE)
+
+static sexp sexp_make_segment (sexp ctx, sexp data, sexp_sint_t base, sexp_sint_t end, sexp parent) {
+  sexp res = sexp_make_vector(ctx, SEXP_FOUR, SEXP_FALSE);
+  if (!sexp_exceptionp(res)) {
+    sexp_vector_set(res, SEXP_ZERO, data);
+    sexp_vector_set(res, SEXP_ONE, sexp_make_fixnum(base));
+    sexp_vector_set(res, SEXP_TWO, sexp_make_fixnum(end));
+    sexp_vector_set(res, SEXP_THREE, parent);
+  }
+  return res;
+}
+
+/* the segment chain for only the slots below end */
+static sexp sexp_truncate_segments (sexp ctx, sexp seg, sexp_sint_t end) {
+  while (sexp_vectorp(seg) && sexp_segment_base(seg) >= end)
+    seg = sexp_segment_parent(seg);
+  if (!sexp_vectorp(seg) || sexp_segment_end(seg) <= end)
+    return seg;
+  return sexp_make_segment(ctx, sexp_segment_data(seg), sexp_segment_base(seg),
+                           end, sexp_segment_parent(seg));
+}
+
+/* the barrier frame at or below fp, or -1 if there is none */
+static sexp_sint_t sexp_find_barrier (sexp ctx, sexp *stack, sexp_sint_t fp) {
+  sexp self;
+  for ( ; fp >= 0; fp = sexp_unbox_fixnum(stack[fp+3])) {
+    self = stack[fp+2];
+    if (sexp_underflowp(ctx, self))
+      return fp;
+    if (!sexp_procedurep(self) || self == sexp_global(ctx, SEXP_G_FINAL_RESUMER))
+      break;
+  }
+  return -1;
+}
+
+/* make fp a barrier frame for the stack below it saved in seg, */
+/* failure just means the next capture copies more of the stack */
+static void sexp_set_barrier (sexp ctx, sexp *stack, sexp_sint_t fp, sexp seg) {
+  sexp_gc_var1(vec);
+  sexp_gc_preserve1(ctx, vec);
+  vec = sexp_make_vector(ctx, SEXP_THREE, SEXP_FALSE);
+  if (!sexp_exceptionp(vec)) {
+    sexp_vector_set(vec, SEXP_ZERO, stack[fp+2]);
+    sexp_vector_set(vec, SEXP_ONE, stack[fp+1]);
+    sexp_vector_set(vec, SEXP_TWO, seg);
+    vec = sexp_make_procedure(ctx, SEXP_ZERO, SEXP_ZERO,
+                              sexp_global(ctx, SEXP_G_UNDERFLOW_BYTECODE), vec);
+    if (!sexp_exceptionp(vec)) {
+      stack[fp+1] = SEXP_ZERO;
+      stack[fp+2] = vec;
+    }
+  }
+  sexp_gc_release1(ctx);
+}
+
+/* save the stack up to end for a continuation captured in frame fp */
+static sexp sexp_capture_stack (sexp ctx, sexp *stack, sexp_sint_t fp, sexp_sint_t end) {
+  sexp_sint_t i, base = 0, barrier = sexp_find_barrier(ctx, stack, fp);
+  sexp *data;
+  sexp_gc_var2(res, parent);
+  sexp_gc_preserve2(ctx, res, parent);
+  parent = SEXP_FALSE;
+  if (barrier >= 0) {
+    /* the old barrier frame is saved, so restore its return address */
+    res = sexp_procedure_vars(stack[barrier+2]);
+    base = barrier - sexp_unbox_fixnum(stack[barrier]);
+    stack[barrier+1] = sexp_vector_ref(res, SEXP_ONE);
+    stack[barrier+2] = sexp_vector_ref(res, SEXP_ZERO);
+    parent = sexp_truncate_segments(ctx, sexp_vector_ref(res, SEXP_TWO), base);
+  }
+  res = sexp_exceptionp(parent) ? parent
+    : sexp_make_vector(ctx, sexp_make_fixnum(end-base), SEXP_VOID);
+  if (!sexp_exceptionp(res)) {
+    data = sexp_vector_data(res);
+    for (i=base; i<end; i++)
+      data[i-base] = stack[i];
+    res = sexp_make_segment(ctx, res, base, end, parent);
+    if (!sexp_exceptionp(res))
+      sexp_set_barrier(ctx, stack, fp, res);
+  }
+  sexp_gc_release2(ctx);
+  return res;
+}
+
+/* reinstate the stack saved in k from frame fp, copying only the */
+/* slots which may differ from the current stack */
+static sexp sexp_reinstate_stack (sexp ctx, sexp_sint_t fp, sexp k) {
+  sexp_sint_t i, lo, shared = 0, end = sexp_segment_end(k), barrier;
+  sexp *stack, *data, cur, seg;
+#if SEXP_USE_CHECK_STACK
+  if ((end+64 >= sexp_stack_length(sexp_context_stack(ctx)))
+      && !sexp_grow_stack(ctx, end+64))
+    return sexp_global(ctx, SEXP_G_OOS_ERROR);
+#endif
+  stack = sexp_stack_data(sexp_context_stack(ctx));
+  barrier = sexp_find_barrier(ctx, stack, fp);
+  if (barrier >= 0) {
+    /* the stack below the barrier is its saved chain, which shares */
+    /* the slots up to the end of the first common segment with k */
+    cur = sexp_vector_ref(sexp_procedure_vars(stack[barrier+2]), SEXP_TWO);
+    seg = k;
+    while (sexp_vectorp(cur) && sexp_vectorp(seg)
+           && sexp_segment_data(cur) != sexp_segment_data(seg)) {
+      i = sexp_segment_base(cur) - sexp_segment_base(seg);
+      if (i >= 0) cur = sexp_segment_parent(cur);
+      if (i <= 0) seg = sexp_segment_parent(seg);
+    }
+    if (sexp_vectorp(cur) && sexp_vectorp(seg)) {
+      shared = barrier - sexp_unbox_fixnum(stack[barrier]);
+      if (sexp_segment_end(cur) < shared) shared = sexp_segment_end(cur);
+      if (sexp_segment_end(seg) < shared) shared = sexp_segment_end(seg);
+    }
+  }
+  for (seg = k; sexp_vectorp(seg) && sexp_segment_end(seg) > shared;
+       seg = sexp_segment_parent(seg)) {
+    lo = sexp_segment_base(seg);
+    data = sexp_vector_data(sexp_segment_data(seg));
+    for (i = (lo > shared ? lo : shared); i < sexp_segment_end(seg); i++)
+      stack[i] = data[i-lo];
+  }
+  sexp_context_top(ctx) = end;
+  sexp_set_barrier(ctx, stack, sexp_unbox_fixnum(stack[end-1]), k);
+  return SEXP_VOID;
+}
+
+#else
+
 static sexp sexp_save_stack (sexp ctx, sexp *stack, sexp_uint_t to) {
   sexp res, *data;
   sexp_uint_t i;
@@ -912,6 +1189,8 @@ static sexp sexp_restore_stack (sexp ctx, sexp saved) {
   return SEXP_VOID;
 }
 
+#endif
+
 #define _ARG1 (stack[top-1])
 #define _ARG2 (stack[top-2])
 #define _ARG3 (stack[top-3])
@@ -948,6 +1227,27 @@ static sexp sexp_restore_stack (sexp ctx, sexp saved) {
       goto call_error_handler;}}                               \
     while (0)
 
+/* With computed gotos each opcode jumps straight to the next one's */
+/* handler through sexp_vm_ops, rather than back through the switch, */
+/* which gives the branch predictor one indirect jump per opcode to */
+/* learn from.  We still drop back to the top of the loop when the */
+/* thread runs out of fuel. */
+#if SEXP_USE_COMPUTED_GOTO
+#define sexp_vm_case(op) case op: op##_LABEL
+#if SEXP_USE_GREEN_THREADS
+#define sexp_vm_next()                                         \
+  do {if (fuel <= 1) goto loop;                                \
+      fuel--;                                                  \
+      goto *sexp_vm_ops[*ip++];}                               \
+    while (0)
+#else
+#define sexp_vm_next() goto *sexp_vm_ops[*ip++]
+#endif
+#else
+#define sexp_vm_case(op) case op
+#define sexp_vm_next() break
+#endif
+
 static int sexp_check_type(sexp ctx, sexp a, sexp b) {
   int d;
   sexp t, v;
@@ -990,10 +1290,35 @@ static int sexp_check_type(sexp ctx, sexp a, sexp b) {
   top -= i; _ARG1 = x; ip += sizeof(sexp); sexp_check_exception();
 #endif
 
+#if SEXP_USE_GENERATIONAL_GC || SEXP_USE_INCREMENTAL_GC
+/* C code stores into the heap without the write barrier, so while */
+/* it runs minor collections scan the whole old generation, as does */
+/* the first one after it returns, and a marking cycle it ran during */
+/* rescans every marked object.  Opcodes flagged referentially */
+/* transparent only allocate, and are called directly. */
+#define sexp_foreign_begin(ctx) (sexp_context_heap(ctx)->barrier_active = 0)
+#define sexp_foreign_end(ctx)                                           \
+  (sexp_context_heap(ctx)->barrier_active                               \
+   = sexp_context_heap(ctx)->barrier_bypassed = 1)
+#define sexp_fcall_begin(op)                                            \
+  do {if (!sexp_opcode_ref_trans_p(op)) sexp_foreign_begin(ctx);} while (0)
+#define sexp_fcall_end(op)                                              \
+  do {if (!sexp_opcode_ref_trans_p(op)) sexp_foreign_end(ctx);} while (0)
+#else
+#define sexp_foreign_begin(ctx)
+#define sexp_foreign_end(ctx)
+#define sexp_fcall_begin(op)
+#define sexp_fcall_end(op)
+#endif
+
 #if SEXP_USE_EXTENDED_FCALL
 #include "opt/fcall.c"
 #endif
 
+#if SEXP_USE_JIT
+#include "opt/jit.c"
+#endif
+
 #if SEXP_USE_PROFILE_VM
 sexp_uint_t profile1[SEXP_OP_NUM_OPCODES];
 sexp_uint_t profile2[SEXP_OP_NUM_OPCODES][SEXP_OP_NUM_OPCODES];
@@ -1036,6 +1361,26 @@ static void* sexp_thread_debug_event(sexp ctx) {
 }
 #endif
 
+#if SEXP_USE_GREEN_THREADS
+/* True if the scheduler would just resume ctx: it can keep running, */
+/* no other thread is runnable, and none is waiting on a timer, fd */
+/* or signal.  Then a CPU-bound thread needn't pay for a scheduler */
+/* run (and a poll) at the end of every quantum. */
+static int sexp_threads_idlep (sexp ctx) {
+  sexp vec;
+  if (sexp_context_refuel(ctx) <= 0 || sexp_context_waitp(ctx)
+      || sexp_global(ctx, SEXP_G_THREADS_SIGNALS) != SEXP_ZERO
+      || sexp_truep(sexp_global(ctx, SEXP_G_THREADS_BLOCKED)))
+    return 0;
+  /* slot 0 of the run queue and timer vectors is their count */
+  vec = sexp_global(ctx, SEXP_G_THREADS_RUNNABLE);
+  if (sexp_vectorp(vec) && sexp_vector_data(vec)[0] != SEXP_ZERO)
+    return 0;
+  vec = sexp_global(ctx, SEXP_G_THREADS_TIMERS);
+  return !(sexp_vectorp(vec) && sexp_vector_data(vec)[0] != SEXP_ZERO);
+}
+#endif
+
 #if SEXP_USE_CHECK_STACK
 #define sexp_ensure_stack(n)                                            \
   if (top+(n) >= sexp_stack_length(sexp_context_stack(ctx))) {          \
@@ -1069,22 +1414,176 @@ int sexp_poll_port(sexp ctx, sexp port, int inputp) {
 }
 #endif
 
+#if SEXP_USE_COMPUTED_GOTO
+#if !defined(__clang__)
+/* keep gcc from merging the per-opcode jumps back into one */
+__attribute__((optimize("no-gcse", "no-crossjumping")))
+#endif
+#endif
 sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
   unsigned char *ip;
   sexp bc, cp, *stack = sexp_stack_data(sexp_context_stack(ctx)), tmp;
   sexp_sint_t i, j, k, fp, top = sexp_stack_top(sexp_context_stack(ctx));
 #if SEXP_USE_GREEN_THREADS
   sexp root_thread = ctx;
-  sexp_sint_t fuel = sexp_context_refuel(ctx);
+  sexp_sint_t fuel = sexp_context_refuel(ctx) > 0 ? sexp_context_quantum(ctx) : 0;
 #endif
 #if SEXP_USE_PROFILE_VM
   unsigned char last_op = SEXP_OP_NOOP;
 #endif
 #if SEXP_USE_BIGNUMS
   sexp_lsint_t prod;
+#endif
+#if SEXP_USE_JIT
+  struct sexp_jit_regs jit_regs;
+  void *jit_entry;
+#endif
+#if SEXP_USE_GENERATIONAL_GC || SEXP_USE_INCREMENTAL_GC
+  int outer_barrier;
+#endif
+#if SEXP_USE_COMPUTED_GOTO
+#if defined(__clang__)
+  /* sexp_vm_ops fills in every slot before naming the real opcodes */
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Winitializer-overrides"
+#endif
+  static void *const sexp_vm_ops[256] = {
+    [0 ... 255] = &&SEXP_OP_UNKNOWN_LABEL,
+    [SEXP_OP_NOOP] = &&SEXP_OP_NOOP_LABEL,
+    [SEXP_OP_RAISE] = &&SEXP_OP_RAISE_LABEL,
+    [SEXP_OP_RESUMECC] = &&SEXP_OP_RESUMECC_LABEL,
+    [SEXP_OP_CALLCC] = &&SEXP_OP_CALLCC_LABEL,
+    [SEXP_OP_APPLY1] = &&SEXP_OP_APPLY1_LABEL,
+    [SEXP_OP_TAIL_CALL] = &&SEXP_OP_TAIL_CALL_LABEL,
+    [SEXP_OP_CALL] = &&SEXP_OP_CALL_LABEL,
+    [SEXP_OP_FCALL0] = &&SEXP_OP_FCALL0_LABEL,
+    [SEXP_OP_FCALL1] = &&SEXP_OP_FCALL1_LABEL,
+    [SEXP_OP_FCALL2] = &&SEXP_OP_FCALL2_LABEL,
+    [SEXP_OP_FCALL3] = &&SEXP_OP_FCALL3_LABEL,
+    [SEXP_OP_FCALL4] = &&SEXP_OP_FCALL4_LABEL,
+#if SEXP_USE_EXTENDED_FCALL
+    [SEXP_OP_FCALLN] = &&SEXP_OP_FCALLN_LABEL,
+#endif
+    [SEXP_OP_JUMP_UNLESS] = &&SEXP_OP_JUMP_UNLESS_LABEL,
+    [SEXP_OP_JUMP] = &&SEXP_OP_JUMP_LABEL,
+    [SEXP_OP_PUSH] = &&SEXP_OP_PUSH_LABEL,
+#if SEXP_USE_RESERVE_OPCODE
+    [SEXP_OP_RESERVE] = &&SEXP_OP_RESERVE_LABEL,
+#endif
+    [SEXP_OP_DROP] = &&SEXP_OP_DROP_LABEL,
+    [SEXP_OP_GLOBAL_REF] = &&SEXP_OP_GLOBAL_REF_LABEL,
+    [SEXP_OP_GLOBAL_KNOWN_REF] = &&SEXP_OP_GLOBAL_KNOWN_REF_LABEL,
+#if SEXP_USE_GREEN_THREADS
+    [SEXP_OP_PARAMETER_REF] = &&SEXP_OP_PARAMETER_REF_LABEL,
+#endif
+    [SEXP_OP_STACK_REF] = &&SEXP_OP_STACK_REF_LABEL,
+    [SEXP_OP_LOCAL_REF] = &&SEXP_OP_LOCAL_REF_LABEL,
+    [SEXP_OP_LOCAL_SET] = &&SEXP_OP_LOCAL_SET_LABEL,
+    [SEXP_OP_CLOSURE_REF] = &&SEXP_OP_CLOSURE_REF_LABEL,
+    [SEXP_OP_CLOSURE_VARS] = &&SEXP_OP_CLOSURE_VARS_LABEL,
+    [SEXP_OP_VECTOR_REF] = &&SEXP_OP_VECTOR_REF_LABEL,
+    [SEXP_OP_VECTOR_SET] = &&SEXP_OP_VECTOR_SET_LABEL,
+    [SEXP_OP_VECTOR_LENGTH] = &&SEXP_OP_VECTOR_LENGTH_LABEL,
+    [SEXP_OP_BYTES_REF] = &&SEXP_OP_BYTES_REF_LABEL,
+    [SEXP_OP_BYTES_SET] = &&SEXP_OP_BYTES_SET_LABEL,
+    [SEXP_OP_BYTES_LENGTH] = &&SEXP_OP_BYTES_LENGTH_LABEL,
+    [SEXP_OP_STRING_REF] = &&SEXP_OP_STRING_REF_LABEL,
+#if SEXP_USE_MUTABLE_STRINGS
+    [SEXP_OP_STRING_SET] = &&SEXP_OP_STRING_SET_LABEL,
+#endif
+    [SEXP_OP_STRING_LENGTH] = &&SEXP_OP_STRING_LENGTH_LABEL,
+#if SEXP_USE_UTF8_STRINGS
+    [SEXP_OP_STRING_CURSOR_NEXT] = &&SEXP_OP_STRING_CURSOR_NEXT_LABEL,
+    [SEXP_OP_STRING_CURSOR_PREV] = &&SEXP_OP_STRING_CURSOR_PREV_LABEL,
+    [SEXP_OP_STRING_CURSOR_END] = &&SEXP_OP_STRING_CURSOR_END_LABEL,
+#endif
+    [SEXP_OP_MAKE_PROCEDURE] = &&SEXP_OP_MAKE_PROCEDURE_LABEL,
+    [SEXP_OP_MAKE_VECTOR] = &&SEXP_OP_MAKE_VECTOR_LABEL,
+    [SEXP_OP_MAKE_EXCEPTION] = &&SEXP_OP_MAKE_EXCEPTION_LABEL,
+    [SEXP_OP_AND] = &&SEXP_OP_AND_LABEL,
+    [SEXP_OP_NULLP] = &&SEXP_OP_NULLP_LABEL,
+    [SEXP_OP_FIXNUMP] = &&SEXP_OP_FIXNUMP_LABEL,
+    [SEXP_OP_SYMBOLP] = &&SEXP_OP_SYMBOLP_LABEL,
+    [SEXP_OP_CHARP] = &&SEXP_OP_CHARP_LABEL,
+    [SEXP_OP_EOFP] = &&SEXP_OP_EOFP_LABEL,
+    [SEXP_OP_TYPEP] = &&SEXP_OP_TYPEP_LABEL,
+    [SEXP_OP_MAKE] = &&SEXP_OP_MAKE_LABEL,
+    [SEXP_OP_SLOT_REF] = &&SEXP_OP_SLOT_REF_LABEL,
+    [SEXP_OP_SLOT_SET] = &&SEXP_OP_SLOT_SET_LABEL,
+    [SEXP_OP_ISA] = &&SEXP_OP_ISA_LABEL,
+    [SEXP_OP_SLOTN_REF] = &&SEXP_OP_SLOTN_REF_LABEL,
+    [SEXP_OP_SLOTN_SET] = &&SEXP_OP_SLOTN_SET_LABEL,
+    [SEXP_OP_CAR] = &&SEXP_OP_CAR_LABEL,
+    [SEXP_OP_CDR] = &&SEXP_OP_CDR_LABEL,
+    [SEXP_OP_SET_CAR] = &&SEXP_OP_SET_CAR_LABEL,
+    [SEXP_OP_SET_CDR] = &&SEXP_OP_SET_CDR_LABEL,
+    [SEXP_OP_CONS] = &&SEXP_OP_CONS_LABEL,
+    [SEXP_OP_ADD] = &&SEXP_OP_ADD_LABEL,
+    [SEXP_OP_SUB] = &&SEXP_OP_SUB_LABEL,
+    [SEXP_OP_MUL] = &&SEXP_OP_MUL_LABEL,
+    [SEXP_OP_DIV] = &&SEXP_OP_DIV_LABEL,
+    [SEXP_OP_QUOTIENT] = &&SEXP_OP_QUOTIENT_LABEL,
+    [SEXP_OP_REMAINDER] = &&SEXP_OP_REMAINDER_LABEL,
+    [SEXP_OP_LT] = &&SEXP_OP_LT_LABEL,
+    [SEXP_OP_LE] = &&SEXP_OP_LE_LABEL,
+    [SEXP_OP_EQN] = &&SEXP_OP_EQN_LABEL,
+    [SEXP_OP_EQ] = &&SEXP_OP_EQ_LABEL,
+    [SEXP_OP_CHAR2INT] = &&SEXP_OP_CHAR2INT_LABEL,
+    [SEXP_OP_INT2CHAR] = &&SEXP_OP_INT2CHAR_LABEL,
+    [SEXP_OP_CHAR_UPCASE] = &&SEXP_OP_CHAR_UPCASE_LABEL,
+    [SEXP_OP_CHAR_DOWNCASE] = &&SEXP_OP_CHAR_DOWNCASE_LABEL,
+    [SEXP_OP_WRITE_CHAR] = &&SEXP_OP_WRITE_CHAR_LABEL,
+    [SEXP_OP_WRITE_STRING] = &&SEXP_OP_WRITE_STRING_LABEL,
+    [SEXP_OP_READ_CHAR] = &&SEXP_OP_READ_CHAR_LABEL,
+    [SEXP_OP_PEEK_CHAR] = &&SEXP_OP_PEEK_CHAR_LABEL,
+    [SEXP_OP_YIELD] = &&SEXP_OP_YIELD_LABEL,
+    [SEXP_OP_FORCE] = &&SEXP_OP_FORCE_LABEL,
+    [SEXP_OP_RET] = &&SEXP_OP_RET_LABEL,
+    [SEXP_OP_DONE] = &&SEXP_OP_DONE_LABEL,
+    [SEXP_OP_SCP] = &&SEXP_OP_SCP_LABEL,
+    [SEXP_OP_SC_LT] = &&SEXP_OP_SC_LT_LABEL,
+    [SEXP_OP_SC_LE] = &&SEXP_OP_SC_LE_LABEL,
+    [SEXP_OP_LOCAL_REF_CAR] = &&SEXP_OP_LOCAL_REF_CAR_LABEL,
+    [SEXP_OP_LOCAL_REF_CDR] = &&SEXP_OP_LOCAL_REF_CDR_LABEL,
+    [SEXP_OP_CLOSURE_REF_CDR] = &&SEXP_OP_CLOSURE_REF_CDR_LABEL,
+    [SEXP_OP_LT_JUMP_UNLESS] = &&SEXP_OP_LT_JUMP_UNLESS_LABEL,
+    [SEXP_OP_LE_JUMP_UNLESS] = &&SEXP_OP_LE_JUMP_UNLESS_LABEL,
+    [SEXP_OP_EQN_JUMP_UNLESS] = &&SEXP_OP_EQN_JUMP_UNLESS_LABEL,
+    [SEXP_OP_NULLP_JUMP_UNLESS] = &&SEXP_OP_NULLP_JUMP_UNLESS_LABEL,
+    [SEXP_OP_UNSAFE_CAR] = &&SEXP_OP_UNSAFE_CAR_LABEL,
+    [SEXP_OP_UNSAFE_CDR] = &&SEXP_OP_UNSAFE_CDR_LABEL,
+    [SEXP_OP_FX_ADD] = &&SEXP_OP_FX_ADD_LABEL,
+    [SEXP_OP_FX_SUB] = &&SEXP_OP_FX_SUB_LABEL,
+    [SEXP_OP_FX_LT] = &&SEXP_OP_FX_LT_LABEL,
+    [SEXP_OP_FX_LE] = &&SEXP_OP_FX_LE_LABEL,
+    [SEXP_OP_FX_EQN] = &&SEXP_OP_FX_EQN_LABEL,
+    [SEXP_OP_LOCAL_REF_UNSAFE_CAR] = &&SEXP_OP_LOCAL_REF_UNSAFE_CAR_LABEL,
+    [SEXP_OP_LOCAL_REF_UNSAFE_CDR] = &&SEXP_OP_LOCAL_REF_UNSAFE_CDR_LABEL,
+    [SEXP_OP_CLOSURE_REF_UNSAFE_CDR] = &&SEXP_OP_CLOSURE_REF_UNSAFE_CDR_LABEL,
+    [SEXP_OP_FX_LT_JUMP_UNLESS] = &&SEXP_OP_FX_LT_JUMP_UNLESS_LABEL,
+    [SEXP_OP_FX_LE_JUMP_UNLESS] = &&SEXP_OP_FX_LE_JUMP_UNLESS_LABEL,
+    [SEXP_OP_FX_EQN_JUMP_UNLESS] = &&SEXP_OP_FX_EQN_JUMP_UNLESS_LABEL,
+#if SEXP_USE_SEGMENTED_CONTINUATIONS
+    [SEXP_OP_UNDERFLOW] = &&SEXP_OP_UNDERFLOW_LABEL,
+#endif
+#if SEXP_USE_INLINE_CACHES
+    [SEXP_OP_CACHED_CALL] = &&SEXP_OP_CACHED_CALL_LABEL,
+    [SEXP_OP_CACHED_TAIL_CALL] = &&SEXP_OP_CACHED_TAIL_CALL_LABEL,
+#endif
+  };
+#if defined(__clang__)
+#pragma clang diagnostic pop
+#endif
 #endif
   sexp_gc_var3(self, tmp1, tmp2);
   sexp_gc_preserve3(ctx, self, tmp1, tmp2);
+#if SEXP_USE_GENERATIONAL_GC || SEXP_USE_INCREMENTAL_GC
+  /* when called from C, its stores bypassed the write barrier */
+  outer_barrier = sexp_context_heap(ctx)->barrier_active;
+  if (!outer_barrier)
+    sexp_context_heap(ctx)->barrier_bypassed = 1;
+  sexp_context_heap(ctx)->barrier_active = 1;
+#endif
   fp = top - 4;
   self = sexp_global(ctx, SEXP_G_FINAL_RESUMER);
   bc = sexp_procedure_code(self);
@@ -1103,14 +1602,19 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
  loop:
 #if SEXP_USE_GREEN_THREADS
   if (--fuel <= 0) {
+#if SEXP_USE_INCREMENTAL_GC
+    sexp_context_top(ctx) = top;
+    sexp_incremental_mark(ctx);
+#endif
     if (sexp_context_interruptp(ctx)) {
-      fuel = sexp_context_refuel(ctx);
+      fuel = sexp_context_quantum(ctx);
       sexp_context_interruptp(ctx) = 0;
       _ARG1 = sexp_global(ctx, SEXP_G_INTERRUPT_ERROR);
       goto call_error_handler;
     }
     tmp1 = sexp_global(ctx, SEXP_G_THREADS_SCHEDULER);
-    if (sexp_applicablep(tmp1) && sexp_not(sexp_global(ctx, SEXP_G_ATOMIC_P))) {
+    if (sexp_applicablep(tmp1) && sexp_not(sexp_global(ctx, SEXP_G_ATOMIC_P))
+        && !sexp_threads_idlep(ctx)) {
       /* save thread */
       sexp_context_top(ctx) = top;
       sexp_context_ip(ctx) = ip;
@@ -1120,7 +1624,9 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
 #if SEXP_USE_DEBUG_THREADS
       tmp2 = ctx;
 #endif
+      sexp_foreign_begin(ctx);
       ctx = sexp_apply1(ctx, tmp1, root_thread);
+      sexp_foreign_end(ctx);
       /* restore thread */
       stack = sexp_stack_data(sexp_context_stack(ctx));
       top = sexp_context_top(ctx);
@@ -1133,17 +1639,32 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
       if (ctx != tmp2) {
         fprintf(stderr, "****** schedule %p: %p (%s) active:",
                 root_thread, ctx, sexp_thread_debug_name(ctx));
-        for (tmp1=sexp_global(ctx, SEXP_G_THREADS_FRONT); sexp_pairp(tmp1); tmp1=sexp_cdr(tmp1))
-          fprintf(stderr, " %p (%s)", sexp_car(tmp1), sexp_thread_debug_name(sexp_car(tmp1)));
+        /* one ring buffer per priority level, highest first */
+        tmp2 = sexp_global(ctx, SEXP_G_THREADS_RUNNABLE);
+        for (i=1; sexp_vectorp(tmp2) && i<(sexp_sint_t)sexp_vector_length(tmp2); i++) {
+          tmp1 = sexp_vector_ref(tmp2, sexp_make_fixnum(i));
+          if (!sexp_vectorp(tmp1)) continue;
+          for (j=0; j<sexp_unbox_fixnum(sexp_vector_data(tmp1)[1]); j++) {
+            k = 2 + (sexp_unbox_fixnum(sexp_vector_data(tmp1)[0]) + j) % (sexp_vector_length(tmp1) - 2);
+            fprintf(stderr, " %p (%s)", sexp_vector_data(tmp1)[k], sexp_thread_debug_name(sexp_vector_data(tmp1)[k]));
+          }
+        }
         fprintf(stderr, " paused:");
         for (tmp1=sexp_global(ctx, SEXP_G_THREADS_PAUSED); sexp_pairp(tmp1); tmp1=sexp_cdr(tmp1))
           fprintf(stderr, " %p (%s) [%s %p]", sexp_car(tmp1), sexp_thread_debug_name(sexp_car(tmp1)), sexp_thread_debug_event_type(sexp_car(tmp1)), sexp_thread_debug_event(sexp_car(tmp1)));
+        /* threads waiting with a timeout are in the timer heap instead */
+        fprintf(stderr, " timers:");
+        tmp2 = sexp_global(ctx, SEXP_G_THREADS_TIMERS);
+        for (i=1; sexp_vectorp(tmp2) && i<=sexp_unbox_fixnum(sexp_vector_data(tmp2)[0]); i++) {
+          tmp1 = sexp_vector_data(tmp2)[i];
+          fprintf(stderr, " %p (%s) [%s %p]", tmp1, sexp_thread_debug_name(tmp1), sexp_thread_debug_event_type(tmp1), sexp_thread_debug_event(tmp1));
+        }
         fprintf(stderr, " ******\n");
       }
 #endif
     }
-    fuel = sexp_context_refuel(ctx);
-    if (fuel <= 0) goto end_loop;
+    if (sexp_context_refuel(ctx) <= 0) goto end_loop;
+    fuel = sexp_context_quantum(ctx);
     if (sexp_context_waitp(ctx)) {
       fuel = 1;
       goto loop;  /* we were still waiting, try again */
@@ -1164,20 +1685,27 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
   profile1[*ip]++;
   profile2[last_op][*ip]++;
   last_op = *ip;
+#endif
+#if SEXP_USE_COMPUTED_GOTO
+  goto *sexp_vm_ops[*ip++];
 #endif
   switch (*ip++) {
-  case SEXP_OP_NOOP:
-    break;
+  sexp_vm_case(SEXP_OP_NOOP):
+    sexp_vm_next();
   call_error_handler:
-    if (! sexp_exception_procedure(_ARG1))
+    if (! sexp_exception_procedure(_ARG1)) {
       sexp_exception_procedure(_ARG1) = self;
+      sexp_write_barrier(ctx, _ARG1, self);
+    }
 #if SEXP_USE_FULL_SOURCE_INFO
     if (sexp_not(sexp_exception_source(_ARG1))
         && sexp_procedurep(sexp_exception_procedure(_ARG1))
-        && sexp_procedure_source(sexp_exception_procedure(_ARG1)))
+        && sexp_procedure_source(sexp_exception_procedure(_ARG1))) {
       sexp_exception_source(_ARG1) = sexp_lookup_source_info(sexp_exception_procedure(_ARG1), (ip-sexp_bytecode_data(bc)));
+      sexp_write_barrier(ctx, _ARG1, sexp_exception_source(_ARG1));
+    }
 #endif
-  case SEXP_OP_RAISE:
+  sexp_vm_case(SEXP_OP_RAISE):
     sexp_context_top(ctx) = top;
     if (sexp_trampolinep(_ARG1)) {
       tmp1 = sexp_trampoline_procedure(_ARG1);
@@ -1204,6 +1732,7 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
       }
       sexp_context_top(ctx) = top;
       sexp_exception_stack_trace(_ARG1) = sexp_get_stack_trace(ctx);
+      sexp_write_barrier(ctx, _ARG1, sexp_exception_stack_trace(_ARG1));
       goto end_loop;
     }
     stack[top] = SEXP_ONE;
@@ -1216,12 +1745,17 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
     ip = sexp_bytecode_data(bc);
     cp = sexp_procedure_vars(self);
     fp = top-4;
-    break;
-  case SEXP_OP_RESUMECC:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_RESUMECC):
     sexp_context_top(ctx) = top;
     tmp1 = stack[fp-1];
+#if SEXP_USE_SEGMENTED_CONTINUATIONS
+    tmp2 = sexp_reinstate_stack(ctx, fp, sexp_vector_ref(cp, 0));
+#else
     tmp2 = sexp_restore_stack(ctx, sexp_vector_ref(cp, 0));
+#endif
     if (sexp_exceptionp(tmp2)) {_ARG1 = tmp2; goto call_error_handler;}
+    stack = sexp_stack_data(sexp_context_stack(ctx));
     top = sexp_context_top(ctx);
     fp = sexp_unbox_fixnum(_ARG1);
     self = _ARG2;
@@ -1230,8 +1764,8 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
     ip = sexp_bytecode_data(bc) + sexp_unbox_fixnum(_ARG3);
     top -= 4;
     _ARG1 = tmp1;
-    break;
-  case SEXP_OP_CALLCC:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_CALLCC):
     stack[top] = SEXP_ONE;
     stack[top+1] = sexp_make_fixnum(ip-sexp_bytecode_data(bc));
     stack[top+2] = self;
@@ -1239,8 +1773,14 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
     tmp1 = _ARG1;
     i = 1;
     sexp_context_top(ctx) = top;
+#if SEXP_USE_SEGMENTED_CONTINUATIONS
+    tmp2 = sexp_capture_stack(ctx, stack, fp, top+4);
+    if (sexp_exceptionp(tmp2)) {_ARG1 = tmp2; goto call_error_handler;}
+    tmp2 = sexp_make_vector(ctx, SEXP_ONE, tmp2);
+#else
     tmp2 = sexp_make_vector(ctx, SEXP_ONE, SEXP_UNDEF);
     sexp_vector_set(tmp2, SEXP_ZERO, sexp_save_stack(ctx, stack, top+4));
+#endif
     _ARG1 = sexp_make_procedure(ctx,
                                 SEXP_ZERO,
                                 SEXP_ONE,
@@ -1249,7 +1789,7 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
     top++;
     ip -= sizeof(sexp);
     goto make_call;
-  case SEXP_OP_APPLY1:
+  sexp_vm_case(SEXP_OP_APPLY1):
     tmp1 = _ARG1;
     tmp2 = _ARG2;
   apply1:
@@ -1279,7 +1819,7 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
       }
     }
     goto make_call;
-  case SEXP_OP_TAIL_CALL:
+  sexp_vm_case(SEXP_OP_TAIL_CALL):
     _ALIGN_IP();
     i = sexp_unbox_fixnum(_WORD0);             /* number of params */
     tmp1 = _ARG1;                              /* procedure to call */
@@ -1298,7 +1838,63 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
     _PUSH(tmp1);
     fp = sexp_unbox_fixnum(tmp2);
     goto make_call;
-  case SEXP_OP_CALL:
+#if SEXP_USE_INLINE_CACHES
+  sexp_vm_case(SEXP_OP_CACHED_TAIL_CALL):
+    _ALIGN_IP();
+    i = sexp_unbox_fixnum(_WORD0);             /* number of params */
+    tmp1 = _ARG1;                              /* procedure to call */
+    tmp = _WORD1;                              /* inline cache */
+    tmp2 = stack[fp+3];
+    j = sexp_unbox_fixnum(stack[fp]);
+    self = stack[fp+2];
+    bc = sexp_procedure_code(self);
+    cp = sexp_procedure_vars(self);
+    ip = (sexp_bytecode_data(bc)+sexp_unbox_fixnum(stack[fp+1])) - sizeof(sexp);
+    for (k=0; k<i; k++)
+      stack[fp-j+k] = stack[top-1-i+k];
+    top = fp+i-j;
+    _PUSH(tmp1);
+    fp = sexp_unbox_fixnum(tmp2);
+    goto cached_call;
+  sexp_vm_case(SEXP_OP_CACHED_CALL):
+    _ALIGN_IP();
+    i = sexp_unbox_fixnum(_WORD0);
+    tmp1 = _ARG1;
+    tmp = _WORD1;
+    /* step to the cache so returns land just past it */
+    ip += sizeof(sexp);
+  cached_call:
+    /* the cache holds the last callee here known to be a */
+    /* non-variadic procedure taking exactly i args, so a */
+    /* redefinition of the global just fails the comparison */
+    if (tmp1 != sexp_car(tmp)) {
+      if (! (sexp_procedurep(tmp1) && ! sexp_procedure_variadic_p(tmp1)
+             && sexp_procedure_num_args(tmp1) == i))
+        goto make_call;
+      sexp_car(tmp) = tmp1;
+      sexp_write_barrier(ctx, tmp, tmp1);
+    }
+    sexp_context_top(ctx) = top;
+    sexp_ensure_stack(sexp_bytecode_max_depth(sexp_procedure_code(tmp1))+64);
+    _ARG1 = sexp_make_fixnum(i);
+    stack[top] = sexp_make_fixnum(ip+sizeof(sexp)-sexp_bytecode_data(bc));
+    stack[top+1] = self;
+    stack[top+2] = sexp_make_fixnum(fp);
+    top += 3;
+    self = tmp1;
+    bc = sexp_procedure_code(self);
+    ip = sexp_bytecode_data(bc);
+    cp = sexp_procedure_vars(self);
+    fp = top-4;
+#if SEXP_USE_JIT
+    if (!sexp_bytecode_jit(bc) && ++sexp_bytecode_calls(bc) == SEXP_JIT_THRESHOLD)
+      sexp_jit_compile(ctx, bc);
+    if ((jit_entry = sexp_jit_entry(bc, 0)))
+      goto jit_enter;
+#endif
+    sexp_vm_next();
+#endif
+  sexp_vm_case(SEXP_OP_CALL):
     _ALIGN_IP();
     i = sexp_unbox_fixnum(_WORD0);
     tmp1 = _ARG1;
@@ -1353,99 +1949,155 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
     ip = sexp_bytecode_data(bc);
     cp = sexp_procedure_vars(self);
     fp = top-4;
-    break;
-  case SEXP_OP_FCALL0:
+#if SEXP_USE_JIT
+    if (!sexp_bytecode_jit(bc) && ++sexp_bytecode_calls(bc) == SEXP_JIT_THRESHOLD)
+      sexp_jit_compile(ctx, bc);
+    if ((jit_entry = sexp_jit_entry(bc, 0)))
+      goto jit_enter;
+#endif
+    sexp_vm_next();
+#if SEXP_USE_JIT
+  jit_enter:
+    jit_regs.stack = stack;
+    jit_regs.limit = stack + sexp_stack_length(sexp_context_stack(ctx));
+    jit_regs.top = top;
+    jit_regs.fp = fp;
+    jit_regs.self = self;
+#if SEXP_USE_GREEN_THREADS
+    jit_regs.fuel = fuel;
+#else
+    jit_regs.fuel = SEXP_MAX_FIXNUM;
+#endif
+    sexp_jit_run(&jit_regs, jit_entry);
+    top = jit_regs.top;
+    fp = jit_regs.fp;
+    self = jit_regs.self;
+    bc = sexp_procedure_code(self);
+    cp = sexp_procedure_vars(self);
+    ip = sexp_bytecode_data(bc) + jit_regs.ip;
+#if SEXP_USE_GREEN_THREADS
+    fuel = jit_regs.fuel;
+#endif
+    sexp_vm_next();
+#endif
+  sexp_vm_case(SEXP_OP_FCALL0):
     _ALIGN_IP();
     sexp_context_top(ctx) = top;
     sexp_context_last_fp(ctx) = fp;
+    sexp_fcall_begin(_WORD0);
     tmp1 = ((sexp_proc1)sexp_opcode_func(_WORD0))(ctx, _WORD0, 0);
+    sexp_fcall_end(_WORD0);
     sexp_fcall_return(tmp1, -1)
-    break;
-  case SEXP_OP_FCALL1:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_FCALL1):
     _ALIGN_IP();
     sexp_context_top(ctx) = top;
     sexp_context_last_fp(ctx) = fp;
+    sexp_fcall_begin(_WORD0);
     tmp1 = ((sexp_proc2)sexp_opcode_func(_WORD0))(ctx, _WORD0, 1, _ARG1);
+    sexp_fcall_end(_WORD0);
     sexp_fcall_return(tmp1, 0)
-    break;
-  case SEXP_OP_FCALL2:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_FCALL2):
     _ALIGN_IP();
     sexp_context_top(ctx) = top;
     sexp_context_last_fp(ctx) = fp;
+    sexp_fcall_begin(_WORD0);
     tmp1 = ((sexp_proc3)sexp_opcode_func(_WORD0))(ctx, _WORD0, 2, _ARG1, _ARG2);
+    sexp_fcall_end(_WORD0);
     sexp_fcall_return(tmp1, 1)
-    break;
-  case SEXP_OP_FCALL3:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_FCALL3):
     _ALIGN_IP();
     sexp_context_top(ctx) = top;
     sexp_context_last_fp(ctx) = fp;
+    sexp_fcall_begin(_WORD0);
     tmp1 = ((sexp_proc4)sexp_opcode_func(_WORD0))(ctx, _WORD0, 3, _ARG1, _ARG2, _ARG3);
+    sexp_fcall_end(_WORD0);
     sexp_fcall_return(tmp1, 2)
-    break;
-  case SEXP_OP_FCALL4:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_FCALL4):
     _ALIGN_IP();
     sexp_context_top(ctx) = top;
     sexp_context_last_fp(ctx) = fp;
+    sexp_fcall_begin(_WORD0);
     tmp1 = ((sexp_proc5)sexp_opcode_func(_WORD0))(ctx, _WORD0, 4, _ARG1, _ARG2, _ARG3, _ARG4);
+    sexp_fcall_end(_WORD0);
     sexp_fcall_return(tmp1, 3)
-    break;
+    sexp_vm_next();
 #if SEXP_USE_EXTENDED_FCALL
-  case SEXP_OP_FCALLN:
+  sexp_vm_case(SEXP_OP_FCALLN):
     _ALIGN_IP();
     sexp_context_top(ctx) = top;
     sexp_context_last_fp(ctx) = fp;
     i = sexp_opcode_num_args(_WORD0) + sexp_opcode_variadic_p(_WORD0);
+    sexp_fcall_begin(_WORD0);
     tmp1 = sexp_fcall(ctx, self, i, _WORD0);
+    sexp_fcall_end(_WORD0);
     sexp_fcall_return(tmp1, i-1)
-    break;
+    sexp_vm_next();
 #endif
-  case SEXP_OP_JUMP_UNLESS:
+  sexp_vm_case(SEXP_OP_JUMP_UNLESS):
     _ALIGN_IP();
     if (stack[--top] == SEXP_FALSE)
       ip += _SWORD0;
     else
       ip += sizeof(sexp_sint_t);
-    break;
-  case SEXP_OP_JUMP:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_JUMP):
     _ALIGN_IP();
+#if SEXP_USE_JIT
+    /* loops from tail jumps count towards compiling like calls */
+    if (_SWORD0 < 0) {
+      ip += _SWORD0;
+      if (!sexp_bytecode_jit(bc) && ++sexp_bytecode_calls(bc) == SEXP_JIT_THRESHOLD)
+        sexp_jit_compile(ctx, bc);
+      if ((jit_entry = sexp_jit_entry(bc, ip - sexp_bytecode_data(bc))))
+        goto jit_enter;
+      sexp_vm_next();
+    }
+#endif
     ip += _SWORD0;
-    break;
-  case SEXP_OP_PUSH:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_PUSH):
     _ALIGN_IP();
     _PUSH(_WORD0);
     ip += sizeof(sexp);
-    break;
+    sexp_vm_next();
 #if SEXP_USE_RESERVE_OPCODE
-  case SEXP_OP_RESERVE:
+  sexp_vm_case(SEXP_OP_RESERVE):
     _ALIGN_IP();
     for (i=_SWORD0; i > 0; i--)
       stack[top++] = SEXP_VOID;
     ip += sizeof(sexp);
-    break;
+    sexp_vm_next();
 #endif
-  case SEXP_OP_DROP:
+  sexp_vm_case(SEXP_OP_DROP):
     top--;
-    break;
-  case SEXP_OP_GLOBAL_REF:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_GLOBAL_REF):
     _ALIGN_IP();
     if (sexp_cdr(_WORD0) == SEXP_UNDEF) {
       /* handle renamed forward references by doing a final delayed */
       /* lookup before throwing an undefined variable error */
       if (sexp_synclop(sexp_car(_WORD0))) {
         tmp1 = sexp_env_cell(ctx, sexp_synclo_env(sexp_car(_WORD0)), sexp_synclo_expr(sexp_car(_WORD0)), 0);
-        if (tmp1 != NULL) _WORD0 = tmp1;
+        if (tmp1 != NULL) {
+          _WORD0 = tmp1;
+          sexp_write_barrier(ctx, bc, tmp1);
+        }
       }
       if (sexp_cdr(_WORD0) == SEXP_UNDEF)
         sexp_raise("undefined variable", sexp_list1(ctx, sexp_car(_WORD0)));
     }
     /* ... FALLTHROUGH ... */
-  case SEXP_OP_GLOBAL_KNOWN_REF:
+  sexp_vm_case(SEXP_OP_GLOBAL_KNOWN_REF):
     _ALIGN_IP();
     _PUSH(sexp_cdr(_WORD0));
     ip += sizeof(sexp);
-    break;
+    sexp_vm_next();
 #if SEXP_USE_GREEN_THREADS
-  case SEXP_OP_PARAMETER_REF:
+  sexp_vm_case(SEXP_OP_PARAMETER_REF):
     _ALIGN_IP();
     sexp_context_top(ctx) = top;
     tmp2 = _WORD0;
@@ -1456,34 +2108,34 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
         goto loop;
       }
     _PUSH(sexp_opcode_data(tmp2));
-    break;
+    sexp_vm_next();
 #endif
-  case SEXP_OP_STACK_REF:
+  sexp_vm_case(SEXP_OP_STACK_REF):
     _ALIGN_IP();
     stack[top] = stack[top - _SWORD0];
     ip += sizeof(sexp);
     top++;
-    break;
-  case SEXP_OP_LOCAL_REF:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_LOCAL_REF):
     _ALIGN_IP();
     stack[top] = stack[fp - 1 - _SWORD0];
     ip += sizeof(sexp);
     top++;
-    break;
-  case SEXP_OP_LOCAL_SET:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_LOCAL_SET):
     _ALIGN_IP();
     stack[fp - 1 - _SWORD0] = _POP();
     ip += sizeof(sexp);
-    break;
-  case SEXP_OP_CLOSURE_REF:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_CLOSURE_REF):
     _ALIGN_IP();
     _PUSH(sexp_vector_ref(cp, sexp_make_fixnum(_SWORD0)));
     ip += sizeof(sexp);
-    break;
-  case SEXP_OP_CLOSURE_VARS:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_CLOSURE_VARS):
     _ARG1 = sexp_procedure_vars(_ARG1);
-    break;
-  case SEXP_OP_VECTOR_REF:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_VECTOR_REF):
     if (! sexp_vectorp(_ARG1))
       sexp_raise("vector-ref: not a vector", sexp_list1(ctx, _ARG1));
     else if (! sexp_fixnump(_ARG2))
@@ -1493,8 +2145,8 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
       sexp_raise("vector-ref: index out of range", sexp_list2(ctx, _ARG1, _ARG2));
     _ARG2 = sexp_vector_ref(_ARG1, _ARG2);
     top--;
-    break;
-  case SEXP_OP_VECTOR_SET:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_VECTOR_SET):
     if (! sexp_vectorp(_ARG1))
       sexp_raise("vector-set!: not a vector", sexp_list1(ctx, _ARG1));
     else if (sexp_immutablep(_ARG1))
@@ -1505,14 +2157,15 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
     if ((i < 0) || (i >= (sexp_sint_t)sexp_vector_length(_ARG1)))
       sexp_raise("vector-set!: index out of range", sexp_list2(ctx, _ARG1, _ARG2));
     sexp_vector_set(_ARG1, _ARG2, _ARG3);
+    sexp_write_barrier(ctx, _ARG1, _ARG3);
     top-=3;
-    break;
-  case SEXP_OP_VECTOR_LENGTH:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_VECTOR_LENGTH):
     if (! sexp_vectorp(_ARG1))
       sexp_raise("vector-length: not a vector", sexp_list1(ctx, _ARG1));
     _ARG1 = sexp_make_fixnum(sexp_vector_length(_ARG1));
-    break;
-  case SEXP_OP_BYTES_REF:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_BYTES_REF):
     if (! sexp_bytesp(_ARG1))
       sexp_raise("byte-vector-ref: not a byte-vector", sexp_list1(ctx, _ARG1));
     if (! sexp_fixnump(_ARG2))
@@ -1522,8 +2175,8 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
       sexp_raise("byte-vector-ref: index out of range", sexp_list2(ctx, _ARG1, _ARG2));
     _ARG2 = sexp_bytes_ref(_ARG1, _ARG2);
     top--;
-    break;
-  case SEXP_OP_STRING_REF:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_STRING_REF):
     if (! sexp_stringp(_ARG1))
       sexp_raise("string-cursor-ref: not a string", sexp_list1(ctx, _ARG1));
     else if (! sexp_string_cursorp(_ARG2))
@@ -1534,8 +2187,8 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
     _ARG2 = sexp_string_cursor_ref(ctx, _ARG1, _ARG2);
     top--;
     sexp_check_exception();
-    break;
-  case SEXP_OP_BYTES_SET:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_BYTES_SET):
     if (! sexp_bytesp(_ARG1))
       sexp_raise("byte-vector-set!: not a byte-vector", sexp_list1(ctx, _ARG1));
     else if (sexp_immutablep(_ARG1))
@@ -1550,9 +2203,9 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
       sexp_raise("byte-vector-set!: index out of range", sexp_list2(ctx, _ARG1, _ARG2));
     sexp_bytes_set(_ARG1, _ARG2, _ARG3);
     top-=3;
-    break;
+    sexp_vm_next();
 #if SEXP_USE_MUTABLE_STRINGS
-  case SEXP_OP_STRING_SET:
+  sexp_vm_case(SEXP_OP_STRING_SET):
     if (! sexp_stringp(_ARG1))
       sexp_raise("string-cursor-set!: not a string", sexp_list1(ctx, _ARG1));
     else if (sexp_immutablep(_ARG1))
@@ -1567,10 +2220,10 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
     sexp_context_top(ctx) = top;
     sexp_string_set(ctx, _ARG1, _ARG2, _ARG3);
     top-=3;
-    break;
+    sexp_vm_next();
 #endif
 #if SEXP_USE_UTF8_STRINGS
-  case SEXP_OP_STRING_CURSOR_NEXT:
+  sexp_vm_case(SEXP_OP_STRING_CURSOR_NEXT):
     if (! sexp_stringp(_ARG1))
       sexp_raise("string-cursor-next: not a string", sexp_list1(ctx, _ARG1));
     else if (! sexp_string_cursorp(_ARG2))
@@ -1578,8 +2231,8 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
     _ARG2 = sexp_string_cursor_next(_ARG1, _ARG2);
     top--;
     sexp_check_exception();
-    break;
-  case SEXP_OP_STRING_CURSOR_PREV:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_STRING_CURSOR_PREV):
     if (! sexp_stringp(_ARG1))
       sexp_raise("string-cursor-prev: not a string", sexp_list1(ctx, _ARG1));
     else if (! sexp_string_cursorp(_ARG2))
@@ -1587,30 +2240,30 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
     _ARG2 = sexp_string_cursor_prev(_ARG1, _ARG2);
     top--;
     sexp_check_exception();
-    break;
-  case SEXP_OP_STRING_CURSOR_END:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_STRING_CURSOR_END):
     if (! sexp_stringp(_ARG1))
       sexp_raise("string-cursor-end: not a string", sexp_list1(ctx, _ARG1));
     _ARG1 = sexp_make_string_cursor(sexp_string_size(_ARG1));
-    break;
+    sexp_vm_next();
 #endif
-  case SEXP_OP_BYTES_LENGTH:
+  sexp_vm_case(SEXP_OP_BYTES_LENGTH):
     if (! sexp_bytesp(_ARG1))
       sexp_raise("bytes-length: not a byte-vector", sexp_list1(ctx, _ARG1));
     _ARG1 = sexp_make_fixnum(sexp_bytes_length(_ARG1));
-    break;
-  case SEXP_OP_STRING_LENGTH:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_STRING_LENGTH):
     if (! sexp_stringp(_ARG1))
       sexp_raise("string-length: not a string", sexp_list1(ctx, _ARG1));
     _ARG1 = sexp_make_fixnum(sexp_string_length(_ARG1));
-    break;
-  case SEXP_OP_MAKE_PROCEDURE:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_MAKE_PROCEDURE):
     sexp_context_top(ctx) = top;
     _ALIGN_IP();
     _ARG1 = sexp_make_procedure(ctx, _WORD0, _WORD1, _WORD2, _ARG1);
     ip += (3 * sizeof(sexp));
-    break;
-  case SEXP_OP_MAKE_VECTOR:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_MAKE_VECTOR):
     sexp_context_top(ctx) = top;
     if (! sexp_fixnump(_ARG1))
       sexp_raise("make-vector: not an integer", sexp_list1(ctx, _ARG1));
@@ -1618,39 +2271,39 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
       sexp_raise("make-vector: length must be non-negative", sexp_list1(ctx, _ARG1));
     _ARG2 = sexp_make_vector(ctx, _ARG1, _ARG2);
     top--;
-    break;
-  case SEXP_OP_MAKE_EXCEPTION:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_MAKE_EXCEPTION):
     sexp_context_top(ctx) = top;
     _ARG5 = sexp_make_exception(ctx, _ARG1, _ARG2, _ARG3, _ARG4, _ARG5);
     top -= 4;
-    break;
-  case SEXP_OP_AND:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_AND):
     _ARG2 = sexp_make_boolean((_ARG1 != SEXP_FALSE) && (_ARG2 != SEXP_FALSE));
     top--;
-    break;
-  case SEXP_OP_EOFP:
-    _ARG1 = sexp_make_boolean(_ARG1 == SEXP_EOF); break;
-  case SEXP_OP_NULLP:
-    _ARG1 = sexp_make_boolean(sexp_nullp(_ARG1)); break;
-  case SEXP_OP_FIXNUMP:
-    _ARG1 = sexp_make_boolean(sexp_fixnump(_ARG1)); break;
-  case SEXP_OP_SYMBOLP:
-    _ARG1 = sexp_make_boolean(sexp_symbolp(_ARG1)); break;
-  case SEXP_OP_CHARP:
-    _ARG1 = sexp_make_boolean(sexp_charp(_ARG1)); break;
-  case SEXP_OP_ISA:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_EOFP):
+    _ARG1 = sexp_make_boolean(_ARG1 == SEXP_EOF); sexp_vm_next();
+  sexp_vm_case(SEXP_OP_NULLP):
+    _ARG1 = sexp_make_boolean(sexp_nullp(_ARG1)); sexp_vm_next();
+  sexp_vm_case(SEXP_OP_FIXNUMP):
+    _ARG1 = sexp_make_boolean(sexp_fixnump(_ARG1)); sexp_vm_next();
+  sexp_vm_case(SEXP_OP_SYMBOLP):
+    _ARG1 = sexp_make_boolean(sexp_symbolp(_ARG1)); sexp_vm_next();
+  sexp_vm_case(SEXP_OP_CHARP):
+    _ARG1 = sexp_make_boolean(sexp_charp(_ARG1)); sexp_vm_next();
+  sexp_vm_case(SEXP_OP_ISA):
     tmp1 = _ARG1, tmp2 = _ARG2;
     if (! sexp_typep(tmp2)) sexp_raise("is-a?: not a type", tmp2);
     top--;
     goto do_check_type;
-  case SEXP_OP_TYPEP:
+  sexp_vm_case(SEXP_OP_TYPEP):
     _ALIGN_IP();
     tmp1 = _ARG1, tmp2 = sexp_type_by_index(ctx, _UWORD0);
     ip += sizeof(sexp);
   do_check_type:
     _ARG1 = sexp_make_boolean(sexp_check_type(ctx, tmp1, tmp2));
-    break;
-  case SEXP_OP_MAKE:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_MAKE):
     _ALIGN_IP();
     sexp_context_top(ctx) = top;
     _PUSH(sexp_alloc_tagged(ctx, _UWORD1, _UWORD0));
@@ -1658,25 +2311,26 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
     for (i=(_UWORD1-sexp_sizeof_header)/sizeof(sexp_uint_t) - 1; i>=0; i--)
       sexp_slot_set(_ARG1, i, SEXP_VOID);
     ip += sizeof(sexp)*2;
-    break;
-  case SEXP_OP_SLOT_REF:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_SLOT_REF):
     _ALIGN_IP();
     if (! sexp_check_type(ctx, _ARG1, sexp_type_by_index(ctx, _UWORD0)))
       sexp_raise("slot-ref: bad type", sexp_list2(ctx, sexp_type_name_by_index(ctx, _UWORD0), _ARG1));
     _ARG1 = sexp_slot_ref(_ARG1, _UWORD1);
     ip += sizeof(sexp)*2;
-    break;
-  case SEXP_OP_SLOT_SET:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_SLOT_SET):
     _ALIGN_IP();
     if (! sexp_check_type(ctx, _ARG1, sexp_type_by_index(ctx, _UWORD0)))
       sexp_raise("slot-set!: bad type", sexp_list2(ctx, sexp_type_name_by_index(ctx, _UWORD0), _ARG1));
     else if (sexp_immutablep(_ARG1))
       sexp_raise("slot-set!: immutable object", sexp_list1(ctx, _ARG1));
     sexp_slot_set(_ARG1, _UWORD1, _ARG2);
+    sexp_write_barrier(ctx, _ARG1, _ARG2);
     ip += sizeof(sexp)*2;
     top-=2;
-    break;
-  case SEXP_OP_SLOTN_REF:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_SLOTN_REF):
     if (! sexp_typep(_ARG1))
       sexp_raise("slotn-ref: not a record type", sexp_list1(ctx, _ARG1));
     else if (! sexp_check_type(ctx, _ARG2, _ARG1))
@@ -1702,8 +2356,8 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
     top-=2;
     if (!_ARG1) _ARG1 = SEXP_VOID;
     else sexp_check_exception();
-    break;
-  case SEXP_OP_SLOTN_SET:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_SLOTN_SET):
     if (! sexp_typep(_ARG1))
       sexp_raise("slotn-set!: not a record type", sexp_list1(ctx, _ARG1));
     else if (! sexp_check_type(ctx, _ARG2, _ARG1))
@@ -1719,48 +2373,54 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
       if (sexp_unbox_fixnum(_ARG3) < 0 || sexp_unbox_fixnum(_ARG3) >= (sexp_sint_t)sexp_vector_length(sexp_type_setters(_ARG1)))
         sexp_raise("slotn-set!: slot out of bounds", sexp_list2(ctx, _ARG3, sexp_make_fixnum(sexp_type_field_len_base(_ARG1))));
       tmp1 = sexp_vector_ref(sexp_type_setters(_ARG1), _ARG3);
-      if (sexp_opcodep(tmp1))
+      if (sexp_opcodep(tmp1)) {
+        sexp_foreign_begin(ctx);
         _ARG4 = ((sexp_proc3)sexp_opcode_func(tmp1))(ctx, tmp1, 2, _ARG2, _ARG4);
+        sexp_foreign_end(ctx);
+      }
       else
         sexp_raise("slotn-set!: no setter defined", sexp_list1(ctx, _ARG3));
     } else {
       if (sexp_unbox_fixnum(_ARG3) < 0 || sexp_unbox_fixnum(_ARG3) >= sexp_type_field_len_base(_ARG1))
         sexp_raise("slotn-set!: slot out of bounds", sexp_list2(ctx, _ARG3, sexp_make_fixnum(sexp_type_field_len_base(_ARG1))));
       sexp_slot_set(_ARG2, sexp_unbox_fixnum(_ARG3), _ARG4);
+      sexp_write_barrier(ctx, _ARG2, _ARG4);
     }
     top-=4;
     sexp_check_exception();
-    break;
-  case SEXP_OP_CAR:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_CAR):
     if (! sexp_pairp(_ARG1))
       sexp_raise("car: not a pair", sexp_list1(ctx, _ARG1));
-    _ARG1 = sexp_car(_ARG1); break;
-  case SEXP_OP_CDR:
+    _ARG1 = sexp_car(_ARG1); sexp_vm_next();
+  sexp_vm_case(SEXP_OP_CDR):
     if (! sexp_pairp(_ARG1))
       sexp_raise("cdr: not a pair", sexp_list1(ctx, _ARG1));
-    _ARG1 = sexp_cdr(_ARG1); break;
-  case SEXP_OP_SET_CAR:
+    _ARG1 = sexp_cdr(_ARG1); sexp_vm_next();
+  sexp_vm_case(SEXP_OP_SET_CAR):
     if (! sexp_pairp(_ARG1))
       sexp_raise("set-car!: not a pair", sexp_list1(ctx, _ARG1));
     else if (sexp_immutablep(_ARG1))
       sexp_raise("set-car!: immutable pair", sexp_list1(ctx, _ARG1));
     sexp_car(_ARG1) = _ARG2;
+    sexp_write_barrier(ctx, _ARG1, _ARG2);
     top-=2;
-    break;
-  case SEXP_OP_SET_CDR:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_SET_CDR):
     if (! sexp_pairp(_ARG1))
       sexp_raise("set-cdr!: not a pair", sexp_list1(ctx, _ARG1));
     else if (sexp_immutablep(_ARG1))
       sexp_raise("set-cdr!: immutable pair", sexp_list1(ctx, _ARG1));
     sexp_cdr(_ARG1) = _ARG2;
+    sexp_write_barrier(ctx, _ARG1, _ARG2);
     top-=2;
-    break;
-  case SEXP_OP_CONS:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_CONS):
     sexp_context_top(ctx) = top;
     _ARG2 = sexp_cons(ctx, _ARG1, _ARG2);
     top--;
-    break;
-  case SEXP_OP_ADD:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_ADD):
     tmp1 = _ARG1, tmp2 = _ARG2;
     sexp_context_top(ctx) = --top;
 #if SEXP_USE_BIGNUMS
@@ -1771,6 +2431,12 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
       else
         _ARG1 = sexp_make_fixnum(j);
     }
+#if SEXP_USE_FLONUMS
+    else if (sexp_flonump(tmp1) && sexp_flonump(tmp2)) {
+      _ARG1 = sexp_fp_add(ctx, tmp1, tmp2);
+      sexp_check_exception();
+    }
+#endif
     else {
       _ARG1 = sexp_add(ctx, tmp1, tmp2);
       sexp_check_exception();
@@ -1788,8 +2454,8 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
 #endif
     else sexp_raise("+: not a number", sexp_list2(ctx, tmp1, tmp2));
 #endif
-    break;
-  case SEXP_OP_SUB:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_SUB):
     tmp1 = _ARG1, tmp2 = _ARG2;
     sexp_context_top(ctx) = --top;
 #if SEXP_USE_BIGNUMS
@@ -1800,6 +2466,12 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
       else
         _ARG1 = sexp_make_fixnum(j);
     }
+#if SEXP_USE_FLONUMS
+    else if (sexp_flonump(tmp1) && sexp_flonump(tmp2)) {
+      _ARG1 = sexp_fp_sub(ctx, tmp1, tmp2);
+      sexp_check_exception();
+    }
+#endif
     else {
       _ARG1 = sexp_sub(ctx, tmp1, tmp2);
       sexp_check_exception();
@@ -1817,8 +2489,8 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
 #endif
     else sexp_raise("-: not a number", sexp_list2(ctx, tmp1, tmp2));
 #endif
-    break;
-  case SEXP_OP_MUL:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_MUL):
     tmp1 = _ARG1, tmp2 = _ARG2;
     sexp_context_top(ctx) = --top;
 #if SEXP_USE_BIGNUMS
@@ -1829,6 +2501,12 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
       else
         _ARG1 = sexp_make_fixnum(lsint_to_sint(prod));
     }
+#if SEXP_USE_FLONUMS
+    else if (sexp_flonump(tmp1) && sexp_flonump(tmp2)) {
+      _ARG1 = sexp_fp_mul(ctx, tmp1, tmp2);
+      sexp_check_exception();
+    }
+#endif
     else {
       _ARG1 = sexp_mul(ctx, tmp1, tmp2);
       sexp_check_exception();
@@ -1846,8 +2524,8 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
 #endif
     else sexp_raise("*: not a number", sexp_list2(ctx, tmp1, tmp2));
 #endif
-    break;
-  case SEXP_OP_DIV:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_DIV):
     tmp1 = _ARG1, tmp2 = _ARG2;
     sexp_context_top(ctx) = --top;
     if (tmp2 == SEXP_ZERO) {
@@ -1894,8 +2572,8 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
 #endif
     else sexp_raise("/: not a number", sexp_list2(ctx, tmp1, tmp2));
 #endif
-    break;
-  case SEXP_OP_QUOTIENT:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_QUOTIENT):
     tmp1 = _ARG1, tmp2 = _ARG2;
     sexp_context_top(ctx) = --top;
     if (sexp_fixnump(tmp1) && sexp_fixnump(tmp2)) {
@@ -1916,8 +2594,8 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
 #else
     else sexp_raise("quotient: not an integer", sexp_list2(ctx, _ARG1, tmp2));
 #endif
-    break;
-  case SEXP_OP_REMAINDER:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_REMAINDER):
     tmp1 = _ARG1, tmp2 = _ARG2;
     sexp_context_top(ctx) = --top;
     if (sexp_fixnump(tmp1) && sexp_fixnump(tmp2)) {
@@ -1933,8 +2611,9 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
 #else
     else sexp_raise("remainder: not an integer", sexp_list2(ctx, _ARG1, tmp2));
 #endif
-    break;
-  case SEXP_OP_LT:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_LT):
+  do_lt:
     tmp1 = _ARG1, tmp2 = _ARG2;
     sexp_context_top(ctx) = --top;
     if (sexp_fixnump(tmp1) && sexp_fixnump(tmp2)) {
@@ -1964,8 +2643,9 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
     } else sexp_raise("<: not a number", sexp_list2(ctx, tmp1, tmp2));
     _ARG1 = sexp_make_boolean(i);
 #endif
-    break;
-  case SEXP_OP_LE:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_LE):
+  do_le:
     tmp1 = _ARG1, tmp2 = _ARG2;
     sexp_context_top(ctx) = --top;
     if (sexp_fixnump(tmp1) && sexp_fixnump(tmp2)) {
@@ -1995,8 +2675,9 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
     } else sexp_raise("<=: not a number", sexp_list2(ctx, tmp1, tmp2));
     _ARG1 = sexp_make_boolean(i);
 #endif
-    break;
-  case SEXP_OP_EQN:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_EQN):
+  do_eqn:
     tmp1 = _ARG1, tmp2 = _ARG2;
     sexp_context_top(ctx) = --top;
     if (sexp_fixnump(tmp1) && sexp_fixnump(tmp2)) {
@@ -2054,45 +2735,45 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
     } else sexp_raise("=: not a number", sexp_list2(ctx, tmp1, tmp2));
     _ARG1 = sexp_make_boolean(i);
 #endif
-    break;
-  case SEXP_OP_EQ:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_EQ):
     _ARG2 = sexp_make_boolean(_ARG1 == _ARG2);
     top--;
-    break;
-  case SEXP_OP_SCP:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_SCP):
     _ARG1 = sexp_make_boolean(sexp_string_cursorp(_ARG1));
-    break;
-  case SEXP_OP_SC_LT:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_SC_LT):
     tmp1 = _ARG1, tmp2 = _ARG2;
     sexp_context_top(ctx) = --top;
     _ARG1 = sexp_make_boolean((sexp_sint_t)tmp1 < (sexp_sint_t)tmp2);
-    break;
-  case SEXP_OP_SC_LE:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_SC_LE):
     tmp1 = _ARG1, tmp2 = _ARG2;
     sexp_context_top(ctx) = --top;
     _ARG1 = sexp_make_boolean((sexp_sint_t)tmp1 <= (sexp_sint_t)tmp2);
-    break;
-  case SEXP_OP_CHAR2INT:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_CHAR2INT):
     if (! sexp_charp(_ARG1))
       sexp_raise("char->integer: not a character", sexp_list1(ctx, _ARG1));
     _ARG1 = sexp_make_fixnum(sexp_unbox_character(_ARG1));
-    break;
-  case SEXP_OP_INT2CHAR:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_INT2CHAR):
     if (! sexp_fixnump(_ARG1))
       sexp_raise("integer->char: not an integer", sexp_list1(ctx, _ARG1));
     _ARG1 = sexp_make_character(sexp_unbox_fixnum(_ARG1));
-    break;
-  case SEXP_OP_CHAR_UPCASE:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_CHAR_UPCASE):
     if (! sexp_charp(_ARG1))
       sexp_raise("char-upcase: not a character", sexp_list1(ctx, _ARG1));
     _ARG1 = sexp_make_character(sexp_toupper(sexp_unbox_character(_ARG1)));
-    break;
-  case SEXP_OP_CHAR_DOWNCASE:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_CHAR_DOWNCASE):
     if (! sexp_charp(_ARG1))
       sexp_raise("char-downcase: not a character", sexp_list1(ctx, _ARG1));
     _ARG1 = sexp_make_character(sexp_tolower(sexp_unbox_character(_ARG1)));
-    break;
-  case SEXP_OP_WRITE_CHAR:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_WRITE_CHAR):
     if (! sexp_charp(_ARG1))
       sexp_raise("write-char: not a character", sexp_list1(ctx, _ARG1));
     if (! sexp_oportp(_ARG2))
@@ -2115,10 +2796,12 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
       if ((sexp_port_stream(_ARG2) ? ferror(sexp_port_stream(_ARG2)) : 1)
           && (errno == EAGAIN)) {
         if (sexp_port_stream(_ARG2)) clearerr(sexp_port_stream(_ARG2));
+        sexp_foreign_begin(ctx);
         if (sexp_applicablep(sexp_global(ctx, SEXP_G_THREADS_BLOCKER)))
           sexp_apply2(ctx, sexp_global(ctx, SEXP_G_THREADS_BLOCKER), _ARG2, SEXP_FALSE);
         else
           sexp_poll_output(ctx, _ARG2);
+        sexp_foreign_end(ctx);
         fuel = 0;
         ip--;      /* try again */
         goto loop;
@@ -2128,8 +2811,8 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
     }
     top--;
     _ARG1 = SEXP_VOID;
-    break;
-  case SEXP_OP_WRITE_STRING:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_WRITE_STRING):
     if (sexp_stringp(_ARG1))
 #if SEXP_USE_PACKED_STRINGS
       tmp1 = _ARG1;
@@ -2165,10 +2848,12 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
       }
       /* yield if threads are enabled (otherwise busy loop) */
       /* TODO: the wait seems necessary on OS X to stop a print loop to ptys */
+      sexp_foreign_begin(ctx);
       if (sexp_applicablep(sexp_global(ctx, SEXP_G_THREADS_BLOCKER)))
         sexp_apply2(ctx, sexp_global(ctx, SEXP_G_THREADS_BLOCKER), _ARG3, SEXP_FALSE);
       else
         sexp_poll_output(ctx, _ARG3);
+      sexp_foreign_end(ctx);
       fuel = 0;
       ip--;      /* try again */
       goto loop;
@@ -2177,8 +2862,8 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
     tmp1 = sexp_make_fixnum(i);     /* return the number of bytes written */
     top-=2;
     _ARG1 = tmp1;
-    break;
-  case SEXP_OP_READ_CHAR:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_READ_CHAR):
     if (! sexp_iportp(_ARG1))
       sexp_raise("read-char: not an input-port", sexp_list1(ctx, _ARG1));
     sexp_context_top(ctx) = top;
@@ -2194,10 +2879,12 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
                  && (errno == EAGAIN)) {
         if (sexp_port_stream(_ARG1)) clearerr(sexp_port_stream(_ARG1));
         /* TODO: block and unblock */
+        sexp_foreign_begin(ctx);
         if (sexp_applicablep(sexp_global(ctx, SEXP_G_THREADS_BLOCKER)))
           sexp_apply2(ctx, sexp_global(ctx, SEXP_G_THREADS_BLOCKER), _ARG1, SEXP_FALSE);
         else
           sexp_poll_input(ctx, _ARG1);
+        sexp_foreign_end(ctx);
         fuel = 0;
         ip--;      /* try again */
 #endif
@@ -2213,8 +2900,8 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
       _ARG1 = sexp_make_character(i);
     }
     sexp_check_exception();
-    break;
-  case SEXP_OP_PEEK_CHAR:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_PEEK_CHAR):
     if (! sexp_iportp(_ARG1))
       sexp_raise("peek-char: not an input-port", sexp_list1(ctx, _ARG1));
     sexp_context_top(ctx) = top;
@@ -2230,10 +2917,12 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
       if ((sexp_port_stream(_ARG1) ? ferror(sexp_port_stream(_ARG1)) : 1)
           && (errno == EAGAIN)) {
         if (sexp_port_stream(_ARG1)) clearerr(sexp_port_stream(_ARG1));
+        sexp_foreign_begin(ctx);
         if (sexp_applicablep(sexp_global(ctx, SEXP_G_THREADS_BLOCKER)))
           sexp_apply2(ctx, sexp_global(ctx, SEXP_G_THREADS_BLOCKER), _ARG1, SEXP_FALSE);
         else
           sexp_poll_input(ctx, _ARG1);
+        sexp_foreign_end(ctx);
         fuel = 0;
         ip--;      /* try again */
       } else
@@ -2250,13 +2939,13 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
       _ARG1 = sexp_make_character(i);
     }
     sexp_check_exception();
-    break;
-  case SEXP_OP_YIELD:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_YIELD):
 #if SEXP_USE_GREEN_THREADS
     fuel = 0;
 #endif
-    break;
-  case SEXP_OP_FORCE:
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_FORCE):
 #if SEXP_USE_AUTO_FORCE
     sexp_context_top(ctx) = top;
     while (sexp_promisep(_ARG1)) {
@@ -2268,13 +2957,132 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
         if (!sexp_promise_donep(_ARG1)) {
           sexp_promise_value(_ARG1) = tmp1;
           sexp_promise_donep(_ARG1) = 1;
+          sexp_write_barrier(ctx, _ARG1, tmp1);
         }
         _ARG1 = tmp1;
       }
     }
 #endif
-    break;
-  case SEXP_OP_RET:
+    sexp_vm_next();
+  /* Superinstructions, rewritten from the first of a pair of */
+  /* opcodes by generate_fused.  The second opcode is left in place, */
+  /* so for the JUMP_UNLESS forms we can fall back on running both. */
+  sexp_vm_case(SEXP_OP_LOCAL_REF_CAR):
+    _ALIGN_IP();
+    _PUSH(stack[fp - 1 - _SWORD0]);
+    ip += sizeof(sexp) + 1;
+    if (! sexp_pairp(_ARG1))
+      sexp_raise("car: not a pair", sexp_list1(ctx, _ARG1));
+    _ARG1 = sexp_car(_ARG1); sexp_vm_next();
+  sexp_vm_case(SEXP_OP_LOCAL_REF_CDR):
+    _ALIGN_IP();
+    _PUSH(stack[fp - 1 - _SWORD0]);
+    ip += sizeof(sexp) + 1;
+    if (! sexp_pairp(_ARG1))
+      sexp_raise("cdr: not a pair", sexp_list1(ctx, _ARG1));
+    _ARG1 = sexp_cdr(_ARG1); sexp_vm_next();
+  sexp_vm_case(SEXP_OP_CLOSURE_REF_CDR):
+    _ALIGN_IP();
+    _PUSH(sexp_vector_ref(cp, sexp_make_fixnum(_SWORD0)));
+    ip += sizeof(sexp) + 1;
+    if (! sexp_pairp(_ARG1))
+      sexp_raise("cdr: not a pair", sexp_list1(ctx, _ARG1));
+    _ARG1 = sexp_cdr(_ARG1); sexp_vm_next();
+  sexp_vm_case(SEXP_OP_LT_JUMP_UNLESS):
+    if (! (sexp_fixnump(_ARG1) && sexp_fixnump(_ARG2))) goto do_lt;
+    i = (sexp_sint_t)_ARG1 < (sexp_sint_t)_ARG2;
+    goto do_jump_unless;
+  sexp_vm_case(SEXP_OP_LE_JUMP_UNLESS):
+    if (! (sexp_fixnump(_ARG1) && sexp_fixnump(_ARG2))) goto do_le;
+    i = (sexp_sint_t)_ARG1 <= (sexp_sint_t)_ARG2;
+    goto do_jump_unless;
+  sexp_vm_case(SEXP_OP_EQN_JUMP_UNLESS):
+    if (! (sexp_fixnump(_ARG1) && sexp_fixnump(_ARG2))) goto do_eqn;
+    i = _ARG1 == _ARG2;
+  do_jump_unless:
+    top -= 2;
+    ip++;
+    _ALIGN_IP();
+    ip += i ? (sexp_sint_t)sizeof(sexp_sint_t) : _SWORD0;
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_NULLP_JUMP_UNLESS):
+    ip++;
+    _ALIGN_IP();
+    ip += sexp_nullp(stack[--top]) ? (sexp_sint_t)sizeof(sexp_sint_t) : _SWORD0;
+    sexp_vm_next();
+  /* Unchecked variants of CAR, CDR and fixnum arithmetic, only */
+  /* generated by optimization passes which have proved the types */
+  /* of the arguments, e.g. (chibi optimize types). */
+  sexp_vm_case(SEXP_OP_UNSAFE_CAR):
+    _ARG1 = sexp_car(_ARG1); sexp_vm_next();
+  sexp_vm_case(SEXP_OP_UNSAFE_CDR):
+    _ARG1 = sexp_cdr(_ARG1); sexp_vm_next();
+  sexp_vm_case(SEXP_OP_FX_ADD):
+    tmp1 = _ARG1, tmp2 = _ARG2;
+    sexp_context_top(ctx) = --top;
+#if SEXP_USE_BIGNUMS
+    j = sexp_unbox_fixnum(tmp1) + sexp_unbox_fixnum(tmp2);
+    if ((j < SEXP_MIN_FIXNUM) || (j > SEXP_MAX_FIXNUM))
+      _ARG1 = sexp_add(ctx, tmp1=sexp_fixnum_to_bignum(ctx, tmp1), tmp2);
+    else
+      _ARG1 = sexp_make_fixnum(j);
+#else
+    _ARG1 = sexp_fx_add(tmp1, tmp2);
+#endif
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_FX_SUB):
+    tmp1 = _ARG1, tmp2 = _ARG2;
+    sexp_context_top(ctx) = --top;
+#if SEXP_USE_BIGNUMS
+    j = sexp_unbox_fixnum(tmp1) - sexp_unbox_fixnum(tmp2);
+    if ((j < SEXP_MIN_FIXNUM) || (j > SEXP_MAX_FIXNUM))
+      _ARG1 = sexp_sub(ctx, tmp1=sexp_fixnum_to_bignum(ctx, tmp1), tmp2);
+    else
+      _ARG1 = sexp_make_fixnum(j);
+#else
+    _ARG1 = sexp_fx_sub(tmp1, tmp2);
+#endif
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_FX_LT):
+    i = (sexp_sint_t)_ARG1 < (sexp_sint_t)_ARG2;
+    top--;
+    _ARG1 = sexp_make_boolean(i);
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_FX_LE):
+    i = (sexp_sint_t)_ARG1 <= (sexp_sint_t)_ARG2;
+    top--;
+    _ARG1 = sexp_make_boolean(i);
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_FX_EQN):
+    i = _ARG1 == _ARG2;
+    top--;
+    _ARG1 = sexp_make_boolean(i);
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_LOCAL_REF_UNSAFE_CAR):
+    _ALIGN_IP();
+    _PUSH(sexp_car(stack[fp - 1 - _SWORD0]));
+    ip += sizeof(sexp) + 1;
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_LOCAL_REF_UNSAFE_CDR):
+    _ALIGN_IP();
+    _PUSH(sexp_cdr(stack[fp - 1 - _SWORD0]));
+    ip += sizeof(sexp) + 1;
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_CLOSURE_REF_UNSAFE_CDR):
+    _ALIGN_IP();
+    _PUSH(sexp_cdr(sexp_vector_ref(cp, sexp_make_fixnum(_SWORD0))));
+    ip += sizeof(sexp) + 1;
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_FX_LT_JUMP_UNLESS):
+    i = (sexp_sint_t)_ARG1 < (sexp_sint_t)_ARG2;
+    goto do_jump_unless;
+  sexp_vm_case(SEXP_OP_FX_LE_JUMP_UNLESS):
+    i = (sexp_sint_t)_ARG1 <= (sexp_sint_t)_ARG2;
+    goto do_jump_unless;
+  sexp_vm_case(SEXP_OP_FX_EQN_JUMP_UNLESS):
+    i = _ARG1 == _ARG2;
+    goto do_jump_unless;
+  sexp_vm_case(SEXP_OP_RET):
     i = sexp_unbox_fixnum(stack[fp]);
     stack[fp-i] = _ARG1;
     top = fp-i+1;
@@ -2283,11 +3091,38 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
     ip = sexp_bytecode_data(bc) + sexp_unbox_fixnum(stack[fp+1]);
     cp = sexp_procedure_vars(self);
     fp = sexp_unbox_fixnum(stack[fp+3]);
-    break;
-  case SEXP_OP_DONE:
+#if SEXP_USE_JIT
+    if ((jit_entry = sexp_jit_entry(bc, ip - sexp_bytecode_data(bc))))
+      goto jit_enter;
+#endif
+    sexp_vm_next();
+  sexp_vm_case(SEXP_OP_DONE):
     sexp_context_last_fp(ctx) = fp;
     goto end_loop;
+#if SEXP_USE_SEGMENTED_CONTINUATIONS
+  sexp_vm_case(SEXP_OP_UNDERFLOW):
+    /* returned through a barrier frame, resume its real caller and */
+    /* make that the new barrier */
+    self = sexp_vector_ref(cp, SEXP_ZERO);
+    tmp1 = sexp_vector_ref(cp, SEXP_TWO);
+    bc = sexp_procedure_code(self);
+    ip = sexp_bytecode_data(bc) + sexp_unbox_fixnum(sexp_vector_ref(cp, SEXP_ONE));
+    cp = sexp_procedure_vars(self);
+    if (self != sexp_global(ctx, SEXP_G_FINAL_RESUMER)
+        && !sexp_underflowp(ctx, stack[fp+2])) {
+      sexp_context_top(ctx) = top;
+      sexp_set_barrier(ctx, stack, fp, tmp1);
+    }
+#if SEXP_USE_JIT
+    if ((jit_entry = sexp_jit_entry(bc, ip - sexp_bytecode_data(bc))))
+      goto jit_enter;
+#endif
+    sexp_vm_next();
+#endif
   default:
+#if SEXP_USE_COMPUTED_GOTO
+  SEXP_OP_UNKNOWN_LABEL:
+#endif
     sexp_raise("unknown opcode", sexp_list1(ctx, sexp_make_fixnum(*(ip-1))));
   }
 #if SEXP_USE_DEBUG_VM
@@ -2324,6 +3159,9 @@ sexp sexp_apply (sexp ctx, sexp proc, sexp args) {
   }
 #endif
   sexp_gc_release3(ctx);
+#if SEXP_USE_GENERATIONAL_GC || SEXP_USE_INCREMENTAL_GC
+  sexp_context_heap(ctx)->barrier_active = outer_barrier;
+#endif
   tmp1 = _ARG1;
   sexp_context_top(ctx) = --top;
   return tmp1;